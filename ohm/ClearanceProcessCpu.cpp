@@ -0,0 +1,486 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "ClearanceProcessCpu.h"
+
+#include "DefaultLayer.h"
+#include "MapChunk.h"
+#include "MapLayer.h"
+#include "MapLayout.h"
+#include "OccupancyMap.h"
+#include "VoxelBuffer.h"
+#include "VoxelOccupancy.h"
+
+#include "private/ClearanceProcessCpuDetail.h"
+#include "private/VoxelAlgorithms.h"
+
+#ifdef OHM_THREADS
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif  // OHM_THREADS
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+namespace ohm
+{
+namespace
+{
+/// Number of regions processed in parallel between time checks in @c ClearanceProcessCpu::update() .
+const size_t kRegionBatchSize = 64u;
+
+/// Parameters shared by all regions in a clearance update.
+struct ClearanceParams
+{
+  glm::ivec3 region_dim;      ///< Region voxel dimensions.
+  glm::ivec3 padding;         ///< Number of voxels to pad each region by; the search radius in voxels.
+  glm::ivec3 grid_dim;        ///< Dimensions of the padded region grid.
+  glm::vec3 axis_weights;     ///< Squared, scaled distance of a single voxel step along each axis.
+  double resolution_sqr;      ///< Squared voxel resolution.
+  float search_radius;        ///< Search radius. Zero for no limit beyond the padding.
+  float occupancy_threshold;  ///< Occupancy threshold value.
+  size_t occupancy_stride;    ///< Occupancy layer voxel byte size.
+  size_t clearance_stride;    ///< Clearance layer voxel byte size.
+  int occupancy_layer;        ///< Occupancy layer index.
+  int clearance_layer;        ///< Clearance layer index.
+  bool unknown_as_occupied;   ///< Treat unobserved voxels as obstructions?
+  bool report_unscaled;       ///< Report distances without the axis scaling?
+};
+
+/// Working buffers for calculating a single region.
+struct ClearanceWorkspace
+{
+  std::vector<float> distance_sqr;  ///< Squared distance transform of the padded region.
+  std::vector<int> nearest;         ///< Nearest obstacle voxel for each voxel in the padded region.
+};
+
+/// Floor division of @p value by @p divisor .
+inline int floorDiv(int value, int divisor)
+{
+  return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+/// Calculate the range of regions overlapped by the padded grid around @p region_key .
+void paddedRegionRange(const ClearanceParams &params, const glm::i16vec3 &region_key, glm::ivec3 &min_region,
+                       glm::ivec3 &max_region)
+{
+  const glm::ivec3 grid_origin = glm::ivec3(region_key) * params.region_dim - params.padding;
+  const glm::ivec3 grid_last = grid_origin + params.grid_dim - glm::ivec3(1);
+  for (int i = 0; i < 3; ++i)
+  {
+    min_region[i] = std::max<int>(floorDiv(grid_origin[i], params.region_dim[i]), std::numeric_limits<int16_t>::min());
+    max_region[i] = std::min<int>(floorDiv(grid_last[i], params.region_dim[i]), std::numeric_limits<int16_t>::max());
+  }
+}
+
+
+/// Seed @p distance_sqr for the padded grid around @p region_key ; zero for obstructions, infinity elsewhere.
+void seedObstructions(const OccupancyMap &map, const ClearanceParams &params, const glm::i16vec3 &region_key,
+                      std::vector<float> &distance_sqr)
+{
+  const float infinity = std::numeric_limits<float>::infinity();
+  // Regions which do not exist are unobserved.
+  distance_sqr.assign(size_t(params.grid_dim.x) * size_t(params.grid_dim.y) * size_t(params.grid_dim.z),
+                      (params.unknown_as_occupied) ? 0.0f : infinity);
+
+  const glm::ivec3 grid_origin = glm::ivec3(region_key) * params.region_dim - params.padding;
+  glm::ivec3 min_region;
+  glm::ivec3 max_region;
+  paddedRegionRange(params, region_key, min_region, max_region);
+
+  glm::i16vec3 neighbour_key;
+  for (int rz = min_region.z; rz <= max_region.z; ++rz)
+  {
+    neighbour_key.z = int16_t(rz);
+    for (int ry = min_region.y; ry <= max_region.y; ++ry)
+    {
+      neighbour_key.y = int16_t(ry);
+      for (int rx = min_region.x; rx <= max_region.x; ++rx)
+      {
+        neighbour_key.x = int16_t(rx);
+        const MapChunk *chunk = map.region(neighbour_key);
+        if (!chunk)
+        {
+          continue;
+        }
+
+        // Resolve the overlap between the padded grid and the neighbour in grid coordinates.
+        const glm::ivec3 region_origin = glm::ivec3(neighbour_key) * params.region_dim - grid_origin;
+        const glm::ivec3 overlap_min = glm::max(region_origin, glm::ivec3(0));
+        const glm::ivec3 overlap_max = glm::min(region_origin + params.region_dim, params.grid_dim);
+
+        VoxelBuffer<const VoxelBlock> voxel_buffer(chunk->voxel_blocks[params.occupancy_layer]);
+        const uint8_t *voxel_mem = voxel_buffer.voxelMemory();
+        float occupancy;
+        for (int z = overlap_min.z; z < overlap_max.z; ++z)
+        {
+          for (int y = overlap_min.y; y < overlap_max.y; ++y)
+          {
+            for (int x = overlap_min.x; x < overlap_max.x; ++x)
+            {
+              const glm::ivec3 local = glm::ivec3(x, y, z) - region_origin;
+              const unsigned voxel_index = voxelIndex(local.x, local.y, local.z, params.region_dim.x,
+                                                      params.region_dim.y, params.region_dim.z);
+              memcpy(&occupancy, voxel_mem + params.occupancy_stride * voxel_index, sizeof(occupancy));
+              const bool obstructed = (occupancy == unobservedOccupancyValue()) ?
+                                        params.unknown_as_occupied :
+                                        occupancy >= params.occupancy_threshold;
+              distance_sqr[x + y * params.grid_dim.x + z * params.grid_dim.x * params.grid_dim.y] =
+                (obstructed) ? 0.0f : infinity;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+
+/// Calculate and write the clearance values for @p chunk .
+void calculateRegionClearance(const OccupancyMap &map, const ClearanceParams &params, MapChunk &chunk,
+                              ClearanceWorkspace &workspace)
+{
+  seedObstructions(map, params, chunk.region.coord, workspace.distance_sqr);
+  squaredDistanceTransform(workspace.distance_sqr, workspace.nearest, params.grid_dim, params.axis_weights);
+
+  const float search_radius_sqr = params.search_radius * params.search_radius;
+  const int grid_stride_y = params.grid_dim.x;
+  const int grid_stride_z = params.grid_dim.x * params.grid_dim.y;
+
+  VoxelBuffer<VoxelBlock> voxel_buffer(chunk.voxel_blocks[params.clearance_layer]);
+  uint8_t *voxel_mem = voxel_buffer.voxelMemory();
+  for (int z = 0; z < params.region_dim.z; ++z)
+  {
+    for (int y = 0; y < params.region_dim.y; ++y)
+    {
+      for (int x = 0; x < params.region_dim.x; ++x)
+      {
+        const int grid_index =
+          (x + params.padding.x) + (y + params.padding.y) * grid_stride_y + (z + params.padding.z) * grid_stride_z;
+        const int nearest = workspace.nearest[grid_index];
+        float clearance = -1.0f;
+        if (nearest >= 0)
+        {
+          float range_sqr = workspace.distance_sqr[grid_index];
+          if (params.report_unscaled)
+          {
+            const glm::ivec3 nearest_coord(nearest % grid_stride_y, (nearest % grid_stride_z) / grid_stride_y,
+                                           nearest / grid_stride_z);
+            const glm::ivec3 separation = nearest_coord - glm::ivec3(x, y, z) - params.padding;
+            range_sqr = float(params.resolution_sqr * double(separation.x * separation.x + separation.y * separation.y +
+                                                              separation.z * separation.z));
+          }
+
+          if (params.search_radius == 0 || range_sqr <= search_radius_sqr)
+          {
+            clearance = std::sqrt(range_sqr);
+          }
+        }
+
+        const unsigned voxel_index =
+          voxelIndex(x, y, z, params.region_dim.x, params.region_dim.y, params.region_dim.z);
+        memcpy(voxel_mem + params.clearance_stride * voxel_index, &clearance, sizeof(clearance));
+      }
+    }
+  }
+}
+
+
+/// Calculate the clearance for the chunks in the range `[start_index, end_index)` of @p chunks .
+void calculateClearanceRange(const OccupancyMap &map, const ClearanceParams &params,
+                             const std::vector<MapChunk *> &chunks, size_t start_index, size_t end_index)
+{
+  ClearanceWorkspace workspace;
+  for (size_t i = start_index; i < end_index; ++i)
+  {
+    calculateRegionClearance(map, params, *chunks[i], workspace);
+  }
+}
+}  // namespace
+
+
+ClearanceProcessCpu::ClearanceProcessCpu()
+  : imp_(new ClearanceProcessCpuDetail)
+{}
+
+
+ClearanceProcessCpu::ClearanceProcessCpu(float search_radius, unsigned query_flags)
+  : ClearanceProcessCpu()
+{
+  setSearchRadius(search_radius);
+  setQueryFlags(query_flags);
+}
+
+
+ClearanceProcessCpu::~ClearanceProcessCpu() = default;
+
+
+float ClearanceProcessCpu::searchRadius() const
+{
+  const ClearanceProcessCpuDetail *d = imp();
+  return d->search_radius;
+}
+
+
+void ClearanceProcessCpu::setSearchRadius(float range)
+{
+  ClearanceProcessCpuDetail *d = imp();
+  d->search_radius = range;
+}
+
+
+unsigned ClearanceProcessCpu::queryFlags() const
+{
+  const ClearanceProcessCpuDetail *d = imp();
+  return d->query_flags;
+}
+
+
+void ClearanceProcessCpu::setQueryFlags(unsigned flags)
+{
+  ClearanceProcessCpuDetail *d = imp();
+  d->query_flags = flags;
+}
+
+
+glm::vec3 ClearanceProcessCpu::axisScaling() const
+{
+  const ClearanceProcessCpuDetail *d = imp();
+  return d->axis_scaling;
+}
+
+
+void ClearanceProcessCpu::setAxisScaling(const glm::vec3 &scaling)
+{
+  ClearanceProcessCpuDetail *d = imp();
+  d->axis_scaling = scaling;
+}
+
+
+void ClearanceProcessCpu::reset()
+{
+  ClearanceProcessCpuDetail *d = imp();
+  d->resetWorking();
+}
+
+
+void ClearanceProcessCpu::ensureClearanceLayer(OccupancyMap &map)
+{
+  if (map.layout().clearanceLayer() != -1)
+  {
+    return;
+  }
+
+  // Duplicate the layout, add the layer and update the map, preserving the current map.
+  MapLayout updated_layout(map.layout());
+  addClearance(updated_layout);
+  map.updateLayout(updated_layout, true);
+}
+
+
+int ClearanceProcessCpu::update(OccupancyMap &map, double time_slice)
+{
+  ClearanceProcessCpuDetail *d = imp();
+
+  // Ensure clearance layer is present.
+  ensureClearanceLayer(map);
+
+  using Clock = std::chrono::high_resolution_clock;
+  const auto start_time = Clock::now();
+  double elapsed_sec = 0;
+
+  if (!d->haveWork())
+  {
+    // Fetch regions which may be out of date: all regions within the search radius of a region with outdated
+    // clearance values.
+    d->resetWorking();
+    const glm::ivec3 padding = calculateVoxelSearchHalfExtents(map, d->search_radius);
+    const glm::ivec3 region_dim = map.regionVoxelDimensions();
+    unsigned region_padding = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+      region_padding = std::max(region_padding, unsigned((padding[i] + region_dim[i] - 1) / region_dim[i]));
+    }
+
+    glm::i16vec3 min_dirty_region;
+    glm::i16vec3 max_dirty_region;
+    map.calculateDirtyClearanceExtents(&min_dirty_region, &max_dirty_region, region_padding);
+
+    std::vector<const MapChunk *> chunks;
+    map.enumerateRegions(chunks);
+    for (const MapChunk *chunk : chunks)
+    {
+      const glm::i16vec3 &coord = chunk->region.coord;
+      if (glm::all(glm::greaterThanEqual(coord, min_dirty_region)) &&
+          glm::all(glm::lessThanEqual(coord, max_dirty_region)))
+      {
+        d->work.emplace_back(coord);
+      }
+    }
+  }
+
+  unsigned total_processed = 0;
+  std::vector<glm::i16vec3> batch;
+  while (d->haveWork() && (time_slice <= 0 || elapsed_sec < time_slice))
+  {
+    const size_t batch_end = std::min(d->work_cursor + kRegionBatchSize, d->work.size());
+    batch.assign(d->work.begin() + d->work_cursor, d->work.begin() + batch_end);
+    d->work_cursor = batch_end;
+
+    total_processed += updateRegions(map, batch, false);
+
+    const auto cur_time = Clock::now();
+    elapsed_sec = std::chrono::duration_cast<std::chrono::duration<double>>(cur_time - start_time).count();
+  }
+
+  return (total_processed != 0 || d->haveWork()) ? kMprProgressing : kMprUpToDate;
+}
+
+
+void ClearanceProcessCpu::calculateForExtents(OccupancyMap &map, const glm::dvec3 &min_extents,
+                                              const glm::dvec3 &max_extents, bool force)
+{
+  // Ensure clearance layer is present.
+  ensureClearanceLayer(map);
+
+  const glm::i16vec3 min_region = map.regionKey(min_extents);
+  const glm::i16vec3 max_region = map.regionKey(max_extents);
+
+  std::vector<glm::i16vec3> region_keys;
+  glm::i16vec3 region_key;
+  for (int z = min_region.z; z <= max_region.z; ++z)
+  {
+    region_key.z = int16_t(z);
+    for (int y = min_region.y; y <= max_region.y; ++y)
+    {
+      region_key.y = int16_t(y);
+      for (int x = min_region.x; x <= max_region.x; ++x)
+      {
+        region_key.x = int16_t(x);
+        region_keys.emplace_back(region_key);
+      }
+    }
+  }
+
+  updateRegions(map, region_keys, force);
+}
+
+
+unsigned ClearanceProcessCpu::updateRegions(OccupancyMap &map, const std::vector<glm::i16vec3> &region_keys,
+                                            bool force)
+{
+  ClearanceProcessCpuDetail *d = imp();
+
+  ClearanceParams params{};
+  params.occupancy_layer = map.layout().occupancyLayer();
+  params.clearance_layer = map.layout().clearanceLayer();
+
+  if (params.occupancy_layer < 0 || params.clearance_layer < 0)
+  {
+    return 0;
+  }
+
+  const glm::vec3 scaled_resolution = float(map.resolution()) * d->axis_scaling;
+  params.region_dim = map.regionVoxelDimensions();
+  params.padding = calculateVoxelSearchHalfExtents(map, d->search_radius);
+  params.grid_dim = params.region_dim + 2 * params.padding;
+  params.axis_weights = scaled_resolution * scaled_resolution;
+  params.resolution_sqr = map.resolution() * map.resolution();
+  params.search_radius = d->search_radius;
+  params.occupancy_threshold = map.occupancyThresholdValue();
+  params.occupancy_stride = map.layout().layer(params.occupancy_layer).voxelByteSize();
+  params.clearance_stride = map.layout().layer(params.clearance_layer).voxelByteSize();
+  params.unknown_as_occupied = (d->query_flags & kQfUnknownAsOccupied) != 0;
+  params.report_unscaled = (d->query_flags & kQfReportUnscaledResults) != 0;
+
+  // Resolve the regions to update along with the stamp to apply to the clearance layer once up to date.
+  std::vector<MapChunk *> chunks;
+  std::vector<uint64_t> target_stamps;
+  chunks.reserve(region_keys.size());
+  target_stamps.reserve(region_keys.size());
+  for (const glm::i16vec3 &region_key : region_keys)
+  {
+    MapChunk *chunk = map.region(region_key, (d->query_flags & kQfInstantiateUnknown));
+    if (!chunk)
+    {
+      continue;
+    }
+
+    // We are dirty if any region within the search radius has updated occupancy values since the last clearance
+    // update. The maximum occupancy stamp in the neighbourhood is also the new stamp for the clearance layer.
+    uint64_t target_update_stamp = chunk->touched_stamps[params.occupancy_layer];
+    glm::ivec3 min_region;
+    glm::ivec3 max_region;
+    paddedRegionRange(params, region_key, min_region, max_region);
+    glm::i16vec3 neighbour_key;
+    for (int z = min_region.z; z <= max_region.z; ++z)
+    {
+      neighbour_key.z = int16_t(z);
+      for (int y = min_region.y; y <= max_region.y; ++y)
+      {
+        neighbour_key.y = int16_t(y);
+        for (int x = min_region.x; x <= max_region.x; ++x)
+        {
+          neighbour_key.x = int16_t(x);
+          const MapChunk *neighbour = map.region(neighbour_key, false);
+          if (neighbour)
+          {
+            target_update_stamp =
+              std::max(target_update_stamp, uint64_t(neighbour->touched_stamps[params.occupancy_layer]));
+          }
+        }
+      }
+    }
+
+    if (!force && chunk->touched_stamps[params.clearance_layer] >= target_update_stamp)
+    {
+      // Up to date.
+      continue;
+    }
+
+    chunks.emplace_back(chunk);
+    target_stamps.emplace_back(target_update_stamp);
+  }
+
+  if (chunks.empty())
+  {
+    return 0;
+  }
+
+  const OccupancyMap &const_map = map;
+#ifdef OHM_THREADS
+  const auto calculate_func = [&const_map, &params, &chunks](const tbb::blocked_range<size_t> &range) {
+    calculateClearanceRange(const_map, params, chunks, range.begin(), range.end());
+  };
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, chunks.size()), calculate_func);
+#else   // OHM_THREADS
+  calculateClearanceRange(const_map, params, chunks, 0, chunks.size());
+#endif  // OHM_THREADS
+
+  // Regions are up to date *now*.
+  const uint64_t touch_stamp = map.touch();
+  for (size_t i = 0; i < chunks.size(); ++i)
+  {
+    chunks[i]->setDirtyStamp(touch_stamp);
+    chunks[i]->touched_stamps[params.clearance_layer] = target_stamps[i];
+  }
+
+  return unsigned(chunks.size());
+}
+
+
+ClearanceProcessCpuDetail *ClearanceProcessCpu::imp()
+{
+  return imp_.get();
+}
+
+
+const ClearanceProcessCpuDetail *ClearanceProcessCpu::imp() const
+{
+  return imp_.get();
+}
+}  // namespace ohm
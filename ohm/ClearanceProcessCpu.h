@@ -0,0 +1,135 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_CLEARANCEPROCESSCPU_H
+#define OHM_CLEARANCEPROCESSCPU_H
+
+#include "OhmConfig.h"
+
+#include "MappingProcess.h"
+#include "QueryFlag.h"
+
+#include <glm/fwd.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace ohm
+{
+struct ClearanceProcessCpuDetail;
+class OccupancyMap;
+
+/// A CPU @c MappingProcess which calculates the voxel clearance layer: the range to the nearest obstructing voxel.
+///
+/// This is the CPU equivalent of the ohmgpu @c ClearanceProcess . Rather than searching the neighbourhood of each voxel,
+/// each region is processed by calculating an exact, squared Euclidean distance transform over the region's voxels
+/// padded by the @c searchRadius() (see @c squaredDistanceTransform() ). The transform is linear in the number of
+/// voxels, making it practical for fine resolution maps with large search radii. Regions are processed in parallel
+/// when @c OHM_THREADS is enabled.
+///
+/// Obstructing voxels are occupied voxels or, when @c kQfUnknownAsOccupied is set, unobserved voxels including those in
+/// regions which have not been allocated. The results written to the clearance layer are interpreted as follows:
+/// - 0.0 => The voxel in question is itself an obstruction.
+/// - > 0 => There is an obstructed voxel within the @c searchRadius().
+/// - < 0 => There are no obstructions within the @c searchRadius().
+///
+/// The process tracks which regions need updating by comparing the clearance layer @c MapChunk::touched_stamps against
+/// the occupancy layer stamps of all regions within the @c searchRadius() . Regions are not recalculated unless they
+/// are out of date or the calculation is forced.
+class ohm_API ClearanceProcessCpu : public MappingProcess
+{
+public:
+  /// Extended query flags for @c ClearanceProcessCpu.
+  enum QueryFlag : unsigned
+  {
+    /// Instantiate regions which are in unknown space.
+    kQfInstantiateUnknown = (kQfSpecialised << 0u),
+  };
+
+  /// Empty constructor.
+  ClearanceProcessCpu();
+
+  /// Construct a new process using the given parameters.
+  /// @param search_radius Defines the range to which obstructions are considered.
+  /// @param query_flags Flags controlling the query behaviour. See @c QueryFlag and @c ClearanceProcessCpu::QueryFlag.
+  ClearanceProcessCpu(float search_radius, unsigned query_flags);
+  /// Destructor.
+  ~ClearanceProcessCpu() override;
+
+  /// Get the search radius to which we look for obstructing voxels.
+  /// @return The radius to look for obstacles within.
+  float searchRadius() const;
+  /// Set the search radius to which we look for obstructing voxels.
+  ///
+  /// Modifying this value requires a forced recalculation of existing results.
+  /// @param range The new search radius.
+  void setSearchRadius(float range);
+
+  /// The @c QueryFlag values applied to the process.
+  /// @return The value values.
+  unsigned queryFlags() const;
+  /// Set the @c QueryFlag values for the process.
+  /// @param flags The flag values to set.
+  void setQueryFlags(unsigned flags);
+
+  /// Get the axis weightings applied when determining the nearest obstructing voxel.
+  /// @return Current axis weighting.
+  /// @see @c setAxisScaling()
+  glm::vec3 axisScaling() const;
+
+  /// Set the per axis scaling applied when determining the closest obstructing voxel. This has the same semantics as
+  /// the ohmgpu @c ClearanceProcess::setAxisScaling() .
+  ///
+  /// Modifying this value requires a forced recalculation of existing results.
+  ///
+  /// @param scaling The new axis scaling to apply.
+  void setAxisScaling(const glm::vec3 &scaling);
+
+  void reset() override;
+
+  /// Ensure the mapping clearance layer is present in @p map .
+  /// @param map The map to ensure has a clearance layer.
+  static void ensureClearanceLayer(OccupancyMap &map);
+
+  /// Update clearance values for out of date regions. Regions are processed in batches until the @p time_slice is
+  /// exceeded.
+  /// @param map The map to process.
+  /// @param time_slice The amount of time available for processing (seconds). Stop if exceeded. Zero for no limit.
+  /// @return See @c MappingProcessResult.
+  int update(OccupancyMap &map, double time_slice) override;
+
+  /// Calculate clearance values for all regions within the given extents.
+  ///
+  /// This call ignores the processing list, and blocks until the calculations are complete.
+  ///
+  /// @param map The map to process.
+  /// @param min_extents The minimum extents corner of the region to calculate.
+  /// @param max_extents The maximum extents corner of the region to calculate.
+  /// @param force Force recalculation of the clearance values even if they seem up to date.
+  ///   This is required if any of the clearance calculation parameters change.
+  void calculateForExtents(OccupancyMap &map, const glm::dvec3 &min_extents, const glm::dvec3 &max_extents,
+                           bool force = true);
+
+protected:
+  /// Calculate clearance for the given regions, in parallel where possible. Regions which do not exist are skipped.
+  /// @param map The operating map.
+  /// @param region_keys The keys of the regions to update.
+  /// @param force Force update => update even if not dirty.
+  /// @return The number of regions updated.
+  unsigned updateRegions(OccupancyMap &map, const std::vector<glm::i16vec3> &region_keys, bool force);
+
+  /// Internal data access
+  /// @return The internal data members.
+  ClearanceProcessCpuDetail *imp();
+  /// Internal data access
+  /// @return The internal data members.
+  const ClearanceProcessCpuDetail *imp() const;
+
+private:
+  std::unique_ptr<ClearanceProcessCpuDetail> imp_;
+};
+}  // namespace ohm
+
+#endif  // OHM_CLEARANCEPROCESSCPU_H
@@ -17,6 +17,8 @@
 #include <glm/vec3.hpp>
 
 #include "CovarianceVoxel.h"
+#include "OccupancyLod.h"
+#include "OccupancyMask.h"
 
 #include <stdexcept>
 
@@ -60,6 +62,16 @@ const char *incidentNormalLayerName()
 {
   return "incident_normal";
 }
+const char *occupancyLodLayerName(unsigned level)
+{
+  static const char *names[kOccupancyLodMaxLevel] = { "occupancy_lod1", "occupancy_lod2", "occupancy_lod3",
+                                                      "occupancy_lod4" };
+  return (level > 0 && level <= kOccupancyLodMaxLevel) ? names[level - 1] : nullptr;
+}
+const char *occupancyMaskLayerName()
+{
+  return "occupancy_mask";
+}
 }  // namespace default_layer
 
 
@@ -274,4 +286,59 @@ MapLayer *addIncidentNormal(MapLayout &layout)
 
   return layer;
 }
+
+
+MapLayer *addOccupancyLod(MapLayout &layout, unsigned level)
+{
+  const char *layer_name = default_layer::occupancyLodLayerName(level);
+  if (!layer_name)
+  {
+    return nullptr;
+  }
+
+  if (const MapLayer *layer = layout.layer(layer_name))
+  {
+    // Already present.
+    return layout.layerPtr(layer->layerIndex());
+  }
+
+  MapLayer *layer = layout.addLayer(layer_name, uint16_t(level));
+  VoxelLayout voxel = layer->voxelLayout();
+  // Initialise as entirely unobserved.
+  const float invalid_marker_value = unobservedOccupancyValue();
+  size_t clear_value = 0;
+  memcpy(&clear_value, &invalid_marker_value, sizeof(invalid_marker_value));
+  voxel.addMember("occupancy", DataType::kFloat, clear_value);
+  voxel.addMember("unobserved_count", DataType::kUInt32, size_t(1u) << (3u * level));
+
+  if (layer->voxelByteSize() != sizeof(OccupancyLodVoxel))
+  {
+    throw std::runtime_error("Occupancy LOD layer size mismatch");
+  }
+
+  return layer;
+}
+
+
+MapLayer *addOccupancyMask(MapLayout &layout)
+{
+  if (const MapLayer *layer = layout.layer(default_layer::occupancyMaskLayerName()))
+  {
+    // Already present.
+    return layout.layerPtr(layer->layerIndex());
+  }
+
+  MapLayer *layer = layout.addLayer(default_layer::occupancyMaskLayerName(), uint16_t(kOccupancyMaskSubsampling));
+  VoxelLayout voxel = layer->voxelLayout();
+  // Initialise as entirely unobserved.
+  voxel.addMember("occupied", DataType::kUInt64, 0);
+  voxel.addMember("observed", DataType::kUInt64, 0);
+
+  if (layer->voxelByteSize() != sizeof(OccupancyMaskVoxel))
+  {
+    throw std::runtime_error("Occupancy mask layer size mismatch");
+  }
+
+  return layer;
+}
 }  // namespace ohm
@@ -39,6 +39,13 @@ const char ohm_API *touchTimeLayerName();
 /// Name of the voxel incident layer.
 /// @return "incident_normal"
 const char ohm_API *incidentNormalLayerName();
+/// Name of an occupancy level of detail layer. See @c OccupancyLodVoxel .
+/// @param level The level of detail in the range [1, @c kOccupancyLodMaxLevel ].
+/// @return "occupancy_lod<level>" or null when @p level is out of range.
+const char ohm_API *occupancyLodLayerName(unsigned level);
+/// Name of the occupancy mask layer. See @c OccupancyMaskVoxel .
+/// @return "occupancy_mask"
+const char ohm_API *occupancyMaskLayerName();
 }  // namespace default_layer
 
 class MapLayout;
@@ -137,6 +144,33 @@ MapLayer ohm_API *addTouchTime(MapLayout &layout);
 /// @param layout The @p MapLayout to modify.
 /// @return The map layer added or the pre-existing layer named according to @c incidentNormalLayerName() .
 MapLayer ohm_API *addIncidentNormal(MapLayout &layout);
+
+/// Add an occupancy level of detail layer to @p layout.
+///
+/// This adds a layer named according to @c occupancyLodLayerName() with a @c MapLayer::subsampling() of @p level ,
+/// holding an @c OccupancyLodVoxel for each block of `2^level` voxels along each axis. The layer is initialised to
+/// represent entirely unobserved space and is maintained by the @c OccupancyLodProcess .
+///
+/// The layer may only be used when the map region dimensions are divisible by `2^level` along each axis.
+///
+/// @param layout The @p MapLayout to modify.
+/// @param level The level of detail in the range [1, @c kOccupancyLodMaxLevel ].
+/// @return The map layer added or the pre-existing layer named according to @c occupancyLodLayerName() . Null when
+///   @p level is out of range.
+MapLayer ohm_API *addOccupancyLod(MapLayout &layout, unsigned level);
+
+/// Add the occupancy mask layer to @p layout.
+///
+/// This adds a layer named according to @c occupancyMaskLayerName() with a @c MapLayer::subsampling() of
+/// @c kOccupancyMaskSubsampling , holding an @c OccupancyMaskVoxel for every 64 voxels. The layer is initialised to
+/// represent entirely unobserved space. It is maintained incrementally by @c RayMapperOccupancy and otherwise
+/// recalculated by @c updateOccupancyMask() .
+///
+/// The layer may only be used when the map region dimensions are divisible by 4 along each axis.
+///
+/// @param layout The @p MapLayout to modify.
+/// @return The map layer added or the pre-existing layer named according to @c occupancyMaskLayerName() .
+MapLayer ohm_API *addOccupancyMask(MapLayout &layout);
 }  // namespace ohm
 
 #endif  // OHMDEFAULTLAYER_H
@@ -0,0 +1,30 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHMITERATORFLAG_H
+#define OHMITERATORFLAG_H
+
+#include "OhmConfig.h"
+
+namespace ohm
+{
+/// Flags used to filter the voxels visited by an @c OccupancyMap iterator. See @c OccupancyMap::begin(unsigned) .
+///
+/// Flags may be combined, in which case a voxel must pass all the filters to be visited.
+enum IteratorFlag : unsigned
+{
+  /// No filtering. Visit every voxel in every region.
+  kIfNone = 0u,
+  /// Visit only observed voxels; those which are not @c OccupancyType::kUnobserved .
+  kIfObserved = (1u << 0u),
+  /// Visit only occupied voxels.
+  kIfOccupied = (1u << 1u),
+  /// Visit only voxels in regions modified after a given stamp value. This is a region level filter, comparing
+  /// the stamp against @c MapChunk::dirty_stamp .
+  kIfTouchedSince = (1u << 2u)
+};
+}  // namespace ohm
+
+#endif  // OHMITERATORFLAG_H
@@ -47,15 +47,53 @@ MapChunk::MapChunk(MapChunk &&other) noexcept
   , first_valid_index(std::exchange(other.first_valid_index, ~0u))
   , touched_time(std::exchange(other.touched_time, 0))
   , dirty_stamp(other.dirty_stamp.load())
+  , created_stamp(std::exchange(other.created_stamp, 0))
   , touched_stamps(std::move(other.touched_stamps))
   , voxel_blocks(std::move(other.voxel_blocks))
   , flags(std::exchange(other.flags, 0))
+  , saturated_free_count(std::exchange(other.saturated_free_count, 0))
+  , saturated_free_stamp(std::exchange(other.saturated_free_stamp, 0))
+  , occupied_voxel_count(std::exchange(other.occupied_voxel_count, 0))
+  , observed_voxel_count(std::exchange(other.observed_voxel_count, 0))
 {}
 
 
 MapChunk::~MapChunk() = default;
 
 
+void MapChunk::recycle(const MapRegion &region)
+{
+  this->region = region;
+  first_valid_index = ~0u;
+  touched_time = 0;
+  dirty_stamp = 0;
+  created_stamp = 0;
+  flags = 0;
+  saturated_free_count = 0;
+  saturated_free_stamp = 0;
+  occupied_voxel_count = 0;
+  observed_voxel_count = 0;
+  for (size_t i = 0; i < voxel_blocks.size(); ++i)
+  {
+    voxel_blocks[i]->reset();
+    touched_stamps[i] = 0u;
+  }
+}
+
+
+void MapChunk::updateDirtyStamp(uint64_t stamp)
+{
+  if (map)
+  {
+    map->dirty_regions.update(region.coord, dirty_stamp, stamp);
+  }
+  else
+  {
+    dirty_stamp = stamp;
+  }
+}
+
+
 const MapLayout &MapChunk::layout() const
 {
   return map->layout;
@@ -128,9 +166,8 @@ void MapChunk::updateLayout(const MapLayout *new_layout,
   {
     if (voxel_blocks[i])
     {
-      // Unmigrated/redudant layer. Release.
-      voxel_blocks[i]->destroy();
-      voxel_blocks[i] = nullptr;
+      // Unmigrated/redudant layer. Release. The deleter destroys the block.
+      voxel_blocks[i].reset();
     }
   }
 
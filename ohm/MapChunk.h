@@ -166,8 +166,16 @@ struct ohm_API MapChunk
 
   /// A monotonic stamp value occupancy layer, used to indicate when this chunk was last updated.
   /// The map maintains the most up to date stamp: @c OccupancyMap::stamp().
+  ///
+  /// This should be modified via @c setDirtyStamp() in order to maintain the map's index of dirty regions.
   std::atomic_uint64_t dirty_stamp{ 0 };
 
+  /// Marks when the chunk was created, or recycled, for its current @c region : one more than the map stamp at the
+  /// time. A chunk with a @c created_stamp greater than a given stamp holds no data from before that stamp, even if
+  /// its @c dirty_stamp is older. Zero for loaded chunks. Used by @c saveIncremental() to detect regions which were
+  /// removed and recreated without being modified.
+  uint64_t created_stamp = 0;
+
   /// A monotonic stamp value for each @c voxelMap, used to indicate when the layer was last updated.
   /// The map maintains the most up to date stamp: @c OccupancyMap::stamp().
   /// @note It is not possible to have a @c std::vector of atomic types. We use a unique pointer to an arrray
@@ -181,6 +189,20 @@ struct ohm_API MapChunk
   /// Chunk flags set from @c MapChunkFlag.
   unsigned flags = 0;
 
+  /// Number of voxels in the occupancy layer saturated at the minimum (free) value. Maintained by
+  /// @c RayMapperOccupancy when @c OccupancyMap::saturateAtMinValue() is set, allowing rays to skip regions where all
+  /// voxels are saturated. Only valid while @c saturated_free_stamp matches the occupancy layer @c touched_stamps .
+  unsigned saturated_free_count = 0;
+  /// The occupancy layer @c touched_stamps value for which @c saturated_free_count is valid.
+  uint64_t saturated_free_stamp = 0;
+
+  /// Number of occupied voxels in the region. Only valid while the occupancy mask layer is up to date. See
+  /// @c occupancyMaskUpToDate() .
+  unsigned occupied_voxel_count = 0;
+  /// Number of observed voxels in the region. Only valid while the occupancy mask layer is up to date. See
+  /// @c occupancyMaskUpToDate() .
+  unsigned observed_voxel_count = 0;
+
   /// Create an empty @c MapChunk object.
   MapChunk() = default;
   /// Create a @c MapChunk for the given @p map .
@@ -238,6 +260,26 @@ struct ohm_API MapChunk
   /// @return True if this chunk contains at least one voxel with a valid value.
   bool hasValidNodes() const;
 
+  /// Set the @c dirty_stamp to @p stamp . This also updates the owning map's dirty region index when the stamp value
+  /// changes, supporting @c OccupancyMap::collectDirtyRegions() . The common case, where the stamp is unchanged, is
+  /// a single relaxed atomic load.
+  /// @param stamp The new dirty stamp value. Generally the value from @c OccupancyMap::touch() .
+  inline void setDirtyStamp(uint64_t stamp)
+  {
+    if (dirty_stamp.load(std::memory_order_relaxed) != stamp)
+    {
+      updateDirtyStamp(stamp);
+    }
+  }
+
+  /// Reset the chunk to cover @p region in place, as if newly created. All voxel blocks are cleared via
+  /// @c VoxelBlock::reset() and the stamps and region summaries are zeroed. Used to recycle chunks in rolling window
+  /// mode. See @c OccupancyMap::setRollingWindow() .
+  ///
+  /// The chunk must not be in the owning map's dirty region index.
+  /// @param region The new region for the chunk.
+  void recycle(const MapRegion &region);
+
   /// Set the @c first_valid_index to the unknown/invalid value.
   inline void invalidateFirstValidIndex() { first_valid_index = ~0u; }
 
@@ -289,6 +331,11 @@ struct ohm_API MapChunk
   /// @param[out] min_ext Set to the lower extents of the AABB.
   /// @param[out] max_ext Set to the upper extents of the AABB.
   void extents(glm::dvec3 &min_ext, glm::dvec3 &max_ext) const;
+
+private:
+  /// Slow path for @c setDirtyStamp() , updating the dirty region index.
+  /// @param stamp The new dirty stamp value.
+  void updateDirtyStamp(uint64_t stamp);
 };
 
 
@@ -220,6 +220,28 @@ void MapLayout::filterLayers(const std::initializer_list<const char *> &preserve
 }
 
 
+void MapLayout::filterLayers(const std::vector<std::string> &preserve_layers)
+{
+  if (imp_->layers.empty())
+  {
+    return;
+  }
+
+  std::vector<unsigned> preserve_indices;
+  for (const std::string &layer_name : preserve_layers)
+  {
+    if (const MapLayer *layer = this->layer(layer_name.c_str()))
+    {
+      preserve_indices.push_back(layer->layerIndex());
+    }
+  }
+
+  ohm::filterLayers(*imp_, preserve_indices);
+  // Rebind the layer index caches.
+  cacheLayerIndices();
+}
+
+
 void MapLayout::filterLayers(const std::initializer_list<unsigned> &preserve_layers)
 {
   ohm::filterLayers(*imp_, preserve_layers);
@@ -11,6 +11,7 @@
 #include "MapLayoutMatch.h"
 
 #include <initializer_list>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -182,6 +183,9 @@ public:
   /// @param preserve_layers Names of the layers to preserve. Exact match required.
   void filterLayers(const std::initializer_list<const char *> &preserve_layers);
 
+  /// @overload
+  void filterLayers(const std::vector<std::string> &preserve_layers);
+
   /// Remove all layers except for the identified layers. Removing interleaved layers may create gaps in the layer
   /// array. These gaps are removed with the array being repacked.
   /// @param preserve_layers Indices of the layers to preserve.
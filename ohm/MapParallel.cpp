@@ -0,0 +1,87 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "MapParallel.h"
+
+#include "private/OccupancyMapDetail.h"
+
+#ifdef OHM_THREADS
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif  // OHM_THREADS
+
+namespace ohm
+{
+namespace
+{
+/// Collect the regions of @p map under the map mutex.
+std::vector<MapChunk *> collectRegions(const OccupancyMap &map)
+{
+  const OccupancyMapDetail &detail = *map.detail();
+  std::vector<MapChunk *> chunks;
+  std::unique_lock<decltype(detail.mutex)> guard(detail.mutex);
+  chunks.reserve(detail.chunks.size());
+  for (auto &&chunk_iter : detail.chunks)
+  {
+    chunks.push_back(chunk_iter.second);
+  }
+  return chunks;
+}
+}  // namespace
+
+
+void parallelForRange(size_t count, const ParallelRangeFunc &func, bool parallel)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+#ifdef OHM_THREADS
+  if (parallel)
+  {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, count),
+                      [&func](const tbb::blocked_range<size_t> &range) { func(range.begin(), range.end()); });
+    return;
+  }
+#else   // OHM_THREADS
+  (void)parallel;
+#endif  // OHM_THREADS
+
+  func(0, count);
+}
+
+
+size_t forEachRegion(OccupancyMap &map, const RegionVisitFunc &func, bool parallel)
+{
+  const std::vector<MapChunk *> chunks = collectRegions(map);
+  parallelForRange(
+    chunks.size(),
+    [&chunks, &func](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+      {
+        func(*chunks[i]);
+      }
+    },
+    parallel);
+  return chunks.size();
+}
+
+
+size_t forEachRegion(const OccupancyMap &map, const ConstRegionVisitFunc &func, bool parallel)
+{
+  const std::vector<MapChunk *> chunks = collectRegions(map);
+  parallelForRange(
+    chunks.size(),
+    [&chunks, &func](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+      {
+        func(*chunks[i]);
+      }
+    },
+    parallel);
+  return chunks.size();
+}
+}  // namespace ohm
@@ -0,0 +1,189 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_MAPPARALLEL_H
+#define OHM_MAPPARALLEL_H
+
+#include "OhmConfig.h"
+
+#include "Key.h"
+#include "MapChunk.h"
+#include "MapLayer.h"
+#include "MapLayout.h"
+#include "OccupancyMap.h"
+#include "VoxelBlock.h"
+#include "VoxelBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace ohm
+{
+/// Function signature for processing a range of items `[begin, end)` in @c parallelForRange() .
+using ParallelRangeFunc = std::function<void(size_t begin, size_t end)>;
+/// Function signature for visiting a region in @c forEachRegion() .
+using RegionVisitFunc = std::function<void(MapChunk &chunk)>;
+/// Function signature for visiting a region in the const @c forEachRegion() .
+using ConstRegionVisitFunc = std::function<void(const MapChunk &chunk)>;
+
+/// Partition the items `[0, count)` into ranges and invoke @p func for each range.
+///
+/// Ranges are processed in parallel on the TBB thread pool when @c OHM_THREADS is enabled and @p parallel is set.
+/// Otherwise @p func is invoked once for the whole range on the calling thread.
+///
+/// @param count The number of items to process.
+/// @param func The range processing function.
+/// @param parallel Allow parallel processing?
+void ohm_API parallelForRange(size_t count, const ParallelRangeFunc &func, bool parallel = true);
+
+/// Invoke @p func for each region in @p map , processing regions in parallel where possible.
+///
+/// The regions to visit are collected under the map mutex before processing, but the map is not locked while @p func
+/// is invoked. Each region is visited by exactly one thread, so @p func may freely read and write the voxels of the
+/// region it is given using either a @c VoxelBuffer on the @c MapChunk::voxel_blocks or a @c Voxel bound to keys in
+/// that region. Modifications must be reflected in the @c MapChunk::touched_stamps and @c MapChunk::dirty_stamp ;
+/// @c Voxel does this automatically, while @c VoxelBuffer users should call @c OccupancyMap::touch() before
+/// processing and set the stamps themselves.
+///
+/// The map must not have regions added or removed during the call.
+///
+/// @param map The map to process.
+/// @param func The region visitor.
+/// @param parallel Allow parallel processing? See @c parallelForRange() .
+/// @return The number of regions visited.
+size_t ohm_API forEachRegion(OccupancyMap &map, const RegionVisitFunc &func, bool parallel = true);
+
+/// @overload
+size_t ohm_API forEachRegion(const OccupancyMap &map, const ConstRegionVisitFunc &func, bool parallel = true);
+
+/// Reduce a value over all regions of @p map , processing regions in parallel where possible.
+///
+/// Each parallel task starts from @p identity and accumulates its regions using @p reduce_func . The task results are
+/// then combined with @p join_func in task order, so results are deterministic for a given partitioning. As an example,
+/// counting the occupied voxels in a map:
+///
+/// @code
+/// const size_t occupied = ohm::reduceRegions(map, size_t(0), [&map](size_t count, const ohm::MapChunk &chunk) {
+///   ohm::Voxel<const float> occupancy(&map, map.layout().occupancyLayer(), chunk.region.coord);
+///   // ... add the occupied voxels of chunk to count.
+///   return count;
+/// }, [](size_t a, size_t b) { return a + b; });
+/// @endcode
+///
+/// @param map The map to process.
+/// @param identity The initial value for each task. Also the result for an empty map.
+/// @param reduce_func Accumulates a region into a task value. Signature `T (T value, const MapChunk &chunk)` .
+/// @param join_func Combines two task values. Signature `T (const T &a, const T &b)` .
+/// @param parallel Allow parallel processing? See @c parallelForRange() .
+/// @return The combined result.
+template <typename T, typename ReduceFunc, typename JoinFunc>
+T reduceRegions(const OccupancyMap &map, const T &identity, ReduceFunc &&reduce_func, JoinFunc &&join_func,
+                bool parallel = true)
+{
+  std::vector<const MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+
+  // Task results keyed by range start to join in a deterministic order.
+  std::vector<std::pair<size_t, T>> partials;
+  std::mutex partials_lock;
+  parallelForRange(
+    chunks.size(),
+    [&](size_t begin, size_t end) {
+      T value = identity;
+      for (size_t i = begin; i < end; ++i)
+      {
+        value = reduce_func(std::move(value), *chunks[i]);
+      }
+      std::unique_lock<std::mutex> guard(partials_lock);
+      partials.emplace_back(begin, std::move(value));
+    },
+    parallel);
+
+  std::sort(partials.begin(), partials.end(),
+            [](const std::pair<size_t, T> &a, const std::pair<size_t, T> &b) { return a.first < b.first; });
+  T result = identity;
+  for (auto &partial : partials)
+  {
+    result = join_func(result, partial.second);
+  }
+  return result;
+}
+
+/// Transform the voxels of a layer of @p map in parallel.
+///
+/// @p transform_func is invoked for every voxel of the layer @p layer_index with a reference to the voxel value and the
+/// voxel key, and returns true if it modified the value. For subsampled layers, the local part of the key addresses
+/// the layer voxel rather than a map voxel. Regions with modified voxels have their @c MapChunk::dirty_stamp and
+/// @c MapChunk::touched_stamps updated to a single @c OccupancyMap::touch() value. When transforming the occupancy
+/// layer, the @c MapChunk::first_valid_index is also updated. Summary layers such as the occupancy mask see the new
+/// stamps and are updated lazily by their users.
+///
+/// For example, applying a decay to the occupancy layer:
+/// @code
+/// ohm::parallelVoxelTransform<float>(map, map.layout().occupancyLayer(), [](float &value, const ohm::Key &) {
+///   if (value == ohm::unobservedOccupancyValue()) { return false; }
+///   value *= 0.9f;
+///   return true;
+/// });
+/// @endcode
+///
+/// @param map The map to process.
+/// @param layer_index The layer to transform. The layer voxel size must match `sizeof(T)` .
+/// @param transform_func The transform function. Signature `bool (T &value, const Key &key)` .
+/// @param parallel Allow parallel processing? See @c parallelForRange() .
+/// @return The number of regions modified, or zero if @p layer_index is invalid.
+template <typename T, typename TransformFunc>
+size_t parallelVoxelTransform(OccupancyMap &map, int layer_index, TransformFunc &&transform_func, bool parallel = true)
+{
+  const MapLayer *layer = (layer_index >= 0) ? map.layout().layerPtr(size_t(layer_index)) : nullptr;
+  if (!layer || layer->voxelByteSize() != sizeof(T))
+  {
+    return 0;
+  }
+
+  const glm::ivec3 layer_dim(layer->dimensions(map.regionVoxelDimensions()));
+  const unsigned layer_volume = unsigned(layer->volume(map.regionVoxelDimensions()));
+  const bool occupancy_layer = layer_index == map.layout().occupancyLayer();
+  const uint64_t touch_stamp = map.touch();
+  std::atomic<size_t> modified_regions{ 0 };
+
+  forEachRegion(
+    map,
+    [&](MapChunk &chunk) {
+      VoxelBuffer<VoxelBlock> buffer(chunk.voxel_blocks[layer_index]);
+      bool modified = false;
+      T value;
+      for (unsigned i = 0; i < layer_volume; ++i)
+      {
+        buffer.readVoxel(i, &value);
+        if (transform_func(value, MapChunk::keyForIndex(i, layer_dim, chunk.region.coord)))
+        {
+          buffer.writeVoxel(i, value);
+          if (occupancy_layer)
+          {
+            chunk.updateFirstValid(i);
+          }
+          modified = true;
+        }
+      }
+
+      if (modified)
+      {
+        chunk.setDirtyStamp(touch_stamp);
+        chunk.touched_stamps[layer_index].store(touch_stamp, std::memory_order_relaxed);
+        ++modified_regions;
+      }
+    },
+    parallel);
+
+  return modified_regions;
+}
+}  // namespace ohm
+
+#endif  // OHM_MAPPARALLEL_H
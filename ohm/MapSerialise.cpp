@@ -5,11 +5,13 @@
 // Author: Kazys Stepanas
 #include "MapSerialise.h"
 
+#include "Aabb.h"
 #include "DefaultLayer.h"
 #include "MapChunk.h"
 #include "MapFlag.h"
 #include "MapLayer.h"
 #include "MapLayout.h"
+#include "MapRegionCache.h"
 #include "OccupancyMap.h"
 #include "Stream.h"
 #include "VoxelBlock.h"
@@ -23,18 +25,31 @@
 #include "serialise/MapSerialiseV0.2.h"
 #include "serialise/MapSerialiseV0.4.h"
 #include "serialise/MapSerialiseV0.5.h"
+#include "serialise/MapSerialiseV0.6.h"
+#include "serialise/MapSerialiseV0.7.h"
 #include "serialise/MapSerialiseV0.h"
 
+#include <ohmutil/VectorHash.h>
+
 #include <glm/glm.hpp>
 
+#ifdef OHM_THREADS
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif  // OHM_THREADS
+
+#include <algorithm>
 #include <array>
 #include <cstdio>
 #include <cstring>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <zlib.h>
@@ -89,11 +104,17 @@ const uint32_t kMapHeaderMarker = 0x44330011u;
 // - MMM is a three digit specification of the current minor version.
 // - PPP is a three digit specification of the current patch version.
 const MapVersion kSupportedVersionMin = { 0, 0, 0 };
-const MapVersion kSupportedVersionMax = { 0, 5, 0 };
-const MapVersion kCurrentVersion = { 0, 5, 0 };
+const MapVersion kSupportedVersionMax = { 0, 7, 0 };
+const MapVersion kCurrentVersion = { 0, 7, 0 };
 
 // Note: version 0.3.x is not supported.
 
+/// Does the map file @p version store independently compressed region blocks with a region index? Added v0.6.0
+inline bool hasRegionIndex(const MapVersion &version)
+{
+  return version.major > 0 || version.minor >= 6;
+}
+
 int saveItem(OutputStream &stream, const MapValue &value)
 {
   //{
@@ -322,6 +343,9 @@ int saveHeader(OutputStream &stream, const OccupancyMapDetail &map)
   // Add v0.3.2
   ok = writeUncompressed<uint32_t>(stream, std::underlying_type_t<MapFlag>(map.flags)) && ok;
 
+  // Added v0.7.0
+  ok = writeUncompressed<uint64_t>(stream, map.identity) && ok;
+
   return (ok) ? 0 : kSeFileWriteFailure;
 }
 
@@ -383,21 +407,24 @@ int saveLayout(OutputStream &stream, const OccupancyMapDetail &map)
 }
 
 
-int saveChunk(OutputStream &stream, const MapChunk &chunk, const OccupancyMapDetail &detail)
+int saveChunk(std::vector<uint8_t> &block, const MapChunk &chunk, const OccupancyMapDetail & /*detail*/)
 {
   bool ok = true;
 
-  // Write region details, then nodes. MapChunk members are derived.
-  ok = write<int32_t>(stream, chunk.region.coord.x) && ok;
-  ok = write<int32_t>(stream, chunk.region.coord.y) && ok;
-  ok = write<int32_t>(stream, chunk.region.coord.z) && ok;
-  ok = write<double>(stream, chunk.region.centre.x) && ok;
-  ok = write<double>(stream, chunk.region.centre.y) && ok;
-  ok = write<double>(stream, chunk.region.centre.z) && ok;
-  ok = write<double>(stream, chunk.touched_time) && ok;
-
-  // Save each map layer.
+  // Write region details, then layer records. MapChunk members are derived.
+  ok = writeBuffer<int32_t>(block, chunk.region.coord.x) && ok;
+  ok = writeBuffer<int32_t>(block, chunk.region.coord.y) && ok;
+  ok = writeBuffer<int32_t>(block, chunk.region.coord.z) && ok;
+  ok = writeBuffer<double>(block, chunk.region.centre.x) && ok;
+  ok = writeBuffer<double>(block, chunk.region.centre.y) && ok;
+  ok = writeBuffer<double>(block, chunk.region.centre.z) && ok;
+  ok = writeBuffer<double>(block, chunk.touched_time) && ok;
+  ok = writeBuffer<uint32_t>(block, chunk.first_valid_index) && ok;
+
+  // Save each map layer in the compressed form held by its voxel block. Blocks which are already compressed are written
+  // verbatim.
   const MapLayout &layout = chunk.layout();
+  std::vector<uint8_t> payload;
   for (size_t i = 0; i < layout.layerCount(); ++i)
   {
     const MapLayer &layer = layout.layer(i);
@@ -408,26 +435,166 @@ int saveChunk(OutputStream &stream, const MapChunk &chunk, const OccupancyMapDet
       continue;
     }
 
-    uint64_t layer_touched_stamp = chunk.touched_stamps[i];
-    ok = write<uint64_t>(stream, layer_touched_stamp) && ok;
+    bool uniform = false;
+    if (!chunk.voxel_blocks[layer.layerIndex()]->exportCompressed(payload, uniform))
+    {
+      return kSeFileWriteFailure;
+    }
 
-    // Get the layer memory.
-    VoxelBuffer<const VoxelBlock> voxel_buffer(chunk.voxel_blocks[layer.layerIndex()]);
-    const uint8_t *layer_mem = voxel_buffer.voxelMemory();
-    const size_t node_count = layer.volume(detail.region_voxel_dimensions);
-    const size_t node_byte_count = layer.voxelByteSize() * node_count;
-    if (node_byte_count != unsigned(node_byte_count))
+    if (payload.size() != uint32_t(payload.size()))
     {
       return kSeValueOverflow;
     }
 
-    ok = stream.write(layer_mem, unsigned(node_byte_count)) == node_byte_count && ok;
+    uint64_t layer_touched_stamp = chunk.touched_stamps[i];
+    ok = writeBuffer<uint64_t>(block, layer_touched_stamp) && ok;
+    ok = writeBuffer<uint8_t>(block, (uniform) ? v0_7::kLayerUniform : v0_7::kLayerCompressed) && ok;
+    ok = writeBuffer<uint32_t>(block, payload.size()) && ok;
+    block.insert(block.end(), payload.begin(), payload.end());
   }
 
   return (ok) ? 0 : kSeFileWriteFailure;
 }
 
 
+/// Encoded content for a region block pending write.
+struct RegionPayload
+{
+  std::vector<uint8_t> block;  ///< Encoded chunk content.
+  int err = 0;                 ///< Encoding error code.
+};
+
+
+/// Encode the @p chunks in the range `[start_index, end_index)` into the corresponding @p payloads .
+void encodeRegionRange(const std::vector<const MapChunk *> &chunks, std::vector<RegionPayload> &payloads,
+                       size_t start_index, size_t end_index, size_t batch_start, const OccupancyMapDetail &detail)
+{
+  for (size_t i = start_index; i < end_index; ++i)
+  {
+    RegionPayload &payload = payloads[i - batch_start];
+    payload.block.clear();
+    payload.err = saveChunk(payload.block, *chunks[i], detail);
+    if (!payload.err && payload.block.size() != uint32_t(payload.block.size()))
+    {
+      payload.err = kSeValueOverflow;
+    }
+  }
+}
+
+
+/// Encode the region blocks for @p chunks , passing each to @p emit_func in order. Processing stops on
+/// the first error, including any non zero value returned by @p emit_func .
+int encodeRegionBlocks(const std::vector<const MapChunk *> &chunks, const OccupancyMapDetail &detail,
+                       SerialiseProgress *progress,
+                       const std::function<int(const MapChunk &, const RegionPayload &)> &emit_func)
+{
+  // Regions are processed in batches. The regions in a batch are encoded in parallel (when threads are enabled), then
+  // emitted in order on this thread. The output matches the single threaded output.
+  std::vector<RegionPayload> payloads(std::min(chunks.size(), v0_6::kRegionBatchSize));
+
+  for (size_t batch_start = 0; batch_start < chunks.size() && (!progress || !progress->quit());
+       batch_start += v0_6::kRegionBatchSize)
+  {
+    const size_t batch_end = std::min(batch_start + v0_6::kRegionBatchSize, chunks.size());
+#ifdef OHM_THREADS
+    const auto encode_func = [&chunks, &payloads, batch_start, &detail](const tbb::blocked_range<size_t> &range) {
+      encodeRegionRange(chunks, payloads, range.begin(), range.end(), batch_start, detail);
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(batch_start, batch_end), encode_func);
+#else   // OHM_THREADS
+    encodeRegionRange(chunks, payloads, batch_start, batch_end, batch_start, detail);
+#endif  // OHM_THREADS
+
+    for (size_t i = batch_start; i < batch_end; ++i)
+    {
+      const RegionPayload &payload = payloads[i - batch_start];
+      int err = payload.err;
+      if (!err)
+      {
+        err = emit_func(*chunks[i], payload);
+      }
+      if (err)
+      {
+        return err;
+      }
+
+      if (progress)
+      {
+        progress->incrementProgress();
+      }
+    }
+  }
+
+  return kSeOk;
+}
+
+
+/// Write compressed region blocks for @p chunks to the end of @p stream , appending their entries to @p index .
+int writeRegionBlocks(OutputStream &stream, const std::vector<const MapChunk *> &chunks,
+                      const OccupancyMapDetail &detail, std::vector<v0_6::RegionBlock> &index,
+                      SerialiseProgress *progress)
+{
+  index.reserve(index.size() + chunks.size());
+  const auto write_func = [&stream, &index](const MapChunk &chunk, const RegionPayload &payload) {
+    v0_6::RegionBlock region_block{};
+    region_block.coord = chunk.region.coord;
+    region_block.offset = stream.tell();
+    region_block.compressed_size = uint32_t(payload.block.size());
+    region_block.byte_size = region_block.compressed_size;
+
+    if (stream.writeUncompressed(payload.block.data(), region_block.compressed_size) != region_block.compressed_size)
+    {
+      return int(kSeFileWriteFailure);
+    }
+
+    index.emplace_back(region_block);
+    return int(kSeOk);
+  };
+
+  return encodeRegionBlocks(chunks, detail, progress, write_func);
+}
+
+
+int saveRegions(OutputStream &stream, const OccupancyMapDetail &detail, SerialiseProgress *progress)
+{
+  // Reserve space for the region index offset. This is patched once the region blocks have been written.
+  const size_t index_offset_pos = stream.tell();
+  if (!writeUncompressed<uint64_t>(stream, 0u))
+  {
+    return kSeFileWriteFailure;
+  }
+
+  std::vector<const MapChunk *> chunks;
+  chunks.reserve(detail.chunks.size());
+  for (const auto &region : detail.chunks)
+  {
+    chunks.emplace_back(region.second);
+  }
+
+  std::vector<v0_6::RegionBlock> index;
+  int err = writeRegionBlocks(stream, chunks, detail, index, progress);
+  if (err)
+  {
+    return err;
+  }
+
+  const size_t index_offset = stream.tell();
+  err = v0_6::saveRegionIndex(stream, index);
+  if (err)
+  {
+    return err;
+  }
+
+  stream.seek(index_offset_pos);
+  if (!writeUncompressed<uint64_t>(stream, index_offset))
+  {
+    return kSeFileWriteFailure;
+  }
+
+  return kSeOk;
+}
+
+
 int loadHeader(InputStream &stream, HeaderVersion &version, OccupancyMapDetail &map, size_t &region_count)
 {
   bool ok = true;
@@ -503,7 +670,9 @@ int loadHeader(InputStream &stream, HeaderVersion &version, OccupancyMapDetail &
   if (version.version.major > 0 || version.version.major == 0 && version.version.minor >= 3)
   {
     // Read the map stamp.
-    ok = readRaw<uint64_t>(stream, map.stamp) && ok;
+    uint64_t stamp = 0;
+    ok = readRaw<uint64_t>(stream, stamp) && ok;
+    map.stamp = stamp;
   }
 
   // v0.3.2 added serialisation of map flags
@@ -519,6 +688,12 @@ int loadHeader(InputStream &stream, HeaderVersion &version, OccupancyMapDetail &
     map.flags = MapFlag::kNone;
   }
 
+  if (version.version.major > 0 || version.version.minor >= 7)
+  {
+    // Adopt the identity of the map which wrote the file. See saveIncremental().
+    ok = readRaw<uint64_t>(stream, map.identity) && ok;
+  }
+
   if (!ok)
   {
     return kSeFileReadFailure;
@@ -528,49 +703,137 @@ int loadHeader(InputStream &stream, HeaderVersion &version, OccupancyMapDetail &
 }
 
 
-// Current version of chunk loading.
-int loadChunk(InputStream &stream, MapChunk &chunk, const OccupancyMapDetail &detail)
+/// Check if two map layouts match in every detail which affects serialisation.
+bool layoutsMatch(const MapLayout &a, const MapLayout &b)
 {
-  bool ok = true;
-
-  // Write region details, then nodes. MapChunk members are derived.
-  ok = read<int32_t>(stream, chunk.region.coord.x) && ok;
-  ok = read<int32_t>(stream, chunk.region.coord.y) && ok;
-  ok = read<int32_t>(stream, chunk.region.coord.z) && ok;
-  ok = read<double>(stream, chunk.region.centre.x) && ok;
-  ok = read<double>(stream, chunk.region.centre.y) && ok;
-  ok = read<double>(stream, chunk.region.centre.z) && ok;
-  ok = read<double>(stream, chunk.touched_time) && ok;
+  if (a.layerCount() != b.layerCount())
+  {
+    return false;
+  }
 
-  if (ok)
+  for (size_t i = 0; i < a.layerCount(); ++i)
   {
-    const MapLayout &layout = detail.layout;
-    for (size_t i = 0; i < layout.layerCount(); ++i)
+    const MapLayer &layer_a = a.layer(i);
+    const MapLayer &layer_b = b.layer(i);
+    if (strcmp(layer_a.name(), layer_b.name()) != 0 || layer_a.flags() != layer_b.flags() ||
+        layer_a.subsampling() != layer_b.subsampling())
     {
-      const MapLayer &layer = layout.layer(i);
-      VoxelBuffer<VoxelBlock> voxel_buffer(chunk.voxel_blocks[i]);
-      uint8_t *layer_mem = voxel_buffer.voxelMemory();
+      return false;
+    }
 
-      if (layer.flags() & MapLayer::kSkipSerialise)
-      {
-        // Not to be serialised. Clear instead.
-        layer.clear(layer_mem, detail.region_voxel_dimensions);
-        continue;
-      }
+    const VoxelLayoutConst voxel_a = layer_a.voxelLayout();
+    const VoxelLayoutConst voxel_b = layer_b.voxelLayout();
+    if (voxel_a.voxelByteSize() != voxel_b.voxelByteSize() || voxel_a.memberCount() != voxel_b.memberCount())
+    {
+      return false;
+    }
 
-      // Get the layer memory.
-      const size_t node_count = layer.volume(detail.region_voxel_dimensions);
-      const size_t node_byte_count = layer.voxelByteSize() * node_count;
-      if (node_byte_count != unsigned(node_byte_count))
+    for (size_t j = 0; j < voxel_a.memberCount(); ++j)
+    {
+      if (strcmp(voxel_a.memberName(j), voxel_b.memberName(j)) != 0 ||
+          voxel_a.memberType(j) != voxel_b.memberType(j) || voxel_a.memberOffset(j) != voxel_b.memberOffset(j) ||
+          voxel_a.memberClearValue(j) != voxel_b.memberClearValue(j))
       {
-        return kSeValueOverflow;
+        return false;
       }
-
-      ok = stream.read(layer_mem, unsigned(node_byte_count)) == node_byte_count && ok;
     }
   }
 
-  return (ok) ? 0 : kSeFileReadFailure;
+  return true;
+}
+
+
+/// Check if two @c MapInfo objects hold the same values.
+bool infoMatches(const MapInfo &a, const MapInfo &b)
+{
+  const unsigned count = a.extract(nullptr, 0);
+  if (count != b.extract(nullptr, 0))
+  {
+    return false;
+  }
+
+  std::vector<MapValue> values_a(count);
+  std::vector<MapValue> values_b(count);
+  a.extract(values_a.data(), count);
+  b.extract(values_b.data(), count);
+  std::sort(values_a.begin(), values_a.end());
+  std::sort(values_b.begin(), values_b.end());
+  return std::equal(values_a.begin(), values_a.end(), values_b.begin());
+}
+
+
+/// State of an existing map file for incremental saving. See @c saveIncremental() .
+struct JournalState
+{
+  /// The map stamp when the file was last written.
+  uint64_t stamp = 0;
+  /// Position of the region index offset in the file.
+  size_t index_offset_pos = 0;
+  /// Size of the file.
+  size_t file_size = 0;
+  /// The current region index.
+  std::vector<v0_6::RegionBlock> index;
+};
+
+
+/// Read the @c JournalState of @p filename . Fails unless the file is a current version map file written by the same map
+/// - matching @c OccupancyMapDetail::identity - and matching the header, @c MapInfo and layout of @p detail .
+int loadJournalState(const std::string &filename, const OccupancyMapDetail &detail, JournalState &state)
+{
+  InputStream stream(filename);
+  if (!stream.isOpen())
+  {
+    return kSeFileOpenFailure;
+  }
+
+  OccupancyMapDetail file_detail;
+  HeaderVersion version;
+  size_t region_count = 0;
+  int err = loadHeader(stream, version, file_detail, region_count);
+  if (err)
+  {
+    return err;
+  }
+
+  if (version.marker != kMapHeaderMarker || version.version != kCurrentVersion)
+  {
+    return kSeUnsupportedVersion;
+  }
+
+  if (file_detail.identity != detail.identity || file_detail.origin != detail.origin ||
+      file_detail.region_voxel_dimensions != detail.region_voxel_dimensions ||
+      file_detail.resolution != detail.resolution || file_detail.stamp > detail.stamp)
+  {
+    return kSeInfoError;
+  }
+
+  err = v0_2::loadMapInfo(stream, file_detail.info);
+  if (!err)
+  {
+    err = v0_1::loadLayout(stream, file_detail);
+  }
+  if (err)
+  {
+    return err;
+  }
+
+  if (!infoMatches(file_detail.info, detail.info) || !layoutsMatch(file_detail.layout, detail.layout))
+  {
+    return kSeInfoError;
+  }
+
+  state.stamp = file_detail.stamp;
+  state.index_offset_pos = stream.tell();
+  uint64_t index_offset = 0;
+  if (!readRaw<uint64_t>(stream, index_offset))
+  {
+    return kSeFileReadFailure;
+  }
+
+  stream.seek(size_t(index_offset));
+  err = v0_6::loadRegionIndex(stream, state.index);
+  state.file_size = stream.tell();
+  return err;
 }
 
 
@@ -593,9 +856,10 @@ void registerSerialiseExtensionErrorCodeString(int err, const char *error_string
 }
 
 
-int save(const std::string &filename, const OccupancyMap &map, SerialiseProgress *progress)
+/// Save @p map to @p stream , which may be open on a file or a memory buffer.
+int saveMap(OutputStream &stream, const OccupancyMap &map, SerialiseProgress *progress)
 {
-  OutputStream stream(filename, kSfCompress);
+  // From version 0.6 each region is compressed independently and the stream itself is uncompressed.
   const OccupancyMapDetail &detail = *map.detail();
 
   if (!stream.isOpen())
@@ -631,28 +895,180 @@ int save(const std::string &filename, const OccupancyMap &map, SerialiseProgress
     return err;
   }
 
-  for (auto region_iter = detail.chunks.begin(); region_iter != detail.chunks.end() && (!progress || !progress->quit());
-       ++region_iter)
+  return saveRegions(stream, detail, progress);
+}
+
+
+int save(const std::string &filename, const OccupancyMap &map, SerialiseProgress *progress)
+{
+  OutputStream stream(filename);
+  return saveMap(stream, map, progress);
+}
+
+
+int save(std::vector<uint8_t> &buffer, const OccupancyMap &map, SerialiseProgress *progress)
+{
+  OutputStream stream;
+  stream.openBuffer(buffer);
+  return saveMap(stream, map, progress);
+}
+
+
+int saveRegionBlocks(const OccupancyMap &map, const SerialiseRegionFunc &region_func, SerialiseProgress *progress)
+{
+  const OccupancyMapDetail &detail = *map.detail();
+  std::vector<const MapChunk *> chunks;
+  chunks.reserve(detail.chunks.size());
+  for (const auto &region : detail.chunks)
+  {
+    chunks.emplace_back(region.second);
+  }
+
+  if (progress)
   {
-    err = saveChunk(stream, *region_iter->second, detail);
-    if (err)
+    progress->setTargetProgress(unsigned(chunks.size()));
+  }
+
+  const auto emit_func = [&region_func](const MapChunk &chunk, const RegionPayload &payload) {
+    return region_func(chunk.region.coord, payload.block.data(), payload.block.size()) ? int(kSeOk) :
+                                                                                         int(kSeFileWriteFailure);
+  };
+  return encodeRegionBlocks(chunks, detail, progress, emit_func);
+}
+
+
+int saveRegionBlocks(const OccupancyMap &map, const std::vector<glm::i16vec3> &regions,
+                     const SerialiseRegionFunc &region_func, SerialiseProgress *progress)
+{
+  const OccupancyMapDetail &detail = *map.detail();
+  std::vector<const MapChunk *> chunks;
+  chunks.reserve(regions.size());
+  for (const glm::i16vec3 &region_coord : regions)
+  {
+    const auto search = detail.chunks.find(region_coord);
+    if (search != detail.chunks.end())
     {
-      return err;
+      chunks.emplace_back(search->second);
     }
+  }
+
+  if (progress)
+  {
+    progress->setTargetProgress(unsigned(chunks.size()));
+  }
+
+  const auto emit_func = [&region_func](const MapChunk &chunk, const RegionPayload &payload) {
+    return region_func(chunk.region.coord, payload.block.data(), payload.block.size()) ? int(kSeOk) :
+                                                                                         int(kSeFileWriteFailure);
+  };
+  return encodeRegionBlocks(chunks, detail, progress, emit_func);
+}
+
+
+int saveIncremental(const std::string &filename, const OccupancyMap &map, SerialiseProgress *progress,
+                    double compaction_ratio)
+{
+  const OccupancyMapDetail &detail = *map.detail();
+  JournalState state;
+  if (loadJournalState(filename, detail, state) != kSeOk)
+  {
+    // No compatible file to append to.
+    return save(filename, map, progress);
+  }
 
-    if (progress)
+  // Select the regions changed since the file was written, reusing the existing blocks for the others.
+  std::unordered_map<glm::i16vec3, v0_6::RegionBlock, Vector3Hash<glm::i16vec3>> existing;
+  existing.reserve(state.index.size());
+  for (const v0_6::RegionBlock &block : state.index)
+  {
+    existing.emplace(block.coord, block);
+  }
+
+  std::vector<const MapChunk *> changed;
+  std::vector<v0_6::RegionBlock> index;
+  size_t live_size = 0;
+  for (const auto &region : detail.chunks)
+  {
+    const MapChunk *chunk = region.second;
+    const auto search = existing.find(region.first);
+    // Regions created or recycled since the file was written hold none of the file content for the region.
+    if (chunk->dirty_stamp > state.stamp || chunk->created_stamp > state.stamp || search == existing.end())
     {
-      progress->incrementProgress();
+      changed.emplace_back(chunk);
+    }
+    else
+    {
+      index.emplace_back(search->second);
+      live_size += search->second.compressed_size;
     }
   }
 
-  return kSeOk;
+  // All existing content other than the reused blocks becomes dead space. Compact by rewriting the file once the
+  // dead space grows too large.
+  const size_t data_size = state.file_size - state.index_offset_pos - sizeof(uint64_t);
+  const size_t dead_size = data_size - std::min(live_size, data_size);
+  if (double(dead_size) > compaction_ratio * double(live_size))
+  {
+    return save(filename, map, progress);
+  }
+
+  OutputStream stream(filename, kSfUpdate);
+  if (!stream.isOpen())
+  {
+    return kSeFileOpenFailure;
+  }
+
+  if (progress)
+  {
+    progress->setTargetProgress(unsigned(changed.size()));
+  }
+
+  int err = kSeOk;
+  if (changed.empty() && index.size() == state.index.size())
+  {
+    // The existing index remains valid. Just update the header.
+    stream.seek(0);
+    err = saveHeader(stream, detail);
+    stream.flush();
+    return err;
+  }
+
+  // Append the changed region blocks, then the new region index. The existing index remains valid until the index
+  // offset is patched below.
+  err = writeRegionBlocks(stream, changed, detail, index, progress);
+  if (err)
+  {
+    return err;
+  }
+
+  const size_t index_offset = stream.tell();
+  err = v0_6::saveRegionIndex(stream, index);
+  if (err)
+  {
+    return err;
+  }
+  stream.flush();
+
+  // Commit the new index by patching the index offset. The header still carries the previous stamp, so an interrupted
+  // save leaves a file which is re-journaled from the old stamp.
+  stream.seek(state.index_offset_pos);
+  if (!writeUncompressed<uint64_t>(stream, index_offset))
+  {
+    return kSeFileWriteFailure;
+  }
+  stream.flush();
+
+  // Update the header, which has a fixed size, last. The new stamp is only recorded once the index is durable.
+  stream.seek(0);
+  err = saveHeader(stream, detail);
+  stream.flush();
+  return err;
 }
 
 
-int load(const std::string &filename, OccupancyMap &map, SerialiseProgress *progress, MapVersion *version_out)
+int loadFiltered(InputStream &stream, OccupancyMap &map, SerialiseProgress *progress, MapVersion *version_out,
+                 const RegionFilterFunc &filter, const std::vector<std::string> *preserve_layers = nullptr)
 {
-  InputStream stream(filename, kSfCompress);
   OccupancyMapDetail &detail = *map.detail();
 
   if (!stream.isOpen())
@@ -676,7 +1092,15 @@ int load(const std::string &filename, OccupancyMap &map, SerialiseProgress *prog
     return err;
   }
 
+  if (!hasRegionIndex(version.version))
+  {
+    // Older versions compress everything after the header as a single stream.
+    stream.setCompressedFlag();
+  }
+
   err = kSeUnsupportedVersion;
+  bool regions_filtered = false;
+  bool layers_filtered = false;
   if (version.marker == 0 || version.version.major == 0 && version.version.minor == 0)
   {
     err = v0::load(stream, detail, progress, version.version, region_count);
@@ -699,15 +1123,156 @@ int load(const std::string &filename, OccupancyMap &map, SerialiseProgress *prog
     {
       err = v0_5::load(stream, detail, progress, version.version, region_count);
     }
+    else if (version.version.major == 0 && version.version.minor == 6)
+    {
+      // Only the selected region blocks are read.
+      err = v0_6::load(stream, detail, progress, version.version, region_count, filter);
+      regions_filtered = true;
+    }
+    else if (version.version.major == 0 && version.version.minor == 7)
+    {
+      // Only the selected region blocks and layers are read.
+      err = v0_7::load(stream, detail, progress, version.version, region_count, filter, preserve_layers);
+      regions_filtered = layers_filtered = true;
+    }
+  }
+
+  if (!err && filter && !regions_filtered)
+  {
+    // No region index. Everything has been loaded, so remove the regions which have not been selected.
+    for (auto region_iter = detail.chunks.begin(); region_iter != detail.chunks.end();)
+    {
+      if (!filter(region_iter->first))
+      {
+        MapChunk *chunk = region_iter->second;
+        region_iter = detail.removeChunk(region_iter);
+        delete chunk;
+      }
+      else
+      {
+        ++region_iter;
+      }
+    }
+  }
+
+  if (!err && preserve_layers)
+  {
+    if (!layers_filtered)
+    {
+      // Older versions store layers interleaved within each region. Drop the unwanted layers after loading.
+      MapLayout layout = detail.layout;
+      layout.filterLayers(*preserve_layers);
+      map.updateLayout(layout);
+    }
+
+    // Correct the voxel mean flag for the filtered layout.
+    if (detail.layout.meanLayer() >= 0)
+    {
+      detail.flags |= MapFlag::kVoxelMean;
+    }
+    else
+    {
+      detail.flags &= ~MapFlag::kVoxelMean;
+    }
   }
 
   return err;
 }
 
 
-int loadHeader(const std::string &filename, OccupancyMap &map, MapVersion *version_out, size_t *region_count)
+int load(const std::string &filename, OccupancyMap &map, SerialiseProgress *progress, MapVersion *version_out)
+{
+  InputStream stream(filename);
+  return loadFiltered(stream, map, progress, version_out, RegionFilterFunc());
+}
+
+
+int load(const uint8_t *buffer, size_t byte_count, OccupancyMap &map, SerialiseProgress *progress,
+         MapVersion *version_out)
+{
+  InputStream stream;
+  stream.openBuffer(buffer, byte_count);
+  return loadFiltered(stream, map, progress, version_out, RegionFilterFunc());
+}
+
+
+int loadLayers(const std::string &filename, OccupancyMap &map, const std::vector<std::string> &preserve_layers,
+               SerialiseProgress *progress, MapVersion *version_out)
+{
+  InputStream stream(filename);
+  return loadFiltered(stream, map, progress, version_out, RegionFilterFunc(), &preserve_layers);
+}
+
+
+int loadLayers(const uint8_t *buffer, size_t byte_count, OccupancyMap &map,
+               const std::vector<std::string> &preserve_layers, SerialiseProgress *progress, MapVersion *version_out)
+{
+  InputStream stream;
+  stream.openBuffer(buffer, byte_count);
+  return loadFiltered(stream, map, progress, version_out, RegionFilterFunc(), &preserve_layers);
+}
+
+
+int loadRegionBlock(OccupancyMap &map, const uint8_t *block, size_t block_size)
+{
+  OccupancyMapDetail &detail = *map.detail();
+  std::unique_ptr<MapChunk> chunk(new MapChunk(detail));
+  const int err = v0_7::loadChunk(block, block_size, *chunk, detail);
+  if (err)
+  {
+    return err;
+  }
+
+  // Replace any existing region.
+  std::unique_lock<decltype(detail.mutex)> guard(detail.mutex);
+  const auto existing = detail.chunks.find(chunk->region.coord);
+  if (existing != detail.chunks.end())
+  {
+    if (detail.gpu_cache)
+    {
+      detail.gpu_cache->remove(existing->first);
+    }
+    MapChunk *old_chunk = existing->second;
+    detail.removeChunk(existing);
+    delete old_chunk;
+  }
+  // The region content is replaced without touching the map.
+  chunk->created_stamp = detail.stamp + 1;
+  detail.addChunk(chunk.release());
+
+  return kSeOk;
+}
+
+
+int loadRegions(const std::string &filename, OccupancyMap &map, const Aabb &extents, SerialiseProgress *progress,
+                MapVersion *version_out)
+{
+  // The filter is invoked after the header has been loaded into the map detail.
+  const OccupancyMapDetail &detail = *map.detail();
+  const auto filter = [&detail, &extents](const glm::i16vec3 &region_coord) {
+    const glm::dvec3 region_centre = detail.origin + glm::dvec3(region_coord) * detail.region_spatial_dimensions;
+    return extents.overlaps(Aabb::fromCentreFullExtents(region_centre, detail.region_spatial_dimensions));
+  };
+  InputStream stream(filename);
+  return loadFiltered(stream, map, progress, version_out, filter);
+}
+
+
+int loadRegions(const std::string &filename, OccupancyMap &map, const std::vector<glm::i16vec3> &regions,
+                SerialiseProgress *progress, MapVersion *version_out)
+{
+  const std::unordered_set<glm::i16vec3, Vector3Hash<glm::i16vec3>> region_set(regions.begin(), regions.end());
+  const auto filter = [&region_set](const glm::i16vec3 &region_coord) {
+    return region_set.find(region_coord) != region_set.end();
+  };
+  InputStream stream(filename);
+  return loadFiltered(stream, map, progress, version_out, filter);
+}
+
+
+/// Load the header, @c MapInfo and layout of a map from @p stream . See @c loadHeader() .
+int loadHeaderAndLayout(InputStream &stream, OccupancyMap &map, MapVersion *version_out, size_t *region_count)
 {
-  InputStream stream(filename, kSfCompress);
   OccupancyMapDetail &detail = *map.detail();
 
   if (!stream.isOpen())
@@ -726,6 +1291,12 @@ int loadHeader(const std::string &filename, OccupancyMap &map, MapVersion *versi
     *version_out = version.version;
   }
 
+  if (!err && !hasRegionIndex(version.version))
+  {
+    // Older versions compress everything after the header as a single stream.
+    stream.setCompressedFlag();
+  }
+
   // From version 0.2 we have MapInfo.
   detail.info.clear();
   if (version.version.major > 0 || version.version.minor > 1)
@@ -771,4 +1342,19 @@ int loadHeader(const std::string &filename, OccupancyMap &map, MapVersion *versi
   return err;
 }
 
+
+int loadHeader(const std::string &filename, OccupancyMap &map, MapVersion *version_out, size_t *region_count)
+{
+  InputStream stream(filename);
+  return loadHeaderAndLayout(stream, map, version_out, region_count);
+}
+
+
+int loadHeader(const uint8_t *buffer, size_t byte_count, OccupancyMap &map, MapVersion *version_out,
+               size_t *region_count)
+{
+  InputStream stream;
+  stream.openBuffer(buffer, byte_count);
+  return loadHeaderAndLayout(stream, map, version_out, region_count);
+}
 }  // namespace ohm
@@ -11,7 +11,9 @@
 #include <glm/fwd.hpp>
 
 #include <cinttypes>
+#include <functional>
 #include <string>
+#include <vector>
 
 #ifdef major
 #undef major
@@ -25,6 +27,7 @@
 
 namespace ohm
 {
+class Aabb;
 class OccupancyMap;
 
 /// An enumeration of potential serialisation errors.
@@ -193,6 +196,83 @@ void ohm_API registerSerialiseExtensionErrorCodeString(int err, const char *erro
 /// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
 int ohm_API save(const std::string &filename, const OccupancyMap &map, SerialiseProgress *progress = nullptr);
 
+/// Save @p map to a memory @p buffer instead of a file.
+///
+/// The @p buffer content is replaced by exactly the bytes which @c save() writes to file, including the header,
+/// @c MapInfo and layout, and may be loaded using the @c load() buffer overload or written to file as is.
+///
+/// @param[out] buffer The buffer to save to.
+/// @param map The map to save.
+/// @param progress Optional progress tracking object.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API save(std::vector<uint8_t> &buffer, const OccupancyMap &map, SerialiseProgress *progress = nullptr);
+
+/// Callback used by @c saveRegionBlocks() to receive the serialised block for a single region.
+///
+/// The block is the independently encoded region content, identical to the region block in a saved map file. The
+/// voxel data are held in compressed form. The @p block memory is only valid for the duration of the call. Return
+/// false to abort serialisation.
+///
+/// Parameters are: the region coordinate, the block and the block size in bytes.
+using SerialiseRegionFunc = std::function<bool(const glm::i16vec3 &, const uint8_t *, size_t)>;
+
+/// Serialise the regions of @p map one at a time, passing each compressed region block to @p region_func .
+///
+/// This supports streaming a map to a remote consumer without writing to file. The consumer first loads the map
+/// header and layout, for example using the @c load() or @c loadHeader() buffer overloads, then adds each region block
+/// using @c loadRegionBlock() . Regions are compressed in parallel when threads are enabled, but @p region_func is
+/// always called on the calling thread in a deterministic order.
+///
+/// @param map The map to serialise.
+/// @param region_func Function receiving each region block.
+/// @param progress Optional progress tracking object.
+/// @return @c SE_OK on success, @c kSeFileWriteFailure if @p region_func aborts, or another non zero
+///   @c SerialisationError on failure.
+int ohm_API saveRegionBlocks(const OccupancyMap &map, const SerialiseRegionFunc &region_func,
+                             SerialiseProgress *progress = nullptr);
+
+/// Serialise the specified @p regions of @p map one at a time, passing each to @p region_func . Regions not present in
+/// @p map are skipped. See the overload serialising all regions.
+///
+/// @param map The map to serialise.
+/// @param regions The coordinates of the regions to serialise.
+/// @param region_func Function receiving each region block.
+/// @param progress Optional progress tracking object.
+/// @return @c SE_OK on success, @c kSeFileWriteFailure if @p region_func aborts, or another non zero
+///   @c SerialisationError on failure.
+int ohm_API saveRegionBlocks(const OccupancyMap &map, const std::vector<glm::i16vec3> &regions,
+                             const SerialiseRegionFunc &region_func, SerialiseProgress *progress = nullptr);
+
+/// Incrementally save @p map to @p filename , appending only the regions changed since the file was last written.
+///
+/// This supports periodic checkpointing of a growing map at a cost proportional to the changes rather than the map
+/// size. The file is treated as an append-only journal: regions whose @c MapChunk::dirty_stamp or
+/// @c MapChunk::created_stamp exceeds the map stamp recorded in the file are appended as new region blocks, followed by
+/// a new region index. Regions created after the last @c OccupancyMap::touch() are rewritten by each save until the map
+/// is touched again, as they cannot be distinguished from regions created after the save. The new index references the
+/// appended blocks along with the existing blocks of unchanged regions, and regions no longer in the map are dropped
+/// from the index. The index offset is then patched and flushed, and the header with the new map stamp is written and
+/// flushed last, so the previous state of the file remains loadable until the append completes and the stamp is never
+/// ahead of the committed index. Loading the file replays the journal by following the latest index to the latest block
+/// for each region.
+///
+/// Superseded blocks and indices become dead space in the file. The file is compacted by rewriting it with @c save()
+/// once the dead space exceeds @p compaction_ratio times the size of the reused region blocks. A full @c save() is also
+/// made when the file does not exist, is not the current format version, or does not match the map resolution, origin,
+/// region dimensions, @c MapInfo or layout. Calling @c save() always compacts the file.
+///
+/// The file header records an identity for the map which wrote it. A map loaded from the file adopts that identity so
+/// it may continue the journal, while any other map makes a full @c save() rather than appending to a journal whose
+/// region blocks it did not write.
+///
+/// @param filename The name of the file to save to.
+/// @param map The map to save.
+/// @param progress Optional progress tracking object.
+/// @param compaction_ratio The ratio of dead space to reused region data at which to compact the file.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API saveIncremental(const std::string &filename, const OccupancyMap &map, SerialiseProgress *progress = nullptr,
+                            double compaction_ratio = 1.0);
+
 /// Load @p map from @p filename.
 ///
 /// This method loads an @c OccupancyMap from file. The progress may optionally be tracked by providing
@@ -209,6 +289,92 @@ int ohm_API save(const std::string &filename, const OccupancyMap &map, Serialise
 int ohm_API load(const std::string &filename, OccupancyMap &map, SerialiseProgress *progress = nullptr,
                  MapVersion *version_out = nullptr);
 
+/// Load @p map from a memory @p buffer holding the content of a map file, such as one written by the @c save() buffer
+/// overload.
+///
+/// Data are read directly from @p buffer without copying the buffer. The current content of @p map is overwritten by
+/// the loaded data.
+///
+/// @param buffer The buffer to load from.
+/// @param byte_count The number of bytes in @p buffer .
+/// @param map The map object to load into.
+/// @param progress Optional progress tracking object.
+/// @param[out] version_out When present, set to the version number of the loaded map format.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API load(const uint8_t *buffer, size_t byte_count, OccupancyMap &map, SerialiseProgress *progress = nullptr,
+                 MapVersion *version_out = nullptr);
+
+/// Load @p map from @p filename keeping only the layers named in @p preserve_layers . The loaded layout is filtered
+/// as for @c MapLayout::filterLayers() .
+///
+/// Other layers are never allocated. From version 0.7 onwards, their data are skipped without decompression, so loading
+/// a subset of a map with many layers costs only the time and memory of the selected layers. Older versions are fully
+/// loaded before the layout is filtered.
+///
+/// @param filename The file to load from.
+/// @param map The map object to load into.
+/// @param preserve_layers Names of the layers to load. Unknown names are ignored.
+/// @param progress Optional progress tracking object.
+/// @param[out] version_out When present, set to the version number of the loaded map format.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API loadLayers(const std::string &filename, OccupancyMap &map, const std::vector<std::string> &preserve_layers,
+                       SerialiseProgress *progress = nullptr, MapVersion *version_out = nullptr);
+
+/// Load @p map from a memory @p buffer keeping only the layers named in @p preserve_layers . See the file overload.
+///
+/// @param buffer The buffer to load from.
+/// @param byte_count The number of bytes in @p buffer .
+/// @param map The map object to load into.
+/// @param preserve_layers Names of the layers to load. Unknown names are ignored.
+/// @param progress Optional progress tracking object.
+/// @param[out] version_out When present, set to the version number of the loaded map format.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API loadLayers(const uint8_t *buffer, size_t byte_count, OccupancyMap &map,
+                       const std::vector<std::string> &preserve_layers, SerialiseProgress *progress = nullptr,
+                       MapVersion *version_out = nullptr);
+
+/// Add a single region to @p map from a region block as produced by @c saveRegionBlocks() .
+///
+/// Any existing region at the same coordinate is replaced. The layout of @p map must match the map the block was
+/// serialised from. The compressed voxel data are adopted without decompression. This function is not threadsafe with
+/// respect to other access to @p map .
+///
+/// @param map The map object to load into.
+/// @param block The region block.
+/// @param block_size The size of @p block in bytes.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API loadRegionBlock(OccupancyMap &map, const uint8_t *block, size_t block_size);
+
+/// Load the regions of @p map from @p filename which overlap @p extents.
+///
+/// From version 0.6, map files store each region as an independently compressed block along with a region index. Only
+/// the blocks for the overlapping regions are read and decompressed, making this much faster than a full @c load() for
+/// large maps. Older map versions are fully loaded, then the regions which do not overlap @p extents are discarded.
+///
+/// The current content of @p map is overwritten by the loaded data.
+///
+/// @param filename The name of the file to load from.
+/// @param map The map object to load into.
+/// @param extents The spatial extents to load in global map coordinates. Regions overlapping these extents are loaded.
+/// @param progress Optional progress tracking object.
+/// @param[out] version_out When present, set to the version number of the loaded map format.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API loadRegions(const std::string &filename, OccupancyMap &map, const Aabb &extents,
+                        SerialiseProgress *progress = nullptr, MapVersion *version_out = nullptr);
+
+/// Load the specified @p regions of @p map from @p filename.
+///
+/// As the @c Aabb overload, but selecting regions by region coordinate. Regions not present in the file are ignored.
+///
+/// @param filename The name of the file to load from.
+/// @param map The map object to load into.
+/// @param regions The coordinates of the regions to load.
+/// @param progress Optional progress tracking object.
+/// @param[out] version_out When present, set to the version number of the loaded map format.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API loadRegions(const std::string &filename, OccupancyMap &map, const std::vector<glm::i16vec3> &regions,
+                        SerialiseProgress *progress = nullptr, MapVersion *version_out = nullptr);
+
 /// Loads the header and layers of a map file without loading the chunks for voxel data.
 ///
 /// The resulting @p map contains no chunks or voxel data, but does contain valid @c MapLayout data.
@@ -223,6 +389,18 @@ int ohm_API load(const std::string &filename, OccupancyMap &map, SerialiseProgre
 /// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
 int ohm_API loadHeader(const std::string &filename, OccupancyMap &map, MapVersion *version_out = nullptr,
                        size_t *region_count = nullptr);
+
+/// Loads the header and layers of a map from a memory @p buffer without loading the chunks for voxel data. See the
+/// file overload.
+///
+/// @param buffer The buffer to load from. Need only contain the header, @c MapInfo and layout.
+/// @param byte_count The number of bytes in @p buffer .
+/// @param map The map object to load into.
+/// @param[out] version_out When present, set to the version number of the loaded map format.
+/// @param[out] region_count When present, set to the number of regions in the map. Regions are not loaded.
+/// @return @c SE_OK on success, or a non zero @c SerialisationError on failure.
+int ohm_API loadHeader(const uint8_t *buffer, size_t byte_count, OccupancyMap &map, MapVersion *version_out = nullptr,
+                       size_t *region_count = nullptr);
 }  // namespace ohm
 
 #endif  // OHM_MAPSERIALISE_H
@@ -14,6 +14,7 @@
 #include "Key.h"
 #include "MapChunk.h"
 #include "OccupancyMap.h"
+#include "OccupancyMask.h"
 #include "QueryFlag.h"
 #include "VoxelBlock.h"
 #include "VoxelBuffer.h"
@@ -37,11 +38,13 @@ unsigned regionNearestNeighboursCpu(OccupancyMap &map, NearestNeighboursDetail &
 {
   const float invalid_occupancy_value = unobservedOccupancyValue();
   const OccupancyMapDetail &map_data = *map.detail();
-  const auto chunk_search = map_data.chunks.find(region_key);
+  const MapChunk *region_chunk = map_data.findChunk(region_key);
   glm::vec3 query_origin;
   glm::vec3 voxel_vector;
   Key voxel_key(nullptr);
   const MapChunk *chunk = nullptr;
+  const MapChunk *mask_chunk = nullptr;
+  const int mask_layer = occupancyMaskLayer(map);
   const uint8_t *occupancy_mem = nullptr;
   float range_squared = 0;
   unsigned added = 0;
@@ -51,7 +54,7 @@ unsigned regionNearestNeighboursCpu(OccupancyMap &map, NearestNeighboursDetail &
 
   query_origin = glm::vec3(query.near_point - map.origin());
 
-  if (chunk_search == map_data.chunks.end())
+  if (!region_chunk)
   {
     // The entire region is unknown space...
     if ((query.query_flags & ohm::kQfUnknownAsOccupied) == 0)
@@ -67,9 +70,14 @@ unsigned regionNearestNeighboursCpu(OccupancyMap &map, NearestNeighboursDetail &
     // Setup voxel occupancy test function to pass all voxels in this region.
     voxel_occupied_func = [](const float /*voxel*/, const OccupancyMapDetail & /*map_data*/) -> bool { return true; };
   }
+  else if (mask_layer >= 0 && occupancyMaskUpToDate(*region_chunk, map_data.layout.occupancyLayer(), mask_layer))
+  {
+    // The occupancy mask is up to date. Scan it instead of the occupancy layer.
+    mask_chunk = region_chunk;
+  }
   else
   {
-    chunk = chunk_search->second;
+    chunk = region_chunk;
     // FIXME: (KS) This is a bit of a mix of legacy direct voxel access and newer VoxelBlock access. Makes things a
     // bit unclear.
     voxel_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[chunk->layout().occupancyLayer()]);
@@ -92,62 +100,96 @@ unsigned regionNearestNeighboursCpu(OccupancyMap &map, NearestNeighboursDetail &
   // TES_BOX_W(g_tes, TES_COLOUR(LightSeaGreen), 0u,
   //           glm::value_ptr(region_centre), glm::value_ptr(map.regionSpatialResolution()));
 
-  float occupancy;
-  for (int z = 0; z < map_data.region_voxel_dimensions.z; ++z)
-  {
-    for (int y = 0; y < map_data.region_voxel_dimensions.y; ++y)
+  // Add the voxel_key if it lies within the search radius.
+  const auto add_voxel = [&](bool observed) {
+    // Occupied voxel, or invalid voxel to be treated as occupied.
+    // Calculate range to centre.
+    voxel_vector = map.voxelCentreLocal(voxel_key);
+    voxel_vector -= query_origin;
+    range_squared = glm::dot(voxel_vector, voxel_vector);
+    if (range_squared <= query.search_radius * query.search_radius)
     {
-      for (int x = 0; x < map_data.region_voxel_dimensions.x; ++x)
-      {
-        memcpy(&occupancy, occupancy_mem, sizeof(float));
-        if (voxel_occupied_func(occupancy, map_data))
-        {
-          // Occupied voxel, or invalid voxel to be treated as occupied.
-          // Calculate range to centre.
-          voxel_key = Key(region_key, x, y, z);
-          voxel_vector = map.voxelCentreLocal(voxel_key);
-          voxel_vector -= query_origin;
-          range_squared = glm::dot(voxel_vector, voxel_vector);
-          if (range_squared <= query.search_radius * query.search_radius)
-          {
-            query.intersected_voxels.push_back(voxel_key);
-            query.ranges.push_back(std::sqrt(range_squared));
+      query.intersected_voxels.push_back(voxel_key);
+      query.ranges.push_back(std::sqrt(range_squared));
 
-            if (range_squared < closest.range)
-            {
-              closest.index = query.intersected_voxels.size() - 1;
-              closest.range = range_squared;
-            }
+      if (range_squared < closest.range)
+      {
+        closest.index = query.intersected_voxels.size() - 1;
+        closest.range = range_squared;
+      }
 
-            ++added;
+      ++added;
 #ifdef TES_ENABLE
-            if (occupancy != unobservedOccupancyValue())
-            {
-              includedOccupied.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
-            }
-            else
-            {
-              includedUncertain.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
-            }
+      if (observed)
+      {
+        includedOccupied.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
+      }
+      else
+      {
+        includedUncertain.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
+      }
 #endif  // TES_ENABLE
-          }
+    }
 #ifdef TES_ENABLE
-          else
+    else
+    {
+      if (observed)
+      {
+        excludedOccupied.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
+      }
+      else
+      {
+        excludedUncertain.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
+      }
+    }
+#endif  // TES_ENABLE
+    (void)observed;
+  };
+
+  if (mask_chunk)
+  {
+    // Scan the occupancy mask, visiting only the voxels of interest.
+    const bool unknown_as_occupied = (query.query_flags & ohm::kQfUnknownAsOccupied) != 0;
+    if (mask_chunk->occupied_voxel_count > 0 || unknown_as_occupied)
+    {
+      VoxelBuffer<const VoxelBlock> mask_buffer(mask_chunk->voxel_blocks[mask_layer]);
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      const auto *mask = reinterpret_cast<const OccupancyMaskVoxel *>(mask_buffer.voxelMemory());
+      const glm::ivec3 &dim = map_data.region_voxel_dimensions;
+      visitOccupancyMaskBits(
+        mask, mask_buffer.voxelMemorySize() / sizeof(OccupancyMaskVoxel),
+        [unknown_as_occupied](const OccupancyMaskVoxel &m) {
+          return m.occupied | ((unknown_as_occupied) ? ~m.observed : uint64_t(0u));
+        },
+        [&](unsigned voxel_index) {
+          const unsigned x = voxel_index % unsigned(dim.x);
+          const unsigned y = (voxel_index / unsigned(dim.x)) % unsigned(dim.y);
+          const unsigned z = voxel_index / unsigned(dim.x * dim.y);
+          voxel_key = Key(region_key, uint8_t(x), uint8_t(y), uint8_t(z));
+          add_voxel((mask[voxel_index / kOccupancyMaskVoxelBits].observed >>
+                     (voxel_index % kOccupancyMaskVoxelBits)) & 1u);
+        });
+    }
+  }
+  else
+  {
+    float occupancy;
+    for (int z = 0; z < map_data.region_voxel_dimensions.z; ++z)
+    {
+      for (int y = 0; y < map_data.region_voxel_dimensions.y; ++y)
+      {
+        for (int x = 0; x < map_data.region_voxel_dimensions.x; ++x)
+        {
+          memcpy(&occupancy, occupancy_mem, sizeof(float));
+          if (voxel_occupied_func(occupancy, map_data))
           {
-            if (occupancy != unobservedOccupancyValue())
-            {
-              excludedOccupied.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
-            }
-            else
-            {
-              excludedUncertain.emplace_back(tes::Vector3d(glm::value_ptr(map.voxelCentreGlobal(voxel_key))));
-            }
+            voxel_key = Key(region_key, x, y, z);
+            add_voxel(occupancy != unobservedOccupancyValue());
           }
-#endif  // TES_ENABLE
-        }
 
-        // Next voxel. Leave pointer as is (pointing to invalid_occupancy_value) if the chunk is invalid.
-        occupancy_mem += (chunk != nullptr) ? sizeof(occupancy) : 0;
+          // Next voxel. Leave pointer as is (pointing to invalid_occupancy_value) if the chunk is invalid.
+          occupancy_mem += (chunk != nullptr) ? sizeof(occupancy) : 0;
+        }
       }
     }
   }
@@ -0,0 +1,209 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OccupancyLod.h"
+
+#include "DefaultLayer.h"
+#include "Key.h"
+#include "MapChunk.h"
+#include "MapLayer.h"
+#include "MapLayout.h"
+#include "OccupancyMap.h"
+#include "VoxelBuffer.h"
+#include "VoxelOccupancy.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+namespace ohm
+{
+namespace
+{
+/// Accumulate @p src into the LOD cell @p dst .
+inline void accumulateLod(OccupancyLodVoxel &dst, const OccupancyLodVoxel &src)
+{
+  dst.unobserved_count += src.unobserved_count;
+  if (src.occupancy != unobservedOccupancyValue())
+  {
+    dst.occupancy =
+      (dst.occupancy != unobservedOccupancyValue()) ? std::max(dst.occupancy, src.occupancy) : src.occupancy;
+  }
+}
+
+
+/// Reduce the occupancy layer of @p chunk into level 1 LOD cells.
+void reduceOccupancy(const MapChunk &chunk, int occupancy_layer, const glm::ivec3 &region_dim,
+                     std::vector<OccupancyLodVoxel> &cells)
+{
+  const glm::ivec3 cell_dim = region_dim / 2;
+  cells.assign(size_t(cell_dim.x) * size_t(cell_dim.y) * size_t(cell_dim.z),
+               OccupancyLodVoxel{ unobservedOccupancyValue(), 0u });
+
+  VoxelBuffer<const VoxelBlock> occupancy_buffer(chunk.voxel_blocks[occupancy_layer]);
+  const uint8_t *occupancy_mem = occupancy_buffer.voxelMemory();
+  float occupancy;
+  unsigned voxel_index = 0;
+  for (int z = 0; z < region_dim.z; ++z)
+  {
+    for (int y = 0; y < region_dim.y; ++y)
+    {
+      for (int x = 0; x < region_dim.x; ++x, ++voxel_index)
+      {
+        memcpy(&occupancy, occupancy_mem + voxel_index * sizeof(occupancy), sizeof(occupancy));
+        OccupancyLodVoxel &cell =
+          cells[voxelIndex(unsigned(x / 2), unsigned(y / 2), unsigned(z / 2), cell_dim.x, cell_dim.y, cell_dim.z)];
+        accumulateLod(cell, OccupancyLodVoxel{ occupancy, (occupancy == unobservedOccupancyValue()) ? 1u : 0u });
+      }
+    }
+  }
+}
+
+
+/// Reduce the LOD @p cells with dimensions @p cell_dim to the next level, updating both arguments.
+void reduceLod(std::vector<OccupancyLodVoxel> &cells, glm::ivec3 &cell_dim)
+{
+  const glm::ivec3 next_dim = cell_dim / 2;
+  std::vector<OccupancyLodVoxel> next_cells(size_t(next_dim.x) * size_t(next_dim.y) * size_t(next_dim.z),
+                                            OccupancyLodVoxel{ unobservedOccupancyValue(), 0u });
+  unsigned cell_index = 0;
+  for (int z = 0; z < cell_dim.z; ++z)
+  {
+    for (int y = 0; y < cell_dim.y; ++y)
+    {
+      for (int x = 0; x < cell_dim.x; ++x, ++cell_index)
+      {
+        accumulateLod(
+          next_cells[voxelIndex(unsigned(x / 2), unsigned(y / 2), unsigned(z / 2), next_dim.x, next_dim.y, next_dim.z)],
+          cells[cell_index]);
+      }
+    }
+  }
+  cells.swap(next_cells);
+  cell_dim = next_dim;
+}
+}  // namespace
+
+
+int occupancyLodLayer(const OccupancyMap &map, unsigned level)
+{
+  const char *layer_name = default_layer::occupancyLodLayerName(level);
+  const MapLayer *layer = (layer_name) ? map.layout().layer(layer_name) : nullptr;
+  if (!layer || layer->subsampling() != level || layer->voxelByteSize() != sizeof(OccupancyLodVoxel))
+  {
+    return -1;
+  }
+
+  // Region dimensions must be divisible by the cell size.
+  const glm::ivec3 region_dim = map.regionVoxelDimensions();
+  const int cell_size = 1 << level;
+  if (region_dim.x % cell_size || region_dim.y % cell_size || region_dim.z % cell_size)
+  {
+    return -1;
+  }
+
+  return int(layer->layerIndex());
+}
+
+
+bool occupancyLodUpToDate(const MapChunk &chunk, int occupancy_layer, int lod_layer)
+{
+  return chunk.touched_stamps[lod_layer] >= chunk.touched_stamps[occupancy_layer];
+}
+
+
+bool updateOccupancyLod(const OccupancyMap &map, MapChunk &chunk, bool force)
+{
+  const int occupancy_layer = map.layout().occupancyLayer();
+  if (occupancy_layer < 0 || map.layout().layer(occupancy_layer).voxelByteSize() != sizeof(float))
+  {
+    return false;
+  }
+
+  // Resolve the valid LOD layers and whether any need updating.
+  std::array<int, kOccupancyLodMaxLevel + 1> lod_layers{};
+  unsigned max_level = 0;
+  bool dirty = force;
+  for (unsigned level = 1; level <= kOccupancyLodMaxLevel; ++level)
+  {
+    lod_layers[level] = occupancyLodLayer(map, level);
+    if (lod_layers[level] >= 0)
+    {
+      max_level = level;
+      dirty = dirty || !occupancyLodUpToDate(chunk, occupancy_layer, lod_layers[level]);
+    }
+  }
+
+  if (max_level == 0 || !dirty)
+  {
+    return false;
+  }
+
+  // Capture the stamp before reading the occupancy values.
+  const uint64_t occupancy_stamp = chunk.touched_stamps[occupancy_layer];
+
+  // Reduce one level at a time, writing the levels present in the layout. Levels absent from the layout are still
+  // calculated as intermediate results.
+  const glm::ivec3 region_dim = map.regionVoxelDimensions();
+  std::vector<OccupancyLodVoxel> cells;
+  glm::ivec3 cell_dim = region_dim / 2;
+  reduceOccupancy(chunk, occupancy_layer, region_dim, cells);
+  for (unsigned level = 1; level <= max_level; ++level)
+  {
+    if (level > 1)
+    {
+      reduceLod(cells, cell_dim);
+    }
+
+    if (lod_layers[level] >= 0)
+    {
+      VoxelBuffer<VoxelBlock> lod_buffer(chunk.voxel_blocks[lod_layers[level]]);
+      if (lod_buffer.voxelMemorySize() == cells.size() * sizeof(OccupancyLodVoxel))
+      {
+        memcpy(lod_buffer.voxelMemory(), cells.data(), lod_buffer.voxelMemorySize());
+        chunk.touched_stamps[lod_layers[level]] = occupancy_stamp;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+bool occupancyLodVoxel(const OccupancyMap &map, const Key &key, unsigned level, OccupancyLodVoxel *voxel)
+{
+  const int lod_layer = occupancyLodLayer(map, level);
+  const int occupancy_layer = map.layout().occupancyLayer();
+  if (lod_layer < 0 || occupancy_layer < 0 || key.isNull())
+  {
+    return false;
+  }
+
+  const MapChunk *chunk = map.region(key.regionKey());
+  if (!chunk || !occupancyLodUpToDate(*chunk, occupancy_layer, lod_layer))
+  {
+    return false;
+  }
+
+  const glm::ivec3 cell_dim = glm::ivec3(map.regionVoxelDimensions()) / (1 << level);
+  const glm::ivec3 cell_key = glm::ivec3(key.localKey()) / (1 << level);
+  VoxelBuffer<const VoxelBlock> lod_buffer(chunk->voxel_blocks[lod_layer]);
+  lod_buffer.readVoxel(voxelIndex(unsigned(cell_key.x), unsigned(cell_key.y), unsigned(cell_key.z), cell_dim.x,
+                                  cell_dim.y, cell_dim.z),
+                       voxel);
+  return true;
+}
+
+
+OccupancyType occupancyLodType(const OccupancyLodVoxel &voxel, float occupancy_threshold_value)
+{
+  if (voxel.occupancy != unobservedOccupancyValue() && voxel.occupancy >= occupancy_threshold_value)
+  {
+    return kOccupied;
+  }
+  return (voxel.unobserved_count == 0) ? kFree : kUnobserved;
+}
+}  // namespace ohm
@@ -0,0 +1,105 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_OCCUPANCYLOD_H
+#define OHM_OCCUPANCYLOD_H
+
+#include "OhmConfig.h"
+
+#include "OccupancyType.h"
+
+#include <cstdint>
+
+namespace ohm
+{
+class Key;
+class OccupancyMap;
+struct MapChunk;
+
+/// Maximum level of detail supported for the occupancy level of detail layers. Level 4 covers 16^3 voxels per cell.
+const unsigned kOccupancyLodMaxLevel = 4u;
+
+/// Voxel structure of an occupancy level of detail layer. See @c addOccupancyLod() .
+///
+/// An occupancy level of detail (LOD) layer summarises the occupancy layer at a reduced resolution. Each LOD voxel, or
+/// cell, at level @c L covers `2^L` voxels along each axis. The cell records the maximum occupancy value of the
+/// observed voxels it covers along with the number of unobserved voxels it covers. This supports conservative
+/// reasoning at the coarse level:
+/// - The cell contains an occupied voxel if @c occupancy reaches the occupancy threshold.
+/// - The cell is entirely free when it has no unobserved voxels and @c occupancy is below the threshold.
+/// - The cell is entirely unobserved when @c unobserved_count matches the cell volume.
+///
+/// Any other cell must be resolved at a finer level.
+struct OccupancyLodVoxel
+{
+  /// Maximum occupancy value of the observed voxels in the cell, or @c unobservedOccupancyValue() when all voxels are
+  /// unobserved.
+  float occupancy;
+  /// Number of unobserved voxels in the cell.
+  uint32_t unobserved_count;
+};
+
+/// Query the number of voxels covered by an occupancy LOD cell at @p level .
+/// @param level The level of detail.
+/// @return The number of voxels in a cell at @p level .
+inline unsigned occupancyLodCellVolume(unsigned level)
+{
+  return 1u << (3u * level);
+}
+
+/// Resolve the layer index of the occupancy LOD layer at @p level in @p map .
+///
+/// The layer is only valid when present in the map layout and the map region dimensions are exactly divisible by the
+/// cell size along each axis.
+///
+/// @param map The map of interest.
+/// @param level The level of detail.
+/// @return The layer index or -1 if there is no valid layer at @p level .
+int ohm_API occupancyLodLayer(const OccupancyMap &map, unsigned level);
+
+/// Check whether the occupancy LOD layers of @p chunk are up to date with the occupancy layer.
+/// @param chunk The region of interest.
+/// @param occupancy_layer The occupancy layer index.
+/// @param lod_layer The occupancy LOD layer index.
+/// @return True if the LOD layer is up to date.
+bool ohm_API occupancyLodUpToDate(const MapChunk &chunk, int occupancy_layer, int lod_layer);
+
+/// Recalculate the occupancy LOD layers of @p chunk from the occupancy layer. All valid LOD layers in the map are
+/// updated, with each level reduced from the level below.
+///
+/// The LOD layer @c MapChunk::touched_stamps are set to match the occupancy layer on completion. The call is threadsafe
+/// so long as different @p chunk objects are processed on each thread and the occupancy layer is not being modified.
+///
+/// @param map The map containing @p chunk .
+/// @param chunk The region to update.
+/// @param force True to update the LOD layers even when they are already up to date.
+/// @return True if the LOD layers were updated.
+bool ohm_API updateOccupancyLod(const OccupancyMap &map, MapChunk &chunk, bool force = false);
+
+/// Lookup the occupancy LOD cell containing the voxel @p key at the given @p level .
+///
+/// This fails if there is no valid layer at @p level , the region containing @p key does not exist, or the LOD layer
+/// is out of date.
+///
+/// @param map The map to query.
+/// @param key The key of a voxel at the map resolution.
+/// @param level The level of detail to query.
+/// @param[out] voxel Set to the LOD cell content on success.
+/// @return True on success.
+bool ohm_API occupancyLodVoxel(const OccupancyMap &map, const Key &key, unsigned level, OccupancyLodVoxel *voxel);
+
+/// Classify an occupancy LOD cell.
+///
+/// - @c kOccupied if any voxel in the cell is occupied.
+/// - @c kFree if all voxels in the cell are observed and free.
+/// - @c kUnobserved otherwise; the cell is partly or wholly unobserved.
+///
+/// @param voxel The LOD cell.
+/// @param occupancy_threshold_value The map occupancy threshold value. See @c OccupancyMap::occupancyThresholdValue() .
+/// @return The cell classification.
+OccupancyType ohm_API occupancyLodType(const OccupancyLodVoxel &voxel, float occupancy_threshold_value);
+}  // namespace ohm
+
+#endif  // OHM_OCCUPANCYLOD_H
@@ -0,0 +1,228 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OccupancyLodProcess.h"
+
+#include "DefaultLayer.h"
+#include "MapChunk.h"
+#include "MapLayout.h"
+#include "OccupancyLod.h"
+#include "OccupancyMap.h"
+
+#ifdef OHM_THREADS
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif  // OHM_THREADS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace ohm
+{
+namespace
+{
+/// Number of regions processed in parallel between time checks in @c OccupancyLodProcess::update() .
+const size_t kRegionBatchSize = 64u;
+
+/// Update the LOD layers of @p chunks in the range `[begin, end)` .
+/// @return The number of regions updated.
+unsigned updateLodRange(const OccupancyMap &map, const std::vector<MapChunk *> &chunks, size_t begin, size_t end,
+                        bool force)
+{
+  unsigned updated = 0;
+  for (size_t i = begin; i < end; ++i)
+  {
+    updated += updateOccupancyLod(map, *chunks[i], force) ? 1u : 0u;
+  }
+  return updated;
+}
+
+
+/// Update the LOD layers of @p chunks in parallel where possible.
+/// @return The number of regions updated.
+unsigned updateLod(const OccupancyMap &map, const std::vector<MapChunk *> &chunks, bool force)
+{
+#ifdef OHM_THREADS
+  std::atomic_uint updated{ 0 };
+  const auto update_func = [&map, &chunks, &updated, force](const tbb::blocked_range<size_t> &range) {
+    updated += updateLodRange(map, chunks, range.begin(), range.end(), force);
+  };
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, chunks.size()), update_func);
+  return updated;
+#else   // OHM_THREADS
+  return updateLodRange(map, chunks, 0, chunks.size(), force);
+#endif  // OHM_THREADS
+}
+}  // namespace
+
+
+/// @c OccupancyLodProcess internals.
+struct OccupancyLodProcessDetail
+{
+  /// Number of LOD levels to maintain.
+  unsigned levels = OccupancyLodProcess::kDefaultLevels;
+  /// Regions pending update from @c OccupancyLodProcess::update() .
+  std::vector<glm::i16vec3> work;
+  /// Index of the next item in @c work to process.
+  size_t work_cursor = 0;
+
+  inline bool haveWork() const { return work_cursor < work.size(); }
+
+  inline void resetWorking()
+  {
+    work.clear();
+    work_cursor = 0;
+  }
+};
+
+
+OccupancyLodProcess::OccupancyLodProcess(unsigned levels)
+  : imp_(new OccupancyLodProcessDetail)
+{
+  setLevels(levels);
+}
+
+
+OccupancyLodProcess::~OccupancyLodProcess() = default;
+
+
+unsigned OccupancyLodProcess::levels() const
+{
+  return imp_->levels;
+}
+
+
+void OccupancyLodProcess::setLevels(unsigned levels)
+{
+  imp_->levels = std::min(levels, kOccupancyLodMaxLevel);
+}
+
+
+void OccupancyLodProcess::reset()
+{
+  imp_->resetWorking();
+}
+
+
+void OccupancyLodProcess::ensureOccupancyLodLayers(OccupancyMap &map, unsigned levels)
+{
+  const glm::ivec3 region_dim = map.regionVoxelDimensions();
+  levels = std::min(levels, kOccupancyLodMaxLevel);
+  std::unique_ptr<MapLayout> updated_layout;
+  for (unsigned level = 1; level <= levels; ++level)
+  {
+    const int cell_size = 1 << level;
+    if (region_dim.x % cell_size || region_dim.y % cell_size || region_dim.z % cell_size)
+    {
+      // Not supported by the region dimensions, nor are coarser levels.
+      break;
+    }
+
+    if (!map.layout().layer(default_layer::occupancyLodLayerName(level)))
+    {
+      if (!updated_layout)
+      {
+        // Duplicate the layout, add the layers and update the map, preserving the current map.
+        updated_layout.reset(new MapLayout(map.layout()));
+      }
+      addOccupancyLod(*updated_layout, level);
+    }
+  }
+
+  if (updated_layout)
+  {
+    map.updateLayout(*updated_layout, true);
+  }
+}
+
+
+int OccupancyLodProcess::update(OccupancyMap &map, double time_slice)
+{
+  OccupancyLodProcessDetail *d = imp_.get();
+  ensureOccupancyLodLayers(map, d->levels);
+
+  using Clock = std::chrono::high_resolution_clock;
+  const auto start_time = Clock::now();
+  double elapsed_sec = 0;
+
+  if (!d->haveWork())
+  {
+    // Fetch regions with out of date LOD layers.
+    d->resetWorking();
+    const int occupancy_layer = map.layout().occupancyLayer();
+    std::vector<int> lod_layers;
+    for (unsigned level = 1; level <= kOccupancyLodMaxLevel; ++level)
+    {
+      const int lod_layer = occupancyLodLayer(map, level);
+      if (lod_layer >= 0)
+      {
+        lod_layers.emplace_back(lod_layer);
+      }
+    }
+
+    if (occupancy_layer < 0 || lod_layers.empty())
+    {
+      return kMprUpToDate;
+    }
+
+    std::vector<const MapChunk *> chunks;
+    map.enumerateRegions(chunks);
+    for (const MapChunk *chunk : chunks)
+    {
+      for (int lod_layer : lod_layers)
+      {
+        if (!occupancyLodUpToDate(*chunk, occupancy_layer, lod_layer))
+        {
+          d->work.emplace_back(chunk->region.coord);
+          break;
+        }
+      }
+    }
+  }
+
+  unsigned total_processed = 0;
+  std::vector<MapChunk *> batch;
+  while (d->haveWork() && (time_slice <= 0 || elapsed_sec < time_slice))
+  {
+    const size_t batch_end = std::min(d->work_cursor + kRegionBatchSize, d->work.size());
+    batch.clear();
+    for (size_t i = d->work_cursor; i < batch_end; ++i)
+    {
+      // Regions may have been removed since the work list was built.
+      if (MapChunk *chunk = map.region(d->work[i], false))
+      {
+        batch.emplace_back(chunk);
+      }
+    }
+    d->work_cursor = batch_end;
+
+    total_processed += updateLod(map, batch, false);
+
+    const auto cur_time = Clock::now();
+    elapsed_sec = std::chrono::duration_cast<std::chrono::duration<double>>(cur_time - start_time).count();
+  }
+
+  return (total_processed != 0 || d->haveWork()) ? kMprProgressing : kMprUpToDate;
+}
+
+
+unsigned OccupancyLodProcess::calculateAll(OccupancyMap &map, bool force)
+{
+  ensureOccupancyLodLayers(map, imp_->levels);
+
+  std::vector<const MapChunk *> const_chunks;
+  map.enumerateRegions(const_chunks);
+  std::vector<MapChunk *> chunks;
+  chunks.reserve(const_chunks.size());
+  for (const MapChunk *chunk : const_chunks)
+  {
+    chunks.emplace_back(map.region(chunk->region.coord, false));
+  }
+
+  return updateLod(map, chunks, force);
+}
+}  // namespace ohm
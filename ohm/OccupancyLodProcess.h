@@ -0,0 +1,78 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_OCCUPANCYLODPROCESS_H
+#define OHM_OCCUPANCYLODPROCESS_H
+
+#include "OhmConfig.h"
+
+#include "MappingProcess.h"
+
+#include <memory>
+
+namespace ohm
+{
+struct OccupancyLodProcessDetail;
+class OccupancyMap;
+
+/// A @c MappingProcess which maintains the occupancy level of detail (LOD) pyramid of a map.
+///
+/// The process ensures the map has occupancy LOD layers for levels `[1, levels()]` (see @c addOccupancyLod() ) and
+/// incrementally updates them from the occupancy layer. Only regions whose occupancy layer has been touched since their
+/// LOD layers were last calculated are updated, and regions are processed in parallel when @c OHM_THREADS is enabled.
+///
+/// Levels are only added where the map region dimensions are divisible by the cell size of that level. For example,
+/// the default 32 voxel region dimensions support all levels up to @c kOccupancyLodMaxLevel .
+///
+/// The LOD layers are used by queries such as the @c RaysQuery to skip over large, uniform areas of the map. Such
+/// queries check each region's LOD layer is up to date and fall back to the full resolution occupancy layer otherwise.
+class ohm_API OccupancyLodProcess : public MappingProcess
+{
+public:
+  /// Default number of levels maintained by the process: 2x, 4x and 8x reductions.
+  static const unsigned kDefaultLevels = 3u;
+
+  /// Constructor.
+  /// @param levels The number of LOD levels to maintain. Clamped to @c kOccupancyLodMaxLevel .
+  explicit OccupancyLodProcess(unsigned levels = kDefaultLevels);
+  /// Destructor.
+  ~OccupancyLodProcess() override;
+
+  /// Query the number of LOD levels maintained.
+  /// @return The number of levels.
+  unsigned levels() const;
+  /// Set the number of LOD levels maintained. Existing LOD layers are not removed from a map.
+  /// @param levels The number of LOD levels to maintain. Clamped to @c kOccupancyLodMaxLevel .
+  void setLevels(unsigned levels);
+
+  void reset() override;
+
+  /// Ensure @p map has occupancy LOD layers for levels `[1, levels]` where supported by the region dimensions.
+  /// @param map The map to ensure has LOD layers.
+  /// @param levels The number of LOD levels required.
+  static void ensureOccupancyLodLayers(OccupancyMap &map, unsigned levels);
+
+  /// Update the LOD layers of out of date regions. Regions are processed in batches until the @p time_slice is
+  /// exceeded.
+  /// @param map The map to process.
+  /// @param time_slice The amount of time available for processing (seconds). Stop if exceeded. Zero for no limit.
+  /// @return See @c MappingProcessResult.
+  int update(OccupancyMap &map, double time_slice) override;
+
+  /// Update the LOD layers of all regions in @p map , blocking until complete.
+  ///
+  /// This call ignores the processing list.
+  ///
+  /// @param map The map to process.
+  /// @param force Force recalculation of the LOD layers even if they seem up to date.
+  /// @return The number of regions updated.
+  unsigned calculateAll(OccupancyMap &map, bool force = false);
+
+private:
+  std::unique_ptr<OccupancyLodProcessDetail> imp_;
+};
+}  // namespace ohm
+
+#endif  // OHM_OCCUPANCYLODPROCESS_H
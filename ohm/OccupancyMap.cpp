@@ -14,7 +14,9 @@
 #include "MapLayer.h"
 #include "MapProbability.h"
 #include "MapRegionCache.h"
+#include "OccupancyMask.h"
 #include "RayMapperOccupancy.h"
+#include "VoxelBlock.h"
 #include "VoxelBlockCompressionQueue.h"
 #include "VoxelBuffer.h"
 #include "VoxelOccupancy.h"
@@ -97,6 +99,19 @@ void releaseChunkIter(uint8_t *mem)
   using Iterator = ChunkMap::iterator;
   chunkIter(mem).~Iterator();
 }
+
+/// Voxel level @c IteratorFlag values.
+const unsigned kIfVoxelFilter = kIfObserved | kIfOccupied;
+
+/// Check if an occupancy @p value passes the voxel level flags in @p filter .
+inline bool passesVoxelFilter(float value, unsigned filter, float occupancy_threshold_value)
+{
+  if (value == unobservedOccupancyValue())
+  {
+    return false;
+  }
+  return !(filter & kIfOccupied) || value >= occupancy_threshold_value;
+}
 }  // namespace
 
 OccupancyMap::base_iterator::base_iterator()  // NOLINT
@@ -119,17 +134,46 @@ OccupancyMap::base_iterator::base_iterator(OccupancyMap *map, const Key &key)  /
   }
 }
 
+OccupancyMap::base_iterator::base_iterator(OccupancyMap *map, unsigned filter, uint64_t since_stamp)  // NOLINT
+  : map_(map)
+  , key_(Key::kNull)
+  , since_stamp_(since_stamp)
+  , filter_(filter)
+{
+  ChunkMap::iterator &chunk_iter = initChunkIter(chunk_mem_.data());
+  {
+    std::unique_lock<decltype(map->detail()->mutex)> guard(map->detail()->mutex);
+    chunk_iter = map->detail()->chunks.begin();
+    if (chunk_iter == map->detail()->chunks.end())
+    {
+      chunk_iter = ChunkMap::iterator();
+      return;
+    }
+  }
+  seekFiltered(beginFilteredChunk());
+}
+
 OccupancyMap::base_iterator::base_iterator(const base_iterator &other)  // NOLINT
   : map_(other.map_)
   , key_(other.key_)
+  , scan_block_(other.scan_block_)
+  , scan_mem_(other.scan_mem_)
+  , since_stamp_(other.since_stamp_)
+  , filter_(other.filter_)
+  , scan_mask_(other.scan_mask_)
 {
   static_assert(sizeof(ChunkMap::iterator) <= sizeof(OccupancyMap::base_iterator::chunk_mem_),  //
                 "Insufficient space for chunk iterator.");
   initChunkIter(chunk_mem_.data()) = chunkIter(other.chunk_mem_.data());
+  if (scan_block_)
+  {
+    scan_block_->retain();
+  }
 }
 
 OccupancyMap::base_iterator::~base_iterator()
 {
+  releaseScanBlock();
   // Explicit destructor invocation.
   releaseChunkIter(chunk_mem_.data());
 }
@@ -138,9 +182,19 @@ OccupancyMap::base_iterator &OccupancyMap::base_iterator::operator=(const base_i
 {
   if (this != &other)
   {
+    if (other.scan_block_)
+    {
+      other.scan_block_->retain();
+    }
+    releaseScanBlock();
     map_ = other.map_;
     key_ = other.key_;
     chunkIter(chunk_mem_.data()) = chunkIter(other.chunk_mem_.data());
+    scan_block_ = other.scan_block_;
+    scan_mem_ = other.scan_mem_;
+    since_stamp_ = other.since_stamp_;
+    filter_ = other.filter_;
+    scan_mask_ = other.scan_mask_;
   }
   return *this;
 }
@@ -166,6 +220,12 @@ void OccupancyMap::base_iterator::walkNext()
 {
   if (!key_.isNull())
   {
+    if (filter_)
+    {
+      seekFiltered(voxelIndex(key_, map_->detail()->region_voxel_dimensions) + 1);
+      return;
+    }
+
     if (!nextLocalKey(key_, map_->detail()->region_voxel_dimensions))
     {
       // Need to move to the next chunk.
@@ -181,6 +241,138 @@ void OccupancyMap::base_iterator::walkNext()
   }
 }
 
+unsigned OccupancyMap::base_iterator::beginFilteredChunk()
+{
+  releaseScanBlock();
+  const OccupancyMapDetail &map = *map_->detail();
+  const glm::ivec3 &dim = map.region_voxel_dimensions;
+  const unsigned region_volume = unsigned(dim.x * dim.y * dim.z);
+  const MapChunk *chunk = chunkIter(chunk_mem_.data())->second;
+
+  if ((filter_ & kIfTouchedSince) && chunk->dirty_stamp.load(std::memory_order_relaxed) <= since_stamp_)
+  {
+    return region_volume;
+  }
+
+  if (!(filter_ & kIfVoxelFilter))
+  {
+    // Region level filtering only. Visit all voxels.
+    return 0u;
+  }
+
+  const int occupancy_layer = map.layout.occupancyLayer();
+  if (occupancy_layer < 0)
+  {
+    // Voxel filters cannot be evaluated.
+    return region_volume;
+  }
+
+  const int mask_layer = occupancyMaskLayer(*map_);
+  if (mask_layer >= 0 && occupancyMaskUpToDate(*chunk, occupancy_layer, mask_layer))
+  {
+    const unsigned count = (filter_ & kIfOccupied) ? chunk->occupied_voxel_count : chunk->observed_voxel_count;
+    if (count == 0)
+    {
+      return region_volume;
+    }
+    scan_block_ = chunk->voxel_blocks[mask_layer].get();
+    scan_mask_ = true;
+  }
+  else
+  {
+    scan_block_ = chunk->voxel_blocks[occupancy_layer].get();
+    scan_mask_ = false;
+  }
+
+  scan_block_->retain();
+  scan_mem_ = scan_block_->voxelBytes();
+  // The mask scan is cheap enough to ignore the first_valid_index. Otherwise we can start from the first_valid_index
+  // when known, noting that not all population paths maintain it.
+  return (!scan_mask_ && chunk->hasValidNodes()) ? std::min(chunk->first_valid_index, region_volume) : 0u;
+}
+
+void OccupancyMap::base_iterator::seekFiltered(unsigned voxel_index)
+{
+  const OccupancyMapDetail &map = *map_->detail();
+  const glm::ivec3 &dim = map.region_voxel_dimensions;
+  const unsigned region_volume = unsigned(dim.x * dim.y * dim.z);
+  ChunkMap::iterator &chunk_iter = chunkIter(chunk_mem_.data());
+
+  while (true)
+  {
+    // Scan the current chunk.
+    unsigned found_index = region_volume;
+    if (voxel_index < region_volume)
+    {
+      if (!(filter_ & kIfVoxelFilter))
+      {
+        found_index = voxel_index;
+      }
+      else if (scan_mask_)
+      {
+        const auto *mask = reinterpret_cast<const OccupancyMaskVoxel *>(scan_mem_);
+        const size_t mask_count = (region_volume + kOccupancyMaskVoxelBits - 1) / kOccupancyMaskVoxelBits;
+        size_t mask_index = voxel_index / kOccupancyMaskVoxelBits;
+        // Mask off the bits before voxel_index in the first mask element.
+        uint64_t bits = ~uint64_t(0) << (voxel_index % kOccupancyMaskVoxelBits);
+        for (; mask_index < mask_count; ++mask_index)
+        {
+          bits &= (filter_ & kIfOccupied) ? mask[mask_index].occupied : mask[mask_index].observed;
+          if (bits)
+          {
+            found_index = unsigned(mask_index * kOccupancyMaskVoxelBits + occupancyMaskFirstBit(bits));
+            break;
+          }
+          bits = ~uint64_t(0);
+        }
+      }
+      else
+      {
+        const auto *occupancy = reinterpret_cast<const float *>(scan_mem_);
+        for (unsigned i = voxel_index; i < region_volume; ++i)
+        {
+          if (passesVoxelFilter(occupancy[i], filter_, map.occupancy_threshold_value))
+          {
+            found_index = i;
+            break;
+          }
+        }
+      }
+    }
+
+    if (found_index < region_volume)
+    {
+      key_.setRegionKey(chunk_iter->second->region.coord);
+      key_.setLocalKey(voxelLocalKey(found_index, dim));
+      return;
+    }
+
+    // Move to the next chunk.
+    releaseScanBlock();
+    ++chunk_iter;
+    if (chunk_iter == map_->detail()->chunks.end())
+    {
+      // Invalidate.
+      key_ = Key::kNull;
+      releaseChunkIter(chunk_mem_.data());
+      initChunkIter(chunk_mem_.data());
+      return;
+    }
+    voxel_index = beginFilteredChunk();
+  }
+}
+
+void OccupancyMap::base_iterator::releaseScanBlock()
+{
+  if (scan_block_)
+  {
+    scan_block_->release();
+    scan_block_ = nullptr;
+    scan_mem_ = nullptr;
+    scan_mask_ = false;
+  }
+}
+
 const MapChunk *OccupancyMap::base_iterator::chunk() const
 {
   return chunkIter(chunk_mem_.data())->second;
@@ -268,6 +460,25 @@ OccupancyMap::const_iterator OccupancyMap::begin() const
   return const_iterator(const_cast<OccupancyMap *>(this), firstIterationKey());
 }
 
+OccupancyMap::iterator OccupancyMap::begin(unsigned filter, uint64_t since_stamp)
+{
+  if (filter == kIfNone)
+  {
+    return begin();
+  }
+  return iterator(this, filter, since_stamp);
+}
+
+OccupancyMap::const_iterator OccupancyMap::begin(unsigned filter, uint64_t since_stamp) const
+{
+  if (filter == kIfNone)
+  {
+    return begin();
+  }
+  // TODO(KS): remove const cast by templating the base_iterator
+  return const_iterator(const_cast<OccupancyMap *>(this), filter, since_stamp);
+}
+
 OccupancyMap::iterator OccupancyMap::end()
 {
   return iterator(this, Key::kNull);
@@ -312,6 +523,9 @@ size_t OccupancyMap::calculateApproximateMemory() const
       // NOLINTNEXTLINE(bugprone-sizeof-expression)
       byte_count += map_bucked_count * sizeof(MapChunk *);
     }
+
+    // Lookup index usage.
+    byte_count += imp_->chunk_index.memoryUsage();
   }
 
   return byte_count;
@@ -696,6 +910,33 @@ unsigned OccupancyMap::removeDistanceRegions(const glm::dvec3 &relative_to, floa
   return cullRegions(should_remove_chunk);
 }
 
+bool OccupancyMap::setRollingWindow(const glm::ivec3 &window_regions)
+{
+  std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
+  if (!imp_->chunks.empty())
+  {
+    return false;
+  }
+
+  if (glm::all(glm::greaterThan(window_regions, glm::ivec3(0))))
+  {
+    imp_->rolling_window = window_regions;
+    imp_->ring = std::make_unique<RingSlot[]>(  // NOLINT(modernize-avoid-c-arrays)
+      size_t(window_regions.x) * size_t(window_regions.y) * size_t(window_regions.z));
+  }
+  else
+  {
+    imp_->rolling_window = glm::ivec3(0);
+    imp_->ring.reset();
+  }
+  return true;
+}
+
+glm::ivec3 OccupancyMap::rollingWindow() const
+{
+  return imp_->rolling_window;
+}
+
 unsigned OccupancyMap::cullRegionsOutside(const glm::dvec3 &min_extents, const glm::dvec3 &max_extents)
 {
   const glm::dvec3 region_extents = imp_->region_spatial_dimensions;
@@ -1066,7 +1307,8 @@ OccupancyMap *OccupancyMap::clone(const glm::dvec3 &min_ext, const glm::dvec3 &m
       MapChunk *dst_chunk = new_map->region(src_chunk->region.coord, true);
       dst_chunk->first_valid_index = src_chunk->first_valid_index;
       dst_chunk->touched_time = src_chunk->touched_time;
-      dst_chunk->dirty_stamp = src_chunk->dirty_stamp.load();
+      dst_chunk->setDirtyStamp(src_chunk->dirty_stamp.load());
+      dst_chunk->created_stamp = src_chunk->created_stamp;
       dst_chunk->flags = src_chunk->flags;
 
       for (unsigned i = 0; i < imp_->layout.layerCount(); ++i)
@@ -1085,6 +1327,47 @@ OccupancyMap *OccupancyMap::clone(const glm::dvec3 &min_ext, const glm::dvec3 &m
   return new_map;
 }
 
+OccupancyMap *OccupancyMap::snapshot() const
+{
+  auto *new_map = new OccupancyMap(imp_->resolution, imp_->region_voxel_dimensions);
+
+  if (imp_->ray_filter)
+  {
+    new_map->setRayFilter(imp_->ray_filter);
+  }
+
+  // Copy general details.
+  new_map->detail()->copyFrom(*imp_);
+
+  std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
+  for (const auto &chunk_iter : imp_->chunks)
+  {
+    const MapChunk *src_chunk = chunk_iter.second;
+    MapChunk *dst_chunk = new_map->region(src_chunk->region.coord, true);
+    dst_chunk->first_valid_index = src_chunk->first_valid_index;
+    dst_chunk->touched_time = src_chunk->touched_time;
+    dst_chunk->setDirtyStamp(src_chunk->dirty_stamp.load());
+    dst_chunk->created_stamp = src_chunk->created_stamp;
+    dst_chunk->flags = src_chunk->flags;
+    dst_chunk->saturated_free_count = src_chunk->saturated_free_count;
+    dst_chunk->saturated_free_stamp = src_chunk->saturated_free_stamp;
+    dst_chunk->occupied_voxel_count = src_chunk->occupied_voxel_count;
+    dst_chunk->observed_voxel_count = src_chunk->observed_voxel_count;
+
+    for (unsigned i = 0; i < imp_->layout.layerCount(); ++i)
+    {
+      dst_chunk->touched_stamps[i] = static_cast<uint64_t>(src_chunk->touched_stamps[i]);
+      if (src_chunk->voxel_blocks[i])
+      {
+        // Share the voxel data rather than copying.
+        dst_chunk->voxel_blocks[i]->shareFrom(*src_chunk->voxel_blocks[i]);
+      }
+    }
+  }
+
+  return new_map;
+}
+
 void OccupancyMap::enumerateRegions(std::vector<const MapChunk *> &chunks) const
 {
   std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
@@ -1096,11 +1379,10 @@ void OccupancyMap::enumerateRegions(std::vector<const MapChunk *> &chunks) const
 
 MapChunk *OccupancyMap::region(const glm::i16vec3 &region_key, bool allow_create)
 {
-  std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
-  const auto region_search = imp_->chunks.find(region_key);
-  if (region_search != imp_->chunks.end())
+  // Lock free lookup for existing regions.
+  MapChunk *chunk = imp_->findChunk(region_key);
+  if (chunk)
   {
-    MapChunk *chunk = region_search->second;
 #ifdef OHM_VALIDATION
     chunk->validateFirstValid(imp_->region_voxel_dimensions);
 #endif  // OHM_VALIDATION
@@ -1109,11 +1391,28 @@ MapChunk *OccupancyMap::region(const glm::i16vec3 &region_key, bool allow_create
 
   if (allow_create)
   {
-    // No such chunk. Create one.
-    MapChunk *chunk = newChunk(Key(region_key, 0, 0, 0));
-    imp_->chunks.insert(std::make_pair(chunk->region.coord, chunk));
-    // No need to touch the map here. We haven't changed the semantics of the map.
-    // That happens when the value of a voxel in the region changes.
+    std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
+    // Search again now we hold the lock as another thread may have created the region.
+    chunk = imp_->findChunk(region_key);
+    if (!chunk)
+    {
+      MapChunk *evicted = (imp_->ring) ? imp_->ring[imp_->ringIndex(region_key)].chunk.load() : nullptr;
+      if (evicted)
+      {
+        // Rolling window: the slot is held by a region which has left the window. Recycle it in place.
+        recycleChunk(evicted, region_key);
+        evicted->created_stamp = imp_->stamp + 1;
+        return evicted;
+      }
+
+      // No such chunk. Create one.
+      chunk = newChunk(Key(region_key, 0, 0, 0));
+      chunk->created_stamp = imp_->stamp + 1;
+      imp_->addChunk(chunk);
+      // No need to touch the map here. We haven't changed the semantics of the map.
+      // That happens when the value of a voxel in the region changes. The created_stamp still identifies the region as
+      // new for incremental saves.
+    }
     return chunk;
   }
 
@@ -1122,54 +1421,24 @@ MapChunk *OccupancyMap::region(const glm::i16vec3 &region_key, bool allow_create
 
 const MapChunk *OccupancyMap::region(const glm::i16vec3 &region_key) const
 {
-  std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
-  const auto region_search = imp_->chunks.find(region_key);
-  if (region_search != imp_->chunks.end())
-  {
-    const MapChunk *chunk = region_search->second;
-    return chunk;
-  }
-
-  return nullptr;
+  return imp_->findChunk(region_key);
 }
 
 unsigned OccupancyMap::collectDirtyRegions(uint64_t from_stamp,
                                            std::vector<std::pair<uint64_t, glm::i16vec3>> &regions) const
 {
-  // Brute for for now.
-  unsigned added_count = 0;
-  bool added;
-  std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
-  for (auto &&chunk_ref : imp_->chunks)
-  {
-    if (chunk_ref.second->dirty_stamp > from_stamp)
-    {
-      added = false;
+  // The dirty region index is ordered by stamp. Least recently touched (oldest) first.
+  const size_t initial_size = regions.size();
+  imp_->dirty_regions.visitSince(from_stamp, [&regions](const DirtyRegionIndex::Entry &entry) {
+    regions.emplace_back(std::make_pair(entry.stamp, entry.region));
+  });
 
-      // Insertion sorted on the chunk's dirty stamp. Least recently touched (oldtest) first.
-      // TODO(KS): test efficiency of the sorted insertion on a vector.
-      // Scope should be small so I expect little impact.
-      auto item = std::make_pair(chunk_ref.second->dirty_stamp.load(), chunk_ref.second->region.coord);
-      for (auto iter = regions.begin(); iter != regions.end(); ++iter)
-      {
-        if (item.first < iter->first)
-        {
-          regions.insert(iter, item);
-          added = true;
-          break;
-        }
-      }
+  // Merge with any existing, sorted items.
+  const auto compare_stamp = [](const std::pair<uint64_t, glm::i16vec3> &a,
+                                const std::pair<uint64_t, glm::i16vec3> &b) { return a.first < b.first; };
+  std::inplace_merge(regions.begin(), regions.begin() + initial_size, regions.end(), compare_stamp);
 
-      if (!added)
-      {
-        regions.push_back(item);
-      }
-
-      ++added_count;
-    }
-  }
-
-  return added_count;
+  return unsigned(regions.size() - initial_size);
 }
 
 uint64_t OccupancyMap::calculateDirtyExtents(uint64_t from_stamp, glm::i16vec3 *min_ext, glm::i16vec3 *max_ext) const
@@ -1177,22 +1446,16 @@ uint64_t OccupancyMap::calculateDirtyExtents(uint64_t from_stamp, glm::i16vec3 *
   *min_ext = glm::i16vec3(std::numeric_limits<decltype(min_ext->x)>::max());
   *max_ext = glm::i16vec3(std::numeric_limits<decltype(min_ext->x)>::min());
 
-  std::unique_lock<decltype(imp_->mutex)> guard(imp_->mutex);
   const uint64_t at_stamp = imp_->stamp;
-  for (auto &&chunk_ref : imp_->chunks)
-  {
-    if (chunk_ref.second->dirty_stamp > from_stamp)
-    {
-      min_ext->x = std::min(chunk_ref.second->region.coord.x, min_ext->x);
-      min_ext->y = std::min(chunk_ref.second->region.coord.y, min_ext->y);
-      min_ext->z = std::min(chunk_ref.second->region.coord.z, min_ext->z);
+  imp_->dirty_regions.visitSince(from_stamp, [min_ext, max_ext](const DirtyRegionIndex::Entry &entry) {
+    min_ext->x = std::min(entry.region.x, min_ext->x);
+    min_ext->y = std::min(entry.region.y, min_ext->y);
+    min_ext->z = std::min(entry.region.z, min_ext->z);
 
-      max_ext->x = std::max(chunk_ref.second->region.coord.x, max_ext->x);
-      max_ext->y = std::max(chunk_ref.second->region.coord.y, max_ext->y);
-      max_ext->z = std::max(chunk_ref.second->region.coord.z, max_ext->z);
-    }
-  }
-  guard.unlock();
+    max_ext->x = std::max(entry.region.x, max_ext->x);
+    max_ext->y = std::max(entry.region.y, max_ext->y);
+    max_ext->z = std::max(entry.region.z, max_ext->z);
+  });
 
   if (min_ext->x > max_ext->x)
   {
@@ -1252,7 +1515,7 @@ void OccupancyMap::clear()
     releaseChunk(chunk_ref.second);
   }
 
-  imp_->chunks.clear();
+  imp_->clearChunks();
   imp_->loaded_region_count = 0;
 }
 
@@ -1281,6 +1544,25 @@ void OccupancyMap::releaseChunk(const MapChunk *chunk)
   delete chunk;
 }
 
+void OccupancyMap::recycleChunk(MapChunk *chunk, const glm::i16vec3 &region_key)
+{
+  // Remove from the GPU cache.
+  if (imp_->gpu_cache)
+  {
+    imp_->gpu_cache->remove(chunk->region.coord);
+  }
+
+  // Removing the chunk empties its ring slot first, so lock free lookups cannot reach the chunk while it is rewritten.
+  auto chunk_iter = imp_->chunks.find(chunk->region.coord);
+  if (chunk_iter != imp_->chunks.end())
+  {
+    imp_->removeChunk(chunk_iter);
+  }
+  chunk->recycle(
+    MapRegion(voxelCentreGlobal(Key(region_key, 0, 0, 0)), imp_->origin, imp_->region_spatial_dimensions));
+  imp_->addChunk(chunk);
+}
+
 unsigned OccupancyMap::cullRegions(const RegionCullFunc &cull_func)
 {
   unsigned removed_count = 0;
@@ -1300,7 +1582,7 @@ unsigned OccupancyMap::cullRegions(const RegionCullFunc &cull_func)
       }
 
       // Culled region. Remove from the map.
-      region_iter = imp_->chunks.erase(region_iter);
+      region_iter = imp_->removeChunk(region_iter);
       releaseChunk(chunk);
       ++removed_count;
     }
@@ -8,6 +8,7 @@
 
 #include "OhmConfig.h"
 
+#include "IteratorFlag.h"
 #include "Key.h"
 #include "MapFlag.h"
 #include "MapProbability.h"
@@ -35,6 +36,7 @@ class MapInfo;
 class MapLayout;
 struct OccupancyMapDetail;
 class RayFilter;
+class VoxelBlock;
 
 /// A spatial container using a voxel representation of 3D space.
 ///
@@ -124,6 +126,12 @@ public:
     /// @param map The map to iterate in.
     /// @param key The key to start iterating at.
     base_iterator(OccupancyMap *map, const Key &key);
+    /// Filtered iterator into @p map starting at the first voxel which passes the @p filter .
+    /// Map must remain unchanged during iteration.
+    /// @param map The map to iterate in.
+    /// @param filter @c IteratorFlag values controlling which voxels are visited.
+    /// @param since_stamp The stamp value used with @c kIfTouchedSince .
+    base_iterator(OccupancyMap *map, unsigned filter, uint64_t since_stamp);
     /// Copy constructor.
     /// @param other Object to shallow copy.
     base_iterator(const base_iterator &other);
@@ -142,6 +150,10 @@ public:
     /// @return The current @c OccupancyMap .
     inline const OccupancyMap *map() const { return map_; }
 
+    /// Query the @c IteratorFlag filter applied by this iterator.
+    /// @return The filter flags.
+    inline unsigned filter() const { return filter_; }
+
     /// Copy assignment.
     /// @param other Object to shallow copy.
     base_iterator &operator=(const base_iterator &other);
@@ -173,8 +185,27 @@ public:
     /// Iterator is unchanged if already invalid.
     void walkNext();
 
+  private:
+    /// Setup filtered iteration of the current chunk.
+    /// @return The voxel index from which to scan the chunk, or the region voxel volume if the region fails the
+    ///   filter.
+    unsigned beginFilteredChunk();
+    /// Move to the first voxel which passes the filter, starting at @p voxel_index in the current chunk and moving
+    /// on through subsequent chunks. The iterator becomes invalid if there are no more such voxels.
+    void seekFiltered(unsigned voxel_index);
+    /// Release the @c scan_block_ if any.
+    void releaseScanBlock();
+
+  protected:
     OccupancyMap *map_ = nullptr;  ///< The referenced map.
     Key key_;                      ///< The current voxel key.
+    /// Block retained while scanning the current chunk in filtered iteration: either the occupancy mask or the
+    /// occupancy layer.
+    VoxelBlock *scan_block_ = nullptr;
+    const uint8_t *scan_mem_ = nullptr;  ///< Voxel memory of @c scan_block_ .
+    uint64_t since_stamp_ = 0;           ///< Stamp for @c kIfTouchedSince filtering.
+    unsigned filter_ = 0;                ///< @c IteratorFlag filter.
+    bool scan_mask_ = false;             ///< True if @c scan_block_ is the occupancy mask layer.
     /// Memory used to track an iterator into a hidden container type.
     /// We use an anonymous, fixed size memory chunk and placement new to prevent exposing STL
     /// types as part of the ABI.
@@ -193,6 +224,13 @@ public:
     inline iterator(OccupancyMap *map, const Key &key)
       : base_iterator(map, key)
     {}
+    /// Filtered iterator into @p map . Map must remain unchanged during iteration.
+    /// @param map The map to iterate in.
+    /// @param filter @c IteratorFlag values controlling which voxels are visited.
+    /// @param since_stamp The stamp value used with @c kIfTouchedSince .
+    inline iterator(OccupancyMap *map, unsigned filter, uint64_t since_stamp)
+      : base_iterator(map, filter, since_stamp)
+    {}
     /// Copy constructor.
     /// @param other Object to shallow copy.
     inline iterator(const iterator &other) = default;
@@ -240,6 +278,13 @@ public:
     inline const_iterator(OccupancyMap *map, const Key &key)
       : base_iterator(map, key)
     {}
+    /// Filtered iterator into @p map . Map must remain unchanged during iteration.
+    /// @param map The map to iterate in.
+    /// @param filter @c IteratorFlag values controlling which voxels are visited.
+    /// @param since_stamp The stamp value used with @c kIfTouchedSince .
+    inline const_iterator(OccupancyMap *map, unsigned filter, uint64_t since_stamp)
+      : base_iterator(map, filter, since_stamp)
+    {}
     /// Copy constructor.
     /// @param other Object to shallow copy.
     inline const_iterator(const const_iterator &other) = default;
@@ -310,6 +355,22 @@ public:
   /// @return An @c const_iterator to the first voxel in the map, or an invalid iterator when empty.
   const_iterator begin() const;
 
+  /// Create an iterator to the first voxel in the map which passes the given @p filter , visiting only the voxels
+  /// which pass the @p filter . The map should not have voxels added or removed during iterator.
+  ///
+  /// Filtered iteration skips whole regions where possible: regions not modified since @p since_stamp and, when the
+  /// occupancy mask layer is up to date, regions with no observed or occupied voxels. Within a region, the occupancy
+  /// mask is scanned for matching voxels when up to date (see @c addOccupancyMask() ) otherwise the occupancy layer is
+  /// scanned from the @c MapChunk::first_valid_index .
+  ///
+  /// @param filter @c IteratorFlag values controlling which voxels are visited.
+  /// @param since_stamp The stamp value used with @c kIfTouchedSince . Regions with a @c MapChunk::dirty_stamp
+  ///   greater than this value are visited.
+  /// @return An @c iterator to the first matching voxel in the map, or an invalid iterator when there is none.
+  iterator begin(unsigned filter, uint64_t since_stamp = 0);
+  /// @overload
+  const_iterator begin(unsigned filter, uint64_t since_stamp = 0) const;
+
   /// Create an iterator representing the end of iteration. See standard iteration patterns.
   /// @return An invalid iterator for this map.
   iterator end();
@@ -518,6 +579,33 @@ public:
   /// @return The number of removed regions.
   unsigned removeDistanceRegions(const glm::dvec3 &relative_to, float distance);
 
+  /// Enable or disable rolling window mode for robot centric, local mapping.
+  ///
+  /// In rolling window mode, regions are held in a fixed 3D ring buffer of @p window_regions regions. Each region maps
+  /// to the ring slot given by its region coordinates modulo @p window_regions , so region lookup is a direct index
+  /// rather than a hash lookup. Creating a region whose slot is occupied by another region evicts that region,
+  /// recycling its @c MapChunk and voxel memory in place for the new region. As the sensor moves, regions which fall
+  /// behind the window are thus replaced by those entering it without any allocation once the window is populated and
+  /// without the need to call @c removeDistanceRegions() .
+  ///
+  /// The window should span the sensor range in each axis. Any region within @p window_regions of the sensor then has
+  /// a unique slot, while regions further away are evicted as their slot is reused.
+  ///
+  /// Evicting a region invalidates pointers to it, as per @c cullRegions() . Concurrent region creation must not evict
+  /// a region in use by another thread. The threaded integration of @c RayMapperOccupancy splits its updates so that
+  /// regions sharing a ring slot are never updated concurrently.
+  ///
+  /// The mode can only be changed while the map is empty.
+  ///
+  /// @param window_regions The number of regions along each axis of the window. Zero, or any non-positive axis,
+  ///   disables rolling window mode.
+  /// @return True on success, false if the map is not empty.
+  bool setRollingWindow(const glm::ivec3 &window_regions);
+
+  /// Query the rolling window dimensions. See @c setRollingWindow() .
+  /// @return The rolling window dimensions in regions, or zero when rolling window mode is disabled.
+  glm::ivec3 rollingWindow() const;
+
   /// Remove @c MapRegion chunks which do not overalp the given axis aligned box.
   ///
   /// @param min_extents The AABB minimum extents.
@@ -873,6 +961,23 @@ public:
   /// @return A deep clone of this map. Caller takes ownership.
   OccupancyMap *clone(const glm::dvec3 &min_ext, const glm::dvec3 &max_ext) const;
 
+  /// Create a copy-on-write snapshot of the map.
+  ///
+  /// The snapshot is a separate map with the same regions, layout and settings as this map, but which shares voxel
+  /// memory with this map rather than copying it. A voxel layer block is only duplicated when this map next writes to
+  /// it, or when the snapshot first accesses it. The cost of a snapshot is thus proportional to the number of regions
+  /// and the data which change while the snapshot is in use, rather than to the size of the voxel data.
+  ///
+  /// This supports handing a consistent view of the map to readers on other threads, such as planners, while mapping
+  /// continues. The snapshot reflects the map content at the time of the call and is unaffected by later changes to
+  /// this map. Changes to the snapshot do not affect this map.
+  ///
+  /// The call must not be made concurrently with modifications to this map. Maps with voxel data held in GPU memory
+  /// should be synchronised first - see @c GpuMap::syncVoxels() .
+  ///
+  /// @return A snapshot of this map. Caller takes ownership.
+  OccupancyMap *snapshot() const;
+
   //-------------------------------------------------------
   // Internal
   //-------------------------------------------------------
@@ -899,13 +1004,19 @@ public:
 
   /// Populate @c regions with a list of regions who's touch stamp is greater than the given value.
   ///
-  /// Adds to @p regions without clearing it, thus there may be redundancy.
+  /// Adds to @p regions without clearing it, thus there may be redundancy. Added regions are sorted by stamp, oldest
+  /// first, and merged with the existing content of @p regions , which is assumed to be similarly sorted.
+  ///
+  /// Regions are resolved from a stamp ordered index of regions so the cost is proportional to the number of regions
+  /// modified since @p from_stamp rather than the map size. The index is maintained by @c MapChunk::setDirtyStamp() .
   ///
   /// @param from_stamp The map stamp value from which to fetch regions.
   /// @param regions The list to add to.
   unsigned collectDirtyRegions(uint64_t from_stamp, std::vector<std::pair<uint64_t, glm::i16vec3>> &regions) const;
 
   /// Experimental: calculate the extents of regions which have been changed since @c from_stamp .
+  ///
+  /// Like @c collectDirtyRegions() , this only visits the regions modified since @p from_stamp .
   /// @param from_stamp The base stamp used to determine dirty regions.
   /// @param min_ext The region key which identifies the minimum extents of the dirty regions.
   /// @param max_ext The region key which identifies the maximum extents of the dirty regions.
@@ -925,6 +1036,7 @@ private:
   Key firstIterationKey() const;
   MapChunk *newChunk(const Key &for_key);
   static void releaseChunk(const MapChunk *chunk);
+  void recycleChunk(MapChunk *chunk, const glm::i16vec3 &region_key);
 
   /// Culling function for @c cullRegions().
   using RegionCullFunc = std::function<bool(const MapChunk &)>;
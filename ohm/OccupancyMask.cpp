@@ -0,0 +1,102 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OccupancyMask.h"
+
+#include "DefaultLayer.h"
+#include "MapChunk.h"
+#include "MapLayer.h"
+#include "MapLayout.h"
+#include "OccupancyMap.h"
+#include "VoxelBuffer.h"
+#include "VoxelOccupancy.h"
+
+#include <cstring>
+
+namespace ohm
+{
+int occupancyMaskLayer(const OccupancyMap &map)
+{
+  const MapLayer *layer = map.layout().layer(default_layer::occupancyMaskLayerName());
+  if (!layer || layer->subsampling() != kOccupancyMaskSubsampling ||
+      layer->voxelByteSize() != sizeof(OccupancyMaskVoxel))
+  {
+    return -1;
+  }
+
+  // Region dimensions must be divisible by the subsampling block size so each mask voxel covers 64 voxels.
+  const glm::ivec3 region_dim = map.regionVoxelDimensions();
+  const int block_size = 1 << kOccupancyMaskSubsampling;
+  if (region_dim.x % block_size || region_dim.y % block_size || region_dim.z % block_size)
+  {
+    return -1;
+  }
+
+  return int(layer->layerIndex());
+}
+
+
+bool occupancyMaskUpToDate(const MapChunk &chunk, int occupancy_layer, int mask_layer)
+{
+  return chunk.touched_stamps[mask_layer] >= chunk.touched_stamps[occupancy_layer];
+}
+
+
+bool updateOccupancyMask(const OccupancyMap &map, MapChunk &chunk, bool force)
+{
+  const int occupancy_layer = map.layout().occupancyLayer();
+  const int mask_layer = occupancyMaskLayer(map);
+  if (occupancy_layer < 0 || mask_layer < 0 ||
+      map.layout().layer(occupancy_layer).voxelByteSize() != sizeof(float))
+  {
+    return false;
+  }
+
+  if (!force && occupancyMaskUpToDate(chunk, occupancy_layer, mask_layer))
+  {
+    return false;
+  }
+
+  // Capture the stamp before reading the occupancy values.
+  const uint64_t occupancy_stamp = chunk.touched_stamps[occupancy_layer];
+  const float occupancy_threshold_value = map.occupancyThresholdValue();
+
+  VoxelBuffer<const VoxelBlock> occupancy_buffer(chunk.voxel_blocks[occupancy_layer]);
+  VoxelBuffer<VoxelBlock> mask_buffer(chunk.voxel_blocks[mask_layer]);
+  const size_t voxel_count = occupancy_buffer.voxelMemorySize() / sizeof(float);
+  const size_t mask_count = mask_buffer.voxelMemorySize() / sizeof(OccupancyMaskVoxel);
+  if (mask_count * kOccupancyMaskVoxelBits != voxel_count)
+  {
+    return false;
+  }
+
+  const uint8_t *occupancy_mem = occupancy_buffer.voxelMemory();
+  uint8_t *mask_mem = mask_buffer.voxelMemory();
+  unsigned occupied_count = 0;
+  unsigned observed_count = 0;
+  float occupancy;
+  for (size_t i = 0; i < mask_count; ++i)
+  {
+    OccupancyMaskVoxel mask{ 0, 0 };
+    for (unsigned b = 0; b < kOccupancyMaskVoxelBits; ++b)
+    {
+      memcpy(&occupancy, occupancy_mem + (i * kOccupancyMaskVoxelBits + b) * sizeof(occupancy), sizeof(occupancy));
+      const uint64_t observed = (occupancy != unobservedOccupancyValue()) ? 1u : 0u;
+      const uint64_t occupied = (observed && occupancy >= occupancy_threshold_value) ? 1u : 0u;
+      mask.observed |= observed << b;
+      mask.occupied |= occupied << b;
+    }
+    occupied_count += occupancyMaskBitCount(mask.occupied);
+    observed_count += occupancyMaskBitCount(mask.observed);
+    memcpy(mask_mem + i * sizeof(mask), &mask, sizeof(mask));
+  }
+
+  chunk.occupied_voxel_count = occupied_count;
+  chunk.observed_voxel_count = observed_count;
+  chunk.touched_stamps[mask_layer] = occupancy_stamp;
+
+  return true;
+}
+}  // namespace ohm
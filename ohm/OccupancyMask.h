@@ -0,0 +1,144 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_OCCUPANCYMASK_H
+#define OHM_OCCUPANCYMASK_H
+
+#include "OhmConfig.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif  // defined(_MSC_VER)
+
+namespace ohm
+{
+class OccupancyMap;
+struct MapChunk;
+
+/// Number of voxels summarised by each @c OccupancyMaskVoxel .
+const unsigned kOccupancyMaskVoxelBits = 64u;
+/// The @c MapLayer::subsampling() of the occupancy mask layer. Each mask layer voxel covers 4^3 = 64 voxels.
+const unsigned kOccupancyMaskSubsampling = 2u;
+
+/// Voxel structure of the occupancy mask layer. See @c addOccupancyMask() .
+///
+/// The occupancy mask packs the occupancy state of each region into bitsets, using two bits per voxel rather than the
+/// 32 bits of the occupancy layer. The mask voxel at index @c i holds the bits for the voxels with linear indices
+/// `[64 i, 64 i + 64)` in the region, with bit @c b corresponding to the voxel at index `64 i + b`. That is, the mask
+/// packs the voxels in the same order as the occupancy layer and is not spatially arranged like other subsampled
+/// layers.
+///
+/// Scanning the mask with @c visitOccupancyMaskBits() visits only the voxels of interest, in increasing voxel index
+/// order, while reading 1/16th of the memory of the occupancy layer.
+struct OccupancyMaskVoxel
+{
+  uint64_t occupied;  ///< Bits set for voxels at or above the occupancy threshold.
+  uint64_t observed;  ///< Bits set for voxels which are not unobserved.
+};
+
+/// Resolve the layer index of the occupancy mask layer in @p map .
+///
+/// The layer is only valid when present in the map layout and the map region dimensions are exactly divisible by 4
+/// along each axis.
+///
+/// @param map The map of interest.
+/// @return The layer index or -1 if there is no valid layer.
+int ohm_API occupancyMaskLayer(const OccupancyMap &map);
+
+/// Check whether the occupancy mask layer of @p chunk is up to date with the occupancy layer.
+///
+/// The mask classifies voxels using the map occupancy threshold at the time of the update. Call
+/// @c updateOccupancyMask() with @c force set after changing the map occupancy threshold.
+///
+/// @param chunk The region of interest.
+/// @param occupancy_layer The occupancy layer index.
+/// @param mask_layer The occupancy mask layer index.
+/// @return True if the mask layer is up to date.
+bool ohm_API occupancyMaskUpToDate(const MapChunk &chunk, int occupancy_layer, int mask_layer);
+
+/// Recalculate the occupancy mask layer of @p chunk from the occupancy layer, along with the
+/// @c MapChunk::occupied_voxel_count and @c MapChunk::observed_voxel_count .
+///
+/// The mask layer @c MapChunk::touched_stamps entry is set to match the occupancy layer on completion. The call is
+/// threadsafe so long as different @p chunk objects are processed on each thread and the occupancy layer is not being
+/// modified.
+///
+/// @param map The map containing @p chunk .
+/// @param chunk The region to update.
+/// @param force True to update the mask even when it is already up to date.
+/// @return True if the mask was updated.
+bool ohm_API updateOccupancyMask(const OccupancyMap &map, MapChunk &chunk, bool force = false);
+
+/// Count the number of bits set in @p bits .
+/// @param bits The bits to count.
+/// @return The number of set bits.
+inline unsigned occupancyMaskBitCount(uint64_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return unsigned(__builtin_popcountll(bits));
+#elif defined(_MSC_VER) && defined(_M_X64)
+  return unsigned(__popcnt64(bits));
+#else   // Fallback
+  unsigned count = 0;
+  for (; bits; bits &= bits - 1u)
+  {
+    ++count;
+  }
+  return count;
+#endif  // Fallback
+}
+
+/// Query the index of the lowest bit set in @p bits .
+/// @param bits The bits to search. Must be non zero.
+/// @return The index of the lowest set bit.
+inline unsigned occupancyMaskFirstBit(uint64_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return unsigned(__builtin_ctzll(bits));
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index = 0;  // NOLINT(google-runtime-int)
+  _BitScanForward64(&index, bits);
+  return unsigned(index);
+#else   // Fallback
+  unsigned index = 0;
+  for (; !(bits & 1u); bits >>= 1u)
+  {
+    ++index;
+  }
+  return index;
+#endif  // Fallback
+}
+
+/// Visit the voxels selected from an occupancy mask in increasing voxel index order.
+///
+/// The @p select_func selects the bits of interest from each @c OccupancyMaskVoxel and has the signature
+/// `uint64_t (const OccupancyMaskVoxel &)` . For example, to visit only the occupied voxels:
+/// @code
+/// visitOccupancyMaskBits(mask, mask_count, [](const OccupancyMaskVoxel &m) { return m.occupied; },
+///                        [](unsigned voxel_index) { /* ... */ });
+/// @endcode
+///
+/// @param mask The region occupancy mask.
+/// @param mask_count The number of elements in @p mask .
+/// @param select_func Selects the bits to visit from each mask element.
+/// @param visit_func Called with the voxel index of each selected voxel. Signature `void (unsigned)` .
+template <typename SelectFunc, typename VisitFunc>
+void visitOccupancyMaskBits(const OccupancyMaskVoxel *mask, size_t mask_count, SelectFunc &&select_func,
+                            VisitFunc &&visit_func)
+{
+  for (size_t i = 0; i < mask_count; ++i)
+  {
+    for (uint64_t bits = select_func(mask[i]); bits; bits &= bits - 1u)
+    {
+      visit_func(unsigned(i * kOccupancyMaskVoxelBits + occupancyMaskFirstBit(bits)));
+    }
+  }
+}
+}  // namespace ohm
+
+#endif  // OHM_OCCUPANCYMASK_H
@@ -229,7 +229,7 @@ size_t RayMapperNdt::integrateRays(const glm::dvec3 *rays, size_t element_count,
     chunk->updateFirstValid(voxel_index);
 
     stop_adjustments = stop_adjustments;
-    chunk->dirty_stamp = touch_stamp;
+    chunk->setDirtyStamp(touch_stamp);
     // Update the touched_stamps with relaxed memory ordering. The important thing is to have an update,
     // not so much the sequencing. We really don't want to synchronise here.
     chunk->touched_stamps[occupancy_layer].store(touch_stamp, std::memory_order_relaxed);
@@ -386,7 +386,7 @@ size_t RayMapperNdt::integrateRays(const glm::dvec3 *rays, size_t element_count,
       // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
       chunk->updateFirstValid(voxel_index);
 
-      chunk->dirty_stamp = touch_stamp;
+      chunk->setDirtyStamp(touch_stamp);
       // Update the touched_stamps with relaxed memory ordering. The important thing is to have an update,
       // not so much the sequencing. We really don't want to synchronise here.
       chunk->touched_stamps[occupancy_layer].store(touch_stamp, std::memory_order_relaxed);
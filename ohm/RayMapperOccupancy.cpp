@@ -6,9 +6,11 @@
 #include "RayMapperOccupancy.h"
 
 #include "DefaultLayer.h"
+#include "KeyHash.h"
 #include "MapChunk.h"
 #include "MapLayer.h"
 #include "MapLayout.h"
+#include "OccupancyMask.h"
 #include "OccupancyMap.h"
 #include "Voxel.h"
 #include "VoxelBuffer.h"
@@ -17,11 +19,25 @@
 #include "VoxelOccupancy.h"
 #include "VoxelTouchTime.h"
 
+#include "private/OccupancyMapDetail.h"
+
 // TODO (KS): RayMapperOccupancy::lookupRays() is deprecated. Use RaysQuery for less code maintenance, but it creates
 // a poor dependency.
 #include "RaysQuery.h"
 
 #include <ohmutil/LineWalk.h>
+#include <ohmutil/VectorHash.h>
+
+#ifdef OHM_THREADS
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif  // OHM_THREADS
+
+#include <algorithm>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace ohm
 {
@@ -32,6 +48,7 @@ RayMapperOccupancy::RayMapperOccupancy(OccupancyMap *map)
   , traversal_layer_(map_->layout().traversalLayer())
   , touch_time_layer_(map_->layout().layerIndex(default_layer::touchTimeLayerName()))
   , incident_normal_layer_(map_->layout().layerIndex(default_layer::incidentNormalLayerName()))
+  , mask_layer_(occupancyMaskLayer(*map_))
 {
   // Use Voxel to validate the layers.
   // In processing we use VoxelBuffer instead of Voxel objects. While Voxel makes for a neater API, using VoxelBuffer
@@ -66,144 +83,775 @@ RayMapperOccupancy::RayMapperOccupancy(OccupancyMap *map)
 RayMapperOccupancy::~RayMapperOccupancy() = default;
 
 
-size_t RayMapperOccupancy::integrateRays(const glm::dvec3 *rays, size_t element_count, const float * /*intensities*/,
-                                         const double *timestamps, unsigned ray_update_flags)
+namespace
 {
-  KeyList keys;
-  MapChunk *last_chunk = nullptr;
-  MapChunk *last_mean_chunk = nullptr;
-  VoxelBuffer<VoxelBlock> occupancy_buffer;
-  VoxelBuffer<VoxelBlock> mean_buffer;
-  VoxelBuffer<VoxelBlock> traversal_buffer;
-  VoxelBuffer<VoxelBlock> touch_time_buffer;
-  VoxelBuffer<VoxelBlock> incidents_buffer;
-  double last_exit_range = 0;
-  bool stop_adjustments = false;
+/// Values which remain constant over a single @c RayMapperOccupancy::integrateRays() call. Shared between the single
+/// threaded and threaded update paths.
+struct OccupancyUpdateContext
+{
+  const OccupancyMap *map = nullptr;
+  const double *timestamps = nullptr;
+  int occupancy_layer = -1;
+  int mean_layer = -1;
+  int traversal_layer = -1;
+  int touch_time_layer = -1;
+  int incident_normal_layer = -1;
+  int mask_layer = -1;
+  glm::u8vec3 occupancy_dim{ 0, 0, 0 };
+  float occupancy_threshold_value = 0;
+  float miss_value = 0;
+  float hit_value = 0;
+  float voxel_min = 0;
+  float voxel_max = 0;
+  float saturation_min = 0;
+  float saturation_max = 0;
+  double resolution = 0;
+  double time_base = 0;
+  uint64_t touch_stamp = 0;
+  unsigned ray_update_flags = 0;
+  /// Number of voxels in each region.
+  unsigned region_volume = 0;
+  /// Maintain @c MapChunk::saturated_free_count ? Set when the map saturates at the minimum value.
+  bool track_saturation = false;
+  /// Skip regions where all voxels are saturated free when walking rays? Requires @c track_saturation and no traversal
+  /// layer, as the traversal layer must be updated for every voxel.
+  bool skip_saturated = false;
+};
 
-  const RayFilterFunction ray_filter = map_->rayFilter();
-  const bool use_filter = bool(ray_filter);
-  const auto occupancy_layer = occupancy_layer_;
-  const auto mean_layer = mean_layer_;
-  const auto traversal_layer = traversal_layer_;
-  const auto occupancy_dim = occupancy_dim_;
-  const auto occupancy_threshold_value = map_->occupancyThresholdValue();
-  const auto miss_value = map_->missValue();
-  const auto hit_value = map_->hitValue();
-  const auto resolution = map_->resolution();
-  const auto voxel_min = map_->minVoxelValue();
-  const auto voxel_max = map_->maxVoxelValue();
-  const auto saturation_min = map_->saturateAtMinValue() ? voxel_min : std::numeric_limits<float>::lowest();
-  const auto saturation_max = map_->saturateAtMaxValue() ? voxel_max : std::numeric_limits<float>::max();
+/// Initialise the map derived values of @p ctx and touch the @p map for a new update. Layer indices and the occupancy
+/// layer dimensions must be set by the caller.
+void initUpdateContext(OccupancyUpdateContext &ctx, OccupancyMap *map, const double *timestamps,
+                       unsigned ray_update_flags)
+{
+  ctx.map = map;
+  ctx.timestamps = timestamps;
+  ctx.occupancy_threshold_value = map->occupancyThresholdValue();
+  ctx.miss_value = map->missValue();
+  ctx.hit_value = map->hitValue();
+  ctx.resolution = map->resolution();
+  ctx.voxel_min = map->minVoxelValue();
+  ctx.voxel_max = map->maxVoxelValue();
+  ctx.saturation_min = map->saturateAtMinValue() ? ctx.voxel_min : std::numeric_limits<float>::lowest();
+  ctx.saturation_max = map->saturateAtMaxValue() ? ctx.voxel_max : std::numeric_limits<float>::max();
+  ctx.ray_update_flags = ray_update_flags;
+  ctx.region_volume = unsigned(ctx.occupancy_dim.x) * unsigned(ctx.occupancy_dim.y) * unsigned(ctx.occupancy_dim.z);
+  ctx.track_saturation = map->saturateAtMinValue();
+  ctx.skip_saturated = ctx.track_saturation && ctx.traversal_layer < 0;
   // Touch the map to flag changes.
-  const auto touch_stamp = map_->touch();
+  ctx.touch_stamp = map->touch();
 
   if (timestamps)
   {
     // Update first ray time if not yet set.
-    map_->updateFirstRayTime(*timestamps);
+    map->updateFirstRayTime(*timestamps);
   }
+  ctx.time_base = map->firstRayTime();
+}
 
-  const auto visit_func = [&](const Key &key, double enter_range, double exit_range) -> bool  //
-  {                                                                                           //
-    // The update logic here is a little unclear as it tries to avoid outright branches.
-    // The intended logic is described as follows:
-    // 1. Select direct write or additive adjustment.
-    //    - Make a direct, non-additive adjustment if one of the following conditions are met:
-    //      - stop_adjustments is true
-    //      - the voxel is uncertain
-    //      - ray_update_flags and kRfExclude<Type> flags pass.
-    //      - voxel is saturated
-    //    - Otherwise add to present value.
-    // 2. Select the value adjustment
-    //    - current_value if one of the following conditions are met:
-    //      - stop_adjustments is true (no longer making adjustments)
-    //      - ray_update_flags and kRfExclude<Type> flags pass.
-    //    - miss_value otherwise
-    // 3. Calculate new value
-    // 4. Apply saturation logic: only min saturation relevant
-    //    -
-    MapChunk *chunk =
-      (last_chunk && key.regionKey() == last_chunk->region.coord) ? last_chunk : map_->region(key.regionKey(), true);
-    if (chunk != last_chunk)
+/// Caches the @c VoxelBuffer objects for the last @c MapChunk touched so successive updates in the same region avoid
+/// retaining the voxel blocks again.
+struct ChunkBufferCache
+{
+  MapChunk *chunk = nullptr;
+  MapChunk *mean_chunk = nullptr;
+  VoxelBuffer<VoxelBlock> occupancy_buffer;
+  VoxelBuffer<VoxelBlock> mean_buffer;
+  VoxelBuffer<VoxelBlock> traversal_buffer;
+  VoxelBuffer<VoxelBlock> touch_time_buffer;
+  VoxelBuffer<VoxelBlock> incidents_buffer;
+  VoxelBuffer<VoxelBlock> mask_buffer;
+
+  /// Select @p new_chunk as the current chunk, retaining the required voxel buffers if it has changed.
+  void select(MapChunk *new_chunk, const OccupancyUpdateContext &ctx)
+  {
+    if (new_chunk != chunk)
     {
-      occupancy_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[occupancy_layer]);
-      if (traversal_layer >= 0)
+      occupancy_buffer = VoxelBuffer<VoxelBlock>(new_chunk->voxel_blocks[ctx.occupancy_layer]);
+      if (ctx.track_saturation &&
+          new_chunk->saturated_free_stamp != new_chunk->touched_stamps[ctx.occupancy_layer].load())
       {
-        traversal_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[traversal_layer]);
+        // The occupancy layer has been modified elsewhere. Recount the saturated voxels before updating the count.
+        unsigned saturated_count = 0;
+        for (unsigned i = 0; i < ctx.region_volume; ++i)
+        {
+          float occupancy_value;
+          occupancy_buffer.readVoxel(i, &occupancy_value);
+          saturated_count += (occupancy_value <= ctx.saturation_min) ? 1u : 0u;
+        }
+        new_chunk->saturated_free_count = saturated_count;
+        new_chunk->saturated_free_stamp = new_chunk->touched_stamps[ctx.occupancy_layer].load();
+      }
+      if (ctx.traversal_layer >= 0)
+      {
+        traversal_buffer = VoxelBuffer<VoxelBlock>(new_chunk->voxel_blocks[ctx.traversal_layer]);
       }
-      if (touch_time_layer_ >= 0 && timestamps)
+      if (ctx.touch_time_layer >= 0 && ctx.timestamps)
       {
         // Touch time not required for miss update, but we need it in sync for the update later.
-        touch_time_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[touch_time_layer_]);
+        touch_time_buffer = VoxelBuffer<VoxelBlock>(new_chunk->voxel_blocks[ctx.touch_time_layer]);
       }
-      if (incident_normal_layer_ >= 0)
+      if (ctx.incident_normal_layer >= 0)
       {
         // Incidents not required for miss update, but we need it in sync for the update later.
-        incidents_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[incident_normal_layer_]);
+        incidents_buffer = VoxelBuffer<VoxelBlock>(new_chunk->voxel_blocks[ctx.incident_normal_layer]);
+      }
+      if (ctx.mask_layer >= 0)
+      {
+        // Bring the occupancy mask up to date before maintaining it incrementally. This is a no-op unless the
+        // occupancy layer has been modified elsewhere.
+        updateOccupancyMask(*ctx.map, *new_chunk);
+        mask_buffer = VoxelBuffer<VoxelBlock>(new_chunk->voxel_blocks[ctx.mask_layer]);
       }
     }
-    last_chunk = chunk;
-    const unsigned voxel_index = ohm::voxelIndex(key, occupancy_dim);
-    float occupancy_value;
-    occupancy_buffer.readVoxel(voxel_index, &occupancy_value);
-    const float initial_value = occupancy_value;
-
-    const bool initially_unobserved = initial_value == unobservedOccupancyValue();
-    const bool initially_free = !initially_unobserved && initial_value < occupancy_threshold_value;
-    const bool initially_occupied = !initially_unobserved && initial_value >= occupancy_threshold_value;
-
-    // Calculate the adjustment to make based on the initial occupancy value, various exclusion flags and the configured
-    // value adjustment.
-    float miss_adjustment = miss_value;
-    // The next series of statements are designed to modify the miss_adjustment according to the current voxel state
-    // and the kRfExclude<Type> values. Note that for kRfExcludeUnobserved we set the miss_adjustment such that it keeps
-    // the observesed value, whereas in other cases we set to zero to make for no change. This is because unobserved
-    // values have a value written, whereas other voxels have use addition to adjust the value.
-    miss_adjustment = (initially_unobserved && (ray_update_flags & kRfExcludeUnobserved)) ? unobservedOccupancyValue() :
-                                                                                            miss_adjustment;
-    miss_adjustment = (initially_free && (ray_update_flags & kRfExcludeFree)) ? 0.0f : miss_adjustment;
-    miss_adjustment = (initially_occupied && (ray_update_flags & kRfExcludeOccupied)) ? 0.0f : miss_adjustment;
-
-    occupancyAdjustMiss(&occupancy_value, initial_value, miss_adjustment, unobservedOccupancyValue(), voxel_min,
-                        saturation_min, saturation_max, stop_adjustments);
-    occupancy_buffer.writeVoxel(voxel_index, occupancy_value);
-
-    // Accumulate traversal
-    if (traversal_layer >= 0)
+    chunk = new_chunk;
+  }
+
+  /// Ensure the @c mean_buffer references the current @c chunk . The mean layer is only required for sample updates
+  /// so it is resolved lazily.
+  void selectMean(const OccupancyUpdateContext &ctx)
+  {
+    if (chunk != mean_chunk)
+    {
+      mean_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[ctx.mean_layer]);
+    }
+    mean_chunk = chunk;
+  }
+};
+
+/// Maintain the region summaries of the currently selected @p cache chunk for the voxel at @p voxel_index changing
+/// from @p initial_value to @p value . This covers the @c MapChunk::saturated_free_count and the occupancy mask layer.
+inline void updateRegionSummaries(const OccupancyUpdateContext &ctx, ChunkBufferCache &cache, unsigned voxel_index,
+                                  float initial_value, float value)
+{
+  MapChunk *chunk = cache.chunk;
+  if (ctx.track_saturation)
+  {
+    chunk->saturated_free_count += unsigned(value <= ctx.saturation_min) - unsigned(initial_value <= ctx.saturation_min);
+    chunk->saturated_free_stamp = ctx.touch_stamp;
+  }
+
+  if (ctx.mask_layer >= 0)
+  {
+    const bool initially_observed = initial_value != unobservedOccupancyValue();
+    const bool initially_occupied = initially_observed && initial_value >= ctx.occupancy_threshold_value;
+    const bool observed = value != unobservedOccupancyValue();
+    const bool occupied = observed && value >= ctx.occupancy_threshold_value;
+    if (observed != initially_observed || occupied != initially_occupied)
+    {
+      const unsigned mask_index = voxel_index / kOccupancyMaskVoxelBits;
+      const uint64_t bit = uint64_t(1u) << (voxel_index % kOccupancyMaskVoxelBits);
+      OccupancyMaskVoxel mask;
+      cache.mask_buffer.readVoxel(mask_index, &mask);
+      mask.observed = (observed) ? mask.observed | bit : mask.observed & ~bit;
+      mask.occupied = (occupied) ? mask.occupied | bit : mask.occupied & ~bit;
+      cache.mask_buffer.writeVoxel(mask_index, mask);
+      chunk->observed_voxel_count += unsigned(observed) - unsigned(initially_observed);
+      chunk->occupied_voxel_count += unsigned(occupied) - unsigned(initially_occupied);
+    }
+    chunk->touched_stamps[ctx.mask_layer].store(ctx.touch_stamp, std::memory_order_relaxed);
+  }
+}
+
+
+/// Check if all the voxels in @p chunk are known to be saturated at the minimum value. A miss update cannot change
+/// any voxel in such a region.
+inline bool regionSaturatedFree(const OccupancyUpdateContext &ctx, const MapChunk *chunk)
+{
+  return chunk && chunk->saturated_free_count == ctx.region_volume &&
+         chunk->saturated_free_stamp == chunk->touched_stamps[ctx.occupancy_layer].load(std::memory_order_relaxed);
+}
+
+
+/// Walk the voxels from @p start to @p end using @c walkSegmentKeys() , invoking @p visit_func for each voxel.
+///
+/// When @c OccupancyUpdateContext::skip_saturated is set, voxels in regions for which @c regionSaturatedFree() is true
+/// on entering the region are not visited. The walk itself continues across such regions, so the voxels visited either
+/// side of a skipped region are exactly those of a walk which does not skip, as used by the threaded integration.
+///
+/// @param include_end_point Visit the voxel containing @p end ?
+/// @param[in,out] last_exit_range Set to the exit range of each skipped voxel, matching what @p visit_func tracks for
+///   the sample traversal adjustment.
+/// @param visit_func The voxel visit function. Ranges are relative to @p start .
+template <typename VisitFunc>
+void walkMissKeys(const OccupancyUpdateContext &ctx, const glm::dvec3 &start, const glm::dvec3 &end,
+                  bool include_end_point, double &last_exit_range, VisitFunc &&visit_func)
+{
+  if (!ctx.skip_saturated)
+  {
+    ohm::walkSegmentKeys<Key>(visit_func, start, end, include_end_point, WalkKeyAdaptor(*ctx.map));
+    return;
+  }
+
+  glm::i16vec3 last_region{ 0 };
+  bool have_region = false;
+  bool skip_region = false;
+
+  const auto skip_visit = [&](const Key &key, double enter_range, double exit_range) -> bool  //
+  {
+    if (!have_region || key.regionKey() != last_region)
+    {
+      // Resolve skipping once on entering each region. A ray cannot re-enter a region.
+      have_region = true;
+      last_region = key.regionKey();
+      skip_region = regionSaturatedFree(ctx, ctx.map->region(key.regionKey()));
+    }
+    if (skip_region)
     {
-      float traversal;
-      traversal_buffer.readVoxel(voxel_index, &traversal);
-      traversal += float(exit_range - enter_range);
-      traversal_buffer.writeVoxel(voxel_index, traversal);
+      last_exit_range = exit_range;
+      return true;
     }
+    return visit_func(key, enter_range, exit_range);
+  };
+
+  ohm::walkSegmentKeys<Key>(skip_visit, start, end, include_end_point, WalkKeyAdaptor(*ctx.map));
+}
+
+
+/// Calculate the occupancy value resulting from a miss update on a voxel with the @p initial_value . This applies the
+/// @c kRfExclude<Type> flags and saturation logic, but does not read or write the voxel.
+/// @param[out] initially_occupied Set to true if the @p initial_value is occupied.
+/// @return The updated occupancy value.
+float missOccupancy(const OccupancyUpdateContext &ctx, float initial_value, bool stop_adjustments,
+                    bool *initially_occupied)
+{
+  // The update logic here is a little unclear as it tries to avoid outright branches.
+  // The intended logic is described as follows:
+  // 1. Select direct write or additive adjustment.
+  //    - Make a direct, non-additive adjustment if one of the following conditions are met:
+  //      - stop_adjustments is true
+  //      - the voxel is uncertain
+  //      - ray_update_flags and kRfExclude<Type> flags pass.
+  //      - voxel is saturated
+  //    - Otherwise add to present value.
+  // 2. Select the value adjustment
+  //    - current_value if one of the following conditions are met:
+  //      - stop_adjustments is true (no longer making adjustments)
+  //      - ray_update_flags and kRfExclude<Type> flags pass.
+  //    - miss_value otherwise
+  // 3. Calculate new value
+  // 4. Apply saturation logic: only min saturation relevant
+  //    -
+  const unsigned ray_update_flags = ctx.ray_update_flags;
+  const bool initially_unobserved = initial_value == unobservedOccupancyValue();
+  const bool initially_free = !initially_unobserved && initial_value < ctx.occupancy_threshold_value;
+  const bool initially_occupied_value = !initially_unobserved && initial_value >= ctx.occupancy_threshold_value;
+
+  // Calculate the adjustment to make based on the initial occupancy value, various exclusion flags and the configured
+  // value adjustment.
+  float miss_adjustment = ctx.miss_value;
+  // The next series of statements are designed to modify the miss_adjustment according to the current voxel state
+  // and the kRfExclude<Type> values. Note that for kRfExcludeUnobserved we set the miss_adjustment such that it keeps
+  // the observesed value, whereas in other cases we set to zero to make for no change. This is because unobserved
+  // values have a value written, whereas other voxels have use addition to adjust the value.
+  miss_adjustment = (initially_unobserved && (ray_update_flags & kRfExcludeUnobserved)) ? unobservedOccupancyValue() :
+                                                                                          miss_adjustment;
+  miss_adjustment = (initially_free && (ray_update_flags & kRfExcludeFree)) ? 0.0f : miss_adjustment;
+  miss_adjustment = (initially_occupied_value && (ray_update_flags & kRfExcludeOccupied)) ? 0.0f : miss_adjustment;
+
+  float occupancy_value = initial_value;
+  occupancyAdjustMiss(&occupancy_value, initial_value, miss_adjustment, unobservedOccupancyValue(), ctx.voxel_min,
+                      ctx.saturation_min, ctx.saturation_max, stop_adjustments);
+  *initially_occupied = initially_occupied_value;
+  return occupancy_value;
+}
+
+
+/// Apply a miss update to the voxel at @p key in the currently selected @p cache chunk.
+/// @return True if the voxel was initially occupied.
+bool updateMiss(const OccupancyUpdateContext &ctx, ChunkBufferCache &cache, const Key &key, double enter_range,
+                double exit_range, bool stop_adjustments)
+{
+  MapChunk *chunk = cache.chunk;
+  const unsigned voxel_index = ohm::voxelIndex(key, ctx.occupancy_dim);
+  float initial_value;
+  cache.occupancy_buffer.readVoxel(voxel_index, &initial_value);
+  bool initially_occupied = false;
+  const float occupancy_value = missOccupancy(ctx, initial_value, stop_adjustments, &initially_occupied);
+  cache.occupancy_buffer.writeVoxel(voxel_index, occupancy_value);
+  updateRegionSummaries(ctx, cache, voxel_index, initial_value, occupancy_value);
+
+  // Accumulate traversal
+  if (ctx.traversal_layer >= 0)
+  {
+    float traversal;
+    cache.traversal_buffer.readVoxel(voxel_index, &traversal);
+    traversal += float(exit_range - enter_range);
+    cache.traversal_buffer.writeVoxel(voxel_index, traversal);
+  }
+
+  // Lint(KS): The analyser takes some branches which are not possible in practice.
+  // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
+  chunk->updateFirstValid(voxel_index);
+
+  chunk->setDirtyStamp(ctx.touch_stamp);
+  // Update the touched_stamps with relaxed memory ordering. The important thing is to have an update,
+  // not so much the sequencing. We really don't want to synchronise here.
+  chunk->touched_stamps[ctx.occupancy_layer].store(ctx.touch_stamp, std::memory_order_relaxed);
+
+  return initially_occupied;
+}
+
+/// Calculate the result of a hit update on a voxel with the given @p initial_value . Only calculates the occupancy value.
+/// @return The updated occupancy value.
+inline float hitOccupancy(const OccupancyUpdateContext &ctx, float initial_value)
+{
+  // Like the miss logic, we have similar obfuscation here to avoid branching. It's a little simpler though,
+  // because we do have a branch above, which will filter some of the conditions catered for in miss integration.
+  const unsigned ray_update_flags = ctx.ray_update_flags;
+  const bool initially_unobserved = initial_value == unobservedOccupancyValue();
+  const bool initially_free = !initially_unobserved && initial_value < ctx.occupancy_threshold_value;
+  const bool initially_occupied = !initially_unobserved && initial_value >= ctx.occupancy_threshold_value;
+
+  // Calculate the adjustment to make based on the initial occupancy value, various exclusion flags and the
+  // configured value adjustment (see the equivalent section for the miss update). Note the adjustment for skipping
+  // an initially_unobserved voxel is not zero - it's unobservedOccupancyValue()/infinity to keep the state
+  // unchanged.
+  float hit_adjustment = ctx.hit_value;
+  hit_adjustment =
+    (initially_unobserved && (ray_update_flags & kRfExcludeUnobserved)) ? unobservedOccupancyValue() : hit_adjustment;
+  hit_adjustment = (initially_free && (ray_update_flags & kRfExcludeFree)) ? 0.0f : hit_adjustment;
+  hit_adjustment = (initially_occupied && (ray_update_flags & kRfExcludeOccupied)) ? 0.0f : hit_adjustment;
+
+  // Hit updates are only made when adjustments have not been stopped.
+  float occupancy_value = initial_value;
+  occupancyAdjustHit(&occupancy_value, initial_value, hit_adjustment, unobservedOccupancyValue(), ctx.voxel_max,
+                     ctx.saturation_min, ctx.saturation_max, false);
+  return occupancy_value;
+}
+
+
+/// Apply a hit update to the sample voxel at @p key in the currently selected @p cache chunk.
+/// @param start The (filtered) ray start point.
+/// @param end The (filtered) ray end point.
+/// @param traversal_adjustment Value to add to the traversal layer.
+/// @param ray_index Index of the ray being integrated; used to lookup the ray timestamp.
+void updateHit(const OccupancyUpdateContext &ctx, ChunkBufferCache &cache, const Key &key, const glm::dvec3 &start,
+               const glm::dvec3 &end, double traversal_adjustment, size_t ray_index)
+{
+  MapChunk *chunk = cache.chunk;
+  const unsigned voxel_index = ohm::voxelIndex(key, ctx.occupancy_dim);
+
+  float initial_value;
+  cache.occupancy_buffer.readVoxel(voxel_index, &initial_value);
+  const float occupancy_value = hitOccupancy(ctx, initial_value);
 
+  // update voxel mean if present.
+  unsigned sample_count = 0;
+  if (ctx.mean_layer >= 0)
+  {
+    cache.selectMean(ctx);
+    VoxelMean voxel_mean;
+    cache.mean_buffer.readVoxel(voxel_index, &voxel_mean);
+    voxel_mean.coord =
+      subVoxelUpdate(voxel_mean.coord, voxel_mean.count, end - ctx.map->voxelCentreGlobal(key), ctx.resolution);
+    sample_count = voxel_mean.count;
+    ++voxel_mean.count;
+    cache.mean_buffer.writeVoxel(voxel_index, voxel_mean);
     // Lint(KS): The analyser takes some branches which are not possible in practice.
     // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
-    chunk->updateFirstValid(voxel_index);
+    chunk->touched_stamps[ctx.mean_layer].store(ctx.touch_stamp, std::memory_order_relaxed);
+  }
+  cache.occupancy_buffer.writeVoxel(voxel_index, occupancy_value);
+  updateRegionSummaries(ctx, cache, voxel_index, initial_value, occupancy_value);
 
-    stop_adjustments = stop_adjustments || ((ray_update_flags & kRfStopOnFirstOccupied) && initially_occupied);
-    chunk->dirty_stamp = touch_stamp;
-    // Update the touched_stamps with relaxed memory ordering. The important thing is to have an update,
-    // not so much the sequencing. We really don't want to synchronise here.
-    chunk->touched_stamps[occupancy_layer].store(touch_stamp, std::memory_order_relaxed);
+  // Accumulate traversal
+  if (ctx.traversal_layer >= 0)
+  {
+    float traversal;
+    cache.traversal_buffer.readVoxel(voxel_index, &traversal);
+    traversal += float(traversal_adjustment);
+    cache.traversal_buffer.writeVoxel(voxel_index, traversal);
+  }
+
+  if (ctx.touch_time_layer >= 0 && ctx.timestamps)
+  {
+    const unsigned touch_time = encodeVoxelTouchTime(ctx.time_base, ctx.timestamps[ray_index]);
+    cache.touch_time_buffer.writeVoxel(voxel_index, touch_time);
+  }
+
+  if (ctx.incident_normal_layer >= 0)
+  {
+    unsigned packed_normal{};
+    cache.incidents_buffer.readVoxel(voxel_index, &packed_normal);
+    packed_normal = updateIncidentNormal(packed_normal, start - end, sample_count);
+    cache.incidents_buffer.writeVoxel(voxel_index, packed_normal);
+  }
+
+  // Lint(KS): The analyser takes some branches which are not possible in practice.
+  // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
+  chunk->updateFirstValid(voxel_index);
+
+  chunk->setDirtyStamp(ctx.touch_stamp);
+  // Update the touched_stamps with relaxed memory ordering. The important thing is to have an update,
+  // not so much the sequencing. We really don't want to synchronise here.
+  chunk->touched_stamps[ctx.occupancy_layer].store(ctx.touch_stamp, std::memory_order_relaxed);
+}
+
+/// Index value marking the end of an @c AccumulatedHit list.
+const unsigned kNoAccumulatedHit = ~0u;
+
+/// A sample (hit) update accumulated for a voxel over a ray batch. See @c VoxelAccumulator .
+struct AccumulatedHit
+{
+  unsigned misses_before;  ///< Number of misses for the voxel since its previous hit or the start of the batch.
+  unsigned ray;            ///< Index of the ray which generated the update.
+  unsigned next;           ///< Index of the next hit for the same voxel or @c kNoAccumulatedHit .
+};
+
+/// The accumulated updates for a single voxel over a ray batch. See @c VoxelAccumulator .
+///
+/// Updates are recorded in ray order as a list of hits, each preceded by a number of misses, followed by the trailing
+/// miss count. Dense scans mostly generate voxels with misses only, which need no hit list.
+struct AccumulatedVoxel
+{
+  Key key;             ///< The voxel key. Null for an empty hash slot.
+  unsigned misses;     ///< Number of misses accumulated since the last hit.
+  unsigned first_hit;  ///< Index of the first hit for the voxel or @c kNoAccumulatedHit .
+  unsigned last_hit;   ///< Index of the last hit for the voxel or @c kNoAccumulatedHit .
+  double traversal;    ///< Accumulated traversal distance for all updates.
+};
+
+/// Apply @p miss_count miss updates to @p occupancy_value in sequence, as @c updateMiss() would.
+/// @return The updated occupancy value.
+inline float applyMisses(const OccupancyUpdateContext &ctx, float occupancy_value, unsigned miss_count)
+{
+  // Apply each miss in turn so the clamping, saturation and kRfExclude<Type> transitions match the sequential update.
+  // Stop once the value stops changing as it will not change again.
+  bool initially_occupied = false;
+  for (unsigned i = 0; i < miss_count; ++i)
+  {
+    const float next_value = missOccupancy(ctx, occupancy_value, false, &initially_occupied);
+    if (next_value == occupancy_value)
+    {
+      break;
+    }
+    occupancy_value = next_value;
+  }
+  return occupancy_value;
+}
+
+/// Apply all the accumulated updates for @p voxel in the currently selected @p cache chunk with a single read and write
+/// of each voxel layer. The occupancy, voxel mean, touch time and incident normal results match applying
+/// @c updateMiss() and @c updateHit() in ray order. Only the traversal is summed in a different order.
+/// @param hits The hit list referenced by @p voxel .
+/// @param rays The filtered ray start/end points of the batch.
+void updateAccumulated(const OccupancyUpdateContext &ctx, ChunkBufferCache &cache, const AccumulatedVoxel &voxel,
+                       const std::vector<AccumulatedHit> &hits, const std::vector<glm::dvec3> &rays)
+{
+  MapChunk *chunk = cache.chunk;
+  const unsigned voxel_index = ohm::voxelIndex(voxel.key, ctx.occupancy_dim);
+  float initial_value;
+  cache.occupancy_buffer.readVoxel(voxel_index, &initial_value);
+  float occupancy_value = initial_value;
+
+  if (voxel.first_hit != kNoAccumulatedHit)
+  {
+    VoxelMean voxel_mean{};
+    unsigned packed_normal{};
+    if (ctx.mean_layer >= 0)
+    {
+      cache.selectMean(ctx);
+      cache.mean_buffer.readVoxel(voxel_index, &voxel_mean);
+    }
+    if (ctx.incident_normal_layer >= 0)
+    {
+      cache.incidents_buffer.readVoxel(voxel_index, &packed_normal);
+    }
+
+    const glm::dvec3 voxel_centre = ctx.map->voxelCentreGlobal(voxel.key);
+    unsigned last_ray = 0;
+    for (unsigned h = voxel.first_hit; h != kNoAccumulatedHit; h = hits[h].next)
+    {
+      const AccumulatedHit &hit = hits[h];
+      const glm::dvec3 &start = rays[hit.ray * 2 + 0];
+      const glm::dvec3 &end = rays[hit.ray * 2 + 1];
+      occupancy_value = hitOccupancy(ctx, applyMisses(ctx, occupancy_value, hit.misses_before));
+
+      unsigned sample_count = 0;
+      if (ctx.mean_layer >= 0)
+      {
+        voxel_mean.coord = subVoxelUpdate(voxel_mean.coord, voxel_mean.count, end - voxel_centre, ctx.resolution);
+        sample_count = voxel_mean.count;
+        ++voxel_mean.count;
+      }
+
+      if (ctx.incident_normal_layer >= 0)
+      {
+        packed_normal = updateIncidentNormal(packed_normal, start - end, sample_count);
+      }
+      last_ray = hit.ray;
+    }
+
+    if (ctx.mean_layer >= 0)
+    {
+      cache.mean_buffer.writeVoxel(voxel_index, voxel_mean);
+      chunk->touched_stamps[ctx.mean_layer].store(ctx.touch_stamp, std::memory_order_relaxed);
+    }
+
+    if (ctx.touch_time_layer >= 0 && ctx.timestamps)
+    {
+      const unsigned touch_time = encodeVoxelTouchTime(ctx.time_base, ctx.timestamps[last_ray]);
+      cache.touch_time_buffer.writeVoxel(voxel_index, touch_time);
+    }
 
+    if (ctx.incident_normal_layer >= 0)
+    {
+      cache.incidents_buffer.writeVoxel(voxel_index, packed_normal);
+    }
+  }
+
+  occupancy_value = applyMisses(ctx, occupancy_value, voxel.misses);
+  cache.occupancy_buffer.writeVoxel(voxel_index, occupancy_value);
+  updateRegionSummaries(ctx, cache, voxel_index, initial_value, occupancy_value);
+
+  // Accumulate traversal
+  if (ctx.traversal_layer >= 0)
+  {
+    float voxel_traversal;
+    cache.traversal_buffer.readVoxel(voxel_index, &voxel_traversal);
+    voxel_traversal += float(voxel.traversal);
+    cache.traversal_buffer.writeVoxel(voxel_index, voxel_traversal);
+  }
+
+  // Lint(KS): The analyser takes some branches which are not possible in practice.
+  // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
+  chunk->updateFirstValid(voxel_index);
+
+  chunk->setDirtyStamp(ctx.touch_stamp);
+  chunk->touched_stamps[ctx.occupancy_layer].store(ctx.touch_stamp, std::memory_order_relaxed);
+}
+
+/// A flat, open addressing hash table accumulating the hit and miss updates for a ray batch, keyed by voxel @c Key .
+///
+/// The table uses linear probing over a power of two capacity and marks empty slots with a null key. It only grows
+/// over the course of a batch as there is no need to support removal. Updates must be added in ray order.
+class VoxelAccumulator
+{
+public:
+  /// Create a table with the given initial @p capacity . Must be a power of two.
+  explicit VoxelAccumulator(size_t capacity = 1024u)  // NOLINT(readability-magic-numbers)
+    : slots_(capacity, emptyVoxel())
+  {}
+
+  /// Add a miss for @p key with the given @p traversal distance.
+  void addMiss(const Key &key, double traversal)
+  {
+    AccumulatedVoxel &voxel = lookup(key);
+    ++voxel.misses;
+    voxel.traversal += traversal;
+  }
+
+  /// Add a hit for @p key generated by @p ray with the given @p traversal adjustment.
+  void addHit(const Key &key, double traversal, unsigned ray)
+  {
+    AccumulatedVoxel &voxel = lookup(key);
+    const unsigned hit_index = unsigned(hits_.size());
+    hits_.emplace_back(AccumulatedHit{ voxel.misses, ray, kNoAccumulatedHit });
+    if (voxel.last_hit != kNoAccumulatedHit)
+    {
+      hits_[voxel.last_hit].next = hit_index;
+    }
+    else
+    {
+      voxel.first_hit = hit_index;
+    }
+    voxel.last_hit = hit_index;
+    voxel.misses = 0;
+    voxel.traversal += traversal;
+  }
+
+  /// Move the accumulated voxels into @p voxels , sorted by region then voxel, and the hit lists into @p hits . This
+  /// clears the table.
+  void extract(std::vector<AccumulatedVoxel> &voxels, std::vector<AccumulatedHit> &hits)
+  {
+    voxels.clear();
+    voxels.reserve(count_);
+    for (AccumulatedVoxel &slot : slots_)
+    {
+      if (!slot.key.isNull())
+      {
+        voxels.emplace_back(slot);
+        slot = emptyVoxel();
+      }
+    }
+    count_ = 0;
+    hits.clear();
+    hits.swap(hits_);
+
+    std::sort(voxels.begin(), voxels.end(), [](const AccumulatedVoxel &a, const AccumulatedVoxel &b) {
+      const glm::i16vec3 &ra = a.key.regionKey();
+      const glm::i16vec3 &rb = b.key.regionKey();
+      if (ra != rb)
+      {
+        return std::tie(ra.z, ra.y, ra.x) < std::tie(rb.z, rb.y, rb.x);
+      }
+      const glm::u8vec3 &la = a.key.localKey();
+      const glm::u8vec3 &lb = b.key.localKey();
+      return std::tie(la.z, la.y, la.x) < std::tie(lb.z, lb.y, lb.x);
+    });
+  }
+
+private:
+  static AccumulatedVoxel emptyVoxel()
+  {
+    return AccumulatedVoxel{ Key::kNull, 0, kNoAccumulatedHit, kNoAccumulatedHit, 0 };
+  }
+
+  /// Find or add the entry for @p key .
+  AccumulatedVoxel &lookup(const Key &key)
+  {
+    AccumulatedVoxel *slot = find(key);
+    if (slot->key.isNull())
+    {
+      slot->key = key;
+      if (++count_ * 2 > slots_.size())
+      {
+        grow();
+        slot = find(key);
+      }
+    }
+    return *slot;
+  }
+
+  AccumulatedVoxel *find(const Key &key)
+  {
+    const size_t mask = slots_.size() - 1;
+    size_t index = KeyHash()(key) & mask;
+    while (!slots_[index].key.isNull() && slots_[index].key != key)
+    {
+      index = (index + 1) & mask;
+    }
+    return &slots_[index];
+  }
+
+  void grow()
+  {
+    std::vector<AccumulatedVoxel> old_slots(slots_.size() * 2, emptyVoxel());
+    old_slots.swap(slots_);
+    for (const AccumulatedVoxel &slot : old_slots)
+    {
+      if (!slot.key.isNull())
+      {
+        *find(slot.key) = slot;
+      }
+    }
+  }
+
+  std::vector<AccumulatedVoxel> slots_;
+  std::vector<AccumulatedHit> hits_;
+  size_t count_ = 0;
+};
+
+#ifdef OHM_THREADS
+/// Number of rays walked by each key generation task in threaded integration. Fixed so the generated update order does
+/// not depend on the TBB partitioning.
+const size_t kThreadedRayBatchSize = 256;
+/// Target number of voxel updates buffered by threaded integration before they are applied. The number of batches
+/// walked before applying the updates adapts to meet this target, bounding the memory used regardless of the total ray
+/// length in an @c integrateRays() call.
+const size_t kThreadedUpdateBudget = size_t(1) << 20u;
+/// Maximum number of batches walked before applying the updates in threaded integration.
+const size_t kThreadedMaxWindowBatches = 64;
+
+/// A voxel update generated by the threaded key walk.
+struct RayVoxelUpdate
+{
+  Key key;            ///< The voxel to update.
+  double enter_range; ///< Range at which the ray enters the voxel. Unused for sample updates.
+  double exit_range;  ///< Range at which the ray exits the voxel. Unused for sample updates.
+  unsigned ray;       ///< Index of the ray which generated the update.
+  bool sample;        ///< True for a sample (hit) update, false for a miss update.
+};
+
+/// A run of consecutive @c RayVoxelUpdate items in a batch which all fall in the same region.
+struct RegionUpdateRun
+{
+  glm::i16vec3 region;  ///< The region coordinate.
+  unsigned batch;       ///< Index of the batch containing the updates.
+  size_t begin;         ///< Index of the first update in the batch.
+  size_t count;         ///< Number of updates in the run.
+};
+
+/// Voxel updates generated by walking a batch of rays.
+struct RayBatchUpdates
+{
+  std::vector<RayVoxelUpdate> updates;
+  std::vector<RegionUpdateRun> runs;
+
+  void add(const RayVoxelUpdate &update, unsigned batch)
+  {
+    const glm::i16vec3 region = update.key.regionKey();
+    if (runs.empty() || runs.back().region != region)
+    {
+      runs.emplace_back(RegionUpdateRun{ region, batch, updates.size(), 0 });
+    }
+    ++runs.back().count;
+    updates.emplace_back(update);
+  }
+};
+
+/// All the update runs which target a single region, in ray order.
+struct RegionUpdates
+{
+  MapChunk *chunk = nullptr;
+  std::vector<RegionUpdateRun> runs;
+};
+#endif  // OHM_THREADS
+}  // namespace
+
+
+size_t RayMapperOccupancy::integrateRays(const glm::dvec3 *rays, size_t element_count, const float *intensities,
+                                         const double *timestamps, unsigned ray_update_flags)
+{
+  // Accumulation cannot support kRfStopOnFirstOccupied as each ray must be resolved in order.
+  if (batch_accumulation_ && !(ray_update_flags & kRfStopOnFirstOccupied))
+  {
+    return integrateRaysAccumulated(rays, element_count, intensities, timestamps, ray_update_flags);
+  }
+
+#ifdef OHM_THREADS
+  // Threaded integration cannot support kRfStopOnFirstOccupied as each ray must be resolved in order.
+  if (threaded_ && !(ray_update_flags & kRfStopOnFirstOccupied))
+  {
+    return integrateRaysThreaded(rays, element_count, intensities, timestamps, ray_update_flags);
+  }
+#else   // OHM_THREADS
+  (void)intensities;
+#endif  // OHM_THREADS
+
+  ChunkBufferCache cache;
+  double last_exit_range = 0;
+  bool stop_adjustments = false;
+
+  const RayFilterFunction ray_filter = map_->rayFilter();
+  const bool use_filter = bool(ray_filter);
+
+  OccupancyUpdateContext ctx;
+  ctx.occupancy_layer = occupancy_layer_;
+  ctx.mean_layer = mean_layer_;
+  ctx.traversal_layer = traversal_layer_;
+  ctx.touch_time_layer = touch_time_layer_;
+  ctx.incident_normal_layer = incident_normal_layer_;
+  ctx.mask_layer = mask_layer_;
+  ctx.occupancy_dim = occupancy_dim_;
+  initUpdateContext(ctx, map_, timestamps, ray_update_flags);
+
+  const auto visit_func = [&](const Key &key, double enter_range, double exit_range) -> bool  //
+  {                                                                                           //
+    MapChunk *chunk = (cache.chunk && key.regionKey() == cache.chunk->region.coord) ?
+                        cache.chunk :
+                        map_->region(key.regionKey(), true);
+    cache.select(chunk, ctx);
+    const bool initially_occupied = updateMiss(ctx, cache, key, enter_range, exit_range, stop_adjustments);
+    stop_adjustments = stop_adjustments || ((ray_update_flags & kRfStopOnFirstOccupied) && initially_occupied);
     // Store last exit range for final traversal accumulation.
     last_exit_range = exit_range;
-
     return true;
   };
 
   glm::dvec3 start;
   glm::dvec3 end;
   unsigned filter_flags;
-  double time_base = 0;
-
-  if (timestamps)
-  {
-    // Update first ray time if not yet set.
-    map_->updateFirstRayTime(*timestamps);
-  }
-  time_base = map_->firstRayTime();
 
   for (size_t i = 0; i < element_count; i += 2)
   {
@@ -225,114 +873,349 @@ size_t RayMapperOccupancy::integrateRays(const glm::dvec3 *rays, size_t element_
     if (!(ray_update_flags & kRfExcludeRay))
     {
       stop_adjustments = false;
-      ohm::walkSegmentKeys<Key>(visit_func, start, end, include_sample_in_ray, WalkKeyAdaptor(*map_));
+      walkMissKeys(ctx, start, end, include_sample_in_ray, last_exit_range, visit_func);
     }
 
     if (!stop_adjustments && !include_sample_in_ray && !(ray_update_flags & kRfExcludeSample))
     {
-      // Like the miss logic, we have similar obfuscation here to avoid branching. It's a little simpler though,
-      // because we do have a branch above, which will filter some of the conditions catered for in miss integration.
       const ohm::Key key = map_->voxelKey(end);
-      MapChunk *chunk =
-        (last_chunk && key.regionKey() == last_chunk->region.coord) ? last_chunk : map_->region(key.regionKey(), true);
-      if (chunk != last_chunk)
+      MapChunk *chunk = (cache.chunk && key.regionKey() == cache.chunk->region.coord) ?
+                          cache.chunk :
+                          map_->region(key.regionKey(), true);
+      cache.select(chunk, ctx);
+      updateHit(ctx, cache, key, start, end, glm::length(end - start) - last_exit_range, i >> 1);
+    }
+  }
+
+  return element_count / 2;
+}
+
+
+size_t RayMapperOccupancy::integrateRaysThreaded(const glm::dvec3 *rays, size_t element_count,
+                                                 const float * /*intensities*/, const double *timestamps,
+                                                 unsigned ray_update_flags)
+{
+#ifdef OHM_THREADS
+  const RayFilterFunction ray_filter = map_->rayFilter();
+  const bool use_filter = bool(ray_filter);
+
+  OccupancyUpdateContext ctx;
+  ctx.occupancy_layer = occupancy_layer_;
+  ctx.mean_layer = mean_layer_;
+  ctx.traversal_layer = traversal_layer_;
+  ctx.touch_time_layer = touch_time_layer_;
+  ctx.incident_normal_layer = incident_normal_layer_;
+  ctx.mask_layer = mask_layer_;
+  ctx.occupancy_dim = occupancy_dim_;
+  initUpdateContext(ctx, map_, timestamps, ray_update_flags);
+
+  // The walk must not skip saturated regions as it runs ahead of the updates, so it sees the region state from before
+  // the window rather than the state left by earlier rays. Instead, phase 2 drops the misses in saturated regions as
+  // the updates are applied in ray order, matching the single threaded path.
+  OccupancyUpdateContext walk_ctx = ctx;
+  walk_ctx.skip_saturated = false;
+
+  const size_t ray_count = element_count / 2;
+  const size_t batch_count = (ray_count + kThreadedRayBatchSize - 1) / kThreadedRayBatchSize;
+
+  // The batches are processed in windows: walk the window batches in parallel, then apply their updates. This bounds
+  // the buffered updates to the window rather than the whole call. The window size adapts to the ray lengths to meet
+  // the kThreadedUpdateBudget.
+  size_t window_batches = 8;  // NOLINT(readability-magic-numbers)
+  // Filtered ray start/end points for the window.
+  std::vector<glm::dvec3> filtered_rays;
+  // Exit range of the last voxel visited by each ray's walk in the window. Negative when no voxel was visited.
+  std::vector<double> last_exit_ranges;
+  std::vector<RayBatchUpdates> batches;
+  std::vector<RegionUpdates> regions;
+  std::unordered_map<glm::i16vec3, size_t, Vector3Hash<glm::i16vec3>> region_indices;
+  // Rolling window ring slots used by the current partition of regions.
+  const OccupancyMapDetail &map_detail = *map_->detail();
+  const bool rolling_window = bool(map_detail.ring);
+  std::unordered_set<size_t> ring_slots;
+  // Sample traversal adjustment carried over from previous rays. See below.
+  double last_exit_range = 0;
+
+  size_t window_end = 0;
+  for (size_t window_begin = 0; window_begin < batch_count; window_begin = window_end)
+  {
+    window_end = std::min(window_begin + window_batches, batch_count);
+    const size_t ray_begin = window_begin * kThreadedRayBatchSize;
+    const size_t ray_end = std::min(window_end * kThreadedRayBatchSize, ray_count);
+
+    filtered_rays.resize((ray_end - ray_begin) * 2);
+    last_exit_ranges.assign(ray_end - ray_begin, -1.0);
+    batches.resize(window_end - window_begin);
+    for (RayBatchUpdates &batch : batches)
+    {
+      batch.updates.clear();
+      batch.runs.clear();
+    }
+
+    // Phase 1: walk the rays in parallel to generate voxel updates. Each batch generates its updates in ray order.
+    const auto walk_batches = [&](const tbb::blocked_range<size_t> &range)  //
+    {
+      for (size_t b = range.begin(); b != range.end(); ++b)
       {
-        occupancy_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[occupancy_layer]);
-        if (traversal_layer >= 0)
-        {
-          traversal_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[traversal_layer]);
-        }
-        if (touch_time_layer_ >= 0 && timestamps)
+        RayBatchUpdates &batch = batches[b - window_begin];
+        const size_t batch_ray_end = std::min((b + 1) * kThreadedRayBatchSize, ray_count);
+        for (size_t r = b * kThreadedRayBatchSize; r < batch_ray_end; ++r)
         {
-          touch_time_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[touch_time_layer_]);
-        }
-        if (incident_normal_layer_ >= 0)
-        {
-          incidents_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[incident_normal_layer_]);
+          const size_t local_ray = r - ray_begin;
+          unsigned filter_flags = 0;
+          glm::dvec3 start = rays[r * 2 + 0];
+          glm::dvec3 end = rays[r * 2 + 1];
+
+          if (use_filter)
+          {
+            if (!ray_filter(&start, &end, &filter_flags))
+            {
+              // Bad ray.
+              continue;
+            }
+          }
+
+          filtered_rays[local_ray * 2 + 0] = start;
+          filtered_rays[local_ray * 2 + 1] = end;
+
+          const bool include_sample_in_ray =
+            (filter_flags & kRffClippedEnd) || (ray_update_flags & kRfEndPointAsFree);
+
+          if (!(ray_update_flags & kRfExcludeRay))
+          {
+            const auto visit_func = [&](const Key &key, double enter_range, double exit_range) -> bool  //
+            {
+              batch.add(RayVoxelUpdate{ key, enter_range, exit_range, unsigned(r), false }, unsigned(b - window_begin));
+              last_exit_ranges[local_ray] = exit_range;
+              return true;
+            };
+            walkMissKeys(walk_ctx, start, end, include_sample_in_ray, last_exit_ranges[local_ray], visit_func);
+          }
+
+          if (!include_sample_in_ray && !(ray_update_flags & kRfExcludeSample))
+          {
+            batch.add(RayVoxelUpdate{ map_->voxelKey(end), 0, 0, unsigned(r), true }, unsigned(b - window_begin));
+          }
         }
       }
-      last_chunk = chunk;
-      const unsigned voxel_index = ohm::voxelIndex(key, occupancy_dim);
-
-      float occupancy_value;
-      occupancy_buffer.readVoxel(voxel_index, &occupancy_value);
-      const float initial_value = occupancy_value;
-
-      const bool initially_unobserved = initial_value == unobservedOccupancyValue();
-      const bool initially_free = !initially_unobserved && initial_value < occupancy_threshold_value;
-      const bool initially_occupied = !initially_unobserved && initial_value >= occupancy_threshold_value;
-
-      // Calculate the adjustment to make based on the initial occupancy value, various exclusion flags and the
-      // configured value adjustment (see the equivalent section for the miss update). Note the adjustment for skipping
-      // an initially_unobserved voxel is not zero - it's unobservedOccupancyValue()/infinity to keep the state
-      // unchanged.
-      float hit_adjustment = hit_value;
-      hit_adjustment = (initially_unobserved && (ray_update_flags & kRfExcludeUnobserved)) ?
-                         unobservedOccupancyValue() :
-                         hit_adjustment;
-      hit_adjustment = (initially_free && (ray_update_flags & kRfExcludeFree)) ? 0.0f : hit_adjustment;
-      hit_adjustment = (initially_occupied && (ray_update_flags & kRfExcludeOccupied)) ? 0.0f : hit_adjustment;
-
-      occupancyAdjustHit(&occupancy_value, initial_value, hit_adjustment, unobservedOccupancyValue(), voxel_max,
-                         saturation_min, saturation_max, stop_adjustments);
-
-      // update voxel mean if present.
-      unsigned sample_count = 0;
-      if (mean_layer >= 0)
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(window_begin, window_end), walk_batches);
+
+    // The sample traversal adjustment uses the exit range of the last voxel visited, which carries over from a
+    // previous ray when the current ray visits no voxels. Resolve this in sequence to match the single threaded path.
+    for (double &exit_range : last_exit_ranges)
+    {
+      if (exit_range >= 0)
       {
-        if (chunk != last_mean_chunk)
-        {
-          mean_buffer = VoxelBuffer<VoxelBlock>(chunk->voxel_blocks[mean_layer]);
-        }
-        last_mean_chunk = chunk;
-        VoxelMean voxel_mean;
-        mean_buffer.readVoxel(voxel_index, &voxel_mean);
-        voxel_mean.coord =
-          subVoxelUpdate(voxel_mean.coord, voxel_mean.count, end - map_->voxelCentreGlobal(key), resolution);
-        sample_count = voxel_mean.count;
-        ++voxel_mean.count;
-        mean_buffer.writeVoxel(voxel_index, voxel_mean);
-        // Lint(KS): The analyser takes some branches which are not possible in practice.
-        // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
-        chunk->touched_stamps[mean_layer].store(touch_stamp, std::memory_order_relaxed);
+        last_exit_range = exit_range;
       }
-      occupancy_buffer.writeVoxel(voxel_index, occupancy_value);
+      exit_range = last_exit_range;
+    }
 
-      // Accumulate traversal
-      if (traversal_layer >= 0)
+    // Phase 2: update each region on a worker thread. Updates within a region are strictly ordered by ray.
+    const auto update_regions = [&](const tbb::blocked_range<size_t> &range)  //
+    {
+      for (size_t region_index = range.begin(); region_index != range.end(); ++region_index)
       {
-        float traversal;
-        traversal_buffer.readVoxel(voxel_index, &traversal);
-        traversal += float(glm::length(end - start) - last_exit_range);
-        traversal_buffer.writeVoxel(voxel_index, traversal);
+        const RegionUpdates &region = regions[region_index];
+        ChunkBufferCache cache;
+        cache.select(region.chunk, ctx);
+        // Ray for which skip_ray_misses was last resolved.
+        unsigned skip_ray = ~0u;
+        bool skip_ray_misses = false;
+        for (const RegionUpdateRun &run : region.runs)
+        {
+          const RayVoxelUpdate *updates = batches[run.batch].updates.data() + run.begin;
+          for (size_t u = 0; u < run.count; ++u)
+          {
+            const RayVoxelUpdate &update = updates[u];
+            if (!update.sample)
+            {
+              // Drop misses in saturated regions as the single threaded walk skips these regions. Skipping is resolved
+              // on each ray's first miss in the region, as the single threaded walk does on entering the region.
+              if (ctx.skip_saturated && update.ray != skip_ray)
+              {
+                skip_ray = update.ray;
+                skip_ray_misses = regionSaturatedFree(ctx, region.chunk);
+              }
+              if (!skip_ray_misses)
+              {
+                updateMiss(ctx, cache, update.key, update.enter_range, update.exit_range, false);
+              }
+            }
+            else
+            {
+              const size_t local_ray = update.ray - ray_begin;
+              const glm::dvec3 &start = filtered_rays[local_ray * 2 + 0];
+              const glm::dvec3 &end = filtered_rays[local_ray * 2 + 1];
+              updateHit(ctx, cache, update.key, start, end, glm::length(end - start) - last_exit_ranges[local_ray],
+                        update.ray);
+            }
+          }
+        }
       }
+    };
+    const auto apply_regions = [&]()  //
+    {
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, regions.size()), update_regions);
+      regions.clear();
+      region_indices.clear();
+      ring_slots.clear();
+    };
 
-      if (touch_time_layer_ >= 0 && timestamps)
+
+    // Partition the update runs by region and apply them. Regions are ordered by first touch and the runs for each
+    // region are in ray order. Chunks are created here, in the same order as the single threaded path would create
+    // them.
+    //
+    // In rolling window mode, creating a region may evict another region sharing its ring slot. A partition must not
+    // hold two such regions, so the updates partitioned so far are applied before creating a region which would evict
+    // one in the current partition. This matches the single threaded path, which evicts and recreates regions in ray
+    // order.
+    size_t update_count = 0;
+    for (const RayBatchUpdates &batch : batches)
+    {
+      update_count += batch.updates.size();
+      for (const RegionUpdateRun &run : batch.runs)
       {
-        const unsigned touch_time = encodeVoxelTouchTime(time_base, timestamps[i >> 1]);
-        touch_time_buffer.writeVoxel(voxel_index, touch_time);
+        auto region_iter = region_indices.find(run.region);
+        if (region_iter == region_indices.end())
+        {
+          if (rolling_window && !ring_slots.insert(map_detail.ringIndex(run.region)).second)
+          {
+            // Ring slot collision.
+            apply_regions();
+            ring_slots.insert(map_detail.ringIndex(run.region));
+          }
+          region_iter = region_indices.emplace(run.region, regions.size()).first;
+          regions.emplace_back();
+          regions.back().chunk = map_->region(run.region, true);
+        }
+        regions[region_iter->second].runs.emplace_back(run);
       }
+    }
+    apply_regions();
 
-      if (incident_normal_layer_ >= 0)
+    // Adapt the window size for the next window to the number of updates generated per batch, growing by at most
+    // double.
+    const size_t updates_per_batch = std::max<size_t>(update_count / (window_end - window_begin), 1);
+    window_batches = std::max<size_t>(
+      1, std::min(std::min(kThreadedUpdateBudget / updates_per_batch, window_batches * 2), kThreadedMaxWindowBatches));
+  }
+
+  return ray_count;
+#else   // OHM_THREADS
+  return integrateRays(rays, element_count, nullptr, timestamps, ray_update_flags);
+#endif  // OHM_THREADS
+}
+
+
+size_t RayMapperOccupancy::integrateRaysAccumulated(const glm::dvec3 *rays, size_t element_count,
+                                                    const float * /*intensities*/, const double *timestamps,
+                                                    unsigned ray_update_flags)
+{
+  const RayFilterFunction ray_filter = map_->rayFilter();
+  const bool use_filter = bool(ray_filter);
+
+  OccupancyUpdateContext ctx;
+  ctx.occupancy_layer = occupancy_layer_;
+  ctx.mean_layer = mean_layer_;
+  ctx.traversal_layer = traversal_layer_;
+  ctx.touch_time_layer = touch_time_layer_;
+  ctx.incident_normal_layer = incident_normal_layer_;
+  ctx.mask_layer = mask_layer_;
+  ctx.occupancy_dim = occupancy_dim_;
+  initUpdateContext(ctx, map_, timestamps, ray_update_flags);
+
+  const size_t ray_count = element_count / 2;
+  VoxelAccumulator accumulator;
+  // Filtered ray start/end points.
+  std::vector<glm::dvec3> filtered_rays(ray_count * 2);
+  double last_exit_range = 0;
+
+  const auto visit_func = [&](const Key &key, double enter_range, double exit_range) -> bool  //
+  {
+    accumulator.addMiss(key, exit_range - enter_range);
+    // Store last exit range for final traversal accumulation.
+    last_exit_range = exit_range;
+    return true;
+  };
+
+  // Phase 1: walk the rays, accumulating the hits and misses per voxel in ray order.
+  for (size_t r = 0; r < ray_count; ++r)
+  {
+    unsigned filter_flags = 0;
+    glm::dvec3 start = rays[r * 2 + 0];
+    glm::dvec3 end = rays[r * 2 + 1];
+
+    if (use_filter)
+    {
+      if (!ray_filter(&start, &end, &filter_flags))
       {
-        unsigned packed_normal{};
-        incidents_buffer.readVoxel(voxel_index, &packed_normal);
-        packed_normal = updateIncidentNormal(packed_normal, start - end, sample_count);
-        incidents_buffer.writeVoxel(voxel_index, packed_normal);
+        // Bad ray.
+        continue;
       }
+    }
+
+    filtered_rays[r * 2 + 0] = start;
+    filtered_rays[r * 2 + 1] = end;
 
-      // Lint(KS): The analyser takes some branches which are not possible in practice.
-      // NOLINTNEXTLINE(clang-analyzer-core.CallAndMessage)
-      chunk->updateFirstValid(voxel_index);
+    const bool include_sample_in_ray = (filter_flags & kRffClippedEnd) || (ray_update_flags & kRfEndPointAsFree);
+
+    if (!(ray_update_flags & kRfExcludeRay))
+    {
+      walkMissKeys(ctx, start, end, include_sample_in_ray, last_exit_range, visit_func);
+    }
 
-      chunk->dirty_stamp = touch_stamp;
-      // Update the touched_stamps with relaxed memory ordering. The important thing is to have an update,
-      // not so much the sequencing. We really don't want to synchronise here.
-      chunk->touched_stamps[occupancy_layer].store(touch_stamp, std::memory_order_relaxed);
+    if (!include_sample_in_ray && !(ray_update_flags & kRfExcludeSample))
+    {
+      accumulator.addHit(map_->voxelKey(end), glm::length(end - start) - last_exit_range, unsigned(r));
     }
   }
 
-  return element_count / 2;
+  // Phase 2: apply the combined updates once per voxel, in region order.
+  std::vector<AccumulatedVoxel> voxels;
+  std::vector<AccumulatedHit> hits;
+  accumulator.extract(voxels, hits);
+  ChunkBufferCache cache;
+  for (const AccumulatedVoxel &voxel : voxels)
+  {
+    MapChunk *chunk = (cache.chunk && voxel.key.regionKey() == cache.chunk->region.coord) ?
+                        cache.chunk :
+                        map_->region(voxel.key.regionKey(), true);
+    cache.select(chunk, ctx);
+    updateAccumulated(ctx, cache, voxel, hits, filtered_rays);
+  }
+
+  return ray_count;
+}
+
+
+void RayMapperOccupancy::setThreaded(bool threaded)
+{
+  threaded_ = threaded;
+}
+
+
+bool RayMapperOccupancy::threaded() const
+{
+#ifdef OHM_THREADS
+  return threaded_;
+#else   // OHM_THREADS
+  return false;
+#endif  // OHM_THREADS
+}
+
+
+void RayMapperOccupancy::setBatchAccumulation(bool accumulate)
+{
+  batch_accumulation_ = accumulate;
+}
+
+
+bool RayMapperOccupancy::batchAccumulation() const
+{
+  return batch_accumulation_;
 }
 
 
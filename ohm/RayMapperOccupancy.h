@@ -25,6 +25,28 @@ namespace ohm
 /// The @c integrateRays() implementation performs a single threaded walk of the voxels to update and touches
 /// those voxels one at a time, updating their occupancy value. The given @c OccupancyMap must have an occupancy
 /// layer and may have a @c VoxelMean layer.
+///
+/// A threaded integration mode may be enabled via @c setThreaded() when ohm is built with @c OHM_THREADS . In this
+/// mode each ray batch is first walked in parallel to generate the voxel keys to update. These keys are partitioned by
+/// @c MapChunk region and each region is then updated by a worker thread. Updates within a region are made in the
+/// original ray order so the results are identical to the single threaded update. Rays are processed in windows of
+/// batches sized to limit the number of buffered voxel updates, so memory usage does not grow with the total ray length
+/// of an @c integrateRays() call.
+///
+/// When the map saturates at the minimum value (see @c OccupancyMap::setSaturateAtMinValue() ), each region tracks the
+/// number of its voxels which are saturated free in @c MapChunk::saturated_free_count . A miss update cannot change a
+/// saturated voxel so rays jump across regions where every voxel is saturated without visiting those voxels. This is
+/// disabled when the map has a traversal layer, which must be updated for every voxel traversed. Threaded integration
+/// still walks these regions, but drops the miss updates for regions which are saturated when the updates are applied.
+///
+/// The occupancy mask layer is maintained incrementally when present in the map. See @c addOccupancyMask() .
+///
+/// A batch accumulation mode may be enabled via @c setBatchAccumulation() . Dense scans revisit the voxels near the
+/// sensor many times per batch, so this mode first accumulates the hit and miss updates per voxel for the whole ray
+/// batch, then reads and writes each voxel once to apply the combined update. Each voxel records its misses as counts
+/// between its hits, preserving the ray order of the updates. The combined update steps through these in registers, so
+/// clamping, saturation and the @c kRfExclude<Type> flags behave exactly as for a sequential update. Only the traversal
+/// layer may differ in the last bits as the traversal is summed per voxel before it is added.
 class ohm_API RayMapperOccupancy : public RayMapper
 {
 public:
@@ -78,17 +100,54 @@ public:
   size_t lookupRays(const glm::dvec3 *rays, size_t element_count, float *newly_observed_volumes, float *ranges,
                     OccupancyType *terminal_states);
 
+  /// Enable or disable threaded ray integration. Only has an effect when ohm is built with @c OHM_THREADS .
+  ///
+  /// Threaded integration is not used when @c kRfStopOnFirstOccupied is set as each ray must then be resolved in
+  /// sequence. The single threaded path is used in that case. Note that the @c OccupancyMap::rayFilter() is invoked
+  /// from multiple threads in this mode.
+  /// @param threaded True to enable threaded integration.
+  void setThreaded(bool threaded);
+
+  /// Is threaded ray integration enabled? Always false when ohm is built without @c OHM_THREADS .
+  /// @return True if threaded integration is enabled.
+  bool threaded() const;
+
+  /// Enable or disable per batch accumulation of voxel updates. Takes precedence over @c setThreaded() .
+  ///
+  /// Accumulation is not used when @c kRfStopOnFirstOccupied is set as each ray must then be resolved in sequence.
+  /// @param accumulate True to enable batch accumulation.
+  void setBatchAccumulation(bool accumulate);
+
+  /// Is per batch accumulation of voxel updates enabled?
+  /// @return True if batch accumulation is enabled.
+  bool batchAccumulation() const;
+
   using RayMapper::integrateRays;
 
 protected:
+  /// Threaded implementation of @c integrateRays() . Only available with @c OHM_THREADS .
+  ///
+  /// Parameters match @c integrateRays() .
+  size_t integrateRaysThreaded(const glm::dvec3 *rays, size_t element_count, const float *intensities,
+                               const double *timestamps, unsigned ray_update_flags);
+
+  /// Batch accumulation implementation of @c integrateRays() . See @c setBatchAccumulation() .
+  ///
+  /// Parameters match @c integrateRays() .
+  size_t integrateRaysAccumulated(const glm::dvec3 *rays, size_t element_count, const float *intensities,
+                                  const double *timestamps, unsigned ray_update_flags);
+
   OccupancyMap *map_ = nullptr;           ///< Target map.
   int occupancy_layer_ = -1;              ///< Cached occupancy layer index.
   int mean_layer_ = -1;                   ///< Cached voxel mean layer index.
   int traversal_layer_ = -1;              ///< The traversal layer index.
   int touch_time_layer_ = -1;             ///< Cache touch time layer index.
   int incident_normal_layer_ = -1;        ///< Cache incident normal layer index.
+  int mask_layer_ = -1;                   ///< Cached occupancy mask layer index. See @c addOccupancyMask() .
   glm::u8vec3 occupancy_dim_{ 0, 0, 0 };  ///< Cached occupancy layer voxel dimensions. Voxel mean must exactly match.
   bool valid_ = false;                    ///< Has layer validation passed?
+  bool threaded_ = false;                 ///< Use threaded integration? See @c setThreaded() .
+  bool batch_accumulation_ = false;       ///< Accumulate updates per batch? See @c setBatchAccumulation() .
 };
 
 }  // namespace ohm
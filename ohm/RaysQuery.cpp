@@ -11,6 +11,7 @@
 #include "KeyList.h"
 #include "MapLayer.h"
 #include "MapLayout.h"
+#include "OccupancyLod.h"
 #include "OccupancyMap.h"
 #include "Voxel.h"
 #include "VoxelBuffer.h"
@@ -19,8 +20,83 @@
 
 #include <ohmutil/LineWalk.h>
 
+#include <functional>
+
 namespace ohm
 {
+namespace
+{
+/// Key for a cell of an occupancy LOD layer: the global coordinates of the cell at the layer's level of detail.
+struct LodKey
+{
+  glm::ivec3 coord{ 0 };  ///< Global cell coordinates.
+  bool null = false;      ///< Null key marker.
+
+  inline bool axisMatches(int axis, const LodKey &other) const { return coord[axis] == other.coord[axis]; }
+  inline bool operator==(const LodKey &other) const { return null == other.null && coord == other.coord; }
+  inline bool operator!=(const LodKey &other) const { return !(*this == other); }
+};
+
+
+/// Floor division of @p value by @p divisor .
+inline int floorDiv(int value, int divisor)
+{
+  return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+
+/// A key adaptor for walking the cells of an occupancy LOD layer using @c walkSegmentKeys() .
+struct LodKeyAdaptor
+{
+  const OccupancyMap *map = nullptr;  ///< The map being walked.
+  glm::ivec3 region_dim{ 0 };         ///< Region voxel dimensions.
+  glm::dvec3 origin_centre{ 0 };      ///< Centre of the voxel at global voxel coordinates zero.
+  double resolution = 0;              ///< Map resolution.
+  glm::ivec3 cell_size{ 1 };          ///< Number of voxels along each axis of a cell.
+
+  inline double voxelResolution(int axis) const { return resolution * cell_size[axis]; }
+  inline LodKey voxelKey(const glm::dvec3 &pt) const
+  {
+    const Key key = map->voxelKey(pt);
+    LodKey lod_key;
+    lod_key.null = key.isNull();
+    if (!lod_key.null)
+    {
+      const glm::ivec3 voxel = glm::ivec3(key.regionKey()) * region_dim + glm::ivec3(key.localKey());
+      for (int i = 0; i < 3; ++i)
+      {
+        lod_key.coord[i] = floorDiv(voxel[i], cell_size[i]);
+      }
+    }
+    return lod_key;
+  }
+  static inline bool isNull(const LodKey &key) { return key.null; }
+  inline glm::dvec3 voxelCentre(const LodKey &key) const
+  {
+    return origin_centre +
+           (glm::dvec3(key.coord) * glm::dvec3(cell_size) + 0.5 * glm::dvec3(cell_size - 1)) * resolution;
+  }
+  static inline void stepKey(LodKey &key, int axis, int dir) { key.coord[axis] += dir; }
+};
+
+
+/// Occupancy LOD layer details used to walk rays. A level with no @c layer walks whole regions.
+struct LodLevel
+{
+  LodKeyAdaptor adaptor;                 ///< Cell key adaptor.
+  glm::ivec3 cell_dim{ 0 };              ///< Number of cells in each region.
+  unsigned cell_volume = 0;              ///< Number of voxels in each cell.
+  int layer = -1;                        ///< LOD layer index or -1 for the region level.
+  int stamp_layer = -1;                  ///< LOD layer used to check the region is up to date.
+  glm::i16vec3 last_region{ 0 };         ///< Key of the last region accessed.
+  bool have_region = false;              ///< True once @c last_region is valid.
+  bool region_present = false;           ///< True if the @c last_region exists in the map.
+  bool up_to_date = false;               ///< True if the @c last_region LOD layer is up to date.
+  VoxelBuffer<const VoxelBlock> buffer;  ///< LOD layer buffer for @c last_region when @c up_to_date .
+};
+}  // namespace
+
+
 RaysQuery::RaysQuery(RaysQueryDetail *detail)
   : Query(detail)
 {}
@@ -124,6 +200,10 @@ bool RaysQuery::onExecute()
   const auto occupancy_dim = d->occupancy_dim;
   const auto occupancy_threshold_value = map->occupancyThresholdValue();
   const auto volume_coefficient = d->volume_coefficient;
+  glm::dvec3 start;
+  glm::dvec3 end;
+  glm::dvec3 direction;
+  double length = 0;
 
   const auto visit_func = [&](const Key &key, double enter_range, double exit_range)  //
   {                                                                                   //
@@ -158,14 +238,196 @@ bool RaysQuery::onExecute()
     return !is_occupied;
   };
 
+  // Resolve the occupancy LOD levels to walk: a region level, which skips missing regions and walks regions with stale
+  // LOD layers at the map resolution, followed by the coarsest LOD layer. Cells which cannot be skipped descend directly
+  // to the map resolution; walking the intermediate levels costs more than it saves.
+  std::vector<LodLevel> lod_levels;
+  if (!(d->query_flags & kQfIgnoreOccupancyLod))
+  {
+    const glm::ivec3 region_dim = map->regionVoxelDimensions();
+    LodLevel lod;
+    lod.adaptor.map = map;
+    lod.adaptor.region_dim = region_dim;
+    lod.adaptor.origin_centre = map->voxelCentreGlobal(Key(glm::i16vec3(0), 0, 0, 0));
+    lod.adaptor.resolution = map->resolution();
+    for (unsigned level = kOccupancyLodMaxLevel; level > 0; --level)
+    {
+      const int lod_layer = occupancyLodLayer(*map, level);
+      if (lod_layer >= 0)
+      {
+        if (lod_levels.empty())
+        {
+          lod.adaptor.cell_size = region_dim;
+          lod.cell_dim = glm::ivec3(1);
+          lod.cell_volume = unsigned(region_dim.x * region_dim.y * region_dim.z);
+          lod.stamp_layer = lod_layer;
+          lod_levels.emplace_back(lod);
+        }
+        lod.adaptor.cell_size = glm::ivec3(1 << level);
+        lod.cell_dim = region_dim / lod.adaptor.cell_size;
+        lod.cell_volume = occupancyLodCellVolume(level);
+        lod.layer = lod.stamp_layer = lod_layer;
+        lod_levels.emplace_back(lod);
+        break;
+      }
+    }
+  }
+
+  // Offset applied to move LOD cell boundaries into the cell when walking a finer level.
+  const double boundary_offset = 1e-6 * map->resolution();
+
+  // Skip [enter_range, exit_range] of the current ray, wholly of the given occupancy_type.
+  const auto skip_func = [&](double enter_range, double exit_range, OccupancyType occupancy_type)  //
+  {                                                                                              //
+    unobserved_volume +=
+      (occupancy_type == OccupancyType::kUnobserved) ?
+        (volume_coefficient * (exit_range * exit_range * exit_range - enter_range * enter_range * enter_range)) :
+        0.0;
+    range = float(exit_range);
+    terminal_state = occupancy_type;
+    // Terminal key is the last voxel in the skipped range.
+    terminal_key = (exit_range < length) ?
+                     map->voxelKey(start + direction * std::max(enter_range, exit_range - boundary_offset)) :
+                     map->voxelKey(end);
+  };
+
+  // Classify an LOD cell as entirely kFree, entirely kUnobserved or kNull when it must be resolved at a finer level.
+  const auto classify_cell = [&](LodLevel &lod, const LodKey &cell) -> OccupancyType  //
+  {                                                                                   //
+    glm::i16vec3 region_key;
+    glm::ivec3 local_cell;
+    for (int i = 0; i < 3; ++i)
+    {
+      region_key[i] = int16_t(floorDiv(cell.coord[i], lod.cell_dim[i]));
+      local_cell[i] = cell.coord[i] - int(region_key[i]) * lod.cell_dim[i];
+    }
+
+    if (!lod.have_region || region_key != lod.last_region)
+    {
+      const MapChunk *chunk = map->region(region_key);
+      lod.have_region = true;
+      lod.last_region = region_key;
+      lod.region_present = chunk != nullptr;
+      lod.up_to_date = chunk && occupancyLodUpToDate(*chunk, occupancy_layer, lod.stamp_layer);
+      lod.buffer = (lod.up_to_date && lod.layer >= 0) ? VoxelBuffer<const VoxelBlock>(chunk->voxel_blocks[lod.layer]) :
+                                                        VoxelBuffer<const VoxelBlock>();
+    }
+
+    if (!lod.region_present)
+    {
+      // Unknown regions are entirely unobserved.
+      return OccupancyType::kUnobserved;
+    }
+
+    if (!lod.up_to_date || lod.layer < 0)
+    {
+      return OccupancyType::kNull;
+    }
+
+    OccupancyLodVoxel lod_voxel{};
+    lod.buffer.readVoxel(voxelIndex(unsigned(local_cell.x), unsigned(local_cell.y), unsigned(local_cell.z),
+                                    lod.cell_dim.x, lod.cell_dim.y, lod.cell_dim.z),
+                         &lod_voxel);
+    if (lod_voxel.unobserved_count == lod.cell_volume)
+    {
+      return OccupancyType::kUnobserved;
+    }
+    if (lod_voxel.unobserved_count == 0 && lod_voxel.occupancy <= occupancy_threshold_value)
+    {
+      return OccupancyType::kFree;
+    }
+    return OccupancyType::kNull;
+  };
+
+  // Range of the current ray resolved by walking regions with stale LOD layers at the map resolution.
+  double resolved_range = 0;
+  // Set while walking a run of regions with stale LOD layers, with stale_region the current region.
+  bool stale_run = false;
+  glm::i16vec3 stale_region{ 0 };
+
+  // Walk [enter_range, exit_range] of the current ray at lod_levels[level_index] or at the map resolution when
+  // level_index is beyond the LOD levels. Returns false once an occupied voxel is reached.
+  std::function<bool(size_t, double, double)> walk_level;
+  walk_level = [&](size_t level_index, double enter_range, double exit_range) -> bool  //
+  {                                                                                   //
+    // Nudge the segment into the cell, except at the ray extents, so that the finer walk does not visit neighbouring
+    // cells.
+    double segment_enter = (enter_range > 0) ? enter_range + boundary_offset : 0.0;
+    double segment_exit = (exit_range < length) ? exit_range - boundary_offset : length;
+    if (segment_exit < segment_enter)
+    {
+      segment_enter = segment_exit = 0.5 * (enter_range + exit_range);
+    }
+    const glm::dvec3 segment_start = (segment_enter > 0) ? start + direction * segment_enter : start;
+    const glm::dvec3 segment_end = (segment_exit < length) ? start + direction * segment_exit : end;
+    const double segment_length = glm::length(segment_end - segment_start);
+
+    // Convert walk ranges to ray ranges. The first and last ranges extend to the unnudged range.
+    const auto to_ray_range = [enter_range, exit_range, segment_enter, segment_length](double walk_range) {
+      return (walk_range <= 0) ? enter_range : ((walk_range >= segment_length) ? exit_range : segment_enter + walk_range);
+    };
+
+    if (level_index >= lod_levels.size())
+    {
+      const auto fine_visit = [&](const Key &key, double walk_enter, double walk_exit) {
+        const double voxel_enter = to_ray_range(walk_enter);
+        if (stale_run && key.regionKey() != stale_region)
+        {
+          const MapChunk *chunk = map->region(key.regionKey());
+          if (!chunk || occupancyLodUpToDate(*chunk, occupancy_layer, lod_levels.front().stamp_layer))
+          {
+            // Resume walking the LOD layers from this voxel.
+            resolved_range = voxel_enter;
+            return false;
+          }
+          stale_region = key.regionKey();
+        }
+        return visit_func(key, voxel_enter, to_ray_range(walk_exit));
+      };
+      resolved_range = (stale_run) ? exit_range : resolved_range;
+      ohm::walkSegmentKeys<Key>(fine_visit, segment_start, segment_end, true, WalkKeyAdaptor(*map));
+      return terminal_state != OccupancyType::kOccupied;
+    }
+
+    LodLevel &lod = lod_levels[level_index];
+    bool keep_walking = true;
+    const auto cell_visit = [&](const LodKey &cell, double walk_enter, double walk_exit) {
+      const double cell_enter = to_ray_range(walk_enter);
+      const double cell_exit = to_ray_range(walk_exit);
+      if (cell_exit <= resolved_range + boundary_offset)
+      {
+        // Already walked at the map resolution.
+        return true;
+      }
+      const OccupancyType cell_type = classify_cell(lod, cell);
+      if (cell_type != OccupancyType::kNull)
+      {
+        skip_func(cell_enter, cell_exit, cell_type);
+        return true;
+      }
+      if (!lod.up_to_date)
+      {
+        // Walk the run of regions with stale LOD layers at the map resolution, rather than restarting the walk for
+        // each region.
+        stale_run = true;
+        stale_region = lod.last_region;
+        keep_walking = walk_level(lod_levels.size(), cell_enter, length);
+        stale_run = false;
+        return keep_walking;
+      }
+      keep_walking = walk_level(level_index + 1, cell_enter, cell_exit);
+      return keep_walking;
+    };
+    ohm::walkSegmentKeys<LodKey>(cell_visit, segment_start, segment_end, true, lod.adaptor);
+    return keep_walking;
+  };
+
   // Size the output arrays.
   d->ranges.reserve(d->rays_in.size() / 2);
   d->intersected_voxels.reserve(d->rays_in.size() / 2);
   d->unobserved_volumes_out.reserve(d->rays_in.size() / 2);
   d->terminal_states_out.reserve(d->rays_in.size() / 2);
 
-  glm::dvec3 start;
-  glm::dvec3 end;
   unsigned filter_flags;
   for (size_t i = 0; i < d->rays_in.size(); i += 2)
   {
@@ -186,7 +448,18 @@ bool RaysQuery::onExecute()
       continue;
     }
 
-    ohm::walkSegmentKeys<Key>(visit_func, start, end, true, WalkKeyAdaptor(*map));
+    direction = end - start;
+    length = glm::length(direction);
+    if (lod_levels.empty() || length < boundary_offset)
+    {
+      ohm::walkSegmentKeys<Key>(visit_func, start, end, true, WalkKeyAdaptor(*map));
+    }
+    else
+    {
+      direction *= 1.0 / length;
+      resolved_range = 0;
+      walk_level(0, 0.0, length);
+    }
 
     d->ranges.emplace_back(range);
     d->unobserved_volumes_out.emplace_back(unobserved_volume);
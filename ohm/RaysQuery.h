@@ -41,6 +41,14 @@ struct RaysQueryDetail;
 /// Where @c enter_range and @c exit_range are the ranges at which the ray enters and leaves a voxel respectively.
 /// This value is accumulated for each unobserved or null voxel.
 ///
+/// When the map has up to date occupancy level of detail layers (see @c OccupancyLodProcess ), the query first walks
+/// each ray region by region, skipping regions which have not been allocated, then through the cells of the coarsest
+/// LOD layer, skipping cells which are entirely free or entirely unobserved. Only the remaining cells are walked at the
+/// map resolution. Finer LOD layers are not used as their per cell overhead outweighs the voxels they save. Regions
+/// with out of date LOD layers are walked at the map resolution. The results are equivalent to walking the map
+/// resolution voxels, but long rays through open or unexplored space visit far fewer voxels. This behaviour may
+/// be disabled using @c kQfIgnoreOccupancyLod .
+///
 /// Note: on a hard reset, the set of rays is cleared, while a soft reset leaves the ray set unchanged.
 class ohm_API RaysQuery : public Query
 {
@@ -48,6 +56,13 @@ public:
   /// Default flags to execute this query with.
   static const unsigned kDefaultFlags = kQfNoCache;
 
+  /// Extended query flags for @c RaysQuery.
+  enum QueryFlag : unsigned
+  {
+    /// Always walk the rays at the map resolution, ignoring any occupancy level of detail layers.
+    kQfIgnoreOccupancyLod = (kQfSpecialised << 0u),
+  };
+
 protected:
   /// Constructor used for inherited objects. This supports deriving @p LineQueryDetail into
   /// more specialised forms.
@@ -0,0 +1,361 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "RegionPrefetch.h"
+
+#include "Aabb.h"
+#include "MapChunk.h"
+#include "OccupancyMap.h"
+#include "VoxelBlock.h"
+
+#include "private/OccupancyMapDetail.h"
+
+#include <ohmutil/VectorHash.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace ohm
+{
+/// A region tracked by a @c RegionPrefetch .
+struct PrefetchRegion
+{
+  /// The chunk the @c blocks were retained from. Null until prefetched.
+  const MapChunk *chunk = nullptr;
+  /// Retained voxel blocks.
+  std::vector<VoxelBlock *> blocks;
+  /// Identifies the request which created this entry. Distinguishes a region released and requested again while the
+  /// workers are processing it.
+  uint64_t request_id = 0;
+  /// True once prefetched and pinned.
+  bool pinned = false;
+};
+
+
+/// @c RegionPrefetch internals.
+struct RegionPrefetchDetail
+{
+  /// Pending work item.
+  struct WorkItem
+  {
+    glm::i16vec3 region_key;
+    uint64_t request_id;
+  };
+
+  OccupancyMap *map = nullptr;
+  /// Requested regions, both pending and pinned.
+  std::unordered_map<glm::i16vec3, PrefetchRegion, Vector3Hash<glm::i16vec3>> regions;
+  /// Queue of regions to prefetch.
+  std::deque<WorkItem> pending;
+  /// Number of items popped from @c pending which the workers have yet to complete.
+  size_t in_flight = 0;
+  /// Number of entries in @c regions which are pinned.
+  size_t pinned_count = 0;
+  /// Next value for @c PrefetchRegion::request_id .
+  uint64_t next_request_id = 1;
+  /// Worker threads.
+  std::vector<std::thread> workers;
+  /// Access mutex for all members.
+  mutable std::mutex lock;
+  /// Condition used to wake the workers.
+  std::condition_variable wake_condition;
+  /// Condition notified when the workers go idle.
+  mutable std::condition_variable idle_condition;
+  /// Worker quit flag.
+  bool quit = false;
+};
+
+
+namespace
+{
+/// Check if @p chunk , prefetched for @p region_key , is still held by the map, and hence so are its blocks.
+///
+/// In rolling window mode, the chunk may have been recycled in place for another region sharing its ring slot. The
+/// recycled chunk keeps the same voxel blocks, so is still considered resident.
+bool chunkResident(const OccupancyMap &map, const glm::i16vec3 &region_key, const MapChunk *chunk)
+{
+  const OccupancyMapDetail &detail = *map.detail();
+  if (detail.ring)
+  {
+    return detail.ring[detail.ringIndex(region_key)].chunk.load() == chunk;
+  }
+  return detail.findChunk(region_key) == chunk;
+}
+
+
+/// Release the retained blocks of @p region .
+void releaseBlocks(const OccupancyMap &map, const glm::i16vec3 &region_key, PrefetchRegion &region)
+{
+  // Guard against the region having been removed, in which case the blocks have been destroyed.
+  if (!region.blocks.empty() && chunkResident(map, region_key, region.chunk))
+  {
+    for (VoxelBlock *block : region.blocks)
+    {
+      block->release();
+    }
+  }
+  region.blocks.clear();
+}
+
+
+/// Notify threads blocked in @c RegionPrefetch::wait() if there is no more work. Call with the lock held.
+void notifyIfIdle(RegionPrefetchDetail &detail)
+{
+  if (detail.pending.empty() && detail.in_flight == 0)
+  {
+    detail.idle_condition.notify_all();
+  }
+}
+
+
+/// Enumerate the region keys overlapping @p box .
+template <typename Func>
+void forEachRegionKey(const OccupancyMap &map, const Aabb &box, Func &&func)
+{
+  const glm::i16vec3 min_key = map.regionKey(box.minExtents());
+  const glm::i16vec3 max_key = map.regionKey(box.maxExtents());
+  glm::i16vec3 key;
+  for (key.z = min_key.z; key.z <= max_key.z; ++key.z)
+  {
+    for (key.y = min_key.y; key.y <= max_key.y; ++key.y)
+    {
+      for (key.x = min_key.x; key.x <= max_key.x; ++key.x)
+      {
+        func(key);
+      }
+    }
+  }
+}
+}  // namespace
+
+
+RegionPrefetch::RegionPrefetch(OccupancyMap &map, unsigned worker_count)
+  : imp_(std::make_unique<RegionPrefetchDetail>())
+{
+  imp_->map = &map;
+  worker_count = std::max(worker_count, 1u);
+  for (unsigned i = 0; i < worker_count; ++i)
+  {
+    imp_->workers.emplace_back([this]() { run(); });
+  }
+}
+
+
+RegionPrefetch::~RegionPrefetch()
+{
+  {
+    std::unique_lock<std::mutex> guard(imp_->lock);
+    imp_->quit = true;
+  }
+  imp_->wake_condition.notify_all();
+  for (auto &worker : imp_->workers)
+  {
+    worker.join();
+  }
+  releaseAll();
+}
+
+
+OccupancyMap &RegionPrefetch::map() const
+{
+  return *imp_->map;
+}
+
+
+size_t RegionPrefetch::request(const glm::i16vec3 *region_keys, size_t count)
+{
+  size_t added = 0;
+  {
+    std::unique_lock<std::mutex> guard(imp_->lock);
+    for (size_t i = 0; i < count; ++i)
+    {
+      PrefetchRegion &region = imp_->regions[region_keys[i]];
+      if (region.request_id == 0)
+      {
+        // New entry.
+        region.request_id = imp_->next_request_id++;
+        imp_->pending.emplace_back(RegionPrefetchDetail::WorkItem{ region_keys[i], region.request_id });
+        ++added;
+      }
+    }
+  }
+
+  if (added)
+  {
+    imp_->wake_condition.notify_all();
+  }
+  return added;
+}
+
+
+size_t RegionPrefetch::request(const std::vector<glm::i16vec3> &region_keys)
+{
+  return request(region_keys.data(), region_keys.size());
+}
+
+
+size_t RegionPrefetch::request(const Aabb &box)
+{
+  std::vector<glm::i16vec3> region_keys;
+  forEachRegionKey(*imp_->map, box, [&region_keys](const glm::i16vec3 &key) { region_keys.emplace_back(key); });
+  return request(region_keys);
+}
+
+
+size_t RegionPrefetch::release(const glm::i16vec3 *region_keys, size_t count)
+{
+  size_t released = 0;
+  std::unique_lock<std::mutex> guard(imp_->lock);
+  for (size_t i = 0; i < count; ++i)
+  {
+    auto search = imp_->regions.find(region_keys[i]);
+    if (search != imp_->regions.end())
+    {
+      // Pending work items for the region are skipped by the workers once the entry is removed.
+      if (search->second.pinned)
+      {
+        releaseBlocks(*imp_->map, search->first, search->second);
+        --imp_->pinned_count;
+      }
+      imp_->regions.erase(search);
+      ++released;
+    }
+  }
+  return released;
+}
+
+
+size_t RegionPrefetch::release(const std::vector<glm::i16vec3> &region_keys)
+{
+  return release(region_keys.data(), region_keys.size());
+}
+
+
+size_t RegionPrefetch::release(const Aabb &box)
+{
+  std::vector<glm::i16vec3> region_keys;
+  forEachRegionKey(*imp_->map, box, [&region_keys](const glm::i16vec3 &key) { region_keys.emplace_back(key); });
+  return release(region_keys);
+}
+
+
+void RegionPrefetch::releaseAll()
+{
+  std::unique_lock<std::mutex> guard(imp_->lock);
+  for (auto &entry : imp_->regions)
+  {
+    releaseBlocks(*imp_->map, entry.first, entry.second);
+  }
+  imp_->regions.clear();
+  imp_->pending.clear();
+  imp_->pinned_count = 0;
+  notifyIfIdle(*imp_);
+}
+
+
+bool RegionPrefetch::isPinned(const glm::i16vec3 &region_key) const
+{
+  std::unique_lock<std::mutex> guard(imp_->lock);
+  const auto search = imp_->regions.find(region_key);
+  return search != imp_->regions.end() && search->second.pinned;
+}
+
+
+size_t RegionPrefetch::pinnedCount() const
+{
+  std::unique_lock<std::mutex> guard(imp_->lock);
+  return imp_->pinned_count;
+}
+
+
+size_t RegionPrefetch::pendingCount() const
+{
+  std::unique_lock<std::mutex> guard(imp_->lock);
+  return imp_->pending.size() + imp_->in_flight;
+}
+
+
+void RegionPrefetch::wait() const
+{
+  std::unique_lock<std::mutex> guard(imp_->lock);
+  imp_->idle_condition.wait(guard, [this]() { return imp_->pending.empty() && imp_->in_flight == 0; });
+}
+
+
+void RegionPrefetch::run()
+{
+  std::vector<VoxelBlock *> blocks;
+  std::unique_lock<std::mutex> guard(imp_->lock);
+  while (true)
+  {
+    imp_->wake_condition.wait(guard, [this]() { return imp_->quit || !imp_->pending.empty(); });
+    if (imp_->quit)
+    {
+      break;
+    }
+
+    const RegionPrefetchDetail::WorkItem item = imp_->pending.front();
+    imp_->pending.pop_front();
+
+    // Skip work for released regions.
+    auto search = imp_->regions.find(item.region_key);
+    if (search == imp_->regions.end() || search->second.request_id != item.request_id)
+    {
+      notifyIfIdle(*imp_);
+      continue;
+    }
+
+    ++imp_->in_flight;
+    guard.unlock();
+
+    // Retain the blocks without holding the lock. This is where the decompression occurs.
+    const MapChunk *chunk = imp_->map->region(item.region_key);
+    blocks.clear();
+    if (chunk)
+    {
+      for (const auto &block : chunk->voxel_blocks)
+      {
+        // Uniform blocks expand cheaply on demand. Pinning them would only inflate memory usage.
+        if (block && !(block->flags() & VoxelBlock::kFUniform))
+        {
+          block->retain();
+          blocks.emplace_back(block.get());
+        }
+      }
+    }
+
+    guard.lock();
+    --imp_->in_flight;
+    search = imp_->regions.find(item.region_key);
+    if (chunk && search != imp_->regions.end() && search->second.request_id == item.request_id)
+    {
+      search->second.chunk = chunk;
+      search->second.blocks = blocks;
+      search->second.pinned = true;
+      ++imp_->pinned_count;
+    }
+    else
+    {
+      // Released while working, or the region does not exist.
+      for (VoxelBlock *block : blocks)
+      {
+        block->release();
+      }
+      if (!chunk && search != imp_->regions.end() && search->second.request_id == item.request_id)
+      {
+        imp_->regions.erase(search);
+      }
+    }
+
+    notifyIfIdle(*imp_);
+  }
+}
+}  // namespace ohm
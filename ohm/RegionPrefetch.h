@@ -0,0 +1,109 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_REGIONPREFETCH_H
+#define OHM_REGIONPREFETCH_H
+
+#include "OhmConfig.h"
+
+#include <glm/fwd.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace ohm
+{
+class Aabb;
+class OccupancyMap;
+struct RegionPrefetchDetail;
+
+/// Decompresses map regions on background threads ahead of their use and pins them in memory until released.
+///
+/// @c VoxelBlock::retain() decompresses voxel data synchronously on the calling thread, so the first access to a
+/// compressed, or spilled, region stalls the caller. A @c RegionPrefetch moves this cost off the calling thread. Regions
+/// are requested ahead of use - for example along the predicted sensor path - and the worker threads retain the voxel
+/// blocks of every layer in each requested region. A retained block is ineligible for compression, so requested
+/// regions remain pinned in uncompressed form until released with @c release() or @c releaseAll() , or the
+/// @c RegionPrefetch is destroyed.
+///
+/// Only existing regions are prefetched; requests for regions which are not in the map are ignored. Regions must not
+/// be removed from the map while pinned. Call @c releaseAll() before culling or clearing the map.
+///
+/// In rolling window mode (see @c OccupancyMap::setRollingWindow() ), a pinned region is evicted when a new region
+/// recycles its ring slot, which the caller cannot prevent. The recycled region reuses the voxel blocks of the evicted
+/// region, so the pin stays on those blocks, preventing their compression, until the evicted region key is released.
+/// Release regions as they leave the window to avoid pinning their replacements.
+///
+/// All functions are threadsafe.
+class ohm_API RegionPrefetch
+{
+public:
+  /// Create a prefetcher for @p map .
+  /// @param map The map to prefetch regions from. Must outlive this object.
+  /// @param worker_count The number of background worker threads. At least one worker is created.
+  explicit RegionPrefetch(OccupancyMap &map, unsigned worker_count = 1);
+  /// Destructor. Stops the workers and releases all pinned regions.
+  ~RegionPrefetch();
+
+  /// Query the map.
+  /// @return The map regions are prefetched from.
+  OccupancyMap &map() const;
+
+  /// Request the regions identified by @p region_keys be prefetched. Regions already requested are ignored.
+  /// @param region_keys The regions to prefetch.
+  /// @param count The number of elements in @p region_keys .
+  /// @return The number of newly requested regions.
+  size_t request(const glm::i16vec3 *region_keys, size_t count);
+
+  /// @overload
+  size_t request(const std::vector<glm::i16vec3> &region_keys);
+
+  /// Request the prefetch of all regions overlapping @p box .
+  /// @param box The spatial extents of interest.
+  /// @return The number of newly requested regions.
+  size_t request(const Aabb &box);
+
+  /// Release the pin on the regions identified by @p region_keys , or cancel their pending prefetch.
+  /// @param region_keys The regions to release.
+  /// @param count The number of elements in @p region_keys .
+  /// @return The number of regions released.
+  size_t release(const glm::i16vec3 *region_keys, size_t count);
+
+  /// @overload
+  size_t release(const std::vector<glm::i16vec3> &region_keys);
+
+  /// Release all regions overlapping @p box .
+  /// @param box The spatial extents of interest.
+  /// @return The number of regions released.
+  size_t release(const Aabb &box);
+
+  /// Release all pinned and pending regions.
+  void releaseAll();
+
+  /// Check if the region at @p region_key has been prefetched and is pinned.
+  /// @param region_key The region of interest.
+  /// @return True if the region is pinned.
+  bool isPinned(const glm::i16vec3 &region_key) const;
+
+  /// Query the number of pinned regions.
+  /// @return The pinned region count.
+  size_t pinnedCount() const;
+
+  /// Query the number of regions requested, but not yet processed by the workers.
+  /// @return The pending region count.
+  size_t pendingCount() const;
+
+  /// Block until all pending requests have been processed.
+  void wait() const;
+
+private:
+  /// Worker thread function.
+  void run();
+
+  std::unique_ptr<RegionPrefetchDetail> imp_;
+};
+}  // namespace ohm
+
+#endif  // OHM_REGIONPREFETCH_H
@@ -9,9 +9,12 @@
 #include <zlib.h>
 #endif  // OHM_ZIP
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace ohm
 {
@@ -95,6 +98,123 @@ int Compression::doneInflate()
 
 #endif  // OHM_ZIP
 
+namespace
+{
+/// Resolve an absolute position for a @c std::streambuf seek operation, or -1 when out of range.
+std::streamoff resolveSeek(std::streamoff off, std::ios_base::seekdir dir, std::streamoff current, std::streamoff end)
+{
+  std::streamoff pos = -1;
+  switch (dir)
+  {
+  case std::ios_base::beg:
+    pos = off;
+    break;
+  case std::ios_base::cur:
+    pos = current + off;
+    break;
+  case std::ios_base::end:
+    pos = end + off;
+    break;
+  default:
+    break;
+  }
+  return (0 <= pos && pos <= end) ? pos : -1;
+}
+
+
+/// A read only @c std::streambuf which reads directly from a user memory buffer without copying.
+class MemoryInputBuffer : public std::streambuf
+{
+public:
+  MemoryInputBuffer(const void *buffer, size_t byte_count)
+  {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    char *begin = const_cast<char *>(static_cast<const char *>(buffer));
+    setg(begin, begin, begin + byte_count);
+  }
+
+protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+  {
+    if (!(which & std::ios_base::in))
+    {
+      return pos_type(off_type(-1));
+    }
+    const std::streamoff pos = resolveSeek(off, dir, gptr() - eback(), egptr() - eback());
+    if (pos >= 0)
+    {
+      setg(eback(), eback() + pos, egptr());
+    }
+    return pos_type(pos);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+  {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+
+/// A write only @c std::streambuf which writes to a user owned byte vector. Seeking backwards overwrites existing
+/// content, while writing past the end grows the vector.
+class MemoryOutputBuffer : public std::streambuf
+{
+public:
+  explicit MemoryOutputBuffer(std::vector<uint8_t> &buffer)
+    : buffer_(buffer)
+  {
+    buffer_.clear();
+  }
+
+protected:
+  int_type overflow(int_type ch) override
+  {
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+      return traits_type::not_eof(ch);
+    }
+    const char c = traits_type::to_char_type(ch);
+    return (xsputn(&c, 1) == 1) ? ch : traits_type::eof();
+  }
+
+  std::streamsize xsputn(const char *data, std::streamsize count) override
+  {
+    const size_t end = pos_ + size_t(count);
+    if (end > buffer_.size())
+    {
+      buffer_.resize(end);
+    }
+    std::copy(data, data + count, reinterpret_cast<char *>(buffer_.data()) + pos_);  // NOLINT
+    pos_ = end;
+    return count;
+  }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+  {
+    if (!(which & std::ios_base::out))
+    {
+      return pos_type(off_type(-1));
+    }
+    const std::streamoff pos = resolveSeek(off, dir, std::streamoff(pos_), std::streamoff(buffer_.size()));
+    if (pos >= 0)
+    {
+      pos_ = size_t(pos);
+    }
+    return pos_type(pos);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+  {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+
+private:
+  std::vector<uint8_t> &buffer_;
+  size_t pos_ = 0;
+};
+}  // namespace
+
+
 struct StreamPrivate
 {
   std::string file_path;
@@ -103,7 +223,10 @@ struct StreamPrivate
 
 struct InputStreamPrivate : StreamPrivate
 {
-  std::ifstream in;
+  /// Stream used for reading. Attached to either @c file or @c memory .
+  std::istream in{ nullptr };
+  std::ifstream file;
+  std::unique_ptr<MemoryInputBuffer> memory;
 #ifdef OHM_ZIP
   Compression compress;
 #endif  // OHM_ZIP
@@ -111,7 +234,10 @@ struct InputStreamPrivate : StreamPrivate
 
 struct OutputStreamPrivate : StreamPrivate
 {
-  std::ofstream out;
+  /// Stream used for writing. Attached to either @c file or @c memory .
+  std::ostream out{ nullptr };
+  std::ofstream file;
+  std::unique_ptr<MemoryOutputBuffer> memory;
 #ifdef OHM_ZIP
   Compression compress;
   bool needs_flush = false;
@@ -264,7 +390,7 @@ unsigned InputStream::readRaw(void *buffer, unsigned max_bytes)
 
 bool InputStream::isOpen() const
 {
-  return imp()->in.is_open();
+  return imp()->file.is_open() || imp()->memory;
 }
 
 
@@ -272,10 +398,29 @@ void InputStream::flush()
 {}
 
 
+bool InputStream::openBuffer(const void *buffer, size_t byte_count, unsigned flags)
+{
+  close();
+  imp()->memory = std::make_unique<MemoryInputBuffer>(buffer, byte_count);
+  imp()->in.rdbuf(imp()->memory.get());
+  imp()->file_path = std::string();
+  setOpenFlags(flags);
+  return true;
+}
+
+
 bool InputStream::doOpen(const std::string &file_path, unsigned flags)
 {
-  imp()->in.open(file_path.c_str(), std::ios_base::binary);
+  imp()->file.open(file_path.c_str(), std::ios_base::binary);
+  imp()->in.rdbuf(imp()->file.rdbuf());
   imp()->file_path = file_path;
+  setOpenFlags(flags);
+  return imp()->file.is_open();
+}
+
+
+void InputStream::setOpenFlags(unsigned flags)
+{
 #ifndef OHM_ZIP
   flags &= ~SF_Compress;
 #endif  // OHM_ZIP
@@ -286,7 +431,6 @@ bool InputStream::doOpen(const std::string &file_path, unsigned flags)
     imp()->compress.initInflate();
   }
 #endif  // OHM_ZIP
-  return imp()->in.is_open();
 }
 
 
@@ -298,7 +442,9 @@ void InputStream::doClose()
     imp()->compress.doneInflate();
   }
 #endif  // OHM_ZIP
-  imp()->in.close();
+  imp()->file.close();
+  imp()->memory.reset();
+  imp()->in.rdbuf(nullptr);
   imp_->flags = 0;
   imp_->file_path = std::string();
 }
@@ -405,7 +551,7 @@ unsigned OutputStream::writeUncompressed(const void *buffer, unsigned max_bytes)
 
 bool OutputStream::isOpen() const
 {
-  return imp()->out.is_open();
+  return imp()->file.is_open() || imp()->memory;
 }
 
 
@@ -440,10 +586,37 @@ void OutputStream::flush()
 }
 
 
+bool OutputStream::openBuffer(std::vector<uint8_t> &buffer, unsigned flags)
+{
+  close();
+  imp()->memory = std::make_unique<MemoryOutputBuffer>(buffer);
+  imp()->out.rdbuf(imp()->memory.get());
+  imp()->file_path = std::string();
+  setOpenFlags(flags & ~kSfUpdate);
+  return true;
+}
+
+
 bool OutputStream::doOpen(const std::string &file_path, unsigned flags)
 {
-  imp()->out.open(file_path.c_str(), std::ios_base::binary);
+  if (flags & kSfUpdate)
+  {
+    // Opening with the input flag avoids truncation.
+    imp()->file.open(file_path.c_str(), std::ios_base::binary | std::ios_base::in | std::ios_base::ate);
+  }
+  else
+  {
+    imp()->file.open(file_path.c_str(), std::ios_base::binary);
+  }
+  imp()->out.rdbuf(imp()->file.rdbuf());
   imp()->file_path = file_path;
+  setOpenFlags(flags);
+  return imp()->file.is_open();
+}
+
+
+void OutputStream::setOpenFlags(unsigned flags)
+{
 #ifndef OHM_ZIP
   flags &= ~SF_Compress;
 #endif  // OHM_ZIP
@@ -454,7 +627,6 @@ bool OutputStream::doOpen(const std::string &file_path, unsigned flags)
     imp()->compress.initDeflate();
   }
 #endif  // OHM_ZIP
-  return imp()->out.is_open();
 }
 
 
@@ -466,7 +638,9 @@ void OutputStream::doClose()
     imp()->compress.doneDeflate();
   }
 #endif  // OHM_ZIP
-  imp()->out.close();
+  imp()->file.close();
+  imp()->memory.reset();
+  imp()->out.rdbuf(nullptr);
   imp_->flags = 0;
   imp_->file_path = std::string();
 }
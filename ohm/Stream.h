@@ -9,7 +9,9 @@
 #include "OhmConfig.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #define OHM_ZIP 1
 
@@ -25,11 +27,16 @@ enum StreamFlag : unsigned
 {
   /// Compression is enabled.
   kSfCompress = (1u << 0u),
+  /// Open an existing file for update rather than truncating it. Writing starts at the end of the file. Only valid for
+  /// @c OutputStream and fails if the file does not exist.
+  kSfUpdate = (1u << 1u),
 };
 
 
 /// Base class for @c InputStream and @c OutputStream used to encapsulate file access and compression.
-/// The stream is tailored towards file access, not a generalised stream.
+/// The stream is tailored towards file access, not a generalised stream. Streams may alternatively be opened on a
+/// memory buffer using @c InputStream::openBuffer() or @c OutputStream::openBuffer() , which support the same
+/// operations as a file.
 class ohm_API Stream
 {
 public:
@@ -132,6 +139,15 @@ public:
   /// Destructor. Flushes and closes the file.
   ~InputStream() override;
 
+  /// Open the stream to read from a memory buffer instead of a file. Data are read directly from @p buffer without
+  /// copying, so @p buffer must remain valid until the stream is closed. The @c filePath() is empty.
+  ///
+  /// @param buffer The memory to read from.
+  /// @param byte_count The number of bytes available in @p buffer .
+  /// @param flags @c StreamFlag values to open with.
+  /// @return True on success.
+  bool openBuffer(const void *buffer, size_t byte_count, unsigned flags = 0u);
+
   /// Enables reading compressed data after opening.
   ///
   /// Intended for use when compression state is determined by data in a file header.
@@ -169,6 +185,10 @@ protected:
   /// @return True on success.
   bool doOpen(const std::string &file_path, unsigned flags) override;
 
+  /// Set the @c StreamFlag values on opening a file or buffer.
+  /// @param flags @c StreamFlag values to open with.
+  void setOpenFlags(unsigned flags);
+
   /// Called to close the file (after a @c flush()).
   void doClose() override;
 
@@ -216,6 +236,15 @@ public:
   /// Destructor. Flushes and closes the file.
   ~OutputStream() override;
 
+  /// Open the stream to write to a memory buffer instead of a file. @p buffer is cleared, then grows as data are
+  /// written. Seeking back and writing overwrites existing content. @p buffer must remain valid until the stream is
+  /// closed. @c kSfUpdate is ignored.
+  ///
+  /// @param buffer The memory to write to.
+  /// @param flags @c StreamFlag values to open with.
+  /// @return True on success.
+  bool openBuffer(std::vector<uint8_t> &buffer, unsigned flags = 0u);
+
   /// Write bytes to the file, compression enabled.
   unsigned write(const void *buffer, unsigned max_bytes);
 
@@ -241,6 +270,10 @@ private:
   /// @return True on success.
   bool doOpen(const std::string &file_path, unsigned flags) override;
 
+  /// Set the @c StreamFlag values on opening a file or buffer.
+  /// @param flags @c StreamFlag values to open with.
+  void setOpenFlags(unsigned flags);
+
   /// Called to close the file (after a @c flush()).
   void doClose() override;
 
@@ -48,8 +48,9 @@ struct VoxelChunkAccess
   /// @param layer_index The voxel memory index in chunk which has been modified.
   static void touch(OccupancyMap *map, MapChunk *chunk, int layer_index)
   {
-    chunk->dirty_stamp = map->touch();
-    chunk->touched_stamps[layer_index].store(chunk->dirty_stamp, std::memory_order_relaxed);
+    const uint64_t touch_stamp = map->touch();
+    chunk->setDirtyStamp(touch_stamp);
+    chunk->touched_stamps[layer_index].store(touch_stamp, std::memory_order_relaxed);
   }
 
   /// Write the @p value to the voxel at @p voxel_index within @p voxel_memory .
@@ -525,6 +526,11 @@ protected:
       if (chunk_ && layer_index_ != -1)
       {
         chunk_->voxel_blocks[layer_index_]->retain();
+        if (!std::is_const<T>::value)
+        {
+          // Writable reference. Preserve data shared with snapshots.
+          chunk_->voxel_blocks[layer_index_]->prepareWrite();
+        }
         flags_ |= unsigned(Flag::kCompressionLock);
         voxel_memory_ = chunk_->voxel_blocks[layer_index_]->voxelBytes();
       }
@@ -7,8 +7,11 @@
 
 #include "MapLayer.h"
 #include "VoxelBlockCompressionQueue.h"
+#include "VoxelBlockPool.h"
 
+#include "private/LzCodec.h"
 #include "private/OccupancyMapDetail.h"
+#include "private/VoxelBlockSpillStore.h"
 
 #include <zlib.h>
 
@@ -22,18 +25,306 @@ namespace
 const unsigned kDefaultBufferSize = 1024u;
 unsigned g_minimum_buffer_size = kDefaultBufferSize;
 int g_zlib_compression_level = Z_BEST_SPEED;
-int g_zlib_gzip_flag = 0;  // Use 16 to enable GZip.
+VoxelBlock::CompressionType g_compression_type = VoxelBlock::kCompressDeflate;
+bool g_run_length_prepass = false;
 const int kWindowBits = 14;
 const int kZLibMemLevel = 8;
 const int kCompressionStrategy = Z_DEFAULT_STRATEGY;
 
 const int kGZipCompressionFlag = 16;
-const unsigned kReleaseDelayMs = 500;
 /// When reserving compressed buffer space, device the uncompressed size by this factor.
 const unsigned kBufferReservationQutient = 10;
+
+/// Codec identifiers. Compressed voxel data start with a codec byte identifying how the data were compressed. This
+/// allows the compression controls to change without invalidating existing compressed blocks.
+///
+/// The codec byte is followed by the uncompressed size of the run length encoded data when @c kCodecRunLength is set.
+enum Codec : uint8_t
+{
+  kCodecDeflate = 0u,
+  kCodecGZip = 1u,
+  kCodecLz = 2u,
+  /// Mask for the codec type.
+  kCodecTypeMask = 0x7fu,
+  /// Flag set when the data were run length encoded before compression.
+  kCodecRunLength = 0x80u
+};
+
+
+/// Resolve the codec byte for the current compression controls.
+uint8_t currentCodec()
+{
+  uint8_t codec = kCodecDeflate;
+  switch (g_compression_type)
+  {
+  default:
+  case VoxelBlock::kCompressDeflate:
+    codec = kCodecDeflate;
+    break;
+  case VoxelBlock::kCompressGZip:
+    codec = kCodecGZip;
+    break;
+  case VoxelBlock::kCompressLz:
+    codec = kCodecLz;
+    break;
+  }
+
+  return (g_run_length_prepass) ? uint8_t(codec | kCodecRunLength) : codec;
+}
+
+
+/// ZLib compress @p src appending to @p dst .
+bool deflateBytes(const uint8_t *src, size_t src_size, std::vector<uint8_t> &dst, int gzip_flag)
+{
+  int ret = Z_OK;
+  z_stream stream;
+  memset(&stream, 0u, sizeof(stream));
+  // NOLINTNEXTLINE(hicpp-signed-bitwise)
+  deflateInit2(&stream, g_zlib_compression_level, Z_DEFLATED, kWindowBits | gzip_flag, kZLibMemLevel,
+               kCompressionStrategy);
+
+  stream.next_in = const_cast<Bytef *>(src);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+  stream.avail_in = unsigned(src_size);
+
+  const size_t initial_size = dst.size();
+  dst.resize(initial_size + std::max(src_size / kBufferReservationQutient, static_cast<size_t>(g_minimum_buffer_size)));
+
+  stream.avail_out = unsigned(dst.size() - initial_size);
+  stream.next_out = dst.data() + initial_size;
+
+  int flush_flag = Z_NO_FLUSH;
+  do
+  {
+    ret = deflate(&stream, flush_flag);
+
+    switch (ret)
+    {
+    case Z_OK:
+      // Done with input data. Make sure we change to flushing.
+      if (stream.avail_in == 0)
+      {
+        flush_flag = Z_FINISH;
+      }
+
+      // Check for insufficient output data before Z_STREAM_END.
+      if (stream.avail_out == 0)
+      {
+        // Output buffer too small.
+        const size_t bytes_so_far = dst.size();
+        dst.resize(2 * bytes_so_far);
+        stream.avail_out = unsigned(dst.size() - bytes_so_far);
+        stream.next_out = dst.data() + bytes_so_far;
+      }
+      break;
+    case Z_STREAM_END:
+      break;
+    default:
+      // Failed.
+      deflateEnd(&stream);
+      return false;
+    }
+  } while (stream.avail_in || ret != Z_STREAM_END);
+
+  // Ensure flush.
+  if (flush_flag != Z_FINISH)
+  {
+    deflate(&stream, Z_FINISH);
+  }
+
+  ret = deflateEnd(&stream);
+  if (ret != Z_OK)
+  {
+    return false;
+  }
+
+  // Resize compressed buffer.
+  dst.resize(dst.size() - stream.avail_out);
+  return true;
+}
+
+
+/// ZLib decompress @p src into @p dst which must be exactly filled.
+bool inflateBytes(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size, int gzip_flag)
+{
+  int ret = Z_OK;
+  z_stream stream;
+  memset(&stream, 0u, sizeof(stream));
+  inflateInit2(&stream, kWindowBits | gzip_flag);  // NOLINT(hicpp-signed-bitwise)
+
+  stream.avail_in = unsigned(src_size);
+  stream.next_in = const_cast<Bytef *>(src);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+
+  stream.avail_out = unsigned(dst_size);
+  stream.next_out = dst;
+
+  int flush_flag = Z_NO_FLUSH;
+  do
+  {
+    ret = inflate(&stream, flush_flag);
+
+    switch (ret)
+    {
+    case Z_OK:
+      // Check for insufficient output data on flush or before finishing input data. This is an error an error condition
+      // as we know how large it should be.
+      if (stream.avail_out == 0 && (flush_flag == Z_FINISH || stream.avail_in))
+      {
+        // Failed.
+        inflateEnd(&stream);
+        return false;
+      }
+
+      // Transition to flush if there is no more input data.
+      if (stream.avail_in == 0)
+      {
+        flush_flag = Z_FINISH;
+      }
+      break;
+    case Z_STREAM_END:
+      break;
+    default:
+      // Failed.
+      inflateEnd(&stream);
+      return false;
+    }
+  } while (stream.avail_in || ret != Z_STREAM_END);
+
+  // Ensure flush.
+  if (flush_flag != Z_FINISH)
+  {
+    inflate(&stream, Z_FINISH);
+  }
+
+  inflateEnd(&stream);
+
+  return stream.avail_out == 0;
+}
+
+
+/// Compress @p src using @p codec (excluding the run length flag), appending to @p dst .
+bool compressBytes(uint8_t codec, const uint8_t *src, size_t src_size, std::vector<uint8_t> &dst)
+{
+  switch (codec & kCodecTypeMask)
+  {
+  case kCodecDeflate:
+    return deflateBytes(src, src_size, dst, 0);
+  case kCodecGZip:
+    return deflateBytes(src, src_size, dst, kGZipCompressionFlag);
+  case kCodecLz:
+    lzCompress(src, src_size, dst);
+    return true;
+  default:
+    break;
+  }
+  return false;
+}
+
+
+/// Compress the uncompressed voxel data in @p src into @p dst using the current compression controls. The result
+/// starts with the codec byte.
+bool compressVoxelBytes(const std::vector<uint8_t> &src_bytes, std::vector<uint8_t> &dst)
+{
+  const uint8_t codec = currentCodec();
+  dst.clear();
+  dst.emplace_back(codec);
+
+  const uint8_t *src = src_bytes.data();
+  size_t src_size = src_bytes.size();
+  std::vector<uint8_t> run_length_buffer;
+  if (codec & kCodecRunLength)
+  {
+    rleEncode(src, src_size, run_length_buffer);
+    if (run_length_buffer.size() != uint32_t(run_length_buffer.size()))
+    {
+      return false;
+    }
+    const auto run_length_size = uint32_t(run_length_buffer.size());
+    dst.resize(1 + sizeof(run_length_size));
+    memcpy(dst.data() + 1, &run_length_size, sizeof(run_length_size));
+    src = run_length_buffer.data();
+    src_size = run_length_buffer.size();
+  }
+
+  return compressBytes(codec, src, src_size, dst);
+}
+
+
+/// Validate the framing of compressed voxel data: a known codec byte, the run length size when flagged, and a
+/// non empty payload. Does not decompress the payload.
+/// @param bytes The compressed data, starting with the codec byte.
+/// @param byte_count Number of bytes in @p bytes .
+/// @param uncompressed_size The size of the uncompressed voxel data.
+/// @return True if the data may be decompressed.
+bool validCompressedData(const uint8_t *bytes, size_t byte_count, size_t uncompressed_size)
+{
+  if (byte_count < 2)
+  {
+    return false;
+  }
+
+  const uint8_t codec = bytes[0];
+  const uint8_t codec_type = codec & kCodecTypeMask;
+  if (codec_type != kCodecDeflate && codec_type != kCodecGZip && codec_type != kCodecLz)
+  {
+    return false;
+  }
+
+  if (codec & kCodecRunLength)
+  {
+    uint32_t run_length_size = 0;
+    if (byte_count < 1 + sizeof(run_length_size) + 1)
+    {
+      return false;
+    }
+    memcpy(&run_length_size, bytes + 1, sizeof(run_length_size));
+    // Run length encoding adds at most a few count bytes to the source data. Reject sizes beyond this to avoid large
+    // allocations for corrupt data.
+    const size_t run_length_overhead = 32u;
+    if (run_length_size == 0 || run_length_size > uncompressed_size + run_length_overhead)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+/// Decompress @p src using @p codec (excluding the run length flag) into @p dst which must be exactly filled.
+bool uncompressBytes(uint8_t codec, const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size)
+{
+  switch (codec & kCodecTypeMask)
+  {
+  case kCodecDeflate:
+    return inflateBytes(src, src_size, dst, dst_size, 0);
+  case kCodecGZip:
+    return inflateBytes(src, src_size, dst, dst_size, kGZipCompressionFlag);
+  case kCodecLz:
+    return lzUncompress(src, src_size, dst, dst_size);
+  default:
+    break;
+  }
+  return false;
+}
 }  // namespace
 
 
+/// An image of @c VoxelBlock data shared between a block and its snapshot blocks. The image is populated from the
+/// @c source block on demand: before the source is next written to or when a snapshot block first needs the data.
+struct VoxelBlockImage
+{
+  /// Guards access to all members. Locked before the mutex of the @c source block.
+  VoxelBlock::Mutex lock;
+  /// The block holding the voxel data. Null once the data have been captured.
+  VoxelBlock *source = nullptr;
+  /// The captured voxel data in the representation given by @c flags .
+  std::vector<uint8_t> voxel_bytes;
+  /// The captured @c VoxelBlock::kFUncompressed and @c VoxelBlock::kFUniform flags. Neither is set for compressed
+  /// data.
+  unsigned flags = 0;
+};
+
+
 void VoxelBlock::getCompressionControls(CompressionControls *controls)
 {
   controls->minimum_buffer_size = g_minimum_buffer_size;
@@ -52,14 +343,8 @@ void VoxelBlock::getCompressionControls(CompressionControls *controls)
     break;
   }
 
-  if (g_zlib_gzip_flag)
-  {
-    controls->compression_type = kCompressGZip;
-  }
-  else
-  {
-    controls->compression_type = kCompressDeflate;
-  }
+  controls->compression_type = g_compression_type;
+  controls->run_length_prepass = g_run_length_prepass;
 }
 
 void VoxelBlock::setCompressionControls(const CompressionControls &controls)
@@ -79,7 +364,8 @@ void VoxelBlock::setCompressionControls(const CompressionControls &controls)
     break;
   }
 
-  g_zlib_gzip_flag = (controls.compression_type == kCompressGZip) ? kGZipCompressionFlag : 0;
+  g_compression_type = controls.compression_type;
+  g_run_length_prepass = controls.run_length_prepass;
 }
 
 
@@ -88,8 +374,10 @@ VoxelBlock::VoxelBlock(const OccupancyMapDetail *map, const MapLayer &layer)
   , layer_index_(layer.layerIndex())
   , uncompressed_byte_size_(layer.layerByteSize(map->region_voxel_dimensions))
 {
-  initUncompressed(voxel_bytes_, layer);
-  flags_ |= kFUncompressed;
+  // Start with the uniform clear value. The voxel buffer is materialised on the first retain().
+  voxel_bytes_.resize(layer.voxelByteSize());
+  layer.clear(voxel_bytes_.data(), glm::u8vec3(1));
+  flags_ |= kFUniform;
   // Try add to compression process if the map uses compression.
   if ((map->flags & MapFlag::kCompressed) == MapFlag::kCompressed)
   {
@@ -98,18 +386,42 @@ VoxelBlock::VoxelBlock(const OccupancyMapDetail *map, const MapLayer &layer)
 }
 
 
-VoxelBlock::~VoxelBlock() = default;
+VoxelBlock::~VoxelBlock()
+{
+  if (flags_ & kFUncompressed)
+  {
+    // Recycle the uncompressed voxel memory.
+    VoxelBlockPool::instance().release(voxel_bytes_);
+  }
+  else if ((flags_ & kFSpilled) && spill_store_)
+  {
+    spill_store_->free(VoxelBlockSpillRecord{ spill_offset_, compressed_byte_size_ });
+  }
+}
 
 
 void VoxelBlock::destroy()
 {
+  // Preserve data shared with snapshots.
+  prepareWrite();
   // Don't use scoped lock as we will delete this which would make releasing the lock invalid.
   access_guard_.lock();
-  if (flags_ & kFManagedForCompression)
+  if (flags_ & kFMarkedForDeath)
+  {
+    // Already destroyed. The compression queue owns the deletion.
+    access_guard_.unlock();
+  }
+  else if (flags_ & kFManagedForCompression)
   {
     // Currently queue. Mark for death. The compression queue will destroy it.
     flags_ |= kFMarkedForDeath;
+    VoxelBlockCompressionQueue *compression_queue = compression_queue_;
     access_guard_.unlock();
+    // Only the compression queue may delete this now, which it will not do until the event is processed.
+    if (compression_queue)
+    {
+      compression_queue->blockDestroyed(this);
+    }
   }
   else
   {
@@ -125,11 +437,29 @@ void VoxelBlock::retain()
   std::unique_lock<Mutex> guard(access_guard_);
   ++reference_count_;
   flags_ |= kFLocked;  // Ensure block is lock to prevent compression.
+  // Fault in shared or spilled data. On failure voxel_bytes_ is left empty, which uncompresses to the clear value.
+  if ((flags_ & kFShared) && !faultInSharedUnguarded())
+  {
+    voxel_bytes_.clear();
+  }
   // Ensure uncompressed data are available.
   if (!(flags_ & kFUncompressed))
   {
+    if ((flags_ & kFSpilled) && !faultInUnguarded())
+    {
+      voxel_bytes_.clear();
+    }
     std::vector<uint8_t> working_buffer;
-    uncompressUnguarded(working_buffer);
+    if (!uncompressUnguarded(working_buffer))
+    {
+      // The data are invalid and lost. Revert to the clear value rather than expose a partially decompressed buffer.
+      initUncompressed(working_buffer, map_->layout.layer(layer_index_));
+    }
+    flags_ &= ~kFUniform;
+    if (compression_queue_)
+    {
+      compression_queue_->adjustAllocation(int64_t(working_buffer.size()) - int64_t(voxel_bytes_.size()));
+    }
     voxel_bytes_.swap(working_buffer);
     flags_ |= kFUncompressed;
   }
@@ -145,10 +475,251 @@ void VoxelBlock::release()
     {
       // Unlock to allow compression.
       flags_ &= ~kFLocked;
+      // Notify the compression queue, moving this block to the back of its LRU list. We only queue one release event
+      // at a time.
+      if (compression_queue_ && !(flags_.fetch_or(kFReleaseQueued) & kFReleaseQueued))
+      {
+        compression_queue_->blockReleased(this);
+      }
+    }
+  }
+}
+
+void VoxelBlock::reset()
+{
+  prepareWrite();
+  std::unique_lock<Mutex> guard(access_guard_);
+  const MapLayer &layer = map_->layout.layer(layer_index_);
+  if (flags_ & kFShared)
+  {
+    image_.reset();
+    flags_ &= ~kFShared;
+  }
+  if (flags_ & kFUncompressed)
+  {
+    layer.clear(voxel_bytes_.data(), map_->region_voxel_dimensions);
+    return;
+  }
+
+  if ((flags_ & kFSpilled) && spill_store_)
+  {
+    spill_store_->free(VoxelBlockSpillRecord{ spill_offset_, compressed_byte_size_ });
+    spill_store_ = nullptr;
+  }
+  flags_ &= ~kFSpilled;
+
+  // Revert to the uniform clear value. Shrinking the buffer does not reallocate.
+  const int64_t previous_size = int64_t(voxel_bytes_.size());
+  voxel_bytes_.resize(layer.voxelByteSize());
+  layer.clear(voxel_bytes_.data(), glm::u8vec3(1));
+  compressed_byte_size_ = voxel_bytes_.size();
+  flags_ |= kFUniform;
+  if (compression_queue_)
+  {
+    compression_queue_->adjustAllocation(int64_t(voxel_bytes_.size()) - previous_size);
+  }
+}
+
+void VoxelBlock::prepareWrite()
+{
+  // Cheap early out for the common case.
+  if (!(flags_ & kFImageShared))
+  {
+    return;
+  }
+
+  std::shared_ptr<VoxelBlockImage> image;
+  {
+    std::unique_lock<Mutex> guard(access_guard_);
+    image = image_;
+  }
+
+  if (!image)
+  {
+    return;
+  }
+
+  // Lock the image before the block to match the lock order of snapshot blocks faulting in the image.
+  std::unique_lock<Mutex> image_guard(image->lock);
+  std::unique_lock<Mutex> guard(access_guard_);
+  if (image_ == image)
+  {
+    // Only capture the data if a snapshot block still references the image. Otherwise the only references are
+    // image_ and the local copy.
+    if (image->source && image.use_count() > 2)
+    {
+      captureImageUnguarded(*image);
+    }
+    image->source = nullptr;
+    image_.reset();
+    flags_ &= ~kFImageShared;
+  }
+}
+
+void VoxelBlock::shareFrom(VoxelBlock &source)
+{
+  std::shared_ptr<VoxelBlockImage> image;
+  bool capture = false;
+  {
+    std::unique_lock<Mutex> source_guard(source.access_guard_);
+    if (!source.image_)
+    {
+      source.image_ = std::make_shared<VoxelBlockImage>();
+      source.image_->source = &source;
+      source.flags_ |= kFImageShared;
     }
+    image = source.image_;
+    capture = source.reference_count_ > 0 && !(source.flags_ & kFShared);
+  }
+
+  if (capture)
+  {
+    // The source is retained and may be written to without a further prepareWrite() call. Capture the data now.
+    std::unique_lock<Mutex> image_guard(image->lock);
+    if (image->source == &source)
+    {
+      std::unique_lock<Mutex> source_guard(source.access_guard_);
+      source.captureImageUnguarded(*image);
+    }
+  }
+
+  std::unique_lock<Mutex> guard(access_guard_);
+  const int64_t previous_size = int64_t(voxel_bytes_.size());
+  if (flags_ & kFUncompressed)
+  {
+    VoxelBlockPool::instance().release(voxel_bytes_);
+  }
+  else if ((flags_ & kFSpilled) && spill_store_)
+  {
+    spill_store_->free(VoxelBlockSpillRecord{ spill_offset_, compressed_byte_size_ });
+    spill_store_ = nullptr;
+  }
+  std::vector<uint8_t>().swap(voxel_bytes_);
+  flags_ &= ~(kFUncompressed | kFUniform | kFSpilled);
+  flags_ |= kFShared;
+  image_ = image;
+  if (compression_queue_)
+  {
+    compression_queue_->adjustAllocation(-previous_size);
   }
 }
 
+bool VoxelBlock::exportCompressed(std::vector<uint8_t> &bytes, bool &uniform)
+{
+  std::unique_lock<Mutex> guard(access_guard_);
+  if (flags_ & kFShared)
+  {
+    // Export directly from the shared image rather than copying it into this block. The image lock is ordered before
+    // the block locks, so release the block lock first. The image keeps the data alive and is immutable once captured.
+    std::shared_ptr<VoxelBlockImage> image = image_;
+    guard.unlock();
+    if (!image)
+    {
+      return false;
+    }
+
+    std::unique_lock<Mutex> image_guard(image->lock);
+    if (image->source)
+    {
+      // Not yet captured. Capture the data from the source now.
+      std::unique_lock<Mutex> source_guard(image->source->access_guard_);
+      image->source->captureImageUnguarded(*image);
+    }
+    return exportBytes(image->voxel_bytes, image->flags, bytes, uniform);
+  }
+
+  if (flags_ & kFSpilled)
+  {
+    // Read the spilled data without faulting the block back in.
+    uniform = false;
+    return spill_store_ && spill_store_->read(VoxelBlockSpillRecord{ spill_offset_, compressed_byte_size_ }, bytes);
+  }
+
+  return exportBytes(voxel_bytes_, flags_, bytes, uniform);
+}
+
+bool VoxelBlock::exportBytes(const std::vector<uint8_t> &voxel_bytes, unsigned flags, std::vector<uint8_t> &bytes,
+                             bool &uniform) const
+{
+  const MapLayer &layer = map_->layout.layer(layer_index_);
+  const size_t voxel_byte_size = layer.voxelByteSize();
+  uniform = false;
+  if (voxel_bytes.empty())
+  {
+    // Never initialised: the clear value.
+    bytes.resize(voxel_byte_size);
+    layer.clear(bytes.data(), glm::u8vec3(1));
+    uniform = true;
+    return true;
+  }
+
+  if (flags & kFUniform)
+  {
+    bytes = voxel_bytes;
+    uniform = true;
+    return true;
+  }
+
+  if (!(flags & kFUncompressed))
+  {
+    // Already compressed.
+    bytes = voxel_bytes;
+    return true;
+  }
+
+  if (voxel_byte_size && voxel_bytes.size() >= voxel_byte_size &&
+      memcmp(voxel_bytes.data(), voxel_bytes.data() + voxel_byte_size, voxel_bytes.size() - voxel_byte_size) == 0)
+  {
+    bytes.assign(voxel_bytes.begin(), voxel_bytes.begin() + voxel_byte_size);
+    uniform = true;
+    return true;
+  }
+
+  return compressVoxelBytes(voxel_bytes, bytes);
+}
+
+bool VoxelBlock::importCompressed(const uint8_t *bytes, size_t byte_count, bool uniform)
+{
+  const size_t voxel_byte_size = map_->layout.layer(layer_index_).voxelByteSize();
+  if ((uniform && byte_count != voxel_byte_size) ||
+      (!uniform && !validCompressedData(bytes, byte_count, uncompressed_byte_size_)))
+  {
+    return false;
+  }
+
+  prepareWrite();
+  std::unique_lock<Mutex> guard(access_guard_);
+  if (reference_count_)
+  {
+    return false;
+  }
+
+  const int64_t previous_size = int64_t(voxel_bytes_.size());
+  if (flags_ & kFUncompressed)
+  {
+    VoxelBlockPool::instance().release(voxel_bytes_);
+  }
+  else if ((flags_ & kFSpilled) && spill_store_)
+  {
+    spill_store_->free(VoxelBlockSpillRecord{ spill_offset_, compressed_byte_size_ });
+    spill_store_ = nullptr;
+  }
+  image_.reset();
+
+  voxel_bytes_.assign(bytes, bytes + byte_count);
+  compressed_byte_size_ = voxel_bytes_.size();
+  flags_ &= ~(kFUncompressed | kFUniform | kFSpilled | kFShared);
+  if (uniform)
+  {
+    flags_ |= kFUniform;
+  }
+  if (compression_queue_)
+  {
+    compression_queue_->adjustAllocation(int64_t(voxel_bytes_.size()) - previous_size);
+  }
+  return true;
+}
+
 #if 0
 void VoxelBlock::compressInto(std::vector<uint8_t> &compression_buffer)
 {
@@ -176,7 +747,7 @@ size_t VoxelBlock::compressWithTemporaryBuffer(std::vector<uint8_t> &compression
 {
   std::unique_lock<Mutex> guard(access_guard_);
 
-  if (!reference_count_ && !(flags_ & kFLocked))
+  if (!reference_count_ && !(flags_ & (kFLocked | kFShared)))
   {
     // Handle uninitialised buffer. We may not have initialised the buffer yet, but this call requires data to be
     // compressed such as when used for serialisation to disk.
@@ -186,8 +757,38 @@ size_t VoxelBlock::compressWithTemporaryBuffer(std::vector<uint8_t> &compression
       flags_ |= kFUncompressed;
     }
 
-    compressUnguarded(compression_buffer);
+    if (flags_ & kFSpilled)
+    {
+      // Already paged out.
+      return compressed_byte_size_;
+    }
+
+    const size_t initial_size = voxel_bytes_.size();
+    if (flags_ & kFUniform)
+    {
+      // Already as small as we can make it.
+      return initial_size;
+    }
+
+    if ((flags_ & kFUncompressed) && collapseUniformUnguarded())
+    {
+      // Uniform data. No need to run the codec.
+      if (compression_queue_)
+      {
+        compression_queue_->adjustAllocation(int64_t(voxel_bytes_.size()) - int64_t(initial_size));
+      }
+      return voxel_bytes_.size();
+    }
+
+    if (!compressUnguarded(compression_buffer))
+    {
+      return 0;
+    }
     setCompressedBytesUnguarded(compression_buffer);
+    if (compression_queue_)
+    {
+      compression_queue_->adjustAllocation(int64_t(voxel_bytes_.size()) - int64_t(initial_size));
+    }
     return compression_buffer.size();
   }
   return 0;
@@ -208,70 +809,10 @@ bool VoxelBlock::compressUnguarded(std::vector<uint8_t> &compression_buffer)
 {
   if (flags_ & kFUncompressed)
   {
-    int ret = Z_OK;
-    z_stream stream;
-    memset(&stream, 0u, sizeof(stream));
-    // NOLINTNEXTLINE(hicpp-signed-bitwise)
-    deflateInit2(&stream, g_zlib_compression_level, Z_DEFLATED, kWindowBits | g_zlib_gzip_flag, kZLibMemLevel,
-                 kCompressionStrategy);
-
-    stream.next_in = static_cast<Bytef *>(voxel_bytes_.data());
-    stream.avail_in = unsigned(voxel_bytes_.size());
-
-    compression_buffer.reserve(
-      std::max(voxel_bytes_.size() / kBufferReservationQutient, static_cast<size_t>(g_minimum_buffer_size)));
-    compression_buffer.resize(compression_buffer.capacity());
-
-    stream.avail_out = unsigned(compression_buffer.size());
-    stream.next_out = compression_buffer.data();
-
-    int flush_flag = Z_NO_FLUSH;
-    do
-    {
-      ret = deflate(&stream, flush_flag);
-
-      switch (ret)
-      {
-      case Z_OK:
-        // Done with input data. Make sure we change to flushing.
-        if (stream.avail_in == 0)
-        {
-          flush_flag = Z_FINISH;
-        }
-
-        // Check for insufficient output data before Z_STREAM_END.
-        if (stream.avail_out == 0)
-        {
-          // Output buffer too small.
-          const size_t bytes_so_far = compression_buffer.size();
-          compression_buffer.resize(2 * bytes_so_far);
-          stream.avail_out = unsigned(compression_buffer.size() - bytes_so_far);
-          stream.next_out = compression_buffer.data() + bytes_so_far;
-        }
-        break;
-      case Z_STREAM_END:
-        break;
-      default:
-        // Failed.
-        deflateEnd(&stream);
-        return false;
-      }
-    } while (stream.avail_in || ret != Z_STREAM_END);
-
-    // Ensure flush.
-    if (flush_flag != Z_FINISH)
-    {
-      deflate(&stream, Z_FINISH);
-    }
-
-    ret = deflateEnd(&stream);
-    if (ret != Z_OK)
+    if (!compressVoxelBytes(voxel_bytes_, compression_buffer))
     {
       return false;
     }
-
-    // Resize compressed buffer.
-    compression_buffer.resize(compression_buffer.size() - stream.avail_out);
   }
   else
   {
@@ -294,6 +835,12 @@ bool VoxelBlock::uncompressUnguarded(std::vector<uint8_t> &expanded_buffer)
     flags_ |= kFUncompressed;
   }
 
+  if (flags_ & kFUniform)
+  {
+    expandUniform(expanded_buffer);
+    return true;
+  }
+
   if (flags_ & kFUncompressed)
   {
     // Simply copy existing bytes.
@@ -305,80 +852,194 @@ bool VoxelBlock::uncompressUnguarded(std::vector<uint8_t> &expanded_buffer)
     return true;
   }
 
-  expanded_buffer.resize(uncompressed_byte_size_);
-
-  int ret = Z_OK;
-  z_stream stream;
-  memset(&stream, 0u, sizeof(stream));
-  inflateInit2(&stream, kWindowBits | g_zlib_gzip_flag);  // NOLINT(hicpp-signed-bitwise)
+  VoxelBlockPool::instance().acquire(expanded_buffer, uncompressed_byte_size_);
 
-  stream.avail_in = unsigned(voxel_bytes_.size());
-  stream.next_in = voxel_bytes_.data();
+  if (!validCompressedData(voxel_bytes_.data(), voxel_bytes_.size(), uncompressed_byte_size_))
+  {
+    return false;
+  }
 
-  stream.avail_out = unsigned(expanded_buffer.size());
-  stream.next_out = static_cast<unsigned char *>(expanded_buffer.data());
+  // Resolve the codec used to compress the data.
+  const uint8_t codec = voxel_bytes_[0];
+  const uint8_t *src = voxel_bytes_.data() + 1;
+  size_t src_size = voxel_bytes_.size() - 1;
 
-  int flush_flag = Z_NO_FLUSH;
-  do
+  if (codec & kCodecRunLength)
   {
-    ret = inflate(&stream, flush_flag);
-
-    switch (ret)
+    uint32_t run_length_size = 0;
+    if (src_size < sizeof(run_length_size))
     {
-    case Z_OK:
-      // Check for insufficient output data on flush or before finishing input data. This is an error an error condition
-      // as we know how large it should be.
-      if (stream.avail_out == 0 && (flush_flag == Z_FINISH || stream.avail_in))
-      {
-        // Failed.
-        inflateEnd(&stream);
-        return false;
-      }
-
-      // Transition to flush if there is no more input data.
-      if (stream.avail_in == 0)
-      {
-        flush_flag = Z_FINISH;
-      }
-      break;
-    case Z_STREAM_END:
-      break;
-    default:
-      // Failed.
-      inflateEnd(&stream);
       return false;
     }
-  } while (stream.avail_in || ret != Z_STREAM_END);
+    memcpy(&run_length_size, src, sizeof(run_length_size));
+    src += sizeof(run_length_size);
+    src_size -= sizeof(run_length_size);
 
-  // Ensure flush.
-  if (flush_flag != Z_FINISH)
+    std::vector<uint8_t> run_length_buffer(run_length_size);
+    return uncompressBytes(codec, src, src_size, run_length_buffer.data(), run_length_buffer.size()) &&
+           rleDecode(run_length_buffer.data(), run_length_buffer.size(), expanded_buffer.data(),
+                     expanded_buffer.size());
+  }
+
+  return uncompressBytes(codec, src, src_size, expanded_buffer.data(), expanded_buffer.size());
+}
+
+
+void VoxelBlock::initUncompressed(std::vector<uint8_t> &expanded_buffer, const MapLayer &layer)
+{
+  VoxelBlockPool::instance().acquire(expanded_buffer, uncompressedByteSize());
+  layer.clear(expanded_buffer.data(), map_->region_voxel_dimensions);
+}
+
+
+void VoxelBlock::expandUniform(std::vector<uint8_t> &expanded_buffer) const
+{
+  VoxelBlockPool::instance().acquire(expanded_buffer, uncompressedByteSize());
+  const size_t voxel_byte_size = voxel_bytes_.size();
+  if (expanded_buffer.size() < voxel_byte_size)
   {
-    inflate(&stream, Z_FINISH);
+    return;
   }
 
-  // Resize compressed buffer.
-  expanded_buffer.resize(expanded_buffer.size() - stream.avail_out);
-  inflateEnd(&stream);
+  // Replicate the voxel value, doubling the copied region each iteration.
+  memcpy(expanded_buffer.data(), voxel_bytes_.data(), voxel_byte_size);
+  size_t filled = voxel_byte_size;
+  while (filled < expanded_buffer.size())
+  {
+    const size_t copy_size = std::min(filled, expanded_buffer.size() - filled);
+    memcpy(expanded_buffer.data() + filled, expanded_buffer.data(), copy_size);
+    filled += copy_size;
+  }
+}
+
+
+bool VoxelBlock::collapseUniformUnguarded()
+{
+  const size_t voxel_byte_size = map_->layout.layer(layer_index_).voxelByteSize();
+  if (voxel_byte_size == 0 || voxel_bytes_.size() < voxel_byte_size || voxel_bytes_.size() % voxel_byte_size != 0)
+  {
+    return false;
+  }
+
+  // The data are uniform if they are unchanged by shifting by one voxel.
+  if (memcmp(voxel_bytes_.data(), voxel_bytes_.data() + voxel_byte_size, voxel_bytes_.size() - voxel_byte_size) != 0)
+  {
+    return false;
+  }
 
+  std::vector<uint8_t> uniform_voxel(voxel_bytes_.begin(), voxel_bytes_.begin() + voxel_byte_size);
+  // Recycle the uncompressed voxel memory.
+  VoxelBlockPool::instance().release(voxel_bytes_);
+  voxel_bytes_.swap(uniform_voxel);
+  compressed_byte_size_ = voxel_bytes_.size();
+  flags_ &= ~kFUncompressed;
+  flags_ |= kFUniform;
   return true;
 }
 
 
-void VoxelBlock::initUncompressed(std::vector<uint8_t> &expanded_buffer, const MapLayer &layer)
+size_t VoxelBlock::spill(VoxelBlockSpillStore &store)
 {
-  expanded_buffer.resize(uncompressedByteSize());
-  layer.clear(expanded_buffer.data(), map_->region_voxel_dimensions);
+  std::unique_lock<Mutex> guard(access_guard_);
+  const unsigned ineligible_flags =
+    kFLocked | kFMarkedForDeath | kFUncompressed | kFUniform | kFSpilled | kFShared;
+  if (reference_count_ || (flags_ & ineligible_flags) || voxel_bytes_.empty())
+  {
+    return 0;
+  }
+
+  VoxelBlockSpillRecord record;
+  if (!store.write(voxel_bytes_.data(), voxel_bytes_.size(), &record))
+  {
+    return 0;
+  }
+
+  const size_t spilled_size = voxel_bytes_.size();
+  std::vector<uint8_t>().swap(voxel_bytes_);
+  compressed_byte_size_ = spilled_size;
+  spill_store_ = &store;
+  spill_offset_ = record.offset;
+  flags_ |= kFSpilled;
+  if (compression_queue_)
+  {
+    compression_queue_->adjustAllocation(-int64_t(spilled_size));
+  }
+  return spilled_size;
+}
+
+
+bool VoxelBlock::faultInUnguarded()
+{
+  const VoxelBlockSpillRecord record{ spill_offset_, compressed_byte_size_ };
+  // On failure the voxel data are lost and the block reverts to the cleared state on uncompressing.
+  const bool ok = spill_store_ && spill_store_->read(record, voxel_bytes_);
+  if (spill_store_)
+  {
+    spill_store_->free(record);
+  }
+  spill_store_ = nullptr;
+  flags_ &= ~kFSpilled;
+  if (!ok)
+  {
+    voxel_bytes_.clear();
+  }
+  if (compression_queue_)
+  {
+    compression_queue_->adjustAllocation(int64_t(voxel_bytes_.size()));
+  }
+  return ok;
+}
+
+
+bool VoxelBlock::faultInSharedUnguarded()
+{
+  std::shared_ptr<VoxelBlockImage> image = std::move(image_);
+  flags_ &= ~kFShared;
+  if (!image)
+  {
+    return false;
+  }
+
+  std::unique_lock<Mutex> image_guard(image->lock);
+  if (image->source)
+  {
+    // Not yet captured. Capture the data from the source now.
+    std::unique_lock<Mutex> source_guard(image->source->access_guard_);
+    image->source->captureImageUnguarded(*image);
+  }
+
+  voxel_bytes_ = image->voxel_bytes;
+  flags_ |= image->flags;
+  compressed_byte_size_ = voxel_bytes_.size();
+  if (compression_queue_)
+  {
+    compression_queue_->adjustAllocation(int64_t(voxel_bytes_.size()));
+  }
+  return true;
+}
+
+
+void VoxelBlock::captureImageUnguarded(VoxelBlockImage &image)
+{
+  if (flags_ & kFSpilled)
+  {
+    faultInUnguarded();
+  }
+  image.voxel_bytes = voxel_bytes_;
+  image.flags = flags_ & (kFUncompressed | kFUniform);
+  image.source = nullptr;
 }
 
 
 void VoxelBlock::setCompressedBytesUnguarded(const std::vector<uint8_t> &compressed_voxels)
 {
-  voxel_bytes_.resize(compressed_voxels.size());
-  if (!compressed_voxels.empty())
+  if (flags_ & kFUncompressed)
   {
-    memcpy(voxel_bytes_.data(), compressed_voxels.data(), sizeof(*compressed_voxels.data()) * compressed_voxels.size());
+    // Recycle the uncompressed voxel memory.
+    VoxelBlockPool::instance().release(voxel_bytes_);
   }
-  voxel_bytes_.shrink_to_fit();
+  // Assign to an exactly sized buffer.
+  std::vector<uint8_t>(compressed_voxels.begin(), compressed_voxels.end()).swap(voxel_bytes_);
   compressed_byte_size_ = voxel_bytes_.size();
   // Clear uncompressed flag.
   flags_ &= ~(kFUncompressed);
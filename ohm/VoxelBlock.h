@@ -15,6 +15,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -22,7 +23,9 @@ namespace ohm
 {
 class MapLayer;
 class VoxelBlockCompressionQueue;
+class VoxelBlockSpillStore;
 struct OccupancyMapDetail;
+struct VoxelBlockImage;
 
 /// A utility class used to track the memory for a dense voxel layer in a @c MapChunk. This class ensures voxel memory
 /// is uncompressed when requested and compressed using the background compression thread when no longer needed.
@@ -37,10 +40,24 @@ struct OccupancyMapDetail;
 /// data access object. This object manages multiple aspects of voxel data access including ensuring @c retain() and
 /// @c release() are called as needed.
 ///
-/// When a @c VoxelBlock is pushed onto the background compression queue, it is assigned a release time before which
-/// it cannot be compressed. The background thread cannot compress the block before this time elapses. The time is
-/// updated on each release, ensuring that the block is not compressed until some time after the most recent release.
-/// This is currently based on wall clock time and may change in future.
+/// A @c VoxelBlock registered with the background compression queue notifies the queue when the last reference is
+/// released and when its allocation size changes. The queue maintains a least recently released ordering of the
+/// blocks, compressing the least recently used blocks first once memory exceeds the queue's high tide.
+///
+/// A block whose voxels all share the same value is held in a uniform representation, storing just the single voxel
+/// value. Blocks are created uniform, holding the @c MapLayer clear value, and the full voxel buffer is only materialised
+/// when the block is first retained. Compressing a block whose voxels are all the same collapses it back to the uniform
+/// representation rather than running the compression codec. This saves both memory and compression time for the
+/// many regions, and layers, which are entirely unobserved or uniformly free.
+///
+/// When the compression queue has spilling enabled, compressed blocks which have not been used recently may be paged
+/// out to the queue's spill file (see @c VoxelBlockCompressionQueue::enableSpill() ). A spilled block holds no voxel
+/// memory and is transparently read back in by the next @c retain() .
+///
+/// Blocks support copy-on-write sharing with map snapshots (see @c OccupancyMap::snapshot() ). A snapshot block
+/// references an image of the source block's voxel data, and the source block only copies its data into the image
+/// when it is next written to - see @c prepareWrite() - or when the snapshot block is first retained. Unchanged blocks
+/// are thus shared between a map and its snapshots without duplicating the voxel data.
 ///
 /// The block also deals with cases where the background thread is in the process of compressing the voxel data while
 /// the reference count is non zero or when the background thread is processing the block when the map chunk is
@@ -79,7 +96,20 @@ public:
     /// Block is to be deleted. Only set when the block should be deleted but is currently on the compression thread.
     kFMarkedForDeath = (1u << 2u),
     /// Block is part of the compression system.
-    kFManagedForCompression = (1u << 3u)
+    kFManagedForCompression = (1u << 3u),
+    /// A release event is pending on the compression queue.
+    kFReleaseQueued = (1u << 4u),
+    /// Every voxel in the block has the same value. The memory buffer holds that single voxel value. Mutually exclusive
+    /// with @c kFUncompressed .
+    kFUniform = (1u << 5u),
+    /// The compressed voxel data have been paged out to the compression queue's spill file. The memory buffer is empty.
+    kFSpilled = (1u << 6u),
+    /// The voxel data are held by the image of another block, shared via @c shareFrom() . The memory buffer is empty.
+    /// The data are copied in by the next @c retain() .
+    kFShared = (1u << 7u),
+    /// An image of the current voxel data is shared with snapshot blocks. The data are copied into the image before
+    /// the next write.
+    kFImageShared = (1u << 8u)
   };
 
   /// Compression level options
@@ -99,7 +129,10 @@ public:
     /// ZLib deflate.
     kCompressDeflate,
     /// GZip compression.
-    kCompressGZip
+    kCompressGZip,
+    /// Fast LZ77 byte codec. Much faster than deflate, particularly to decompress, at a lower compression ratio.
+    /// Ignores the @c CompressionLevel .
+    kCompressLz
   };
 
   /// Static compression controls.
@@ -111,13 +144,16 @@ public:
     CompressionLevel compression_level = kCompressFast;
     /// Voxel block compression technique.
     CompressionType compression_type = kCompressDeflate;
+    /// Run length encode voxel data as 32-bit words before compression? This cheaply collapses the long runs of
+    /// unobserved voxels in sparse regions, reducing the work for the @c compression_type codec.
+    bool run_length_prepass = false;
   };
 
   /// Get the current compression controls.
   /// @param[out] controls A non-null pointer to the structure in which current compression settings are returned.
   static void getCompressionControls(CompressionControls *controls);
   /// Set the voxel block compression controls. Should only be called before maps are created and voxel compression
-  /// begins.
+  /// begins. Blocks which are already compressed record the codec used and remain valid.
   /// @param controls New compression settings.
   static void setCompressionControls(const CompressionControls &controls);
 
@@ -162,13 +198,58 @@ public:
   /// Retain the uncompressed voxel memory until a corresponding @c release() call. Not recommended; use
   /// @c voxelBuffer().
   ///
-  /// This call may block while the voxel memory is uncompressed or allocated an initialised.
+  /// This call may block while the voxel memory is uncompressed or allocated an initialised. Should the voxel data be
+  /// unavailable - a failed spill store read or invalid compressed data - the block is filled with the layer clear
+  /// value.
   void retain();
 
   /// Release the uncompressed voxel memory until a corresponding @c release() call. Not recommended; use
   /// @c voxelBuffer().
   void release();
 
+  /// Reset the block to the @c MapLayer clear value in place.
+  ///
+  /// An uncompressed block is cleared in place, keeping its voxel memory, which remains valid for existing
+  /// @c retain() references. Otherwise the block reverts to the uniform clear value, releasing any spilled data.
+  void reset();
+
+  /// Prepare the block for modification of its voxel data, preserving the current data for any snapshot blocks which
+  /// share them. Must be called before writing to the voxel memory. Writable @c VoxelBuffer and @c Voxel references
+  /// call this on retaining the block.
+  ///
+  /// This only does work when the block has been shared since the last write.
+  void prepareWrite();
+
+  /// Make this block share the voxel data of @p source in a copy-on-write fashion. For use by
+  /// @c OccupancyMap::snapshot() on newly created blocks.
+  ///
+  /// No data are copied unless @p source is currently retained, in which case a writer may be holding a reference
+  /// across the call and the data are copied immediately.
+  /// @param source The block to share data with. Must have a matching layer.
+  void shareFrom(VoxelBlock &source);
+
+  /// Get the voxel data in compressed form for serialisation without decompressing the block.
+  ///
+  /// Compressed and spilled blocks copy their compressed bytes verbatim, including the leading codec byte, while uniform
+  /// blocks yield their single voxel value. An uncompressed block yields its single voxel value if uniform, otherwise
+  /// its data are compressed into @p bytes using the current compression controls, leaving the block unchanged. A
+  /// snapshot block exports the data of its shared image without copying the image into the block.
+  ///
+  /// @param[out] bytes Set to the compressed data, or the uniform voxel value.
+  /// @param[out] uniform Set to true if @p bytes holds a uniform voxel value.
+  /// @return True on success.
+  bool exportCompressed(std::vector<uint8_t> &bytes, bool &uniform);
+
+  /// Replace the voxel data with data from @c exportCompressed() , adopting the bytes as they are without
+  /// decompressing them. The data are decompressed on the next @c retain() . Fails if the block is currently retained.
+  ///
+  /// @param bytes The compressed data, or the uniform voxel value.
+  /// @param byte_count Number of bytes in @p bytes . Must match the layer voxel size when @p uniform is set.
+  /// @param uniform True if @p bytes hold a uniform voxel value.
+  /// @return True on success, false if the block is retained or @p bytes do not start with a known codec byte and a
+  ///   plausible payload size.
+  bool importCompressed(const uint8_t *bytes, size_t byte_count, bool uniform);
+
 #if 0
   // This function could be useful, but I'm not keen on maintaining it.
 
@@ -183,7 +264,8 @@ public:
   /// Attempt to compress the @c VoxelBlock memory.
   ///
   /// This call can only succeed if the current reference count is zero (and the kFLocked flag is clear). The compressed
-  /// data size is returned on success.
+  /// data size is returned on success. Blocks where every voxel is the same are collapsed into the uniform
+  /// representation (see @c kFUniform ), in which case the size is the voxel byte size.
   ///
   /// Threadsafe.
   ///
@@ -226,6 +308,15 @@ private:
   ///   though the capacity may be larger.
   /// @return True if compressio into @p compression_buffer succeeded.
   bool compressUnguarded(std::vector<uint8_t> &compression_buffer);
+  /// Generate the @c exportCompressed() data for the given voxel data representation. The caller must hold the lock
+  /// guarding @p voxel_bytes .
+  /// @param voxel_bytes The voxel data to export. Empty for cleared data.
+  /// @param flags The @c kFUncompressed and @c kFUniform flags describing @p voxel_bytes .
+  /// @param[out] bytes Set to the compressed data, or the uniform voxel value.
+  /// @param[out] uniform Set to true if @p bytes holds a uniform voxel value.
+  /// @return True on success.
+  bool exportBytes(const std::vector<uint8_t> &voxel_bytes, unsigned flags, std::vector<uint8_t> &bytes,
+                   bool &uniform) const;
   /// Decompress voxel data into @p expanded_buffer without locking the mutex. This is called from @c retain() after
   /// the mutex is locked.
   /// @param expanded_buffer The buffer to populate with uncompressed data.
@@ -236,6 +327,28 @@ private:
   /// @param expanded_buffer The buffer to initialised.
   /// @param layer The layer used to initialise the memory. Must be explicitly passed to handle map layout changes.
   void initUncompressed(std::vector<uint8_t> &expanded_buffer, const MapLayer &layer);
+  /// Expand the uniform voxel value in @c voxel_bytes_ into @p expanded_buffer , replicating it for every voxel.
+  /// @param expanded_buffer The buffer to populate with uncompressed data.
+  void expandUniform(std::vector<uint8_t> &expanded_buffer) const;
+  /// Collapse the uncompressed voxel data to the uniform representation if every voxel has the same value. Must be
+  /// called with the mutex locked.
+  /// @return True if the data were uniform and have been collapsed.
+  bool collapseUniformUnguarded();
+  /// Page the compressed voxel data out to @p store , releasing the voxel memory. Only compressed blocks with no
+  /// retained references may be spilled. For use by the @c VoxelBlockCompressionQueue.
+  /// @param store The store to write to.
+  /// @return The number of bytes spilled, or zero if the block cannot be spilled.
+  size_t spill(VoxelBlockSpillStore &store);
+  /// Read spilled voxel data back into memory. Must be called with the mutex locked.
+  /// @return True on success.
+  bool faultInUnguarded();
+  /// Copy the voxel data shared via @c image_ into this block. Must be called with the mutex locked.
+  /// @return True on success.
+  bool faultInSharedUnguarded();
+  /// Copy the current voxel data into @p image , detaching it from this block. Must be called with the mutex and the
+  /// @p image lock held.
+  /// @param image The image to populate.
+  void captureImageUnguarded(VoxelBlockImage &image);
   /// Swap the voxel bytes with the given compressed voxel bytes, but only if there are currently no retained
   /// references. This is for use byte the @c VoxelBlockCompressionQueue.
   /// @param compressed_voxels The compressed voxel data.
@@ -244,10 +357,13 @@ private:
 
   /// Voxel data.
   ///
-  /// This data can be in one of three states:
+  /// This data can be in one of six states:
   /// 1. Empty implying no changes have been made from the default initialised values.
   /// 2. Uncompressed when not empty and `flags_ & kFUncompressed` set.
-  /// 3. Compressed when not emtpy and `flags_ & kFUncompressed` clear.
+  /// 3. Uniform when `flags_ & kFUniform` set, holding a single voxel value.
+  /// 4. Compressed when not emtpy and neither `flags_ & kFUncompressed` nor `flags_ & kFUniform` are set.
+  /// 5. Spilled when `flags_ & kFSpilled` set. Empty with the compressed data held by @c spill_store_ .
+  /// 6. Shared when `flags_ & kFShared` set. Empty with the data held by @c image_ .
   std::vector<uint8_t> voxel_bytes_;
   /// Data access mutex
   mutable Mutex access_guard_;
@@ -255,8 +371,8 @@ private:
   std::atomic_uint32_t reference_count_{ 0 };
   /// Block status @c Flag values.
   std::atomic_uint32_t flags_{ 0 };
-  /// Timepoint after which the block may be compressed.
-  Clock::time_point release_after_;
+  /// The compression queue managing this block, if any.
+  VoxelBlockCompressionQueue *compression_queue_ = nullptr;
   /// The owning occupancy map detail.
   const OccupancyMapDetail *map_ = nullptr;
   /// The index into the @c MapLayout represented by this voxel data.
@@ -265,6 +381,13 @@ private:
   size_t uncompressed_byte_size_ = 0;
   /// Byte size of this voxel block when uncompressed.
   size_t compressed_byte_size_ = 0;
+  /// The store holding the voxel data when @c kFSpilled is set.
+  VoxelBlockSpillStore *spill_store_ = nullptr;
+  /// Byte offset of the spilled data in @c spill_store_ .
+  uint64_t spill_offset_ = 0;
+  /// Shared voxel data image. For a @c kFShared block, this holds the voxel data. Otherwise this is the image shared
+  /// with snapshot blocks while @c kFImageShared is set.
+  std::shared_ptr<VoxelBlockImage> image_;
 };
 
 inline uint8_t *VoxelBlock::voxelBytes()
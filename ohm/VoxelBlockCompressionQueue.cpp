@@ -6,9 +6,16 @@
 #include "VoxelBlockCompressionQueue.h"
 
 #include "VoxelBlock.h"
+#include "VoxelBlockPool.h"
 
 #include "private/VoxelBlockCompressionQueueDetail.h"
 
+#ifdef OHM_THREADS
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#endif  // OHM_THREADS
+
 #include <algorithm>
 #include <chrono>
 #include <cinttypes>
@@ -16,10 +23,13 @@
 
 namespace ohm
 {
-const int kSleepIntervalMs = 50;
+/// Interval at which the compression thread wakes to process block events when not woken by memory pressure.
+const int kHousekeepingIntervalMs = 500;
 
 VoxelBlockCompressionQueue &VoxelBlockCompressionQueue::instance()
 {
+  // Ensure the buffer pool outlives the queue as the queue may release voxel blocks during destruction.
+  VoxelBlockPool::instance();
   static VoxelBlockCompressionQueue queue_instance;
   return queue_instance;
 }
@@ -75,6 +85,10 @@ uint64_t VoxelBlockCompressionQueue::highTide() const
 void VoxelBlockCompressionQueue::setHighTide(uint64_t tide)
 {
   imp_->high_tide = tide;
+  if (imp_->estimated_allocated_size >= tide && !imp_->test_mode)
+  {
+    ohm::wake(*imp_);
+  }
 }
 
 
@@ -96,12 +110,66 @@ uint64_t VoxelBlockCompressionQueue::estimatedAllocationSize() const
 }
 
 
+unsigned VoxelBlockCompressionQueue::workerCount() const
+{
+  return imp_->worker_count;
+}
+
+
+void VoxelBlockCompressionQueue::setWorkerCount(unsigned count)
+{
+  imp_->worker_count = std::max(count, 1u);
+}
+
+
+bool VoxelBlockCompressionQueue::enableSpill(const std::string &path)
+{
+  std::unique_lock<std::mutex> guard(imp_->spill_lock);
+  if (!imp_->spill_store || imp_->spill_store->path() != path)
+  {
+    if (imp_->spill_store && imp_->spill_store->spilledBytes())
+    {
+      // Blocks reference the current store.
+      return false;
+    }
+    imp_->spill_store = std::make_unique<VoxelBlockSpillStore>(path);
+  }
+
+  imp_->spill_enabled = imp_->spill_store->isOpen();
+  return imp_->spill_enabled;
+}
+
+
+void VoxelBlockCompressionQueue::disableSpill()
+{
+  imp_->spill_enabled = false;
+}
+
+
+bool VoxelBlockCompressionQueue::spillEnabled() const
+{
+  return imp_->spill_enabled;
+}
+
+
+uint64_t VoxelBlockCompressionQueue::spilledSize() const
+{
+  std::unique_lock<std::mutex> guard(imp_->spill_lock);
+  return (imp_->spill_store) ? imp_->spill_store->spilledBytes() : 0u;
+}
+
+
 void VoxelBlockCompressionQueue::push(VoxelBlock *block)
 {
   if (imp_->running || imp_->test_mode)
   {
-    block->flags_ |= VoxelBlock::kFManagedForCompression;
-    ohm::push(*imp_, block);
+    {
+      std::unique_lock<VoxelBlock::Mutex> guard(block->access_guard_);
+      block->flags_ |= VoxelBlock::kFManagedForCompression;
+      block->compression_queue_ = this;
+      adjustAllocation(int64_t(block->voxel_bytes_.size()));
+    }
+    ohm::push(*imp_, CompressionEvent{ block, CompressionEventType::kRegister });
   }
 }
 
@@ -114,114 +182,230 @@ bool VoxelBlockCompressionQueue::testMode() const
 
 void VoxelBlockCompressionQueue::__tick(std::vector<uint8_t> &compression_buffer)
 {
-  // Process any new items added to the compression queue by adding them to the block list.
+  // Process block events, maintaining the LRU list and deleting blocks marked for death.
+  CompressionEvent event{};
+  while (ohm::tryPop(*imp_, &event))
   {
-    VoxelBlock *voxels = nullptr;
+    VoxelBlock *voxels = event.voxels;
+    switch (event.type)
+    {
+    case CompressionEventType::kRegister:
+    {
+      VoxelBlockCompressionQueueDetail::LruEntry entry;
+      entry.iter = imp_->lru.insert(imp_->lru.end(), voxels);
+      entry.state = LruState::kUncompressed;
+      imp_->blocks.emplace(voxels, entry);
+      break;
+    }
+    case CompressionEventType::kRelease:
+    {
+      voxels->flags_ &= ~VoxelBlock::kFReleaseQueued;
+      auto iter = imp_->blocks.find(voxels);
+      if (iter != imp_->blocks.end())
+      {
+        // Move to the back of the LRU list. Compressed and spilled blocks are decompressed before they can be
+        // released, so they are moved or (re)inserted.
+        VoxelBlockCompressionQueueDetail::LruEntry &entry = iter->second;
+        switch (entry.state)
+        {
+        case LruState::kUncompressed:
+          imp_->lru.splice(imp_->lru.end(), imp_->lru, entry.iter);
+          break;
+        case LruState::kCompressed:
+          imp_->lru.splice(imp_->lru.end(), imp_->compressed_lru, entry.iter);
+          break;
+        case LruState::kNone:
+        default:
+          entry.iter = imp_->lru.insert(imp_->lru.end(), voxels);
+          break;
+        }
+        entry.state = LruState::kUncompressed;
+      }
+      break;
+    }
+    case CompressionEventType::kDestroy:
+    {
+      auto iter = imp_->blocks.find(voxels);
+      if (iter != imp_->blocks.end())
+      {
+        if (iter->second.state == LruState::kUncompressed)
+        {
+          imp_->lru.erase(iter->second.iter);
+        }
+        else if (iter->second.state == LruState::kCompressed)
+        {
+          imp_->compressed_lru.erase(iter->second.iter);
+        }
+        imp_->blocks.erase(iter);
+      }
+      // Block no longer required. Lock access guard to make sure the code that sets the flag has completed.
+      voxels->access_guard_.lock();
+      adjustAllocation(-int64_t(voxels->voxel_bytes_.size()));
+      // fprintf(stderr, "0x%" PRIXPTR ", VoxelBlockCompressionQueue\n", (uintptr_t)voxels);
+      delete voxels;
+      break;
+    }
+    default:
+      break;
+    }
+  }
 
-    while (ohm::tryPop(*imp_, &voxels))
+  // Check if we are over the high tide and release what we can.
+  if (imp_->estimated_allocated_size >= imp_->high_tide)
+  {
+    compressLeastRecentlyUsed(compression_buffer);
+    // Spill if compression is not enough.
+    if (imp_->spill_enabled && imp_->estimated_allocated_size >= imp_->low_tide)
     {
-      imp_->blocks.emplace_back(CompressionEntry{ voxels, 0u });
+      spillLeastRecentlyUsed();
     }
   }
+}
+
 
-  // Estimate the current memory usage and release items marked for death.
-  uint64_t memory_usage = 0;
+void VoxelBlockCompressionQueue::blockReleased(VoxelBlock *block)
+{
+  ohm::push(*imp_, CompressionEvent{ block, CompressionEventType::kRelease });
+}
+
+
+void VoxelBlockCompressionQueue::blockDestroyed(VoxelBlock *block)
+{
+  ohm::push(*imp_, CompressionEvent{ block, CompressionEventType::kDestroy });
+}
+
+
+void VoxelBlockCompressionQueue::adjustAllocation(int64_t delta)
+{
+  // Two's complement addition handles negative deltas.
+  const uint64_t previous = imp_->estimated_allocated_size.fetch_add(uint64_t(delta));
   const uint64_t high_tide = imp_->high_tide;
+  // Wake on growth beyond the high tide unless a wake is already pending.
+  if (delta > 0 && previous + uint64_t(delta) >= high_tide && !imp_->wake_flag && !imp_->test_mode)
+  {
+    ohm::wake(*imp_);
+  }
+}
+
+
+void VoxelBlockCompressionQueue::compressLeastRecentlyUsed(std::vector<uint8_t> &compression_buffer)
+{
   const uint64_t low_tide = imp_->low_tide;
-  for (auto iter = imp_->blocks.begin(); iter != imp_->blocks.end();)
+  const unsigned worker_count = imp_->worker_count;
+  // Candidates selected for compression in the current pass.
+  std::vector<VoxelBlock *> candidates;
+
+  auto iter = imp_->lru.begin();
+  while (iter != imp_->lru.end() && imp_->estimated_allocated_size >= low_tide)
   {
-    CompressionEntry &entry = *iter;
-    // Check if marked for death.
-    if (!(entry.voxels->flags_ & VoxelBlock::kFMarkedForDeath))
+    // Select the next set of candidates. Locked blocks remain in place until released. Blocks marked for death are
+    // left for their destroy event.
+    // We select one candidate per worker so we do not compress well beyond the low tide.
+    candidates.clear();
+    while (iter != imp_->lru.end() && candidates.size() < worker_count)
     {
-      // Still alive. Update th entry's allocation size.
-      if (entry.voxels->flags_ & VoxelBlock::kFUncompressed)
-      {
-        entry.allocation_size = entry.voxels->uncompressed_byte_size_;
-      }
-      else
+      VoxelBlock *voxels = *iter;
+      if (!(voxels->flags_ & (VoxelBlock::kFLocked | VoxelBlock::kFMarkedForDeath)))
       {
-        entry.allocation_size = entry.voxels->compressed_byte_size_;
+        candidates.emplace_back(voxels);
       }
-
-      memory_usage += entry.allocation_size;
       ++iter;
     }
+
+    // Try compress the candidates. This could fail as the flags can have changed. On failure, the compressed size will
+    // be zero. We call compressWithTemporaryBuffer() to re-use the compression buffer memory. The allocation size is
+    // adjusted by the block.
+#ifdef OHM_THREADS
+    if (candidates.size() > 1)
+    {
+      const auto compress_func = [&candidates](const tbb::blocked_range<size_t> &range) {
+        std::vector<uint8_t> buffer;
+        for (size_t i = range.begin(); i < range.end(); ++i)
+        {
+          if (!candidates[i]->compressWithTemporaryBuffer(buffer))
+          {
+            candidates[i] = nullptr;
+          }
+        }
+      };
+      tbb::task_arena arena{ int(worker_count) };
+      arena.execute([&candidates, &compress_func]() {
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, candidates.size(), 1), compress_func);
+      });
+    }
     else
+#endif  // OHM_THREADS
     {
-      // Marked for death. Remove this entry;
-      // Block no longer required. Remove it.
-      // Marked for death. Clean it up.
-      // Lock access guard to make sure the code that sets the flag has completed
-      iter->voxels->access_guard_.lock();
-      // fprintf(stderr, "0x%" PRIXPTR ", VoxelBlockCompressionQueue\n", (uintptr_t)iter->voxels);
-      delete iter->voxels;
-      iter = imp_->blocks.erase(iter);
+      for (VoxelBlock *&voxels : candidates)
+      {
+        if (!voxels->compressWithTemporaryBuffer(compression_buffer))
+        {
+          voxels = nullptr;
+        }
+      }
     }
-  }
 
-  // Check if we are over the high tide and release what we can.
-  if (memory_usage >= high_tide)
-  {
-    // Sort all blocks by allocation size.
-    // TODO(KS): consider including the queued for compression flag so we push items to be compressed to the front
-    // of the sort results.
-    // TODO(KS): try using a partial sort.
-    std::sort(imp_->blocks.begin(), imp_->blocks.end(), [](const CompressionEntry &a, const CompressionEntry &b) {
-      return a.allocation_size > b.allocation_size;
-    });
-
-    auto iter = imp_->blocks.begin();
-    // Free until we reach the low tide.
-    while (iter != imp_->blocks.end() && memory_usage >= low_tide)
+    // Move compressed blocks to the compressed LRU list. Uniform blocks cannot be reduced further and are removed.
+    for (VoxelBlock *voxels : candidates)
     {
-      // Check if marked for death. The status may have changed since we updated the allocation size.
-      if (!(iter->voxels->flags_ & VoxelBlock::kFMarkedForDeath))
+      if (voxels)
       {
-        // Not maked for death. Check lock flag and compress this item if we can
-        if (!(iter->voxels->flags_ & VoxelBlock::kFLocked))
+        auto block_iter = imp_->blocks.find(voxels);
+        if (block_iter != imp_->blocks.end() && block_iter->second.state == LruState::kUncompressed)
         {
-          // Block is not locked.
-          // std::cout << "compress\n" << std::flush;
-          // Try compress the current item. This could fail as the flag can have changed. On failure, the
-          // compressed_size will be zero. We call compressWithTemporaryBuffer() to re-use the compression buffer
-          // memory.
-          size_t compressed_size = iter->voxels->compressWithTemporaryBuffer(compression_buffer);
-          if (compressed_size)
+          VoxelBlockCompressionQueueDetail::LruEntry &entry = block_iter->second;
+          if (voxels->flags_ & VoxelBlock::kFUniform)
           {
-            // Compression succeeded.
-            // Adjust memory_usage down in a way which guarantees no underflow. Paranoia.
-            memory_usage = (memory_usage > iter->allocation_size) ? memory_usage - iter->allocation_size : 0u;
-            memory_usage += compressed_size;
+            imp_->lru.erase(entry.iter);
+            entry.state = LruState::kNone;
+          }
+          else
+          {
+            imp_->compressed_lru.splice(imp_->compressed_lru.end(), imp_->lru, entry.iter);
+            entry.state = LruState::kCompressed;
           }
         }
-
-        ++iter;
-      }
-      else
-      {
-        // Block no longer required. Remove it.
-        // Marked for death. Clean it up.
-        // Lock access guard to make sure the code that sets the flag has completed
-        iter->voxels->access_guard_.lock();
-        // fprintf(stderr, "0x%" PRIXPTR ", VoxelBlockCompressionQueue\n", (uintptr_t)iter->voxels);
-        delete iter->voxels;
-        // Adjust memory_usage down in a way which guarantees no underflow. Paranoia.
-        memory_usage = (memory_usage > iter->allocation_size) ? memory_usage - iter->allocation_size : 0u;
-        iter = imp_->blocks.erase(iter);
       }
     }
   }
+}
+
+
+void VoxelBlockCompressionQueue::spillLeastRecentlyUsed()
+{
+  std::unique_lock<std::mutex> guard(imp_->spill_lock);
+  if (!imp_->spill_store)
+  {
+    return;
+  }
 
-  imp_->estimated_allocated_size = memory_usage;
+  const uint64_t low_tide = imp_->low_tide;
+  auto iter = imp_->compressed_lru.begin();
+  while (iter != imp_->compressed_lru.end() && imp_->estimated_allocated_size >= low_tide)
+  {
+    // Spilling fails for blocks which have been retained since compression. These are moved by their release event.
+    // The allocation size is adjusted by the block.
+    VoxelBlock *voxels = *iter;
+    if (voxels->spill(*imp_->spill_store))
+    {
+      imp_->blocks[voxels].state = LruState::kNone;
+      iter = imp_->compressed_lru.erase(iter);
+    }
+    else
+    {
+      ++iter;
+    }
+  }
 }
 
+
 void VoxelBlockCompressionQueue::joinCurrentThread()
 {
   // Mark thread for quit.
   if (imp_->running)
   {
     imp_->quit_flag = true;
+    ohm::wake(*imp_);
     imp_->processing_thread.join();
     // Clear the running and quit flags.
     imp_->running = false;
@@ -235,8 +419,17 @@ void VoxelBlockCompressionQueue::run()
   std::vector<uint8_t> compression_buffer;
   while (!imp_->quit_flag)
   {
-    std::this_thread::sleep_for(std::chrono::milliseconds(kSleepIntervalMs));
+    {
+      // Sleep until woken by growth beyond the high tide, or until the housekeeping interval elapses.
+      std::unique_lock<std::mutex> guard(imp_->wake_lock);
+      imp_->wake_condition.wait_for(guard, std::chrono::milliseconds(kHousekeepingIntervalMs),
+                                    [this]() { return imp_->wake_flag.load(); });
+      imp_->wake_flag = false;
+    }
     __tick(compression_buffer);
   }
+
+  // Final tick to delete blocks destroyed since the last tick.
+  __tick(compression_buffer);
 }
 }  // namespace ohm
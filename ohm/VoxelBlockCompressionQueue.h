@@ -8,6 +8,7 @@
 
 #include "OhmConfig.h"
 
+#include <string>
 #include <vector>
 
 namespace ohm
@@ -22,8 +23,20 @@ struct VoxelBlockCompressionQueueDetail;
 /// last reference then attaining a new reference to start a new background thread.
 ///
 /// An @c OccupancyMap will call @c retain() and @c release() on construction and destruction respectively.
+///
+/// Compression is event driven. Registered blocks report changes to their allocation size as they are compressed and
+/// decompressed, keeping the @c estimatedAllocationSize() current without rescanning the blocks. Growth beyond the
+/// @c highTide() wakes the background thread which compresses the least recently released blocks until the allocation
+/// falls below the @c lowTide(). The thread also wakes periodically to delete blocks which have been destroyed.
+///
+/// The queue may also page compressed blocks out to a spill file on disk; see @c enableSpill(). When compression
+/// alone cannot bring the allocation below the @c lowTide(), the least recently compressed blocks are written to the
+/// spill file and their memory released. Spilled blocks are read back in when next retained. This bounds memory use by
+/// the tides, at the cost of disk IO, for maps too large to hold in memory even when compressed.
 class ohm_API VoxelBlockCompressionQueue
 {
+  friend VoxelBlock;
+
 public:
   /// Singleton access.
   static VoxelBlockCompressionQueue &instance();
@@ -46,7 +59,7 @@ public:
 
   /// Memory threshold (bytes) at which the queue starts compressing voxel blocks.
   uint64_t highTide() const;
-  /// Set the @c highTide().
+  /// Set the @c highTide(). Wakes the compression thread if the @c estimatedAllocationSize() exceeds the new tide.
   /// @param tide The high tide (bytes) to start compressing once exceeded.
   void setHighTide(uint64_t tide);
   /// Memory level (bytes) to which the queue tries to compress down to once the high tide is exceeded.
@@ -57,6 +70,30 @@ public:
   /// Query the number of bytes allocated to voxel blocks managed by this compressor (byte).
   uint64_t estimatedAllocationSize() const;
 
+  /// Query the number of threads used to compress voxel blocks.
+  unsigned workerCount() const;
+  /// Set the number of threads used to compress voxel blocks once the @c highTide() is exceeded. Multiple workers are
+  /// only supported when @c OHM_THREADS is enabled.
+  /// @param count The number of compression threads. Zero is treated as one.
+  void setWorkerCount(unsigned count);
+
+  /// Enable spilling compressed voxel blocks to the file at @p path . The file is truncated and is removed when the
+  /// queue is destroyed.
+  ///
+  /// The spill file cannot be changed while it holds spilled blocks. Calling with the current spill file path simply
+  /// re-enables spilling.
+  /// @param path The spill file path.
+  /// @return True if spilling has been enabled, false if the file cannot be opened or another spill file is in use.
+  bool enableSpill(const std::string &path);
+  /// Disable spilling further blocks. Blocks which have already been spilled remain in the spill file until retained.
+  void disableSpill();
+  /// Query whether spilling is enabled.
+  /// @return True if spilling is enabled.
+  bool spillEnabled() const;
+  /// Query the number of bytes of voxel data currently held in the spill file.
+  /// @return The spilled byte count.
+  uint64_t spilledSize() const;
+
   /// Push a @c VoxelBlock on the queue for compression.
   /// @param block The block to compress.
   void push(VoxelBlock *block);
@@ -69,6 +106,24 @@ public:
   void __tick(std::vector<uint8_t> &compression_buffer);
 
 private:
+  /// Called from @c VoxelBlock::release() when the last reference is released, moving the block to the back of the
+  /// least recently used list.
+  /// @param block The released block.
+  void blockReleased(VoxelBlock *block);
+  /// Called from @c VoxelBlock::destroy() once the block is marked for death.
+  /// @param block The destroyed block.
+  void blockDestroyed(VoxelBlock *block);
+  /// Adjust the @c estimatedAllocationSize() by @p delta bytes, waking the compression thread on growth beyond the
+  /// @c highTide().
+  /// @param delta The change in allocation size (bytes).
+  void adjustAllocation(int64_t delta);
+
+  /// Compress the least recently used blocks until the allocation is below the @c lowTide().
+  /// @param compression_buffer Buffer used to compress into.
+  void compressLeastRecentlyUsed(std::vector<uint8_t> &compression_buffer);
+  /// Spill the least recently compressed blocks until the allocation is below the @c lowTide().
+  void spillLeastRecentlyUsed();
+
   void joinCurrentThread();
 
   /// Main compression loop. This is the thread entry point.
@@ -0,0 +1,168 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "VoxelBlockPool.h"
+
+#include "Mutex.h"
+
+#include <algorithm>
+#include <map>
+
+namespace ohm
+{
+/// Free list and statistics for buffers of a single size.
+struct VoxelBlockPoolBucket
+{
+  std::vector<std::vector<uint8_t>> free_buffers;  ///< Buffers available for reuse.
+  VoxelBlockPool::Stats stats;                     ///< Statistics for this buffer size.
+};
+
+/// @c VoxelBlockPool internals.
+struct VoxelBlockPoolDetail
+{
+  /// Access mutex.
+  mutable Mutex lock;
+  /// Buckets keyed by buffer size.
+  std::map<size_t, VoxelBlockPoolBucket> buckets;
+  /// Number of bytes held in the free lists.
+  size_t pooled_bytes = 0;
+  /// Maximum number of bytes to hold in the free lists.
+  size_t max_pooled_bytes = VoxelBlockPool::kDefaultMaxPooledBytes;
+};
+
+const size_t VoxelBlockPool::kDefaultMaxPooledBytes = 256u * 1024u * 1024u;
+
+VoxelBlockPool &VoxelBlockPool::instance()
+{
+  static VoxelBlockPool pool_instance;
+  return pool_instance;
+}
+
+
+VoxelBlockPool::VoxelBlockPool()
+  : imp_(new VoxelBlockPoolDetail)
+{}
+
+
+VoxelBlockPool::~VoxelBlockPool() = default;
+
+
+void VoxelBlockPool::acquire(std::vector<uint8_t> &buffer, size_t byte_size)
+{
+  release(buffer);
+
+  std::unique_lock<Mutex> guard(imp_->lock);
+  VoxelBlockPoolBucket &bucket = imp_->buckets[byte_size];
+  bucket.stats.buffer_size = byte_size;
+  ++bucket.stats.outstanding;
+  if (!bucket.free_buffers.empty())
+  {
+    buffer.swap(bucket.free_buffers.back());
+    bucket.free_buffers.pop_back();
+    imp_->pooled_bytes -= byte_size;
+    bucket.stats.pooled_count = bucket.free_buffers.size();
+    ++bucket.stats.reuses;
+    return;
+  }
+
+  ++bucket.stats.allocations;
+  // Allocate outside the lock.
+  guard.unlock();
+  buffer.resize(byte_size);
+}
+
+
+void VoxelBlockPool::release(std::vector<uint8_t> &buffer)
+{
+  if (buffer.empty())
+  {
+    return;
+  }
+
+  const size_t byte_size = buffer.size();
+  std::unique_lock<Mutex> guard(imp_->lock);
+  auto iter = imp_->buckets.find(byte_size);
+  if (iter == imp_->buckets.end())
+  {
+    // Not a pooled buffer size.
+    guard.unlock();
+    std::vector<uint8_t>().swap(buffer);
+    return;
+  }
+
+  VoxelBlockPoolBucket &bucket = iter->second;
+  bucket.stats.outstanding -= (bucket.stats.outstanding > 0) ? 1u : 0u;
+  ++bucket.stats.releases;
+  if (buffer.capacity() == byte_size && imp_->pooled_bytes + byte_size <= imp_->max_pooled_bytes)
+  {
+    bucket.free_buffers.emplace_back();
+    bucket.free_buffers.back().swap(buffer);
+    imp_->pooled_bytes += byte_size;
+    bucket.stats.pooled_count = bucket.free_buffers.size();
+    return;
+  }
+
+  ++bucket.stats.discards;
+  guard.unlock();
+  std::vector<uint8_t>().swap(buffer);
+}
+
+
+size_t VoxelBlockPool::maxPooledBytes() const
+{
+  std::unique_lock<Mutex> guard(imp_->lock);
+  return imp_->max_pooled_bytes;
+}
+
+
+void VoxelBlockPool::setMaxPooledBytes(size_t max_bytes)
+{
+  std::unique_lock<Mutex> guard(imp_->lock);
+  imp_->max_pooled_bytes = max_bytes;
+  trimTo(max_bytes);
+}
+
+
+size_t VoxelBlockPool::pooledBytes() const
+{
+  std::unique_lock<Mutex> guard(imp_->lock);
+  return imp_->pooled_bytes;
+}
+
+
+void VoxelBlockPool::trim()
+{
+  std::unique_lock<Mutex> guard(imp_->lock);
+  trimTo(0);
+}
+
+
+void VoxelBlockPool::stats(std::vector<Stats> &stats) const
+{
+  std::unique_lock<Mutex> guard(imp_->lock);
+  stats.clear();
+  stats.reserve(imp_->buckets.size());
+  for (const auto &bucket : imp_->buckets)
+  {
+    stats.emplace_back(bucket.second.stats);
+  }
+}
+
+
+void VoxelBlockPool::trimTo(size_t max_bytes)
+{
+  // Free from the largest buffers first.
+  for (auto iter = imp_->buckets.rbegin(); iter != imp_->buckets.rend() && imp_->pooled_bytes > max_bytes; ++iter)
+  {
+    VoxelBlockPoolBucket &bucket = iter->second;
+    while (!bucket.free_buffers.empty() && imp_->pooled_bytes > max_bytes)
+    {
+      bucket.free_buffers.pop_back();
+      imp_->pooled_bytes -= iter->first;
+    }
+    bucket.stats.pooled_count = bucket.free_buffers.size();
+  }
+}
+}  // namespace ohm
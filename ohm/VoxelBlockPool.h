@@ -0,0 +1,93 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef VOXELBLOCKPOOL_H
+#define VOXELBLOCKPOOL_H
+
+#include "OhmConfig.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ohm
+{
+struct VoxelBlockPoolDetail;
+
+/// A pool of uncompressed @c VoxelBlock buffers used to recycle voxel memory.
+///
+/// Uncompressed voxel memory for a @c MapLayer is always @c MapLayer::layerByteSize() bytes, so blocks of the same
+/// layer repeatedly allocate and free identically sized buffers as they are compressed, decompressed, created and
+/// destroyed. The pool holds a free list per buffer size - effectively per layer - from which buffers are recycled
+/// rather than returned to the heap. This reduces heap churn and fragmentation, particularly when regions are
+/// continually added and removed such as when mapping with a sliding window.
+///
+/// The total memory held in the free lists is capped by @c maxPooledBytes() . Buffers released beyond this limit are
+/// freed.
+///
+/// Threadsafe.
+class ohm_API VoxelBlockPool
+{
+public:
+  /// Statistics for buffers of a single byte size.
+  struct ohm_API Stats
+  {
+    size_t buffer_size = 0;    ///< The buffer byte size these stats pertain to.
+    uint64_t allocations = 0;  ///< Number of buffers allocated from the heap.
+    uint64_t reuses = 0;       ///< Number of buffers acquired from the pool rather than allocated.
+    uint64_t releases = 0;     ///< Number of buffers released back to the pool.
+    uint64_t discards = 0;     ///< Number of released buffers freed because the pool was full.
+    size_t pooled_count = 0;   ///< Number of buffers currently held by the pool.
+    size_t outstanding = 0;    ///< Number of acquired buffers yet to be released.
+  };
+
+  /// Default value for @c maxPooledBytes() .
+  static const size_t kDefaultMaxPooledBytes;
+
+  /// Singleton access.
+  static VoxelBlockPool &instance();
+
+  /// Constructor.
+  VoxelBlockPool();
+  /// Destructor.
+  ~VoxelBlockPool();
+
+  /// Acquire a buffer of exactly @p byte_size bytes. The buffer content is undefined.
+  /// @param[out] buffer Set to the acquired buffer. Any existing content is released back to the pool.
+  /// @param byte_size The required buffer size.
+  void acquire(std::vector<uint8_t> &buffer, size_t byte_size);
+
+  /// Release @p buffer back to the pool. The @p buffer is empty on return.
+  ///
+  /// The buffer is only retained when it's capacity exactly matches it's size and there is room in the pool.
+  /// @param buffer The buffer to release.
+  void release(std::vector<uint8_t> &buffer);
+
+  /// Query the maximum number of bytes held by the pool free lists.
+  size_t maxPooledBytes() const;
+  /// Set the @c maxPooledBytes() . Excess buffers are freed.
+  /// @param max_bytes The maximum number of bytes to hold.
+  void setMaxPooledBytes(size_t max_bytes);
+
+  /// Query the number of bytes currently held by the pool free lists.
+  size_t pooledBytes() const;
+
+  /// Free all buffers held by the pool. Statistics are preserved.
+  void trim();
+
+  /// Collect statistics for each buffer size the pool has handled.
+  /// @param[out] stats Populated with the statistics for each buffer size, sorted by size.
+  void stats(std::vector<Stats> &stats) const;
+
+private:
+  /// Free buffers until @c pooledBytes() is at most @p max_bytes . Call with the mutex locked.
+  void trimTo(size_t max_bytes);
+
+  std::unique_ptr<VoxelBlockPoolDetail> imp_;
+};
+}  // namespace ohm
+
+#endif  // VOXELBLOCKPOOL_H
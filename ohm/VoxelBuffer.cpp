@@ -14,6 +14,11 @@ VoxelBuffer<VoxelBlock>::VoxelBuffer(ohm::VoxelBlock *block)
   if (block)
   {
     block->retain();
+    if (!std::is_const<VoxelBlock>::value)
+    {
+      // Writable reference. Preserve data shared with snapshots.
+      block->prepareWrite();
+    }
     voxel_memory_size_ = block->uncompressedByteSize();
     voxel_memory_ = block->voxelBytes();
   }
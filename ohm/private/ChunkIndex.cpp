@@ -0,0 +1,258 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "ChunkIndex.h"
+
+#include <algorithm>
+
+namespace ohm
+{
+namespace
+{
+/// Key value marking an empty slot. Valid keys always have @c kKeyValidBit set, so can never match.
+const uint64_t kEmptyKey = 0u;
+/// Bit set in all valid encoded keys.
+const uint64_t kKeyValidBit = (1ull << 48u);
+/// Minimum table capacity. Must be a power of two.
+const size_t kMinimumCapacity = 256u;
+
+/// Encode a region coordinate as a 64-bit key.
+inline uint64_t encodeKey(const glm::i16vec3 &region_key)
+{
+  return uint64_t(uint16_t(region_key.x)) | (uint64_t(uint16_t(region_key.y)) << 16u) |
+         (uint64_t(uint16_t(region_key.z)) << 32u) | kKeyValidBit;
+}
+
+/// Resolve the reader count stripe for the calling thread. Threads are assigned stripes round robin on first use.
+/// @param stripe_count The number of stripes. Must be a power of two.
+inline unsigned threadReaderStripe(unsigned stripe_count)
+{
+  static std::atomic<unsigned> next_stripe{ 0u };
+  thread_local const unsigned thread_stripe = next_stripe.fetch_add(1u, std::memory_order_relaxed);
+  return thread_stripe & (stripe_count - 1u);
+}
+
+/// Hash an encoded key.
+inline size_t hashKey(uint64_t key)
+{
+  // Fibonacci hashing with the high bits folded into the low bits.
+  key *= 0x9E3779B97F4A7C15ull;  // NOLINT(readability-magic-numbers)
+  return size_t(key ^ (key >> 32u));
+}
+}  // namespace
+
+struct ChunkIndex::Table
+{
+  /// A single table entry. The @c chunk is written before the @c key is published.
+  struct Slot
+  {
+    std::atomic<uint64_t> key{ kEmptyKey };
+    std::atomic<MapChunk *> chunk{ nullptr };
+  };
+
+  size_t capacity;
+  std::unique_ptr<Slot[]> slots;
+
+  explicit Table(size_t capacity)
+    : capacity(capacity)
+    , slots(new Slot[capacity])
+  {}
+
+  /// Find the slot containing @p key or the empty slot at which the probe ends. Returns null if the table is full and
+  /// contains no such key.
+  Slot *probe(uint64_t key) const
+  {
+    const size_t mask = capacity - 1;
+    size_t index = hashKey(key) & mask;
+    for (size_t i = 0; i < capacity; ++i)
+    {
+      Slot *slot = &slots[index];
+      const uint64_t slot_key = slot->key.load(std::memory_order_acquire);
+      if (slot_key == key || slot_key == kEmptyKey)
+      {
+        return slot;
+      }
+      index = (index + 1) & mask;
+    }
+    return nullptr;
+  }
+};
+
+
+ChunkIndex::ChunkIndex()
+  : table_(nullptr)
+{}
+
+
+ChunkIndex::~ChunkIndex() = default;
+
+
+MapChunk *ChunkIndex::find(const glm::i16vec3 &region_key) const
+{
+  // Register as a reader before loading the table. Sequentially consistent ordering pairs with reclaim(): either
+  // reclaim() sees this reader and keeps the retired tables, or this load sees the table published before reclaim().
+  // Only this thread's stripe is written.
+  std::atomic<unsigned> &active_readers = reader_stripes_[threadReaderStripe(kReaderStripeCount)].count;
+  active_readers.fetch_add(1u, std::memory_order_seq_cst);
+  const Table *table = table_.load(std::memory_order_seq_cst);
+  MapChunk *chunk = nullptr;
+  if (table)
+  {
+    const uint64_t key = encodeKey(region_key);
+    const Table::Slot *slot = table->probe(key);
+    if (slot && slot->key.load(std::memory_order_acquire) == key)
+    {
+      chunk = slot->chunk.load(std::memory_order_acquire);
+    }
+  }
+  active_readers.fetch_sub(1u, std::memory_order_release);
+
+  return chunk;
+}
+
+
+void ChunkIndex::insert(const glm::i16vec3 &region_key, MapChunk *chunk)
+{
+  const uint64_t key = encodeKey(region_key);
+  Table *table = table_.load(std::memory_order_relaxed);
+  Table::Slot *slot = (table) ? table->probe(key) : nullptr;
+
+  if (slot && slot->key.load(std::memory_order_relaxed) == key)
+  {
+    // Existing or removed entry for this key.
+    if (!slot->chunk.load(std::memory_order_relaxed))
+    {
+      ++live_count_;
+    }
+    slot->chunk.store(chunk, std::memory_order_release);
+    reclaim();
+    return;
+  }
+
+  // Require a new slot. Keep the load factor at or below 1/2.
+  if (!table || 2 * (used_count_ + 1) > table->capacity)
+  {
+    table = rebuild(live_count_ + 1);
+    slot = table->probe(key);
+  }
+
+  slot->chunk.store(chunk, std::memory_order_relaxed);
+  slot->key.store(key, std::memory_order_release);
+  ++used_count_;
+  ++live_count_;
+  reclaim();
+}
+
+
+bool ChunkIndex::remove(const glm::i16vec3 &region_key)
+{
+  Table *table = table_.load(std::memory_order_relaxed);
+  if (!table)
+  {
+    return false;
+  }
+
+  const uint64_t key = encodeKey(region_key);
+  Table::Slot *slot = table->probe(key);
+  if (slot && slot->key.load(std::memory_order_relaxed) == key && slot->chunk.load(std::memory_order_relaxed))
+  {
+    // Leave the key in place to preserve probe sequences for concurrent readers.
+    slot->chunk.store(nullptr, std::memory_order_release);
+    --live_count_;
+    reclaim();
+    return true;
+  }
+
+  return false;
+}
+
+
+void ChunkIndex::clear()
+{
+  table_.store(nullptr, std::memory_order_release);
+  current_table_.reset();
+  retired_tables_.clear();
+  live_count_ = used_count_ = 0;
+}
+
+
+size_t ChunkIndex::memoryUsage() const
+{
+  size_t usage = sizeof(*this);
+  if (current_table_)
+  {
+    usage += sizeof(*current_table_) + current_table_->capacity * sizeof(Table::Slot);
+  }
+  for (const auto &table : retired_tables_)
+  {
+    usage += sizeof(*table) + table->capacity * sizeof(Table::Slot);
+  }
+  return usage;
+}
+
+
+ChunkIndex::Table *ChunkIndex::rebuild(size_t required_count)
+{
+  size_t capacity = kMinimumCapacity;
+  // Size for a load factor of 1/4 after the rebuild so we do not immediately need to rebuild again.
+  while (capacity < 4 * required_count)
+  {
+    capacity *= 2;
+  }
+
+  std::unique_ptr<Table> new_table(new Table(capacity));
+  size_t used_count = 0;
+  const Table *old_table = table_.load(std::memory_order_relaxed);
+  if (old_table)
+  {
+    for (size_t i = 0; i < old_table->capacity; ++i)
+    {
+      const Table::Slot &old_slot = old_table->slots[i];
+      const uint64_t key = old_slot.key.load(std::memory_order_relaxed);
+      MapChunk *chunk = old_slot.chunk.load(std::memory_order_relaxed);
+      if (key != kEmptyKey && chunk)
+      {
+        // Removed entries are dropped here.
+        Table::Slot *slot = new_table->probe(key);
+        slot->chunk.store(chunk, std::memory_order_relaxed);
+        slot->key.store(key, std::memory_order_relaxed);
+        ++used_count;
+      }
+    }
+  }
+
+  Table *table = new_table.get();
+  // Publish the new table. Readers see the populated slots. The superseded table is retired until reclaim() finds no
+  // active readers.
+  table_.store(table, std::memory_order_seq_cst);
+  if (current_table_)
+  {
+    retired_tables_.emplace_back(std::move(current_table_));
+  }
+  current_table_ = std::move(new_table);
+  used_count_ = used_count;
+  return table;
+}
+
+
+void ChunkIndex::reclaim()
+{
+  if (retired_tables_.empty())
+  {
+    return;
+  }
+
+  for (const ReaderStripe &stripe : reader_stripes_)
+  {
+    if (stripe.count.load(std::memory_order_seq_cst) != 0)
+    {
+      return;
+    }
+  }
+
+  // Any reader which registers from here on loads the current table, which is not retired.
+  retired_tables_.clear();
+}
+}  // namespace ohm
@@ -0,0 +1,118 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_CHUNKINDEX_H
+#define OHM_CHUNKINDEX_H
+
+#include "OhmConfig.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ohm
+{
+struct MapChunk;
+
+/// A read optimised index of @c MapChunk pointers keyed by region coordinate.
+///
+/// The @c find() function is lock free and may be called concurrently with modification. Modifying functions -
+/// @c insert() , @c remove() and @c clear() - must be serialised by the caller. For the @c OccupancyMap this means
+/// holding the @c OccupancyMapDetail::mutex .
+///
+/// The index is implemented as an open addressing hash table with linear probing. Removing an entry leaves its key in
+/// place, only clearing the chunk pointer, so concurrent readers may continue probing past the removed slot. The table
+/// is rebuilt into a new allocation once the occupied slot count exceeds the load limit and the new table is
+/// published atomically.
+///
+/// Superseded tables may still be in use by concurrent readers, so they are retired rather than released immediately.
+/// Each @c find() call registers itself in an active reader count while it holds a table pointer. Retired tables are
+/// released by the next modification which observes no active readers. Any reader arriving after that point can only
+/// see the current table. The reader count is striped over separate cache lines, with each thread assigned a fixed
+/// stripe, so concurrent readers on different threads do not contend on a shared counter.
+class ohm_API ChunkIndex
+{
+public:
+  /// Constructor. No memory is allocated until the first @c insert() .
+  ChunkIndex();
+  /// Destructor.
+  ~ChunkIndex();
+
+  ChunkIndex(const ChunkIndex &other) = delete;
+  ChunkIndex &operator=(const ChunkIndex &other) = delete;
+
+  /// Lookup the chunk for @p region_key . Lock free.
+  /// @param region_key The region coordinate to lookup.
+  /// @return The chunk for @p region_key or null if not present.
+  MapChunk *find(const glm::i16vec3 &region_key) const;
+
+  /// Add or replace the @p chunk for @p region_key . Must be serialised with other modifications.
+  /// @param region_key The region coordinate for @p chunk .
+  /// @param chunk The chunk to add. Must not be null.
+  void insert(const glm::i16vec3 &region_key, MapChunk *chunk);
+
+  /// Remove the chunk for @p region_key . Must be serialised with other modifications.
+  /// @param region_key The region coordinate to remove.
+  /// @return True if an entry was removed.
+  bool remove(const glm::i16vec3 &region_key);
+
+  /// Remove all entries and release all table memory. Must not be called concurrently with @c find() .
+  void clear();
+
+  /// Query the number of chunks in the index.
+  /// @return The number of chunks.
+  inline size_t size() const { return live_count_; }
+
+  /// Estimate the memory used by the index tables.
+  /// @return The memory used by the index in bytes.
+  size_t memoryUsage() const;
+
+  /// Query the number of superseded tables not yet released. For testing and diagnostics.
+  /// @return The number of retired tables.
+  inline size_t retiredTableCount() const { return retired_tables_.size(); }
+
+private:
+  struct Table;
+
+  /// Number of reader count stripes. Must be a power of two.
+  static const unsigned kReaderStripeCount = 16u;
+
+  /// A reader count padded to occupy its own cache line.
+  struct ReaderStripe
+  {
+    /// Number of @c find() calls on threads assigned this stripe currently holding a table pointer.
+    std::atomic<unsigned> count{ 0u };
+    /// Padding to the cache line size.
+    char padding[64u - sizeof(std::atomic<unsigned>)];  // NOLINT(modernize-avoid-c-arrays)
+  };
+
+  /// Rebuild the current table with at least enough capacity for @p required_count entries.
+  /// @param required_count The number of entries which must fit in the new table.
+  /// @return The new table.
+  Table *rebuild(size_t required_count);
+
+  /// Release the @c retired_tables_ if there are no active readers. Must be serialised with other modifications.
+  void reclaim();
+
+  /// The current table. Read lock free.
+  std::atomic<Table *> table_;
+  /// Owns the current table.
+  std::unique_ptr<Table> current_table_;
+  /// Superseded tables which may still be in use by concurrent readers.
+  std::vector<std::unique_ptr<Table>> retired_tables_;
+  /// Striped count of the @c find() calls currently holding a table pointer. Indexed by the calling thread's stripe.
+  mutable ReaderStripe reader_stripes_[kReaderStripeCount];  // NOLINT(modernize-avoid-c-arrays)
+  /// Number of chunks in the index.
+  size_t live_count_ = 0;
+  /// Number of occupied slots in the current table. Includes removed entries.
+  size_t used_count_ = 0;
+};
+}  // namespace ohm
+
+#endif  // OHM_CHUNKINDEX_H
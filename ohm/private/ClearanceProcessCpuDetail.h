@@ -0,0 +1,38 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_CLEARANCEPROCESSCPUDETAIL_H
+#define OHM_CLEARANCEPROCESSCPUDETAIL_H
+
+#include "OhmConfig.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace ohm
+{
+/// @c ClearanceProcessCpu internals.
+struct ClearanceProcessCpuDetail
+{
+  unsigned query_flags = 0;
+  glm::vec3 axis_scaling = glm::vec3(1);
+  float search_radius = 0;
+  /// Regions pending update from @c ClearanceProcessCpu::update() .
+  std::vector<glm::i16vec3> work;
+  /// Index of the next item in @c work to process.
+  size_t work_cursor = 0;
+
+  inline bool haveWork() const { return work_cursor < work.size(); }
+
+  inline void resetWorking()
+  {
+    work.clear();
+    work_cursor = 0;
+  }
+};
+}  // namespace ohm
+
+#endif  // OHM_CLEARANCEPROCESSCPUDETAIL_H
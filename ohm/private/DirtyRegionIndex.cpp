@@ -0,0 +1,48 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "DirtyRegionIndex.h"
+
+namespace ohm
+{
+void DirtyRegionIndex::update(const glm::i16vec3 &region, std::atomic_uint64_t &dirty_stamp, uint64_t new_stamp)
+{
+  std::unique_lock<SpinMutex> guard(lock_);
+  const uint64_t old_stamp = dirty_stamp.exchange(new_stamp);
+  if (old_stamp == new_stamp)
+  {
+    return;
+  }
+  if (old_stamp)
+  {
+    entries_.erase(Entry{ old_stamp, region });
+  }
+  if (new_stamp)
+  {
+    entries_.insert(Entry{ new_stamp, region });
+  }
+}
+
+
+void DirtyRegionIndex::remove(const glm::i16vec3 &region, uint64_t stamp)
+{
+  std::unique_lock<SpinMutex> guard(lock_);
+  entries_.erase(Entry{ stamp, region });
+}
+
+
+void DirtyRegionIndex::clear()
+{
+  std::unique_lock<SpinMutex> guard(lock_);
+  entries_.clear();
+}
+
+
+size_t DirtyRegionIndex::size() const
+{
+  std::unique_lock<SpinMutex> guard(lock_);
+  return entries_.size();
+}
+}  // namespace ohm
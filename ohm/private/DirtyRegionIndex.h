@@ -0,0 +1,103 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_DIRTYREGIONINDEX_H
+#define OHM_DIRTYREGIONINDEX_H
+
+#include "OhmConfig.h"
+
+#include "ohm/Mutex.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <set>
+
+namespace ohm
+{
+/// Maintains the set of map regions ordered by their @c MapChunk::dirty_stamp .
+///
+/// Each region appears at most once, keyed on its most recent dirty stamp. This supports querying the regions
+/// modified since a given stamp in O(log n + changed) rather than iterating every chunk in the map. All functions are
+/// thread safe.
+///
+/// The index is updated via @c MapChunk::setDirtyStamp() which only calls @c update() when the stamp value changes.
+/// Since a single map update generally uses one stamp value for all modified voxels, the index is touched once per
+/// region per update.
+class DirtyRegionIndex
+{
+public:
+  /// An index entry.
+  struct Entry
+  {
+    uint64_t stamp;       ///< The dirty stamp.
+    glm::i16vec3 region;  ///< The region coordinate.
+
+    /// Ordering operator: by stamp then region coordinate.
+    inline bool operator<(const Entry &other) const
+    {
+      if (stamp != other.stamp)
+      {
+        return stamp < other.stamp;
+      }
+      if (region.x != other.region.x)
+      {
+        return region.x < other.region.x;
+      }
+      if (region.y != other.region.y)
+      {
+        return region.y < other.region.y;
+      }
+      return region.z < other.region.z;
+    }
+  };
+
+  /// Set the @p dirty_stamp for @p region to @p new_stamp and update the index entry to match. The @p dirty_stamp is
+  /// exchanged while the index is locked to keep the index consistent with concurrent updates to the same region.
+  /// @param region The region coordinate.
+  /// @param dirty_stamp The region's dirty stamp to modify: @c MapChunk::dirty_stamp .
+  /// @param new_stamp The new dirty stamp for @p region .
+  void update(const glm::i16vec3 &region, std::atomic_uint64_t &dirty_stamp, uint64_t new_stamp);
+
+  /// Remove @p region from the index.
+  /// @param region The region coordinate.
+  /// @param stamp The current dirty stamp for @p region .
+  void remove(const glm::i16vec3 &region, uint64_t stamp);
+
+  /// Remove all entries.
+  void clear();
+
+  /// Query the number of regions in the index.
+  /// @return The number of indexed regions.
+  size_t size() const;
+
+  /// Invoke @p func for each region with a dirty stamp greater than @p from_stamp . Regions are visited in ascending
+  /// stamp order; least recently modified first.
+  ///
+  /// The index is locked during the visit so @p func must not modify the map.
+  ///
+  /// @param from_stamp Visit regions with a stamp greater than this.
+  /// @param func Function object invoked as `func(const Entry &)` .
+  template <typename Func>
+  void visitSince(uint64_t from_stamp, Func &&func) const
+  {
+    std::unique_lock<SpinMutex> guard(lock_);
+    const Entry lower{ from_stamp + 1, glm::i16vec3(std::numeric_limits<int16_t>::min()) };
+    for (auto iter = entries_.lower_bound(lower); iter != entries_.end(); ++iter)
+    {
+      func(*iter);
+    }
+  }
+
+private:
+  mutable SpinMutex lock_;
+  std::set<Entry> entries_;
+};
+}  // namespace ohm
+
+#endif  // OHM_DIRTYREGIONINDEX_H
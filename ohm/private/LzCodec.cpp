@@ -0,0 +1,319 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "LzCodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ohm
+{
+namespace
+{
+/// Minimum match length. Also the hashed sequence length.
+const size_t kMinMatch = 4u;
+/// Maximum back reference distance.
+const size_t kMaxOffset = 0xffffu;
+/// Log2 of the number of hash table entries.
+const unsigned kHashBits = 14u;
+/// Value marking an extended nibble count.
+const unsigned kNibbleMax = 15u;
+/// Minimum number of repeated words to encode as a repeat run.
+const size_t kMinRun = 4u;
+/// Word size used in run length encoding.
+const size_t kWordSize = sizeof(uint32_t);
+
+inline uint32_t read32(const uint8_t *ptr)
+{
+  uint32_t val;
+  memcpy(&val, ptr, sizeof(val));
+  return val;
+}
+
+inline unsigned hashSequence(uint32_t sequence)
+{
+  // NOLINTNEXTLINE(readability-magic-numbers)
+  return unsigned((sequence * 2654435761u) >> (32u - kHashBits));
+}
+
+/// Write the extension bytes for @p count which has exceeded the nibble range.
+inline void writeExtendedCount(size_t count, std::vector<uint8_t> &dst)
+{
+  count -= kNibbleMax;
+  while (count >= 0xffu)
+  {
+    dst.emplace_back(uint8_t(0xffu));
+    count -= 0xffu;
+  }
+  dst.emplace_back(uint8_t(count));
+}
+
+/// Read extension bytes for a count at its nibble maximum.
+inline bool readExtendedCount(const uint8_t *&src, const uint8_t *src_end, size_t &count)
+{
+  uint8_t byte = 0;
+  do
+  {
+    if (src >= src_end)
+    {
+      return false;
+    }
+    byte = *src++;
+    count += byte;
+  } while (byte == 0xffu);
+  return true;
+}
+
+/// Write a single LZ sequence; the literals, then the optional match.
+void writeSequence(const uint8_t *literals, size_t literal_count, size_t offset, size_t match_length,
+                   std::vector<uint8_t> &dst)
+{
+  const size_t match_code = (match_length) ? match_length - kMinMatch : 0u;
+  const unsigned literal_nibble = unsigned(std::min<size_t>(literal_count, kNibbleMax));
+  const unsigned match_nibble = unsigned(std::min<size_t>(match_code, kNibbleMax));
+  dst.emplace_back(uint8_t((literal_nibble << 4u) | match_nibble));
+  if (literal_nibble == kNibbleMax)
+  {
+    writeExtendedCount(literal_count, dst);
+  }
+  dst.insert(dst.end(), literals, literals + literal_count);
+
+  if (match_length)
+  {
+    dst.emplace_back(uint8_t(offset & 0xffu));
+    dst.emplace_back(uint8_t((offset >> 8u) & 0xffu));
+    if (match_nibble == kNibbleMax)
+    {
+      writeExtendedCount(match_code, dst);
+    }
+  }
+}
+
+/// Write a variable length unsigned integer, 7 bits per byte, least significant first.
+inline void writeVarUInt(size_t value, std::vector<uint8_t> &dst)
+{
+  while (value >= 0x80u)
+  {
+    dst.emplace_back(uint8_t(value | 0x80u));
+    value >>= 7u;
+  }
+  dst.emplace_back(uint8_t(value));
+}
+
+/// Read a variable length unsigned integer written by @c writeVarUInt()
+inline bool readVarUInt(const uint8_t *&src, const uint8_t *src_end, size_t &value)
+{
+  value = 0;
+  unsigned shift = 0;
+  uint8_t byte = 0;
+  do
+  {
+    if (src >= src_end || shift >= 8 * sizeof(value))
+    {
+      return false;
+    }
+    byte = *src++;
+    value |= size_t(byte & 0x7fu) << shift;
+    shift += 7u;
+  } while (byte & 0x80u);
+  return true;
+}
+}  // namespace
+
+
+void lzCompress(const uint8_t *src, size_t src_size, std::vector<uint8_t> &dst)
+{
+  // Hash table of the most recent position of each hashed 4 byte sequence. Stored as position + 1 so zero is empty.
+  std::vector<uint32_t> hash_table(size_t(1u) << kHashBits, 0u);
+
+  size_t pos = 0;
+  size_t literal_start = 0;
+  while (src_size >= kMinMatch && pos <= src_size - kMinMatch)
+  {
+    const uint32_t sequence = read32(src + pos);
+    const unsigned hash = hashSequence(sequence);
+    const size_t candidate = hash_table[hash];
+    hash_table[hash] = uint32_t(pos + 1);
+
+    if (candidate && pos - (candidate - 1) <= kMaxOffset && read32(src + candidate - 1) == sequence)
+    {
+      const size_t match_pos = candidate - 1;
+      size_t match_length = kMinMatch;
+      while (pos + match_length < src_size && src[match_pos + match_length] == src[pos + match_length])
+      {
+        ++match_length;
+      }
+
+      writeSequence(src + literal_start, pos - literal_start, pos - match_pos, match_length, dst);
+      pos += match_length;
+      literal_start = pos;
+    }
+    else
+    {
+      ++pos;
+    }
+  }
+
+  // Final literal only sequence.
+  writeSequence(src + literal_start, src_size - literal_start, 0, 0, dst);
+}
+
+
+bool lzUncompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size)
+{
+  const uint8_t *src_end = src + src_size;
+  size_t out = 0;
+  while (src < src_end)
+  {
+    const uint8_t token = *src++;
+    size_t literal_count = token >> 4u;
+    if (literal_count == kNibbleMax && !readExtendedCount(src, src_end, literal_count))
+    {
+      return false;
+    }
+
+    if (literal_count > size_t(src_end - src) || literal_count > dst_size - out)
+    {
+      return false;
+    }
+    memcpy(dst + out, src, literal_count);
+    src += literal_count;
+    out += literal_count;
+
+    if (src == src_end)
+    {
+      // Final sequence.
+      break;
+    }
+
+    if (src_end - src < 2)
+    {
+      return false;
+    }
+    const size_t offset = size_t(src[0]) | (size_t(src[1]) << 8u);
+    src += 2;
+    size_t match_length = token & kNibbleMax;
+    if (match_length == kNibbleMax && !readExtendedCount(src, src_end, match_length))
+    {
+      return false;
+    }
+    match_length += kMinMatch;
+
+    if (offset == 0 || offset > out || match_length > dst_size - out)
+    {
+      return false;
+    }
+
+    const uint8_t *match = dst + out - offset;
+    if (offset >= match_length)
+    {
+      memcpy(dst + out, match, match_length);
+    }
+    else
+    {
+      // Overlapping copy: repeating pattern.
+      for (size_t i = 0; i < match_length; ++i)
+      {
+        dst[out + i] = match[i];
+      }
+    }
+    out += match_length;
+  }
+
+  return out == dst_size;
+}
+
+
+void rleEncode(const uint8_t *src, size_t src_size, std::vector<uint8_t> &dst)
+{
+  const size_t word_count = src_size / kWordSize;
+  size_t literal_start = 0;
+  size_t word = 0;
+  while (word < word_count)
+  {
+    // Measure the run starting at this word.
+    const uint32_t value = read32(src + word * kWordSize);
+    size_t run_end = word + 1;
+    while (run_end < word_count && read32(src + run_end * kWordSize) == value)
+    {
+      ++run_end;
+    }
+
+    if (run_end - word >= kMinRun)
+    {
+      // Write pending literals, then the run.
+      writeVarUInt(word - literal_start, dst);
+      dst.insert(dst.end(), src + literal_start * kWordSize, src + word * kWordSize);
+      writeVarUInt(run_end - word, dst);
+      dst.insert(dst.end(), src + word * kWordSize, src + (word + 1) * kWordSize);
+      literal_start = run_end;
+    }
+    word = run_end;
+  }
+
+  // Trailing literal words terminated by a zero length run, then any remaining bytes which do not fill a word.
+  writeVarUInt(word_count - literal_start, dst);
+  dst.insert(dst.end(), src + literal_start * kWordSize, src + word_count * kWordSize);
+  writeVarUInt(0, dst);
+  dst.insert(dst.end(), src + word_count * kWordSize, src + src_size);
+}
+
+
+bool rleDecode(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size)
+{
+  const uint8_t *src_end = src + src_size;
+  size_t out = 0;
+  for (;;)
+  {
+    size_t literal_words = 0;
+    if (!readVarUInt(src, src_end, literal_words) || literal_words > (dst_size - out) / kWordSize ||
+        literal_words * kWordSize > size_t(src_end - src))
+    {
+      return false;
+    }
+
+    const size_t literal_bytes = literal_words * kWordSize;
+    memcpy(dst + out, src, literal_bytes);
+    src += literal_bytes;
+    out += literal_bytes;
+
+    size_t run_words = 0;
+    if (!readVarUInt(src, src_end, run_words))
+    {
+      return false;
+    }
+
+    if (run_words == 0)
+    {
+      // Terminating sequence.
+      break;
+    }
+
+    if (run_words > (dst_size - out) / kWordSize || size_t(src_end - src) < kWordSize)
+    {
+      return false;
+    }
+
+    // Fill the run.
+    for (size_t i = 0; i < run_words; ++i)
+    {
+      memcpy(dst + out, src, kWordSize);
+      out += kWordSize;
+    }
+    src += kWordSize;
+  }
+
+  // Trailing bytes.
+  const size_t trailing_bytes = size_t(src_end - src);
+  if (trailing_bytes != dst_size - out)
+  {
+    return false;
+  }
+  memcpy(dst + out, src, trailing_bytes);
+  out += trailing_bytes;
+
+  return out == dst_size;
+}
+}  // namespace ohm
@@ -0,0 +1,62 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_LZCODEC_H
+#define OHM_LZCODEC_H
+
+#include "OhmConfig.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ohm
+{
+/// Compress @p src using a fast, byte oriented LZ77 codec, appending the results to @p dst .
+///
+/// The format is a sequence of literal runs and back references similar to an LZ4 block. Each sequence starts with a
+/// token byte where the high nibble is the literal count and the low nibble is the match length less 4. A nibble value
+/// of 15 is extended by additional bytes, each added to the count, until a byte less than 255 is read. The literal
+/// bytes follow, then a 16-bit little endian match offset and any match length extension bytes. The final sequence
+/// contains only literals. Compression uses a greedy, single probe hash of 4 byte sequences; favouring speed over
+/// compression ratio.
+///
+/// @param src The data to compress.
+/// @param src_size Number of bytes in @p src .
+/// @param[in,out] dst The buffer to append compressed data to.
+void lzCompress(const uint8_t *src, size_t src_size, std::vector<uint8_t> &dst);
+
+/// Decompress data generated by @c lzCompress() .
+/// @param src The compressed data.
+/// @param src_size Number of bytes in @p src .
+/// @param dst The buffer to decompress into.
+/// @param dst_size The expected decompressed size. Must exactly match the decompressed data size.
+/// @return True on success, false if the data are invalid or do not exactly fill @p dst_size bytes.
+bool lzUncompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size);
+
+/// Run length encode @p src as 32-bit words, appending the result to @p dst .
+///
+/// This is intended as a fast pre-pass before compression of voxel data which typically contain long runs of the
+/// same value - such as the unobserved occupancy value - in sparse regions. The data are treated as a sequence of
+/// alternating literal and repeated words. Each literal sequence is written as a variable length count followed by the
+/// literal words, while each repeat sequence is a variable length count followed by the repeated word. The data end
+/// with a zero length repeat, followed by any trailing bytes which do not fill a word. Repeats shorter than four words
+/// are left as literals.
+///
+/// @param src The data to encode.
+/// @param src_size Number of bytes in @p src .
+/// @param[in,out] dst The buffer to append encoded data to.
+void rleEncode(const uint8_t *src, size_t src_size, std::vector<uint8_t> &dst);
+
+/// Decode data generated by @c rleEncode() .
+/// @param src The encoded data.
+/// @param src_size Number of bytes in @p src .
+/// @param dst The buffer to decode into.
+/// @param dst_size The expected decoded size. Must exactly match the decoded data size.
+/// @return True on success, false if the data are invalid or do not exactly fill @p dst_size bytes.
+bool rleDecode(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size);
+}  // namespace ohm
+
+#endif  // OHM_LZCODEC_H
@@ -14,7 +14,10 @@
 #include "VoxelOccupancy.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <mutex>
+#include <random>
 
 namespace ohm
 {
@@ -24,6 +27,27 @@ OccupancyMapDetail::~OccupancyMapDetail()
 }
 
 
+uint64_t OccupancyMapDetail::generateIdentity()
+{
+  static std::mutex generator_lock;
+  static std::mt19937_64 generator = []() {
+    // Mix in the clock in case std::random_device is deterministic on this platform.
+    std::random_device device;
+    std::seed_seq seed{ device(), device(),
+                        unsigned(std::chrono::high_resolution_clock::now().time_since_epoch().count()) };
+    return std::mt19937_64(seed);
+  }();
+
+  std::unique_lock<std::mutex> guard(generator_lock);
+  uint64_t identity = 0;
+  while (identity == 0)
+  {
+    identity = generator();
+  }
+  return identity;
+}
+
+
 void OccupancyMapDetail::moveKeyAlongAxis(Key &key, int axis, int step, const glm::ivec3 &region_voxel_dimensions)
 {
   const glm::ivec3 local_limits = region_voxel_dimensions;
@@ -143,13 +167,86 @@ void OccupancyMapDetail::setDefaultLayout(MapFlag init_flags)
 }
 
 
+void OccupancyMapDetail::addChunk(MapChunk *chunk)
+{
+  if (ring)
+  {
+    // Evict the region holding the slot. It has left the window, or is being replaced.
+    RingSlot &slot = ring[ringIndex(chunk->region.coord)];
+    MapChunk *evicted = slot.chunk.load(std::memory_order_relaxed);
+    if (evicted && evicted != chunk)
+    {
+      if (gpu_cache)
+      {
+        gpu_cache->remove(evicted->region.coord);
+      }
+      const auto evicted_iter = chunks.find(evicted->region.coord);
+      if (evicted_iter != chunks.end() && evicted_iter->second == evicted)
+      {
+        removeChunk(evicted_iter);
+      }
+      else
+      {
+        slot.set(nullptr);
+      }
+      delete evicted;
+    }
+  }
+
+  chunks.insert(std::make_pair(chunk->region.coord, chunk));
+  if (ring)
+  {
+    ring[ringIndex(chunk->region.coord)].set(chunk);
+  }
+  else
+  {
+    chunk_index.insert(chunk->region.coord, chunk);
+  }
+}
+
+
+ChunkMap::iterator OccupancyMapDetail::removeChunk(ChunkMap::iterator iter)
+{
+  if (ring)
+  {
+    RingSlot &slot = ring[ringIndex(iter->first)];
+    if (slot.chunk.load(std::memory_order_relaxed) == iter->second)
+    {
+      slot.set(nullptr);
+    }
+  }
+  else
+  {
+    chunk_index.remove(iter->first);
+  }
+  dirty_regions.remove(iter->first, iter->second->dirty_stamp);
+  return chunks.erase(iter);
+}
+
+
+void OccupancyMapDetail::clearChunks()
+{
+  chunk_index.clear();
+  if (ring)
+  {
+    const size_t ring_size = size_t(rolling_window.x) * size_t(rolling_window.y) * size_t(rolling_window.z);
+    for (size_t i = 0; i < ring_size; ++i)
+    {
+      ring[i].set(nullptr);
+    }
+  }
+  dirty_regions.clear();
+  chunks.clear();
+}
+
+
 void OccupancyMapDetail::copyFrom(const OccupancyMapDetail &other)
 {
   origin = other.origin;
   region_spatial_dimensions = other.region_spatial_dimensions;
   region_voxel_dimensions = other.region_voxel_dimensions;
   resolution = other.resolution;
-  stamp = other.stamp;
+  stamp = other.stamp.load();
   occupancy_threshold_value = other.occupancy_threshold_value;
   hit_value = other.hit_value;
   miss_value = other.miss_value;
@@ -159,5 +256,15 @@ void OccupancyMapDetail::copyFrom(const OccupancyMapDetail &other)
   saturate_at_max_value = other.saturate_at_max_value;
   layout = MapLayout(other.layout);
   flags = other.flags;
+  rolling_window = other.rolling_window;
+  if (other.ring)
+  {
+    ring = std::make_unique<RingSlot[]>(  // NOLINT(modernize-avoid-c-arrays)
+      size_t(rolling_window.x) * size_t(rolling_window.y) * size_t(rolling_window.z));
+  }
+  else
+  {
+    ring.reset();
+  }
 }
 }  // namespace ohm
@@ -15,6 +15,8 @@
 #include "ohm/MapRegion.h"
 #include "ohm/Mutex.h"
 #include "ohm/RayFilter.h"
+#include "ohm/private/ChunkIndex.h"
+#include "ohm/private/DirtyRegionIndex.h"
 
 #include <ohmutil/VectorHash.h>
 
@@ -27,7 +29,10 @@
 #pragma GCC diagnostic pop
 #endif  // __GNUC__
 
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -38,6 +43,62 @@ using ChunkMap = ska::bytell_hash_map<glm::i16vec3, MapChunk *, Vector3Hash<glm:
 class MapRegionCache;
 class OccupancyMap;
 
+/// A slot in the rolling window ring buffer. See @c OccupancyMapDetail::ring .
+///
+/// The slot content is guarded by a sequence lock. Lock free readers retry while the slot is modified, so they never
+/// pair a chunk with the wrong region. The region coordinates are mirrored in the slot so a lookup never reads the
+/// chunk itself, which may be recycled in place. Writers must hold the map mutex.
+struct RingSlot
+{
+  /// The chunk held in the slot. Null when empty.
+  std::atomic<MapChunk *> chunk{ nullptr };
+  /// Region coordinates of @c chunk packed by @c packRegionKey() .
+  std::atomic<uint64_t> region_key{ 0 };
+  /// Sequence lock counter. Odd while the slot is being modified.
+  std::atomic<uint64_t> sequence{ 0 };
+
+  /// Pack @p region_key into a single integer for @c region_key .
+  static inline uint64_t packRegionKey(const glm::i16vec3 &region_key)
+  {
+    return uint64_t(uint16_t(region_key.x)) | (uint64_t(uint16_t(region_key.y)) << 16u) |
+           (uint64_t(uint16_t(region_key.z)) << 32u);
+  }
+
+  /// Lookup the chunk for @p key . Lock free.
+  /// @return The slot chunk if it holds the region @p key , or null.
+  inline MapChunk *find(const glm::i16vec3 &key) const
+  {
+    const uint64_t packed_key = packRegionKey(key);
+    while (true)
+    {
+      const uint64_t seq = sequence.load(std::memory_order_acquire);
+      if (!(seq & 1u))
+      {
+        MapChunk *slot_chunk = chunk.load(std::memory_order_relaxed);
+        const uint64_t slot_key = region_key.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == seq)
+        {
+          return (slot_chunk && slot_key == packed_key) ? slot_chunk : nullptr;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  /// Set the slot content. The caller must hold the map mutex.
+  /// @param new_chunk The chunk to hold, or null to clear the slot.
+  inline void set(MapChunk *new_chunk)
+  {
+    const uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    chunk.store(new_chunk, std::memory_order_relaxed);
+    region_key.store((new_chunk) ? packRegionKey(new_chunk->region.coord) : 0u, std::memory_order_relaxed);
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+};
+
 /// Internal details associated with an @c OccupancyMap .
 struct ohm_API OccupancyMapDetail
 {
@@ -58,8 +119,13 @@ struct ohm_API OccupancyMapDetail
   /// @note Timestamps may be unavailable.
   double first_ray_time = -1;
   /// Used to mark changes in the map. This is a monotonic value which is modified when the map is changed and is
-  /// copied into associated @c MapChunk objects. This can be used to detect the recency of changes.
-  uint64_t stamp = 0;
+  /// copied into associated @c MapChunk objects. This can be used to detect the recency of changes. Atomic to support
+  /// concurrent modification of different regions.
+  std::atomic_uint64_t stamp{ 0 };
+  /// Identifies the map for incremental serialisation, distinguishing files journaled by different maps. Generated on
+  /// construction and never zero. Not copied by @c copyFrom() , but adopted from the header when loading a map file so
+  /// a loaded map may continue the file's journal. See @c ohm::saveIncremental() .
+  uint64_t identity = generateIdentity();
   /// The value threshold used to consider a voxel as occupied. Occupied voxels have a value equal to or greater than
   /// this value, but not equal to @c ohm::unobservedOccupancyValue() (infinity).
   /// @see @c ohm::valueToProbability()
@@ -84,7 +150,19 @@ struct ohm_API OccupancyMapDetail
   MapLayout layout;
   /// The hash map of @c MapChunk objects contained in this map.
   ChunkMap chunks;
-  /// Data access mutex. Used to protect @c chunks .
+  /// Lock free lookup index for the @c chunks . Must be kept in sync with @c chunks - see @c addChunk() ,
+  /// @c removeChunk() and @c clearChunks() . Unused in rolling window mode, where @c ring is used instead.
+  ChunkIndex chunk_index;
+  /// Rolling window dimensions in regions. Zero when rolling window mode is disabled. See
+  /// @c OccupancyMap::setRollingWindow() .
+  glm::ivec3 rolling_window = glm::ivec3(0);
+  /// Rolling window ring buffer of chunks, indexed by @c ringIndex() . Replaces the @c chunk_index for lookup when not
+  /// null. Each slot holds the one chunk whose region coordinates map to the slot.
+  std::unique_ptr<RingSlot[]> ring;  // NOLINT(modernize-avoid-c-arrays)
+  /// Index of regions ordered by @c MapChunk::dirty_stamp . Maintained by @c MapChunk::setDirtyStamp() . Mutable as
+  /// chunks reference the map detail via a const pointer. Internally synchronised.
+  mutable DirtyRegionIndex dirty_regions;
+  /// Data access mutex. Used to protect modification of @c chunks and @c chunk_index and iteration of @c chunks .
   mutable Mutex mutex;
   // Region count at load time. Useful when only the header is loaded.
   size_t loaded_region_count = 0;
@@ -105,6 +183,10 @@ struct ohm_API OccupancyMapDetail
 
   /// Default constructor.
   OccupancyMapDetail() = default;
+
+  /// Generate a new, non zero map @c identity .
+  /// @return A new random identity.
+  static uint64_t generateIdentity();
   /// Destructor ensures @c gpu_cache is destroyed.
   ~OccupancyMapDetail();
 
@@ -127,6 +209,46 @@ struct ohm_API OccupancyMapDetail
   ///   The @p flags member is updated accordingly.
   void setDefaultLayout(MapFlag init_flags = MapFlag::kNone);
 
+  /// Resolve the @c ring slot index for @p region_key : the region coordinates modulo the @c rolling_window .
+  /// Only valid in rolling window mode.
+  /// @param region_key The region coordinates.
+  /// @return The slot index for @p region_key .
+  inline size_t ringIndex(const glm::i16vec3 &region_key) const
+  {
+    const glm::ivec3 wrapped = ((glm::ivec3(region_key) % rolling_window) + rolling_window) % rolling_window;
+    return size_t(wrapped.x) + size_t(rolling_window.x) * (size_t(wrapped.y) + size_t(rolling_window.y) * wrapped.z);
+  }
+
+  /// Lookup the chunk for @p region_key using either the @c ring or the @c chunk_index . Lock free.
+  /// @param region_key The region coordinates.
+  /// @return The chunk for @p region_key or null if not present.
+  inline MapChunk *findChunk(const glm::i16vec3 &region_key) const
+  {
+    if (ring)
+    {
+      return ring[ringIndex(region_key)].find(region_key);
+    }
+    return chunk_index.find(region_key);
+  }
+
+  /// Add @p chunk to @c chunks and the @c chunk_index or @c ring . The caller must hold the @c mutex .
+  ///
+  /// In rolling window mode, any other chunk holding the @c ring slot is evicted: removed from the map and the
+  /// @c gpu_cache and released. This keeps @c chunks in sync with the @c ring when adding regions which share a slot,
+  /// such as when loading a map larger than the window.
+  /// @param chunk The chunk to add. Ownership passes to the map.
+  void addChunk(MapChunk *chunk);
+
+  /// Remove the chunk at @p iter from @c chunks , the @c chunk_index or @c ring and @c dirty_regions . The chunk is not
+  /// released. The caller must hold the @c mutex .
+  /// @param iter Iterator to the chunk to remove.
+  /// @return The iterator following @p iter .
+  ChunkMap::iterator removeChunk(ChunkMap::iterator iter);
+
+  /// Clear @c chunks , the @c chunk_index , @c ring and @c dirty_regions . Chunks are not released. The caller must hold
+  /// the @c mutex .
+  void clearChunks();
+
   /// Copy internal details from @p other. For cloning.
   /// @param other The map detail to copy from.
   void copyFrom(const OccupancyMapDetail &other);
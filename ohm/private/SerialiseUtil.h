@@ -10,6 +10,10 @@
 
 #include "ohm/Stream.h"
 
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
 namespace ohm
 {
 /// Explicitly typed stream writing, uncompressed.
@@ -56,6 +60,43 @@ inline bool read(InputStream &stream, S &val)
   val = static_cast<S>(val2);
   return true;
 }
+
+
+/// Explicitly typed writing to a memory buffer. The value is appended to @p buffer .
+template <typename T, typename S>
+inline bool writeBuffer(std::vector<uint8_t> &buffer, const S &val)
+{
+  const T val2 = static_cast<T>(val);
+  const size_t offset = buffer.size();
+  buffer.resize(offset + sizeof(val2));
+  memcpy(buffer.data() + offset, &val2, sizeof(val2));
+  return true;
+}
+
+
+/// Explicitly typed reading from a memory buffer of @p buffer_size bytes. Reads from @p buffer at @p cursor ,
+/// advancing @p cursor on success.
+template <typename T, typename S>
+inline bool readBuffer(const uint8_t *buffer, size_t buffer_size, size_t &cursor, S &val)
+{
+  T val2{ 0 };
+  if (cursor + sizeof(val2) > buffer_size)
+  {
+    return false;
+  }
+  memcpy(&val2, buffer + cursor, sizeof(val2));
+  cursor += sizeof(val2);
+  val = static_cast<S>(val2);
+  return true;
+}
+
+
+/// Explicitly typed reading from a memory buffer. Reads from @p buffer at @p cursor , advancing @p cursor on success.
+template <typename T, typename S>
+inline bool readBuffer(const std::vector<uint8_t> &buffer, size_t &cursor, S &val)
+{
+  return readBuffer<T>(buffer.data(), buffer.size(), cursor, val);
+}
 }  // namespace ohm
 
 #endif  // SERIALISEUTIL_H
@@ -9,10 +9,103 @@
 #include "OccupancyMap.h"
 #include "VoxelData.h"
 
+#include <algorithm>
 #include <limits>
 
 namespace ohm
 {
+namespace
+{
+/// Working buffers for @c distanceTransform1d()
+struct DistanceTransformWorkspace
+{
+  std::vector<double> values;    ///< Input line values.
+  std::vector<int> sites;        ///< Input line nearest obstacle indices.
+  std::vector<int> envelope;     ///< Parabola vertex locations in the lower envelope.
+  std::vector<double> boundary;  ///< Boundaries between the lower envelope parabolas.
+
+  void resize(size_t count)
+  {
+    values.resize(count);
+    sites.resize(count);
+    envelope.resize(count);
+    boundary.resize(count + 1);
+  }
+};
+
+
+/// Apply a one dimensional squared distance transform to a line of @p count voxels separated by @p stride elements.
+void distanceTransform1d(float *distance_sqr, int *nearest, int count, size_t stride, double weight,
+                         DistanceTransformWorkspace &work)
+{
+  const double infinity = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < count; ++i)
+  {
+    work.values[i] = distance_sqr[i * stride];
+    work.sites[i] = nearest[i * stride];
+  }
+
+  // Build the lower envelope from the parabolas rooted at each voxel with a finite value.
+  int k = -1;
+  for (int q = 0; q < count; ++q)
+  {
+    if (work.values[q] == infinity)
+    {
+      continue;
+    }
+
+    if (k < 0 || weight <= 0)
+    {
+      // First parabola, or degenerate weighting where only the minimum value matters.
+      if (k < 0 || work.values[q] < work.values[work.envelope[0]])
+      {
+        k = 0;
+        work.envelope[0] = q;
+        work.boundary[0] = -infinity;
+        work.boundary[1] = infinity;
+      }
+      continue;
+    }
+
+    double s = 0;
+    for (;;)
+    {
+      const int p = work.envelope[k];
+      s = ((work.values[q] + weight * q * q) - (work.values[p] + weight * p * p)) / (2.0 * weight * (q - p));
+      if (s > work.boundary[k])
+      {
+        break;
+      }
+      --k;
+    }
+
+    ++k;
+    work.envelope[k] = q;
+    work.boundary[k] = s;
+    work.boundary[k + 1] = infinity;
+  }
+
+  if (k < 0)
+  {
+    // No obstacles on this line. Values remain infinite.
+    return;
+  }
+
+  k = 0;
+  for (int p = 0; p < count; ++p)
+  {
+    while (work.boundary[k + 1] < p)
+    {
+      ++k;
+    }
+    const int q = work.envelope[k];
+    distance_sqr[p * stride] = float(weight * double(p - q) * double(p - q) + work.values[q]);
+    nearest[p * stride] = work.sites[q];
+  }
+}
+}  // namespace
+
+
 glm::ivec3 calculateVoxelSearchHalfExtents(const OccupancyMap &map, float search_radius)
 {
   return glm::ivec3(int(std::ceil(search_radius / map.resolution())));
@@ -95,4 +188,52 @@ float calculateNearestNeighbour(const Key &voxel_key, const OccupancyMap &map,
 
   return -1.0f;
 }
+
+
+void squaredDistanceTransform(std::vector<float> &distance_sqr, std::vector<int> &nearest, const glm::ivec3 &dims,
+                              const glm::vec3 &axis_weights)
+{
+  const size_t volume = size_t(dims.x) * size_t(dims.y) * size_t(dims.z);
+  nearest.resize(volume);
+  for (size_t i = 0; i < volume; ++i)
+  {
+    nearest[i] = (distance_sqr[i] == 0) ? int(i) : -1;
+  }
+
+  DistanceTransformWorkspace work;
+  work.resize(size_t(std::max(dims.x, std::max(dims.y, dims.z))));
+
+  const size_t stride_y = size_t(dims.x);
+  const size_t stride_z = size_t(dims.x) * size_t(dims.y);
+
+  // Transform along X.
+  for (int z = 0; z < dims.z; ++z)
+  {
+    for (int y = 0; y < dims.y; ++y)
+    {
+      const size_t start = y * stride_y + z * stride_z;
+      distanceTransform1d(&distance_sqr[start], &nearest[start], dims.x, 1, axis_weights.x, work);
+    }
+  }
+
+  // Transform along Y.
+  for (int z = 0; z < dims.z; ++z)
+  {
+    for (int x = 0; x < dims.x; ++x)
+    {
+      const size_t start = x + z * stride_z;
+      distanceTransform1d(&distance_sqr[start], &nearest[start], dims.y, stride_y, axis_weights.y, work);
+    }
+  }
+
+  // Transform along Z.
+  for (int y = 0; y < dims.y; ++y)
+  {
+    for (int x = 0; x < dims.x; ++x)
+    {
+      const size_t start = x + y * stride_y;
+      distanceTransform1d(&distance_sqr[start], &nearest[start], dims.z, stride_z, axis_weights.z, work);
+    }
+  }
+}
 }  // namespace ohm
@@ -10,6 +10,8 @@
 
 #include <glm/glm.hpp>
 
+#include <vector>
+
 namespace ohm
 {
 class Key;
@@ -39,6 +41,24 @@ float ohm_API calculateNearestNeighbour(const Key &voxel_key, const OccupancyMap
                                         bool ignore_self, float search_range = 0,
                                         const glm::vec3 &axis_scaling = glm::vec3(1.0f, 1.0f, 1.0f),
                                         bool report_unscaled_distance = false);
+
+/// Calculate the exact, squared Euclidean distance transform of a dense voxel grid.
+///
+/// This implements the separable, linear time algorithm of Felzenszwalb and Huttenlocher, applying a one dimensional
+/// transform along each axis in turn using the lower envelope of parabolas rooted at each voxel. The nearest obstacle
+/// voxel is tracked through each pass (a feature transform), so callers may derive alternative distance metrics from
+/// the obstacle location.
+///
+/// Voxels are indexed `x + y * dims.x + z * dims.x * dims.y`.
+///
+/// @param[in,out] distance_sqr On input, zero for obstacle voxels and infinity for all others. On output, the weighted
+///   squared distance to the nearest obstacle or infinity when there are no obstacles.
+/// @param[out] nearest Set to the index of the nearest obstacle voxel for each voxel, or -1 when there are no obstacles.
+/// @param dims The grid dimensions.
+/// @param axis_weights The squared distance of a single step along each axis. For example, the squared voxel
+///   resolution.
+void ohm_API squaredDistanceTransform(std::vector<float> &distance_sqr, std::vector<int> &nearest,
+                                      const glm::ivec3 &dims, const glm::vec3 &axis_weights);
 }  // namespace ohm
 
 #endif  // OHM_NODEALGORITHMS_H
@@ -10,6 +10,8 @@
 
 #include "Mutex.h"
 
+#include "VoxelBlockSpillStore.h"
+
 #ifdef OHM_THREADS
 #include <tbb/concurrent_queue.h>
 #else  // OHM_THREADS
@@ -18,7 +20,8 @@
 
 #include <atomic>
 #include <condition_variable>
-#include <deque>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
@@ -27,40 +30,93 @@ namespace ohm
 {
 class VoxelBlock;
 
-/// Data structure used to track the blocks available for compression.
-struct CompressionEntry
+/// Types of events raised by a @c VoxelBlock for the @c VoxelBlockCompressionQueue
+enum class CompressionEventType : unsigned
+{
+  /// The block has been registered for compression.
+  kRegister,
+  /// The last reference to the block has been released.
+  kRelease,
+  /// The block has been marked for death and must be deleted.
+  kDestroy
+};
+
+/// Event raised by a @c VoxelBlock for processing on the compression thread.
+struct CompressionEvent
 {
-  VoxelBlock *voxels;      ///< [Compression enabled] voxel block.
-  size_t allocation_size;  ///< Last calculated allocation size.
+  VoxelBlock *voxels;         ///< The block raising the event.
+  CompressionEventType type;  ///< The event type.
+};
+
+/// Identifies which @c VoxelBlockCompressionQueueDetail list holds a registered @c VoxelBlock .
+enum class LruState : unsigned
+{
+  /// Not in any list: uniform, spilled or awaiting a release event.
+  kNone,
+  /// In the @c VoxelBlockCompressionQueueDetail::lru list.
+  kUncompressed,
+  /// In the @c VoxelBlockCompressionQueueDetail::compressed_lru list.
+  kCompressed
 };
 
 /// @c VoxelBlockCompressionQueue internals.
 struct VoxelBlockCompressionQueueDetail
 {
   using Mutex = ohm::Mutex;
+  /// Least recently used ordering of @c VoxelBlock items.
+  using LruList = std::list<VoxelBlock *>;
+
+  /// Tracks the list position of a registered @c VoxelBlock .
+  struct LruEntry
+  {
+    LruList::iterator iter;            ///< Position in the list identified by @c state .
+    LruState state = LruState::kNone;  ///< The list holding the block.
+  };
+
   /// Reference count mutex.
   Mutex ref_lock;
 #ifdef OHM_THREADS
-  /// Queue used to push @c VoxelBlock candidates for compression.
-  tbb::concurrent_queue<VoxelBlock *> compression_queue;
+  /// Queue of @c VoxelBlock events to process on the compression thread.
+  tbb::concurrent_queue<CompressionEvent> event_queue;
 #else   // OHM_THREADS
-  /// Spin lock mutex for @c compression_queue
+  /// Spin lock mutex for @c event_queue
   ohm::SpinMutex queue_lock;
-  /// Queue used to push @c VoxelBlock candidates for compression.
-  std::queue<VoxelBlock *> compression_queue;
+  /// Queue of @c VoxelBlock events to process on the compression thread.
+  std::queue<CompressionEvent> event_queue;
 #endif  // OHM_THREADS
-  /// Full set of registered @c VoxelBlock items.
-  std::vector<CompressionEntry> blocks;
+  /// Uncompressed blocks which are candidates for compression, least recently released first. Only accessed from the
+  /// compression thread.
+  LruList lru;
+  /// Compressed blocks which are candidates for spilling, least recently compressed first. Only accessed from the
+  /// compression thread.
+  LruList compressed_lru;
+  /// Full set of registered @c VoxelBlock items, mapped to their list position. Only accessed from the compression
+  /// thread.
+  std::unordered_map<VoxelBlock *, LruEntry> blocks;
+  /// Store for spilled blocks. Retained once created as spilled blocks reference the store.
+  std::unique_ptr<VoxelBlockSpillStore> spill_store;
+  /// Mutex for @c spill_store .
+  std::mutex spill_lock;
+  /// True to spill compressed blocks when compression alone cannot reach the low tide.
+  std::atomic_bool spill_enabled{ false };
   /// High tide to initiate compression at.
   std::atomic_uint64_t high_tide{ 12ull * 1024ull * 1024ull * 1024ull };
   /// Low tide to compression down to.
   std::atomic_uint64_t low_tide{ 6ull * 1024ull * 1024ull * 1024ull };
-  /// Current allocation estimation.
+  /// Current allocation estimation. Maintained incrementally by the registered @c VoxelBlock items.
   std::atomic_uint64_t estimated_allocated_size{ 0 };
+  /// Number of threads used to compress blocks.
+  std::atomic_uint worker_count{ 1 };
   /// Thread reference count.
   std::atomic_int reference_count{ 0 };
   /// Thread quit flag.
   std::atomic_bool quit_flag{ false };
+  /// Set to wake the compression thread. Cleared by the compression thread on waking.
+  std::atomic_bool wake_flag{ false };
+  /// Mutex for @c wake_flag and @c wake_condition .
+  std::mutex wake_lock;
+  /// Condition used to wake the processing thread.
+  std::condition_variable wake_condition;
   /// Processing thread.
   std::thread processing_thread;
   /// True if @c processing_thread is running.
@@ -69,32 +125,42 @@ struct VoxelBlockCompressionQueueDetail
   bool test_mode{ false };
 };
 
-inline void push(VoxelBlockCompressionQueueDetail &detail, VoxelBlock *block)
+inline void push(VoxelBlockCompressionQueueDetail &detail, const CompressionEvent &event)
 {
 #ifdef OHM_THREADS
-  detail.compression_queue.push(block);
+  detail.event_queue.push(event);
 #else   // OHM_THREADS
   std::unique_lock<ohm::SpinMutex> guard(detail.queue_lock);
-  detail.compression_queue.emplace(block);
+  detail.event_queue.emplace(event);
 #endif  // OHM_THREADS
 }
 
-inline bool tryPop(VoxelBlockCompressionQueueDetail &detail, VoxelBlock **block)
+inline bool tryPop(VoxelBlockCompressionQueueDetail &detail, CompressionEvent *event)
 {
 #ifdef OHM_THREADS
-  return detail.compression_queue.try_pop(*block);
+  return detail.event_queue.try_pop(*event);
 #else   // OHM_THREADS
   std::unique_lock<ohm::SpinMutex> guard(detail.queue_lock);
-  if (!detail.compression_queue.empty())
+  if (!detail.event_queue.empty())
   {
-    *block = detail.compression_queue.back();
-    detail.compression_queue.pop();
+    *event = detail.event_queue.front();
+    detail.event_queue.pop();
     return true;
   }
 
   return false;
 #endif  // OHM_THREADS
 }
+
+/// Wake the compression thread.
+inline void wake(VoxelBlockCompressionQueueDetail &detail)
+{
+  {
+    std::unique_lock<std::mutex> guard(detail.wake_lock);
+    detail.wake_flag = true;
+  }
+  detail.wake_condition.notify_one();
+}
 }  // namespace ohm
 
 #endif  // VOXELMAPCOMPRESSIONQUEUEDETAIL_H
@@ -0,0 +1,224 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "VoxelBlockSpillStore.h"
+
+#if defined(_MSC_VER)
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#else  // defined(_MSC_VER)
+#include <sys/types.h>
+#include <unistd.h>
+#endif  // defined(_MSC_VER)
+
+#include <cstdio>
+#include <iterator>
+#include <mutex>
+
+namespace ohm
+{
+VoxelBlockSpillStore::VoxelBlockSpillStore(const std::string &path)
+  : path_(path)
+{
+  file_.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+}
+
+
+VoxelBlockSpillStore::~VoxelBlockSpillStore()
+{
+  if (file_.is_open())
+  {
+    file_.close();
+    std::remove(path_.c_str());
+  }
+}
+
+
+bool VoxelBlockSpillStore::isOpen() const
+{
+  std::unique_lock<Mutex> guard(lock_);
+  return file_.is_open();
+}
+
+
+uint64_t VoxelBlockSpillStore::spilledBytes() const
+{
+  std::unique_lock<Mutex> guard(lock_);
+  return spilled_bytes_;
+}
+
+
+uint64_t VoxelBlockSpillStore::fileSize() const
+{
+  std::unique_lock<Mutex> guard(lock_);
+  return file_end_;
+}
+
+
+bool VoxelBlockSpillStore::write(const uint8_t *data, size_t size, VoxelBlockSpillRecord *record)
+{
+  std::unique_lock<Mutex> guard(lock_);
+  if (!file_.is_open() || size == 0)
+  {
+    return false;
+  }
+
+  // Best fit from the free space, or append.
+  VoxelBlockSpillRecord target;
+  target.size = size;
+  auto free_iter = free_by_size_.lower_bound(size);
+  const bool recycled = free_iter != free_by_size_.end();
+  target.offset = (recycled) ? free_iter->second : file_end_;
+
+  file_.clear();
+  file_.seekp(std::streamoff(target.offset));
+  file_.write(reinterpret_cast<const char *>(data), std::streamsize(size));  // NOLINT
+  if (!file_.good())
+  {
+    file_.clear();
+    return false;
+  }
+
+  if (recycled)
+  {
+    const uint64_t remaining = free_iter->first - size;
+    removeFreeExtent(free_by_offset_.find(target.offset));
+    if (remaining)
+    {
+      addFreeExtent(target.offset + size, remaining);
+    }
+  }
+  else
+  {
+    file_end_ += size;
+  }
+
+  spilled_bytes_ += size;
+  *record = target;
+  return true;
+}
+
+
+bool VoxelBlockSpillStore::read(const VoxelBlockSpillRecord &record, std::vector<uint8_t> &buffer)
+{
+  std::unique_lock<Mutex> guard(lock_);
+  if (!file_.is_open())
+  {
+    return false;
+  }
+
+  buffer.resize(record.size);
+  file_.clear();
+  file_.seekg(std::streamoff(record.offset));
+  file_.read(reinterpret_cast<char *>(buffer.data()), std::streamsize(record.size));  // NOLINT
+  if (!file_.good())
+  {
+    file_.clear();
+    return false;
+  }
+  return true;
+}
+
+
+void VoxelBlockSpillStore::free(const VoxelBlockSpillRecord &record)
+{
+  std::unique_lock<Mutex> guard(lock_);
+  if (record.size == 0)
+  {
+    return;
+  }
+
+  spilled_bytes_ -= record.size;
+  if (spilled_bytes_ == 0)
+  {
+    // Everything is free. Start again from the beginning of the file.
+    free_by_size_.clear();
+    free_by_offset_.clear();
+    file_end_ = 0;
+    truncateFile();
+    return;
+  }
+
+  // Merge with adjacent free space.
+  uint64_t offset = record.offset;
+  uint64_t size = record.size;
+  auto next = free_by_offset_.lower_bound(offset);
+  if (next != free_by_offset_.begin())
+  {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == offset)
+    {
+      offset = previous->first;
+      size += previous->second;
+      removeFreeExtent(previous);
+    }
+  }
+  if (next != free_by_offset_.end() && offset + size == next->first)
+  {
+    size += next->second;
+    removeFreeExtent(next);
+  }
+
+  if (offset + size == file_end_)
+  {
+    // Free space at the end of the file. Release it.
+    file_end_ = offset;
+    truncateFile();
+    return;
+  }
+
+  addFreeExtent(offset, size);
+}
+
+
+void VoxelBlockSpillStore::addFreeExtent(uint64_t offset, uint64_t size)
+{
+  free_by_offset_.emplace(offset, size);
+  free_by_size_.emplace(size, offset);
+}
+
+
+void VoxelBlockSpillStore::removeFreeExtent(std::map<uint64_t, uint64_t>::iterator offset_iter)
+{
+  const auto range = free_by_size_.equal_range(offset_iter->second);
+  for (auto iter = range.first; iter != range.second; ++iter)
+  {
+    if (iter->second == offset_iter->first)
+    {
+      free_by_size_.erase(iter);
+      break;
+    }
+  }
+  free_by_offset_.erase(offset_iter);
+}
+
+
+void VoxelBlockSpillStore::truncateFile()
+{
+  if (!file_.is_open())
+  {
+    return;
+  }
+
+  // Flush pending writes first so they cannot extend the file again.
+  file_.clear();
+  file_.flush();
+#if defined(_MSC_VER)
+  int fd = -1;
+  if (_sopen_s(&fd, path_.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, 0) == 0)
+  {
+    _chsize_s(fd, __int64(file_end_));
+    _close(fd);
+  }
+#else   // defined(_MSC_VER)
+  if (::truncate(path_.c_str(), off_t(file_end_)) != 0)
+  {
+    // Failure leaves the file larger than required, which is harmless.
+    return;
+  }
+#endif  // defined(_MSC_VER)
+}
+}  // namespace ohm
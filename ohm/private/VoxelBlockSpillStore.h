@@ -0,0 +1,106 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef OHM_VOXELBLOCKSPILLSTORE_H
+#define OHM_VOXELBLOCKSPILLSTORE_H
+
+#include "OhmConfig.h"
+
+#include "ohm/Mutex.h"
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ohm
+{
+/// Identifies a record written to a @c VoxelBlockSpillStore .
+struct VoxelBlockSpillRecord
+{
+  uint64_t offset = 0;  ///< Byte offset of the record in the spill file.
+  uint64_t size = 0;    ///< Byte size of the record.
+};
+
+/// A disk backed store for compressed @c VoxelBlock data which have been paged out of memory.
+///
+/// Records are written to a single spill file. Freed records are recycled for later writes using a best fit search of
+/// the free space, splitting larger spaces as required. Freed space is merged with adjacent free space so it can be
+/// recycled for larger records, and free space at the end of the file is truncated away. The file is truncated on
+/// opening and removed on closing; it is only scratch storage for the lifetime of the process.
+///
+/// Threadsafe.
+class ohm_API VoxelBlockSpillStore
+{
+public:
+  /// Create a store, writing to the file at @p path . Check @c isOpen() for success.
+  /// @param path The spill file path.
+  explicit VoxelBlockSpillStore(const std::string &path);
+  /// Destructor; closes and removes the spill file.
+  ~VoxelBlockSpillStore();
+
+  /// Query the spill file path.
+  /// @return The spill file path.
+  const std::string &path() const { return path_; }
+
+  /// Check if the spill file is open.
+  /// @return True if open.
+  bool isOpen() const;
+
+  /// Query the number of bytes held in live records.
+  /// @return The spilled byte count.
+  uint64_t spilledBytes() const;
+
+  /// Query the size of the spill file including free space.
+  /// @return The file size in bytes.
+  uint64_t fileSize() const;
+
+  /// Write @p size bytes from @p data to the store.
+  /// @param data The data to write.
+  /// @param size The number of bytes to write. Must be non zero.
+  /// @param[out] record Set to the location of the written data on success.
+  /// @return True on success.
+  bool write(const uint8_t *data, size_t size, VoxelBlockSpillRecord *record);
+
+  /// Read the data at @p record into @p buffer , resizing @p buffer to match the record.
+  /// @param record The record to read.
+  /// @param[out] buffer The buffer to read into.
+  /// @return True on success.
+  bool read(const VoxelBlockSpillRecord &record, std::vector<uint8_t> &buffer);
+
+  /// Release the space at @p record for reuse.
+  /// @param record The record to release.
+  void free(const VoxelBlockSpillRecord &record);
+
+private:
+  /// Add a free extent to the free space indices. Must be called with the @c lock_ held.
+  /// @param offset The extent byte offset.
+  /// @param size The extent byte size.
+  void addFreeExtent(uint64_t offset, uint64_t size);
+  /// Remove the free extent at @p offset from the free space indices. Must be called with the @c lock_ held.
+  /// @param offset_iter The @c free_by_offset_ entry to remove.
+  void removeFreeExtent(std::map<uint64_t, uint64_t>::iterator offset_iter);
+  /// Truncate the spill file to @c file_end_ . Must be called with the @c lock_ held.
+  void truncateFile();
+
+  /// Access mutex.
+  mutable Mutex lock_;
+  /// The spill file.
+  std::fstream file_;
+  /// The spill file path.
+  std::string path_;
+  /// Free space in the file keyed by size, mapping to the offset. Used for best fit searches.
+  std::multimap<uint64_t, uint64_t> free_by_size_;
+  /// Free space in the file keyed by offset, mapping to the size. Used to merge adjacent free space.
+  std::map<uint64_t, uint64_t> free_by_offset_;
+  /// Bytes held in live records.
+  uint64_t spilled_bytes_ = 0;
+  /// Current end of the file.
+  uint64_t file_end_ = 0;
+};
+}  // namespace ohm
+
+#endif  // OHM_VOXELBLOCKSPILLSTORE_H
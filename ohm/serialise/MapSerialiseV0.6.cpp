@@ -0,0 +1,338 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "MapSerialiseV0.6.h"
+
+#include "MapSerialiseV0.1.h"
+#include "MapSerialiseV0.2.h"
+
+#include "private/OccupancyMapDetail.h"
+#include "private/SerialiseUtil.h"
+
+#include "MapChunk.h"
+#include "MapLayer.h"
+#include "MapSerialise.h"
+#include "Stream.h"
+#include "VoxelBlock.h"
+#include "VoxelBuffer.h"
+
+#ifdef OHM_THREADS
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif  // OHM_THREADS
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+#include <zlib.h>
+
+namespace ohm
+{
+namespace v0_6
+{
+namespace
+{
+/// Stored content and decoded chunk for a region block pending load.
+struct RegionPayload
+{
+  std::vector<uint8_t> stored;      ///< Block content read from file.
+  std::unique_ptr<MapChunk> chunk;  ///< Decoded chunk.
+  int err = 0;                      ///< Decoding error code.
+};
+
+
+/// Decode the region blocks in the range `[start_index, end_index)` of @p index from @p payloads .
+void decodeRegionRange(const std::vector<RegionBlock> &index, std::vector<RegionPayload> &payloads,
+                       size_t start_index, size_t end_index, size_t batch_start, const OccupancyMapDetail &detail,
+                       const RegionDecodeFunc &decode)
+{
+  for (size_t i = start_index; i < end_index; ++i)
+  {
+    RegionPayload &payload = payloads[i - batch_start];
+    payload.chunk.reset();
+    std::unique_ptr<MapChunk> chunk(new MapChunk(detail));
+    payload.err = decode(payload.stored, index[i], *chunk);
+    if (!payload.err)
+    {
+      payload.chunk = std::move(chunk);
+    }
+  }
+}
+}  // namespace
+
+
+int load(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress, const MapVersion &version,
+         size_t region_count)
+{
+  return load(stream, detail, progress, version, region_count, RegionFilterFunc());
+}
+
+
+int load(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress, const MapVersion & /*version*/,
+         size_t /*region_count*/, const RegionFilterFunc &filter)
+{
+  // MapInfo and layout are stored uncompressed.
+  int err = v0_2::loadMapInfo(stream, detail.info);
+  if (err)
+  {
+    return err;
+  }
+
+  err = v0_1::loadLayout(stream, detail);
+  if (err)
+  {
+    return err;
+  }
+
+  const auto decode = [&detail](const std::vector<uint8_t> &stored, const RegionBlock &region, MapChunk &chunk) {
+    std::vector<uint8_t> block;
+    int err = decompressBlock(stored, block, region.byte_size);
+    if (!err)
+    {
+      err = loadChunk(block, chunk, detail);
+    }
+    if (!err)
+    {
+      // Resolve map chunk details.
+      chunk.searchAndUpdateFirstValid(detail.region_voxel_dimensions);
+    }
+    return err;
+  };
+
+  return loadRegionBlocks(stream, detail, progress, filter, decode);
+}
+
+
+int loadRegionBlocks(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress,
+                     const RegionFilterFunc &filter, const RegionDecodeFunc &decode)
+{
+  uint64_t index_offset = 0;
+  if (!readRaw<uint64_t>(stream, index_offset))
+  {
+    return kSeFileReadFailure;
+  }
+
+  std::vector<RegionBlock> index;
+  stream.seek(size_t(index_offset));
+  int err = loadRegionIndex(stream, index);
+  if (err)
+  {
+    return err;
+  }
+
+  if (filter)
+  {
+    index.erase(std::remove_if(index.begin(), index.end(),
+                               [&filter](const RegionBlock &block) { return !filter(block.coord); }),
+                index.end());
+  }
+
+  if (progress)
+  {
+    if (!index.empty())
+    {
+      progress->setTargetProgress(unsigned(index.size()));
+    }
+    else
+    {
+      progress->setTargetProgress(unsigned(1));
+      progress->incrementProgress();
+    }
+  }
+
+  // Regions are processed in batches. The blocks for a batch are read in file order on this thread, then decoded in
+  // parallel (when threads are enabled). Chunks are added to the map on this thread.
+  std::vector<RegionPayload> payloads(std::min(index.size(), kRegionBatchSize));
+  for (size_t batch_start = 0; batch_start < index.size() && (!progress || !progress->quit());
+       batch_start += kRegionBatchSize)
+  {
+    const size_t batch_end = std::min(batch_start + kRegionBatchSize, index.size());
+    for (size_t i = batch_start; i < batch_end; ++i)
+    {
+      const RegionBlock &region = index[i];
+      RegionPayload &payload = payloads[i - batch_start];
+      payload.stored.resize(region.compressed_size);
+      stream.seek(size_t(region.offset));
+      if (stream.readRaw(payload.stored.data(), region.compressed_size) != region.compressed_size)
+      {
+        return kSeFileReadFailure;
+      }
+    }
+
+#ifdef OHM_THREADS
+    const auto decode_func = [&index, &payloads, batch_start, &detail,
+                              &decode](const tbb::blocked_range<size_t> &range) {
+      decodeRegionRange(index, payloads, range.begin(), range.end(), batch_start, detail, decode);
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(batch_start, batch_end), decode_func);
+#else   // OHM_THREADS
+    decodeRegionRange(index, payloads, batch_start, batch_end, batch_start, detail, decode);
+#endif  // OHM_THREADS
+
+    // Add all decoded chunks before checking for errors so none are leaked.
+    err = kSeOk;
+    for (size_t i = batch_start; i < batch_end; ++i)
+    {
+      RegionPayload &payload = payloads[i - batch_start];
+      if (payload.chunk)
+      {
+        detail.addChunk(payload.chunk.release());
+      }
+      err = (!err) ? payload.err : err;
+
+      if (progress)
+      {
+        progress->incrementProgress();
+      }
+    }
+
+    if (err)
+    {
+      return err;
+    }
+  }
+
+  return kSeOk;
+}
+
+
+int loadRegionIndex(InputStream &stream, std::vector<RegionBlock> &index)
+{
+  bool ok = true;
+  uint32_t block_count = 0;
+  ok = readRaw<uint32_t>(stream, block_count) && ok;
+
+  index.clear();
+  index.reserve(block_count);
+  for (uint32_t i = 0; ok && i < block_count; ++i)
+  {
+    RegionBlock block{};
+    ok = readRaw<int32_t>(stream, block.coord.x) && ok;
+    ok = readRaw<int32_t>(stream, block.coord.y) && ok;
+    ok = readRaw<int32_t>(stream, block.coord.z) && ok;
+    ok = readRaw<uint64_t>(stream, block.offset) && ok;
+    ok = readRaw<uint32_t>(stream, block.compressed_size) && ok;
+    ok = readRaw<uint32_t>(stream, block.byte_size) && ok;
+    index.emplace_back(block);
+  }
+
+  return (ok) ? 0 : kSeFileReadFailure;
+}
+
+
+int saveRegionIndex(OutputStream &stream, const std::vector<RegionBlock> &index)
+{
+  bool ok = true;
+  if (index.size() > std::numeric_limits<uint32_t>::max())
+  {
+    return kSeValueOverflow;
+  }
+
+  ok = writeUncompressed<uint32_t>(stream, index.size()) && ok;
+  for (const RegionBlock &block : index)
+  {
+    ok = writeUncompressed<int32_t>(stream, block.coord.x) && ok;
+    ok = writeUncompressed<int32_t>(stream, block.coord.y) && ok;
+    ok = writeUncompressed<int32_t>(stream, block.coord.z) && ok;
+    ok = writeUncompressed<uint64_t>(stream, block.offset) && ok;
+    ok = writeUncompressed<uint32_t>(stream, block.compressed_size) && ok;
+    ok = writeUncompressed<uint32_t>(stream, block.byte_size) && ok;
+  }
+
+  return (ok) ? 0 : kSeFileWriteFailure;
+}
+
+
+int compressBlock(const std::vector<uint8_t> &block, std::vector<uint8_t> &compressed)
+{
+  if (block.size() != uLong(block.size()))
+  {
+    return kSeValueOverflow;
+  }
+
+  uLongf compressed_size = compressBound(uLong(block.size()));
+  compressed.resize(compressed_size);
+  if (compress2(compressed.data(), &compressed_size, block.data(), uLong(block.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    return kSeFileWriteFailure;
+  }
+  compressed.resize(compressed_size);
+
+  return kSeOk;
+}
+
+
+int decompressBlock(const std::vector<uint8_t> &compressed, std::vector<uint8_t> &block, size_t byte_size)
+{
+  return decompressBlock(compressed.data(), compressed.size(), block, byte_size);
+}
+
+
+int decompressBlock(const uint8_t *compressed, size_t compressed_size, std::vector<uint8_t> &block, size_t byte_size)
+{
+  block.resize(byte_size);
+  uLongf block_size = uLongf(byte_size);
+  if (uncompress(block.data(), &block_size, compressed, uLong(compressed_size)) != Z_OK || block_size != byte_size)
+  {
+    return kSeFileReadFailure;
+  }
+
+  return kSeOk;
+}
+
+
+int loadChunk(const std::vector<uint8_t> &block, MapChunk &chunk, const OccupancyMapDetail &detail)
+{
+  bool ok = true;
+  size_t cursor = 0;
+
+  // Read region details, then nodes. MapChunk members are derived.
+  ok = readBuffer<int32_t>(block, cursor, chunk.region.coord.x) && ok;
+  ok = readBuffer<int32_t>(block, cursor, chunk.region.coord.y) && ok;
+  ok = readBuffer<int32_t>(block, cursor, chunk.region.coord.z) && ok;
+  ok = readBuffer<double>(block, cursor, chunk.region.centre.x) && ok;
+  ok = readBuffer<double>(block, cursor, chunk.region.centre.y) && ok;
+  ok = readBuffer<double>(block, cursor, chunk.region.centre.z) && ok;
+  ok = readBuffer<double>(block, cursor, chunk.touched_time) && ok;
+
+  if (ok)
+  {
+    const MapLayout &layout = detail.layout;
+    for (size_t i = 0; i < layout.layerCount(); ++i)
+    {
+      const MapLayer &layer = layout.layer(i);
+      VoxelBuffer<VoxelBlock> voxel_buffer(chunk.voxel_blocks[i]);
+      // Get the layer memory.
+      uint8_t *layer_mem = voxel_buffer.voxelMemory();
+
+      if (layer.flags() & MapLayer::kSkipSerialise)
+      {
+        // Not to be serialised. Clear instead.
+        layer.clear(layer_mem, detail.region_voxel_dimensions);
+        continue;
+      }
+
+      uint64_t layer_touched_stamp = 0;
+      ok = readBuffer<uint64_t>(block, cursor, layer_touched_stamp) && ok;
+
+      chunk.touched_stamps[i] = layer_touched_stamp;
+
+      const size_t node_count = layer.volume(detail.region_voxel_dimensions);
+      const size_t node_byte_count = layer.voxelByteSize() * node_count;
+      if (!ok || cursor + node_byte_count > block.size())
+      {
+        return kSeFileReadFailure;
+      }
+
+      memcpy(layer_mem, block.data() + cursor, node_byte_count);
+      cursor += node_byte_count;
+    }
+  }
+
+  return (ok) ? 0 : kSeFileReadFailure;
+}
+}  // namespace v0_6
+}  // namespace ohm
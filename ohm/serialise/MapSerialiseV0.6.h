@@ -0,0 +1,78 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef MAPSERIALISEV0_6_H
+#define MAPSERIALISEV0_6_H
+
+#include "OhmConfig.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace ohm
+{
+class InputStream;
+class OutputStream;
+struct MapChunk;
+struct MapVersion;
+struct OccupancyMapDetail;
+class SerialiseProgress;
+
+/// Function used to select which regions to load. Returns true to load the region with the given coordinate.
+using RegionFilterFunc = std::function<bool(const glm::i16vec3 &)>;
+
+/// Version 0.6 introduces an indexed file format supporting random access to individual regions.
+///
+/// The header, @c MapInfo and layout are written uncompressed. These are followed by the absolute file offset of the
+/// region index, then by each region as an independently compressed block. The region index trails the blocks and
+/// maps each region coordinate to the file offset and size of its block. Loading a subset of the map only reads and
+/// inflates the blocks for the requested regions.
+namespace v0_6
+{
+/// Number of regions processed together when saving or loading. Regions in a batch are compressed or decompressed in
+/// parallel when @c OHM_THREADS is enabled, while file I/O is performed in order on the calling thread.
+const size_t kRegionBatchSize = 256u;
+
+/// Region index entry locating the compressed block for a single region.
+struct RegionBlock
+{
+  glm::i16vec3 coord;        ///< The region coordinate.
+  uint64_t offset;           ///< Absolute file offset of the compressed block.
+  uint32_t compressed_size;  ///< Size of the compressed block in bytes.
+  uint32_t byte_size;        ///< Size of the block content once decompressed.
+};
+
+int load(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress, const MapVersion &version,
+         size_t region_count);
+
+/// Load only the regions for which @p filter returns true. All regions are loaded if @p filter is empty.
+int load(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress, const MapVersion &version,
+         size_t region_count, const RegionFilterFunc &filter);
+
+/// Function used to decode the block content @p stored for @p region into @p chunk . Called concurrently when threads
+/// are enabled.
+using RegionDecodeFunc =
+  std::function<int(const std::vector<uint8_t> &stored, const RegionBlock &region, MapChunk &chunk)>;
+
+/// Load the region blocks following the layout, starting with the region index offset. Each block is decoded by
+/// @p decode . Shared by later versions which change only the block encoding.
+int loadRegionBlocks(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress,
+                     const RegionFilterFunc &filter, const RegionDecodeFunc &decode);
+
+int loadRegionIndex(InputStream &stream, std::vector<RegionBlock> &index);
+int saveRegionIndex(OutputStream &stream, const std::vector<RegionBlock> &index);
+
+int compressBlock(const std::vector<uint8_t> &block, std::vector<uint8_t> &compressed);
+int decompressBlock(const std::vector<uint8_t> &compressed, std::vector<uint8_t> &block, size_t byte_size);
+int decompressBlock(const uint8_t *compressed, size_t compressed_size, std::vector<uint8_t> &block, size_t byte_size);
+
+int loadChunk(const std::vector<uint8_t> &block, MapChunk &chunk, const OccupancyMapDetail &detail);
+}  // namespace v0_6
+}  // namespace ohm
+
+#endif  // MAPSERIALISEV0_6_H
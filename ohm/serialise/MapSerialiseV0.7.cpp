@@ -0,0 +1,116 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "MapSerialiseV0.7.h"
+
+#include "MapSerialiseV0.1.h"
+#include "MapSerialiseV0.2.h"
+
+#include "private/OccupancyMapDetail.h"
+#include "private/SerialiseUtil.h"
+
+#include "MapChunk.h"
+#include "MapLayer.h"
+#include "MapLayout.h"
+#include "MapSerialise.h"
+#include "VoxelBlock.h"
+
+namespace ohm
+{
+namespace v0_7
+{
+int load(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress, const MapVersion & /*version*/,
+         size_t /*region_count*/, const RegionFilterFunc &filter, const std::vector<std::string> *preserve_layers)
+{
+  // MapInfo and layout are stored uncompressed.
+  int err = v0_2::loadMapInfo(stream, detail.info);
+  if (err)
+  {
+    return err;
+  }
+
+  err = v0_1::loadLayout(stream, detail);
+  if (err)
+  {
+    return err;
+  }
+
+  // Keep the file layout to parse the layer records, then filter the map layout before any chunks are created.
+  const MapLayout file_layout = detail.layout;
+  if (preserve_layers)
+  {
+    detail.layout.filterLayers(*preserve_layers);
+  }
+
+  const auto decode = [&detail, &file_layout](const std::vector<uint8_t> &stored, const v0_6::RegionBlock & /*region*/,
+                                              MapChunk &chunk) {
+    return loadChunk(stored.data(), stored.size(), chunk, detail, file_layout);
+  };
+
+  return v0_6::loadRegionBlocks(stream, detail, progress, filter, decode);
+}
+
+
+int loadChunk(const uint8_t *block, size_t block_size, MapChunk &chunk, const OccupancyMapDetail &detail)
+{
+  return loadChunk(block, block_size, chunk, detail, detail.layout);
+}
+
+
+int loadChunk(const uint8_t *block, size_t block_size, MapChunk &chunk, const OccupancyMapDetail &detail,
+              const MapLayout &file_layout)
+{
+  bool ok = true;
+  size_t cursor = 0;
+
+  // Read region details, then layer records. MapChunk members are derived.
+  ok = readBuffer<int32_t>(block, block_size, cursor, chunk.region.coord.x) && ok;
+  ok = readBuffer<int32_t>(block, block_size, cursor, chunk.region.coord.y) && ok;
+  ok = readBuffer<int32_t>(block, block_size, cursor, chunk.region.coord.z) && ok;
+  ok = readBuffer<double>(block, block_size, cursor, chunk.region.centre.x) && ok;
+  ok = readBuffer<double>(block, block_size, cursor, chunk.region.centre.y) && ok;
+  ok = readBuffer<double>(block, block_size, cursor, chunk.region.centre.z) && ok;
+  ok = readBuffer<double>(block, block_size, cursor, chunk.touched_time) && ok;
+  // Stored so the occupancy layer need not be decompressed to resolve it.
+  ok = readBuffer<uint32_t>(block, block_size, cursor, chunk.first_valid_index) && ok;
+
+  for (size_t i = 0; ok && i < file_layout.layerCount(); ++i)
+  {
+    const MapLayer &file_layer = file_layout.layer(i);
+    if (file_layer.flags() & MapLayer::kSkipSerialise)
+    {
+      // Not serialised. The block retains the clear value.
+      continue;
+    }
+
+    uint64_t layer_touched_stamp = 0;
+    uint8_t encoding = 0;
+    uint32_t payload_size = 0;
+    ok = readBuffer<uint64_t>(block, block_size, cursor, layer_touched_stamp) && ok;
+    ok = readBuffer<uint8_t>(block, block_size, cursor, encoding) && ok;
+    ok = readBuffer<uint32_t>(block, block_size, cursor, payload_size) && ok;
+    if (!ok || cursor + payload_size > block_size || (encoding != kLayerUniform && encoding != kLayerCompressed))
+    {
+      return kSeFileReadFailure;
+    }
+
+    // Adopt the payload without decompressing. Layers filtered out of the map layout are skipped.
+    const MapLayer *layer = (&file_layout != &detail.layout) ? detail.layout.layer(file_layer.name()) : &file_layer;
+    if (layer)
+    {
+      const unsigned layer_index = layer->layerIndex();
+      if (!chunk.voxel_blocks[layer_index]->importCompressed(block + cursor, payload_size, encoding == kLayerUniform))
+      {
+        return kSeFileReadFailure;
+      }
+      chunk.touched_stamps[layer_index] = layer_touched_stamp;
+    }
+    cursor += payload_size;
+  }
+
+  return (ok) ? 0 : kSeFileReadFailure;
+}
+}  // namespace v0_7
+}  // namespace ohm
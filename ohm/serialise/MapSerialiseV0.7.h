@@ -0,0 +1,57 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#ifndef MAPSERIALISEV0_7_H
+#define MAPSERIALISEV0_7_H
+
+#include "OhmConfig.h"
+
+#include "MapSerialiseV0.6.h"
+
+#include <string>
+
+namespace ohm
+{
+class MapLayout;
+
+/// Version 0.7 retains the indexed file structure of version 0.6, but changes the region block encoding to store each
+/// layer in the compressed form held in memory by its @c VoxelBlock .
+///
+/// Region blocks are no longer compressed as a whole. A block holds the region details and the
+/// @c MapChunk::first_valid_index followed by a record for each serialised layer. A layer record holds the layer touched
+/// stamp, a @c LayerEncoding , the payload byte count and the payload. The payload is either the single voxel value of a
+/// uniform layer or the codec tagged compressed voxel data of a @c VoxelBlock . Saving copies the compressed bytes of
+/// blocks already compressed in memory verbatim, while loading adopts the payload as a compressed @c VoxelBlock . Voxel
+/// data are thus only decompressed when first accessed. For the @c RegionBlock index entries, the @c byte_size matches
+/// the @c compressed_size .
+namespace v0_7
+{
+/// Encoding of a layer record payload within a region block.
+enum LayerEncoding : uint8_t
+{
+  /// Payload is a single voxel value shared by every voxel in the layer.
+  kLayerUniform = 0u,
+  /// Payload is compressed voxel data as held by a @c VoxelBlock , beginning with the codec byte.
+  kLayerCompressed = 1u
+};
+
+/// Load the regions selected by @p filter , or all regions if @p filter is empty. When @p preserve_layers is given,
+/// the layout is filtered to only those layers (see @c MapLayout::filterLayers() ) and the records for other layers
+/// are skipped without being allocated or decompressed.
+int load(InputStream &stream, OccupancyMapDetail &detail, SerialiseProgress *progress, const MapVersion &version,
+         size_t region_count, const RegionFilterFunc &filter,
+         const std::vector<std::string> *preserve_layers = nullptr);
+
+/// Decode a region @p block into @p chunk , where @p detail has the same layout as the block.
+int loadChunk(const uint8_t *block, size_t block_size, MapChunk &chunk, const OccupancyMapDetail &detail);
+
+/// Decode a region @p block written with the @p file_layout into @p chunk . The layout of @p detail may hold a subset of
+/// the @p file_layout layers, matched by name. Records for other layers are skipped.
+int loadChunk(const uint8_t *block, size_t block_size, MapChunk &chunk, const OccupancyMapDetail &detail,
+              const MapLayout &file_layout);
+}  // namespace v0_7
+}  // namespace ohm
+
+#endif  // MAPSERIALISEV0_7_H
@@ -212,24 +212,25 @@ void regionFloodFillStepCpuBlock(OccupancyMap &map, ClearanceProcessDetail & /*q
     }
   }
 
-  chunk->touched_stamps[map.layout().clearanceLayer()] = chunk->dirty_stamp = map.touch();
+  const uint64_t touch_stamp = map.touch();
+  chunk->setDirtyStamp(touch_stamp);
+  chunk->touched_stamps[map.layout().clearanceLayer()] = touch_stamp;
 }
 
 
 unsigned regionClearanceProcessCpu(OccupancyMap &map, ClearanceProcessDetail &query, const glm::i16vec3 &region_key)
 {
   OccupancyMapDetail &map_data = *map.detail();
-  const auto chunk_search = map_data.chunks.find(region_key);
+  MapChunk *chunk = map_data.findChunk(region_key);
   glm::ivec3 voxel_search_half_extents;
 
-  if (chunk_search == map_data.chunks.end())
+  if (!chunk)
   {
     // The entire region is unknown space. Nothing to do as we can't write to anything.
     return 0;
   }
 
   voxel_search_half_extents = ohm::calculateVoxelSearchHalfExtents(map, query.search_radius);
-  MapChunk *chunk = chunk_search->second;
 
 #ifdef OHM_THREADS
   const auto parallel_query_func = [&query, &map, region_key, chunk,
@@ -256,17 +257,16 @@ unsigned regionSeedFloodFillCpu(OccupancyMap &map, ClearanceProcessDetail &query
                                 const glm::ivec3 & /*voxel_extents*/, const glm::ivec3 &calc_extents)
 {
   OccupancyMapDetail &map_data = *map.detail();
-  const auto chunk_search = map_data.chunks.find(region_key);
+  MapChunk *chunk = map_data.findChunk(region_key);
   glm::ivec3 voxel_search_half_extents;
 
-  if (chunk_search == map_data.chunks.end())
+  if (!chunk)
   {
     // The entire region is unknown space. Nothing to do as we can't write to anything.
     return 0;
   }
 
   voxel_search_half_extents = ohm::calculateVoxelSearchHalfExtents(map, query.search_radius);
-  MapChunk *chunk = chunk_search->second;
 
 #ifdef OHM_THREADS
   const auto parallel_query_func = [&query, &map, region_key, chunk,
@@ -293,17 +293,16 @@ unsigned regionFloodFillStepCpu(OccupancyMap &map, ClearanceProcessDetail &query
                                 const glm::ivec3 & /*voxel_extents*/, const glm::ivec3 &calc_extents)
 {
   OccupancyMapDetail &map_data = *map.detail();
-  const auto chunk_search = map_data.chunks.find(region_key);
+  MapChunk *chunk = map_data.findChunk(region_key);
   glm::ivec3 voxel_search_half_extents;
 
-  if (chunk_search == map_data.chunks.end())
+  if (!chunk)
   {
     // The entire region is unknown space. Nothing to do as we can't write to anything.
     return 0;
   }
 
   voxel_search_half_extents = ohm::calculateVoxelSearchHalfExtents(map, query.search_radius);
-  MapChunk *chunk = chunk_search->second;
 
 #ifdef OHM_THREADS
   const auto parallel_query_func = [&query, &map, region_key, chunk,
@@ -11,6 +11,8 @@
 #include <array>
 #include <cassert>
 #include <functional>
+#include <limits>
+#include <utility>
 
 namespace ohm
 {
@@ -27,7 +29,9 @@ using WalkSegmentFunc = std::function<bool(const Key &, double, double)>;
 /// @p endPoint, invoking @p walkFunc for each traversed voxel.
 ///
 /// The @p walkFunc is simply a callable object which accepts a @p KEY argument. Keys are provided in order of
-/// traversal.
+/// traversal. The callable must match the @c WalkSegmentFunc signature, but is passed as a template parameter
+/// (@p WALKFUNC ) rather than a @c std::function . This allows the visit call to be inlined into the traversal loop.
+/// The @c WalkSegmentFunc overloads are retained for existing code and forward to this function.
 ///
 /// The templatisation requires @p funcs to provide a set of key manipulation utility functions. Specifically,
 /// the @p KEYFUNCS type must have the following signature:
@@ -57,8 +61,8 @@ using WalkSegmentFunc = std::function<bool(const Key &, double, double)>;
 ///     @c endPoint, when it does not lie in the same voxel as @p startPoint.
 /// @param funcs Key helper functions object.
 /// @return The number of voxels traversed. This includes @p endPoint when @p includeEndPoint is true.
-template <typename KEY, typename KEYFUNCS>
-size_t walkSegmentKeys(WalkSegmentFunc walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point,
+template <typename KEY, typename KEYFUNCS, typename WALKFUNC>
+size_t walkSegmentKeys(WALKFUNC &&walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point,
                        bool include_end_point, const KEYFUNCS &funcs,
                        double length_epsilon = 1e-6)  // NOLINT(readability-magic-numbers)
 {
@@ -187,11 +191,11 @@ size_t walkSegmentKeys(WalkSegmentFunc walk_func, const glm::dvec3 &start_point,
 /// @param end_point The end of the line in 3D space.
 /// @param funcs Key helper functions object.
 /// @return The number of voxels traversed. This includes @p endPoint.
-template <typename KEY, typename KEYFUNCS>
-size_t walkSegmentKeys(WalkSegmentFunc walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point,
+template <typename KEY, typename KEYFUNCS, typename WALKFUNC>
+size_t walkSegmentKeys(WALKFUNC &&walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point,
                        const KEYFUNCS &funcs)
 {
-  return walkSegmentKeys(walk_func, start_point, end_point, true, funcs);
+  return walkSegmentKeys<KEY>(std::forward<WALKFUNC>(walk_func), start_point, end_point, true, funcs);
 }
 
 /// A @c walkSegmentKeys() overload which uses a default passes constructed @p KEYFUNCS object and sets
@@ -200,10 +204,44 @@ size_t walkSegmentKeys(WalkSegmentFunc walk_func, const glm::dvec3 &start_point,
 /// @param start_point The start of the line in 3D space.
 /// @param end_point The end of the line in 3D space.
 /// @return The number of voxels traversed. This includes @p endPoint.
+template <typename KEY, typename KEYFUNCS, typename WALKFUNC>
+size_t walkSegmentKeys(WALKFUNC &&walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point)
+{
+  return walkSegmentKeys<KEY>(std::forward<WALKFUNC>(walk_func), start_point, end_point, true, KEYFUNCS());
+}
+
+/// A @c walkSegmentKeys() overload accepting a @c WalkSegmentFunc . Prefer passing the callable object directly to
+/// avoid the indirect call per voxel.
+/// @param walk_func The function to invoke for each traversed voxel key.
+/// @param start_point The start of the line in 3D space.
+/// @param end_point The end of the line in 3D space.
+/// @param include_end_point Should be @c true if @p walkFunc should be called for the voxel containing
+///     @c endPoint, when it does not lie in the same voxel as @p startPoint.
+/// @param funcs Key helper functions object.
+/// @return The number of voxels traversed. This includes @p endPoint when @p includeEndPoint is true.
+template <typename KEY, typename KEYFUNCS>
+size_t walkSegmentKeys(const WalkSegmentFunc &walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point,
+                       bool include_end_point, const KEYFUNCS &funcs,
+                       double length_epsilon = 1e-6)  // NOLINT(readability-magic-numbers)
+{
+  return walkSegmentKeys<KEY, KEYFUNCS, const WalkSegmentFunc &>(walk_func, start_point, end_point, include_end_point,
+                                                                 funcs, length_epsilon);
+}
+
+/// @overload
+template <typename KEY, typename KEYFUNCS>
+size_t walkSegmentKeys(const WalkSegmentFunc &walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point,
+                       const KEYFUNCS &funcs)
+{
+  return walkSegmentKeys<KEY, KEYFUNCS, const WalkSegmentFunc &>(walk_func, start_point, end_point, true, funcs);
+}
+
+/// @overload
 template <typename KEY, typename KEYFUNCS>
-size_t walkSegmentKeys(WalkSegmentFunc walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point)
+size_t walkSegmentKeys(const WalkSegmentFunc &walk_func, const glm::dvec3 &start_point, const glm::dvec3 &end_point)
 {
-  return walkSegmentKeys(walk_func, start_point, end_point, true, KEYFUNCS());
+  return walkSegmentKeys<KEY, KEYFUNCS, const WalkSegmentFunc &>(walk_func, start_point, end_point, true,
+                                                                 KEYFUNCS());
 }
 }  // namespace ohm
 
@@ -0,0 +1,149 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OhmTestConfig.h"
+
+#include <gtest/gtest.h>
+
+#include <ohm/ClearanceProcessCpu.h>
+#include <ohm/Key.h>
+#include <ohm/MapChunk.h>
+#include <ohm/OccupancyMap.h>
+#include <ohm/Voxel.h>
+#include <ohm/VoxelOccupancy.h>
+
+#include <ohm/private/VoxelAlgorithms.h>
+
+#include <ohmutil/OhmUtil.h>
+
+#include <chrono>
+#include <random>
+
+namespace clearance
+{
+using Clock = std::chrono::high_resolution_clock;
+
+/// Populate @p map with scattered occupied and free voxels over a few regions.
+void buildMap(ohm::OccupancyMap &map)
+{
+  std::default_random_engine rng(1153297050u);
+  std::uniform_real_distribution<double> uniform(-0.8, 0.8);
+  const unsigned hit_count = 20;
+  const unsigned miss_count = 500;
+
+  for (unsigned i = 0; i < miss_count; ++i)
+  {
+    ohm::integrateMiss(map, map.voxelKey(glm::dvec3(uniform(rng), uniform(rng), uniform(rng))));
+  }
+  for (unsigned i = 0; i < hit_count; ++i)
+  {
+    const ohm::Key key = map.voxelKey(glm::dvec3(uniform(rng), uniform(rng), uniform(rng)));
+    for (int h = 0; h < 3; ++h)
+    {
+      ohm::integrateHit(map, key);
+    }
+  }
+}
+
+
+/// Validate the clearance values in @p map against a brute force search.
+void validateClearance(const ohm::OccupancyMap &map, float search_radius, unsigned query_flags,
+                       const glm::vec3 &axis_scaling)
+{
+  const glm::ivec3 search_half_extents = ohm::calculateVoxelSearchHalfExtents(map, search_radius);
+  const glm::ivec3 region_dim = map.regionVoxelDimensions();
+  ohm::Voxel<const float> clearance(&map, map.layout().clearanceLayer());
+  ASSERT_TRUE(clearance.isLayerValid());
+
+  std::vector<const ohm::MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  ASSERT_FALSE(chunks.empty());
+
+  unsigned failures = 0;
+  for (const ohm::MapChunk *chunk : chunks)
+  {
+    for (int z = 0; z < region_dim.z; ++z)
+    {
+      for (int y = 0; y < region_dim.y; ++y)
+      {
+        for (int x = 0; x < region_dim.x; ++x)
+        {
+          const ohm::Key key(chunk->region.coord, x, y, z);
+          clearance.setKey(key);
+          ASSERT_TRUE(clearance.isValid());
+          const float expected = ohm::calculateNearestNeighbour(
+            key, map, search_half_extents, (query_flags & ohm::kQfUnknownAsOccupied) != 0, false, search_radius,
+            axis_scaling, (query_flags & ohm::kQfReportUnscaledResults) != 0);
+          const float actual = clearance.data();
+          if (std::abs(expected - actual) > 1e-4f && failures++ < 10)
+          {
+            EXPECT_NEAR(actual, expected, 1e-4f) << "region " << chunk->region.coord.x << "," << chunk->region.coord.y
+                                                 << "," << chunk->region.coord.z << " voxel " << x << "," << y << ","
+                                                 << z;
+          }
+        }
+      }
+    }
+  }
+  EXPECT_EQ(failures, 0u);
+}
+
+
+void testClearance(unsigned query_flags, const glm::vec3 &axis_scaling, bool rolling_window = false)
+{
+  ohm::OccupancyMap map(0.1, glm::u8vec3(16));
+  if (rolling_window)
+  {
+    map.setRollingWindow(glm::ivec3(4));
+  }
+  buildMap(map);
+
+  // Choose a search radius which does not fall on a voxel separation to avoid floating point ties at the boundary.
+  const float search_radius = 0.45f;
+  ohm::ClearanceProcessCpu clearance_process(search_radius, query_flags);
+  clearance_process.setAxisScaling(axis_scaling);
+
+  const auto start = Clock::now();
+  EXPECT_EQ(clearance_process.update(map, 0), ohm::kMprProgressing);
+  const auto end = Clock::now();
+  std::cout << "Clearance update: " << (end - start) << std::endl;
+
+  // Everything is now up to date.
+  EXPECT_EQ(clearance_process.update(map, 0), ohm::kMprUpToDate);
+
+  validateClearance(map, search_radius, query_flags, axis_scaling);
+
+  // Adding an obstacle invalidates the nearby regions.
+  ohm::integrateHit(map, map.voxelKey(glm::dvec3(0.05)));
+  ohm::integrateHit(map, map.voxelKey(glm::dvec3(0.05)));
+  EXPECT_EQ(clearance_process.update(map, 0), ohm::kMprProgressing);
+  EXPECT_EQ(clearance_process.update(map, 0), ohm::kMprUpToDate);
+  validateClearance(map, search_radius, query_flags, axis_scaling);
+}
+
+
+TEST(Clearance, Cpu)
+{
+  testClearance(0, glm::vec3(1.0f));
+}
+
+
+TEST(Clearance, CpuUnknownAsOccupied)
+{
+  testClearance(ohm::kQfUnknownAsOccupied, glm::vec3(1.0f));
+}
+
+
+TEST(Clearance, CpuAxisScaling)
+{
+  testClearance(0, glm::vec3(1.0f, 1.0f, 2.0f));
+}
+
+
+TEST(Clearance, CpuRollingWindow)
+{
+  testClearance(0, glm::vec3(1.0f), true);
+}
+}  // namespace clearance
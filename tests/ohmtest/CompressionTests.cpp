@@ -13,14 +13,29 @@
 #include <ohm/OccupancyMap.h>
 #include <ohm/VoxelBlock.h>
 #include <ohm/VoxelBlockCompressionQueue.h>
+#include <ohm/VoxelBlockPool.h>
+#include <ohm/VoxelOccupancy.h>
+
+#include <ohm/private/VoxelBlockSpillStore.h>
 
 #include <ohmutil/OhmUtil.h>
 
 #include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <thread>
 
 namespace
 {
 using Clock = std::chrono::high_resolution_clock;
+
+/// Blocks are created in the uniform representation. Retain and release a block to materialise its voxel buffer.
+void materialise(ohm::VoxelBlock &block)
+{
+  block.retain();
+  block.release();
+}
 }
 
 TEST(Compression, Simple)
@@ -41,6 +56,7 @@ TEST(Compression, Simple)
     blocks.emplace_back();
     blocks[i].reset(new ohm::VoxelBlock(map.detail(), layer));
     compressor.push(blocks[i].get());
+    materialise(*blocks[i]);
   }
   // Set the high water mark above the current allocation size.
   compressor.setHighTide((block_count + 1) * layer_mem_size);
@@ -151,6 +167,7 @@ TEST(Compression, HighLoad)
     blocks.emplace_back();
     blocks[i].reset(new ohm::VoxelBlock(map.detail(), layer));
     compressor.push(blocks[i].get());
+    materialise(*blocks[i]);
   }
   // Set the high water mark above the current allocation size.
   compressor.setHighTide((block_count + 1) * layer_mem_size);
@@ -181,3 +198,525 @@ TEST(Compression, HighLoad)
   EXPECT_EQ(compressor.estimatedAllocationSize(), 0);
   std::cout << "Release tick: " << (end - start) << std::endl;
 }
+
+
+TEST(Compression, LeastRecentlyUsed)
+{
+  ohm::VoxelBlockCompressionQueue compressor(true);  // Instantiate in test mode
+  // Create a map in order to use the layout. DO NOT SET kCompressed. That would start a new compression object.
+  ohm::OccupancyMap map(1.0, ohm::MapFlag::kNone);
+  std::vector<ohm::VoxelBlock::Ptr> blocks;
+  std::vector<uint8_t> compression_buffer;
+
+  const size_t block_count = 4;
+  const ohm::MapLayer &layer = map.layout().layer(map.layout().occupancyLayer());
+  const size_t layer_mem_size = layer.layerByteSize(map.regionVoxelDimensions());
+  for (size_t i = 0; i < block_count; ++i)
+  {
+    blocks.emplace_back(new ohm::VoxelBlock(map.detail(), layer));
+    compressor.push(blocks[i].get());
+    materialise(*blocks[i]);
+  }
+  // Allocation is tracked on registration and materialisation.
+  EXPECT_EQ(compressor.estimatedAllocationSize(), layer_mem_size * block_count);
+  // Process the materialisation release events.
+  compressor.__tick(compression_buffer);
+
+  // Use the first block, making it the most recently used.
+  blocks[0]->retain();
+  blocks[0]->release();
+
+  // Compress down to below three blocks. This requires compressing two blocks and the least recently used blocks
+  // should be compressed first.
+  compressor.setHighTide(0);
+  compressor.setLowTide(layer_mem_size * (block_count - 1));
+  compressor.__tick(compression_buffer);
+
+  EXPECT_TRUE((blocks[0]->flags() & ohm::VoxelBlock::kFUncompressed));
+  EXPECT_FALSE((blocks[1]->flags() & ohm::VoxelBlock::kFUncompressed));
+  EXPECT_FALSE((blocks[2]->flags() & ohm::VoxelBlock::kFUncompressed));
+  EXPECT_TRUE((blocks[3]->flags() & ohm::VoxelBlock::kFUncompressed));
+  EXPECT_LT(compressor.estimatedAllocationSize(), layer_mem_size * (block_count - 1));
+
+  // Decompressing a block is reflected in the allocation size without a tick.
+  const size_t allocated = compressor.estimatedAllocationSize();
+  blocks[1]->retain();
+  EXPECT_GT(compressor.estimatedAllocationSize(), allocated);
+  blocks[1]->release();
+
+  blocks.clear();
+  compressor.__tick(compression_buffer);
+  EXPECT_EQ(compressor.estimatedAllocationSize(), 0);
+}
+
+
+TEST(Compression, HighTideWake)
+{
+  ohm::VoxelBlockCompressionQueue compressor;
+  // Create a map in order to use the layout. DO NOT SET kCompressed. That would start a new compression object.
+  ohm::OccupancyMap map(1.0, ohm::MapFlag::kNone);
+  std::vector<ohm::VoxelBlock::Ptr> blocks;
+
+  const size_t block_count = 32;
+  const ohm::MapLayer &layer = map.layout().layer(map.layout().occupancyLayer());
+  const size_t layer_mem_size = layer.layerByteSize(map.regionVoxelDimensions());
+
+  const uint64_t high_tide = layer_mem_size * block_count / 2;
+  const auto wait_below = [&compressor](uint64_t tide) {
+    const auto start = Clock::now();
+    while (compressor.estimatedAllocationSize() >= tide && Clock::now() - start < std::chrono::seconds(5))
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+
+  compressor.setWorkerCount(2);
+  compressor.setHighTide(high_tide);
+  compressor.setLowTide(layer_mem_size * block_count / 4);
+
+  // The compression thread sleeps for the housekeeping interval (500ms) before its first tick, so the allocation can
+  // only fall before then if growth beyond the high tide wakes the thread. Each wake compresses to below the low tide,
+  // but later growth may leave the allocation between the tides where nothing is compressed, so only the high tide is
+  // guaranteed once the blocks are registered.
+  const auto thread_start = Clock::now();
+  compressor.retain();
+
+  // Retaining the blocks grows the allocation beyond the high tide set above and should wake the compression thread.
+  for (size_t i = 0; i < block_count; ++i)
+  {
+    blocks.emplace_back(new ohm::VoxelBlock(map.detail(), layer));
+    compressor.push(blocks[i].get());
+    materialise(*blocks[i]);
+  }
+
+  wait_below(high_tide);
+  auto elapsed = Clock::now() - thread_start;
+  std::cout << "Compressed below high tide on growth: " << elapsed << std::endl;
+  EXPECT_LT(compressor.estimatedAllocationSize(), high_tide);
+  EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 500);
+
+  // Raise the high tide and decompress the blocks again without crossing it.
+  compressor.setHighTide(std::numeric_limits<uint64_t>::max());
+  for (auto &block : blocks)
+  {
+    materialise(*block);
+  }
+  EXPECT_GE(compressor.estimatedAllocationSize(), high_tide);
+
+  // Lowering the high tide below the allocation should wake the compression thread, which compresses to the low tide.
+  const auto lower_start = Clock::now();
+  compressor.setHighTide(high_tide);
+  wait_below(compressor.lowTide());
+  elapsed = Clock::now() - lower_start;
+  std::cout << "Compressed to low tide on lowering the high tide: " << elapsed << std::endl;
+  EXPECT_LT(compressor.estimatedAllocationSize(), compressor.lowTide());
+
+  // Destroyed blocks are released by the thread on joining.
+  blocks.clear();
+  compressor.release();
+  EXPECT_EQ(compressor.estimatedAllocationSize(), 0);
+}
+
+
+TEST(Compression, BufferPool)
+{
+  ohm::VoxelBlockPool &pool = ohm::VoxelBlockPool::instance();
+  // Create a map in order to use the layout. DO NOT SET kCompressed. That would start a new compression object.
+  ohm::OccupancyMap map(1.0, ohm::MapFlag::kNone);
+  const ohm::MapLayer &layer = map.layout().layer(map.layout().occupancyLayer());
+  const size_t layer_mem_size = layer.layerByteSize(map.regionVoxelDimensions());
+
+  const auto layer_stats = [&pool, layer_mem_size]() {
+    std::vector<ohm::VoxelBlockPool::Stats> stats;
+    pool.stats(stats);
+    for (const auto &size_stats : stats)
+    {
+      if (size_stats.buffer_size == layer_mem_size)
+      {
+        return size_stats;
+      }
+    }
+    return ohm::VoxelBlockPool::Stats{};
+  };
+
+  pool.trim();
+  const ohm::VoxelBlockPool::Stats initial_stats = layer_stats();
+
+  // Compressing a block releases its uncompressed buffer to the pool.
+  std::vector<ohm::VoxelBlock::Ptr> blocks;
+  const size_t block_count = 4;
+  for (size_t i = 0; i < block_count; ++i)
+  {
+    blocks.emplace_back(new ohm::VoxelBlock(map.detail(), layer));
+    materialise(*blocks.back());
+    EXPECT_GT(blocks.back()->compress(), 0u);
+  }
+  ohm::VoxelBlockPool::Stats stats = layer_stats();
+  EXPECT_EQ(stats.allocations, initial_stats.allocations + 1);
+  EXPECT_EQ(stats.reuses, initial_stats.reuses + block_count - 1);
+  EXPECT_EQ(stats.pooled_count, 1u);
+  EXPECT_EQ(pool.pooledBytes(), layer_mem_size);
+
+  // Decompressing reuses the pooled buffer.
+  blocks[0]->retain();
+  stats = layer_stats();
+  EXPECT_EQ(stats.reuses, initial_stats.reuses + block_count);
+  EXPECT_EQ(stats.outstanding, initial_stats.outstanding + 1);
+  EXPECT_EQ(pool.pooledBytes(), 0u);
+  blocks[0]->release();
+
+  // Respect the pool limit.
+  pool.setMaxPooledBytes(0);
+  blocks.clear();
+  stats = layer_stats();
+  EXPECT_EQ(stats.outstanding, initial_stats.outstanding);
+  EXPECT_EQ(stats.discards, initial_stats.discards + 1);
+  EXPECT_EQ(pool.pooledBytes(), 0u);
+  pool.setMaxPooledBytes(ohm::VoxelBlockPool::kDefaultMaxPooledBytes);
+}
+
+
+TEST(Compression, UniformBlock)
+{
+  ohm::VoxelBlockCompressionQueue compressor(true);  // Instantiate in test mode
+  // Create a map in order to use the layout. DO NOT SET kCompressed. That would start a new compression object.
+  ohm::OccupancyMap map(1.0, ohm::MapFlag::kNone);
+  std::vector<uint8_t> compression_buffer;
+  const ohm::MapLayer &layer = map.layout().layer(map.layout().occupancyLayer());
+  const size_t layer_mem_size = layer.layerByteSize(map.regionVoxelDimensions());
+  const size_t voxel_count = layer_mem_size / sizeof(float);
+
+  // New blocks hold only the uniform clear value.
+  ohm::VoxelBlock::Ptr block(new ohm::VoxelBlock(map.detail(), layer));
+  compressor.push(block.get());
+  EXPECT_TRUE((block->flags() & ohm::VoxelBlock::kFUniform));
+  EXPECT_FALSE((block->flags() & ohm::VoxelBlock::kFUncompressed));
+  EXPECT_EQ(compressor.estimatedAllocationSize(), sizeof(float));
+
+  // Retaining materialises the full buffer with the clear value.
+  block->retain();
+  EXPECT_FALSE((block->flags() & ohm::VoxelBlock::kFUniform));
+  EXPECT_TRUE((block->flags() & ohm::VoxelBlock::kFUncompressed));
+  EXPECT_EQ(compressor.estimatedAllocationSize(), layer_mem_size);
+  auto *voxels = reinterpret_cast<float *>(block->voxelBytes());
+  for (size_t i = 0; i < voxel_count; ++i)
+  {
+    ASSERT_EQ(voxels[i], ohm::unobservedOccupancyValue());
+  }
+  // Set every voxel to the same, non-default value.
+  for (size_t i = 0; i < voxel_count; ++i)
+  {
+    voxels[i] = 0.5f;
+  }
+  block->release();
+
+  // Compression collapses the block back to uniform without running the codec.
+  compressor.setHighTide(0);
+  compressor.setLowTide(0);
+  compressor.__tick(compression_buffer);
+  EXPECT_TRUE((block->flags() & ohm::VoxelBlock::kFUniform));
+  EXPECT_EQ(compressor.estimatedAllocationSize(), sizeof(float));
+
+  block->retain();
+  voxels = reinterpret_cast<float *>(block->voxelBytes());
+  for (size_t i = 0; i < voxel_count; ++i)
+  {
+    ASSERT_EQ(voxels[i], 0.5f);
+  }
+  // A single differing voxel prevents the collapse.
+  voxels[voxel_count / 2] = 1.0f;
+  block->release();
+  compressor.__tick(compression_buffer);
+  EXPECT_FALSE((block->flags() & ohm::VoxelBlock::kFUniform));
+  EXPECT_FALSE((block->flags() & ohm::VoxelBlock::kFUncompressed));
+  EXPECT_GT(compressor.estimatedAllocationSize(), sizeof(float));
+
+  block->retain();
+  voxels = reinterpret_cast<float *>(block->voxelBytes());
+  EXPECT_EQ(voxels[0], 0.5f);
+  EXPECT_EQ(voxels[voxel_count / 2], 1.0f);
+  EXPECT_EQ(voxels[voxel_count - 1], 0.5f);
+  block->release();
+
+  block.reset();
+  compressor.__tick(compression_buffer);
+  EXPECT_EQ(compressor.estimatedAllocationSize(), 0);
+}
+
+
+TEST(Compression, Codecs)
+{
+  ohm::VoxelBlock::CompressionControls initial_controls;
+  ohm::VoxelBlock::getCompressionControls(&initial_controls);
+
+  // Create a map in order to use the layout. DO NOT SET kCompressed. That would start a new compression object.
+  ohm::OccupancyMap map(1.0, ohm::MapFlag::kNone);
+  const ohm::MapLayer &layer = map.layout().layer(map.layout().occupancyLayer());
+  const size_t layer_mem_size = layer.layerByteSize(map.regionVoxelDimensions());
+
+  // Build a sparse block: mostly unobserved with a scattering of observed voxels.
+  std::vector<float> reference(layer_mem_size / sizeof(float), ohm::unobservedOccupancyValue());
+  for (size_t i = 0; i < reference.size() / 3; i += 7)
+  {
+    reference[i] = 0.01f * float(i % 101);
+  }
+
+  const auto make_block = [&map, &layer, &reference]() {
+    ohm::VoxelBlock::Ptr block(new ohm::VoxelBlock(map.detail(), layer));
+    block->retain();
+    memcpy(block->voxelBytes(), reference.data(), reference.size() * sizeof(float));
+    block->release();
+    return block;
+  };
+
+  const auto validate_block = [&reference](ohm::VoxelBlock &block) {
+    EXPECT_FALSE((block.flags() & ohm::VoxelBlock::kFUncompressed));
+    block.retain();
+    EXPECT_TRUE((block.flags() & ohm::VoxelBlock::kFUncompressed));
+    EXPECT_EQ(memcmp(block.voxelBytes(), reference.data(), reference.size() * sizeof(float)), 0);
+    block.release();
+  };
+
+  const ohm::VoxelBlock::CompressionType types[] = { ohm::VoxelBlock::kCompressDeflate,
+                                                     ohm::VoxelBlock::kCompressGZip, ohm::VoxelBlock::kCompressLz };
+  const char *type_names[] = { "deflate", "gzip", "lz" };
+  std::vector<ohm::VoxelBlock::Ptr> blocks;
+  for (int run_length = 0; run_length < 2; ++run_length)
+  {
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t)
+    {
+      ohm::VoxelBlock::CompressionControls controls = initial_controls;
+      controls.compression_type = types[t];
+      controls.run_length_prepass = run_length != 0;
+      ohm::VoxelBlock::setCompressionControls(controls);
+
+      ohm::VoxelBlock::Ptr block = make_block();
+      const auto start = Clock::now();
+      const size_t compressed_size = block->compress();
+      const auto end = Clock::now();
+      std::cout << type_names[t] << ((run_length) ? "+rle" : "") << ": " << ohm::util::Bytes(compressed_size) << " "
+                << (end - start) << std::endl;
+      EXPECT_GT(compressed_size, 0u);
+      EXPECT_LT(compressed_size, layer_mem_size);
+      validate_block(*block);
+
+      // Recompress and keep for validation after changing the compression controls.
+      EXPECT_GT(block->compress(), 0u);
+      blocks.emplace_back(std::move(block));
+    }
+  }
+
+  // Blocks must remain valid after the compression controls change.
+  ohm::VoxelBlock::setCompressionControls(initial_controls);
+  for (auto &block : blocks)
+  {
+    validate_block(*block);
+  }
+}
+
+
+TEST(Compression, InvalidData)
+{
+  // Create a map in order to use the layout. DO NOT SET kCompressed. That would start a new compression object.
+  ohm::OccupancyMap map(1.0, ohm::MapFlag::kNone);
+  const ohm::MapLayer &layer = map.layout().layer(map.layout().occupancyLayer());
+  const size_t layer_mem_size = layer.layerByteSize(map.regionVoxelDimensions());
+  const size_t voxel_count = layer_mem_size / sizeof(float);
+
+  std::vector<float> reference(voxel_count, ohm::unobservedOccupancyValue());
+  for (size_t i = 0; i < voxel_count; i += 5)
+  {
+    reference[i] = 0.01f * float(i % 101);
+  }
+
+  ohm::VoxelBlock::Ptr source(new ohm::VoxelBlock(map.detail(), layer));
+  source->retain();
+  memcpy(source->voxelBytes(), reference.data(), layer_mem_size);
+  source->release();
+
+  std::vector<uint8_t> bytes;
+  bool uniform = true;
+  ASSERT_TRUE(source->exportCompressed(bytes, uniform));
+  ASSERT_FALSE(uniform);
+  ASSERT_GT(bytes.size(), 2u);
+
+  // Valid data round trip.
+  ohm::VoxelBlock::Ptr block(new ohm::VoxelBlock(map.detail(), layer));
+  ASSERT_TRUE(block->importCompressed(bytes.data(), bytes.size(), false));
+  block->retain();
+  EXPECT_EQ(memcmp(block->voxelBytes(), reference.data(), layer_mem_size), 0);
+  block->release();
+
+  // Reject unknown codecs, truncated data and implausible run length sizes.
+  std::vector<uint8_t> invalid = bytes;
+  invalid[0] = 0x7fu;
+  EXPECT_FALSE(block->importCompressed(invalid.data(), invalid.size(), false));
+  EXPECT_FALSE(block->importCompressed(bytes.data(), 1, false));
+  invalid.assign(8, 0u);
+  invalid[0] = 0x80u;  // Deflate with the run length flag.
+  const uint32_t run_length_size = uint32_t(16 * layer_mem_size);
+  memcpy(invalid.data() + 1, &run_length_size, sizeof(run_length_size));
+  EXPECT_FALSE(block->importCompressed(invalid.data(), invalid.size(), false));
+
+  // The rejected imports leave the block unchanged.
+  block->retain();
+  EXPECT_EQ(memcmp(block->voxelBytes(), reference.data(), layer_mem_size), 0);
+  block->release();
+
+  // A corrupt payload with a valid codec cannot be detected until the block is decompressed. Retaining the block
+  // yields the clear value.
+  invalid = bytes;
+  for (size_t i = 1; i < invalid.size(); ++i)
+  {
+    invalid[i] = uint8_t(0xa5u ^ i);
+  }
+  ASSERT_TRUE(block->importCompressed(invalid.data(), invalid.size(), false));
+  block->retain();
+  EXPECT_TRUE((block->flags() & ohm::VoxelBlock::kFUncompressed));
+  const auto *voxels = reinterpret_cast<const float *>(block->voxelBytes());
+  for (size_t i = 0; i < voxel_count; ++i)
+  {
+    ASSERT_EQ(voxels[i], ohm::unobservedOccupancyValue()) << "voxel " << i;
+  }
+  block->release();
+}
+
+
+TEST(Compression, Spill)
+{
+  ohm::VoxelBlockCompressionQueue compressor(true);  // Instantiate in test mode
+  // Create a map in order to use the layout. DO NOT SET kCompressed. That would start a new compression object.
+  ohm::OccupancyMap map(1.0, ohm::MapFlag::kNone);
+  std::vector<uint8_t> compression_buffer;
+  const ohm::MapLayer &layer = map.layout().layer(map.layout().occupancyLayer());
+  const size_t layer_mem_size = layer.layerByteSize(map.regionVoxelDimensions());
+  const size_t voxel_count = layer_mem_size / sizeof(float);
+
+  ASSERT_FALSE(compressor.spillEnabled());
+  ASSERT_TRUE(compressor.enableSpill("test-compression.spill"));
+  EXPECT_TRUE(compressor.spillEnabled());
+
+  // Populate blocks with distinct content.
+  const size_t block_count = 8;
+  std::vector<ohm::VoxelBlock::Ptr> blocks;
+  std::vector<float> voxels(voxel_count);
+  for (size_t i = 0; i < block_count; ++i)
+  {
+    blocks.emplace_back(new ohm::VoxelBlock(map.detail(), layer));
+    compressor.push(blocks.back().get());
+    blocks.back()->retain();
+    for (size_t v = 0; v < voxel_count; ++v)
+    {
+      voxels[v] = float((v * (i + 1)) % 97);  // NOLINT(readability-magic-numbers)
+    }
+    memcpy(blocks.back()->voxelBytes(), voxels.data(), layer_mem_size);
+    blocks.back()->release();
+  }
+  compressor.__tick(compression_buffer);
+  EXPECT_EQ(compressor.spilledSize(), 0u);
+
+  // With zero tides, everything is compressed and spilled.
+  compressor.setHighTide(0);
+  compressor.setLowTide(0);
+  compressor.__tick(compression_buffer);
+  EXPECT_EQ(compressor.estimatedAllocationSize(), 0u);
+  EXPECT_GT(compressor.spilledSize(), 0u);
+  std::cout << "spilled: " << ohm::util::Bytes(compressor.spilledSize()) << std::endl;
+  for (auto &block : blocks)
+  {
+    EXPECT_TRUE((block->flags() & ohm::VoxelBlock::kFSpilled));
+    EXPECT_FALSE((block->flags() & ohm::VoxelBlock::kFUncompressed));
+  }
+
+  // Retaining faults the data back in.
+  for (size_t i = 0; i < block_count; ++i)
+  {
+    blocks[i]->retain();
+    EXPECT_FALSE((blocks[i]->flags() & ohm::VoxelBlock::kFSpilled));
+    EXPECT_TRUE((blocks[i]->flags() & ohm::VoxelBlock::kFUncompressed));
+    const auto *block_voxels = reinterpret_cast<const float *>(blocks[i]->voxelBytes());
+    for (size_t v = 0; v < voxel_count; ++v)
+    {
+      ASSERT_EQ(block_voxels[v], float((v * (i + 1)) % 97)) << "block " << i << " voxel " << v;
+    }
+  }
+  EXPECT_EQ(compressor.spilledSize(), 0u);
+  EXPECT_EQ(compressor.estimatedAllocationSize(), block_count * layer_mem_size);
+
+  // The spill file cannot change while blocks are spilled.
+  for (auto &block : blocks)
+  {
+    block->release();
+  }
+  compressor.__tick(compression_buffer);
+  EXPECT_GT(compressor.spilledSize(), 0u);
+  EXPECT_FALSE(compressor.enableSpill("test-compression-other.spill"));
+  EXPECT_TRUE(compressor.enableSpill("test-compression.spill"));
+
+  // Disabling spilling leaves blocks compressed in memory.
+  compressor.disableSpill();
+  EXPECT_FALSE(compressor.spillEnabled());
+  blocks[0]->retain();
+  blocks[0]->release();
+  compressor.__tick(compression_buffer);
+  EXPECT_FALSE((blocks[0]->flags() & (ohm::VoxelBlock::kFSpilled | ohm::VoxelBlock::kFUncompressed)));
+  EXPECT_GT(compressor.estimatedAllocationSize(), 0u);
+
+  // Destroying spilled blocks releases the spill file space.
+  blocks.clear();
+  compressor.__tick(compression_buffer);
+  EXPECT_EQ(compressor.spilledSize(), 0u);
+  EXPECT_EQ(compressor.estimatedAllocationSize(), 0u);
+}
+
+
+TEST(Compression, SpillStoreExtents)
+{
+  const char *spill_path = "test-spill-store.spill";
+  ohm::VoxelBlockSpillStore store(spill_path);
+  ASSERT_TRUE(store.isOpen());
+
+  const auto physical_size = [spill_path]() {
+    std::ifstream file(spill_path, std::ios::binary | std::ios::ate);
+    return uint64_t(file.tellg());
+  };
+
+  // Write four consecutive records with distinct content.
+  const uint64_t sizes[] = { 100, 200, 300, 400 };
+  ohm::VoxelBlockSpillRecord records[4];
+  std::vector<uint8_t> data;
+  for (int i = 0; i < 4; ++i)
+  {
+    data.assign(size_t(sizes[i]), uint8_t(i + 1));
+    ASSERT_TRUE(store.write(data.data(), data.size(), &records[i]));
+  }
+  ASSERT_EQ(store.fileSize(), 1000u);
+
+  // Free the two middle records. The space merges to fit a record larger than either.
+  store.free(records[1]);
+  store.free(records[2]);
+  ohm::VoxelBlockSpillRecord merged;
+  data.assign(450, 0xa5u);
+  ASSERT_TRUE(store.write(data.data(), data.size(), &merged));
+  EXPECT_EQ(merged.offset, records[1].offset);
+  EXPECT_EQ(store.fileSize(), 1000u);
+
+  // Freeing the last record truncates the file, including the merged remainder of the middle space.
+  store.free(records[3]);
+  EXPECT_EQ(store.fileSize(), merged.offset + merged.size);
+  EXPECT_EQ(physical_size(), store.fileSize());
+
+  std::vector<uint8_t> read_back;
+  ASSERT_TRUE(store.read(merged, read_back));
+  EXPECT_EQ(read_back, data);
+  ASSERT_TRUE(store.read(records[0], read_back));
+  EXPECT_EQ(read_back, std::vector<uint8_t>(size_t(sizes[0]), 1u));
+
+  // Freeing from the front, then the end, releases the whole file.
+  store.free(records[0]);
+  EXPECT_EQ(store.fileSize(), merged.offset + merged.size);
+  store.free(merged);
+  EXPECT_EQ(store.fileSize(), 0u);
+  EXPECT_EQ(store.spilledBytes(), 0u);
+  EXPECT_EQ(physical_size(), 0u);
+}
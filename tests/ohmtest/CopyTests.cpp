@@ -9,8 +9,11 @@
 #include <ohm/CopyUtil.h>
 #include <ohm/Key.h>
 #include <ohm/LineQuery.h>
+#include <ohm/MapChunk.h>
+#include <ohm/MapSerialise.h>
 #include <ohm/OccupancyMap.h>
 #include <ohm/RayMapperOccupancy.h>
+#include <ohm/VoxelBlock.h>
 #include <ohm/VoxelData.h>
 
 #include <ohmtools/OhmCloud.h>
@@ -65,6 +68,89 @@ TEST(Copy, CloneSubmap)
 }
 
 
+TEST(Copy, Snapshot)
+{
+  auto map = std::make_unique<OccupancyMap>(0.25);
+
+  // Generate occupancy.
+  const double box_size = 5.0;
+  ohmgen::boxRoom(*map, glm::dvec3(-box_size), glm::dvec3(box_size));
+
+  const std::unique_ptr<OccupancyMap> reference(map->clone());
+  const std::unique_ptr<OccupancyMap> snapshot(map->snapshot());
+  ASSERT_EQ(snapshot->regionCount(), map->regionCount());
+
+  // No voxel data are copied on taking the snapshot.
+  std::vector<const MapChunk *> chunks;
+  snapshot->enumerateRegions(chunks);
+  for (const MapChunk *chunk : chunks)
+  {
+    for (const auto &block : chunk->voxel_blocks)
+    {
+      EXPECT_TRUE(block->flags() & VoxelBlock::kFShared);
+    }
+  }
+
+  // Serialising the snapshot exports the shared data without copying it into the snapshot blocks.
+  const auto validate_serialised_snapshot = [](const OccupancyMap &snapshot_map, const OccupancyMap &reference_map) {
+    std::vector<uint8_t> buffer;
+    ASSERT_EQ(save(buffer, snapshot_map), 0);
+    std::vector<const MapChunk *> snapshot_chunks;
+    snapshot_map.enumerateRegions(snapshot_chunks);
+    for (const MapChunk *chunk : snapshot_chunks)
+    {
+      for (const auto &block : chunk->voxel_blocks)
+      {
+        EXPECT_TRUE(block->flags() & VoxelBlock::kFShared);
+      }
+    }
+    OccupancyMap loaded_map(1.0);
+    ASSERT_EQ(load(buffer.data(), buffer.size(), loaded_map), 0);
+    ohmtestutil::compareMaps(loaded_map, reference_map, ohmtestutil::kCfCompareExtended);
+  };
+  // Serialise one snapshot before the map is modified, while the images have yet to be captured, and another after.
+  const std::unique_ptr<OccupancyMap> serialised_snapshot(map->snapshot());
+  validate_serialised_snapshot(*snapshot, *reference);
+
+  // Modify the map. The snapshot must be unaffected.
+  const Key key(0, 0, 0, 0, 0, 0);
+  {
+    Voxel<float> occupancy(map.get(), map->layout().occupancyLayer(), key);
+    ASSERT_TRUE(occupancy.isValid());
+    const glm::ivec3 dim(map->regionVoxelDimensions());
+    const MapChunk *chunk = map->region(key.regionKey());
+    for (int i = 0; i < dim.x * dim.y * dim.z; ++i)
+    {
+      occupancy.setKey(chunk->keyForIndex(i, dim));
+      ohm::integrateHit(occupancy);
+    }
+  }
+  ohmgen::boxRoom(*map, glm::dvec3(-0.5 * box_size), glm::dvec3(0.5 * box_size));
+  ohmtestutil::compareMaps(*snapshot, *reference, ohmtestutil::kCfCompareExtended);
+  validate_serialised_snapshot(*serialised_snapshot, *reference);
+
+  // Take another snapshot of the modified map.
+  const std::unique_ptr<OccupancyMap> modified_reference(map->clone());
+  std::unique_ptr<OccupancyMap> modified_snapshot(map->snapshot());
+  ohmtestutil::compareMaps(*modified_snapshot, *modified_reference, ohmtestutil::kCfCompareExtended);
+
+  // Modifying a snapshot does not affect the map.
+  {
+    Voxel<float> occupancy(modified_snapshot.get(), modified_snapshot->layout().occupancyLayer(), key);
+    ASSERT_TRUE(occupancy.isValid());
+    ohm::integrateMiss(occupancy);
+  }
+  ohmtestutil::compareMaps(*map, *modified_reference, ohmtestutil::kCfCompareExtended);
+
+  // Snapshots outlive the map.
+  const std::unique_ptr<OccupancyMap> snapshot_of_snapshot(modified_snapshot->snapshot());
+  map.reset();
+  modified_snapshot.reset();
+  ohmtestutil::compareMaps(*snapshot, *reference, ohmtestutil::kCfCompareExtended);
+  ohmtestutil::compareMaps(*snapshot_of_snapshot, *modified_reference, ohmtestutil::kCfCompareExtended, 1);
+}
+
+
 TEST(Copy, Copy)
 {
   // Test copying utilities.
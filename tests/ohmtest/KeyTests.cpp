@@ -5,11 +5,14 @@
 // Author: Kazys Stepanas
 #include "OhmTestConfig.h"
 
+#include <ohm/CalculateSegmentKeys.h>
 #include <ohm/Key.h>
 #include <ohm/MapChunk.h>
 #include <ohm/MapCoord.h>
 #include <ohm/OccupancyMap.h>
 
+#include <ohmutil/LineWalk.h>
+
 #include <cstdio>
 #include <vector>
 
@@ -278,4 +281,47 @@ TEST(Keys, Quantisation)
     quantisationTest(bad_value, region_size, resolution);
   }
 }
+
+
+// Validate the templated line walk visitor matches the WalkSegmentFunc walk.
+TEST(Keys, SegmentWalk)
+{
+  ohm::OccupancyMap map(0.25);
+  const glm::dvec3 start(-1.1, 0.3, 2.7);
+  const glm::dvec3 end(10.2, -7.9, -3.3);
+
+  struct VisitedKey
+  {
+    ohm::Key key;
+    double enter_range;
+    double exit_range;
+  };
+
+  std::vector<VisitedKey> visited_function;
+  std::vector<VisitedKey> visited_template;
+
+  const ohm::WalkSegmentFunc walk_func = [&visited_function](const ohm::Key &key, double enter_range,
+                                                              double exit_range) {
+    visited_function.emplace_back(VisitedKey{ key, enter_range, exit_range });
+    return true;
+  };
+  const size_t function_count = ohm::walkSegmentKeys<ohm::Key>(walk_func, start, end, true, ohm::WalkKeyAdaptor(map));
+
+  const size_t template_count = ohm::walkSegmentKeys<ohm::Key>(
+    [&visited_template](const ohm::Key &key, double enter_range, double exit_range) {
+      visited_template.emplace_back(VisitedKey{ key, enter_range, exit_range });
+      return true;
+    },
+    start, end, true, ohm::WalkKeyAdaptor(map));
+
+  EXPECT_GT(function_count, 1u);
+  ASSERT_EQ(function_count, template_count);
+  ASSERT_EQ(visited_function.size(), visited_template.size());
+  for (size_t i = 0; i < visited_function.size(); ++i)
+  {
+    EXPECT_EQ(visited_function[i].key, visited_template[i].key);
+    EXPECT_EQ(visited_function[i].enter_range, visited_template[i].enter_range);
+    EXPECT_EQ(visited_function[i].exit_range, visited_template[i].exit_range);
+  }
+}
 }  // namespace keytests
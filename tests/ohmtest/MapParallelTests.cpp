@@ -0,0 +1,210 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OhmTestConfig.h"
+
+#include <gtest/gtest.h>
+
+#include <ohm/Key.h>
+#include <ohm/MapChunk.h>
+#include <ohm/MapParallel.h>
+#include <ohm/OccupancyMap.h>
+#include <ohm/RayMapperOccupancy.h>
+#include <ohm/VoxelData.h>
+#include <ohm/VoxelOccupancy.h>
+
+#include <mutex>
+#include <random>
+#include <unordered_set>
+
+namespace mapparallel
+{
+/// Populate @p map with random rays around the origin.
+void populateMap(ohm::OccupancyMap &map)
+{
+  std::mt19937 rand_engine(1234);
+  std::uniform_real_distribution<double> rand(-5.0, 5.0);
+  std::vector<glm::dvec3> rays;
+  for (unsigned i = 0; i < 2000; ++i)
+  {
+    rays.emplace_back(glm::dvec3(0.0));
+    rays.emplace_back(glm::dvec3(rand(rand_engine), rand(rand_engine), 0.25 * rand(rand_engine)));
+  }
+  ohm::RayMapperOccupancy mapper(&map);
+  mapper.integrateRays(rays.data(), rays.size());
+}
+
+
+/// Count the occupied voxels in @p chunk .
+size_t countOccupied(const ohm::OccupancyMap &map, const ohm::MapChunk &chunk)
+{
+  size_t count = 0;
+  ohm::Voxel<const float> occupancy(&map, map.layout().occupancyLayer(), chunk.region.coord);
+  const glm::ivec3 dim(map.regionVoxelDimensions());
+  for (int i = 0; i < dim.x * dim.y * dim.z; ++i)
+  {
+    occupancy.setKey(chunk.keyForIndex(i, dim));
+    count += ohm::isOccupied(occupancy) ? 1u : 0u;
+  }
+  return count;
+}
+
+
+TEST(MapParallel, ForEachRegion)
+{
+  ohm::OccupancyMap map(0.1, glm::u8vec3(16));
+  populateMap(map);
+  ASSERT_GT(map.regionCount(), 1u);
+
+  // Each region must be visited exactly once.
+  std::mutex lock;
+  std::unordered_set<const ohm::MapChunk *> visited;
+  size_t visit_count = 0;
+  const size_t region_count = ohm::forEachRegion(map, [&](ohm::MapChunk &chunk) {
+    std::unique_lock<std::mutex> guard(lock);
+    visited.insert(&chunk);
+    ++visit_count;
+  });
+  EXPECT_EQ(region_count, map.regionCount());
+  EXPECT_EQ(visit_count, map.regionCount());
+  EXPECT_EQ(visited.size(), map.regionCount());
+}
+
+
+TEST(MapParallel, Reduce)
+{
+  ohm::OccupancyMap map(0.1, glm::u8vec3(16));
+  populateMap(map);
+
+  const auto reduce_func = [&map](size_t count, const ohm::MapChunk &chunk) {
+    return count + countOccupied(map, chunk);
+  };
+  const auto join_func = [](size_t a, size_t b) { return a + b; };
+
+  const size_t parallel_count = ohm::reduceRegions(map, size_t(0), reduce_func, join_func);
+  const size_t serial_count = ohm::reduceRegions(map, size_t(0), reduce_func, join_func, false);
+
+  size_t expected_count = 0;
+  ohm::Voxel<const float> occupancy(&map, map.layout().occupancyLayer());
+  for (auto iter = map.begin(); iter != map.end(); ++iter)
+  {
+    occupancy.setKey(*iter);
+    expected_count += ohm::isOccupied(occupancy) ? 1u : 0u;
+  }
+  occupancy.reset();
+
+  EXPECT_GT(expected_count, 0u);
+  EXPECT_EQ(parallel_count, expected_count);
+  EXPECT_EQ(serial_count, expected_count);
+
+  // Empty map reduces to the identity.
+  ohm::OccupancyMap empty_map(0.1);
+  EXPECT_EQ(ohm::reduceRegions(empty_map, size_t(42), reduce_func, join_func), 42u);
+}
+
+
+TEST(MapParallel, VoxelTransform)
+{
+  ohm::OccupancyMap map(0.1, glm::u8vec3(16));
+  populateMap(map);
+  const int occupancy_layer = map.layout().occupancyLayer();
+
+  // Threshold the map: occupied voxels are set to the max value, free voxels to the min value.
+  const float threshold = map.occupancyThresholdValue();
+  const float max_value = map.maxVoxelValue();
+  const float min_value = map.minVoxelValue();
+  const uint64_t stamp_before = map.stamp();
+  const size_t modified_regions =
+    ohm::parallelVoxelTransform<float>(map, occupancy_layer, [=](float &value, const ohm::Key &) {
+      if (value == ohm::unobservedOccupancyValue())
+      {
+        return false;
+      }
+      value = (value >= threshold) ? max_value : min_value;
+      return true;
+    });
+  EXPECT_GT(modified_regions, 0u);
+  EXPECT_GT(map.stamp(), stamp_before);
+
+  // Validate the values and stamps.
+  size_t observed_regions = 0;
+  ohm::Voxel<const float> occupancy(&map, occupancy_layer);
+  std::vector<const ohm::MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  for (const ohm::MapChunk *chunk : chunks)
+  {
+    bool observed = false;
+    const glm::ivec3 dim(map.regionVoxelDimensions());
+    for (int i = 0; i < dim.x * dim.y * dim.z; ++i)
+    {
+      occupancy.setKey(chunk->keyForIndex(i, dim));
+      if (!ohm::isUnobserved(occupancy))
+      {
+        observed = true;
+        EXPECT_TRUE(occupancy.data() == max_value || occupancy.data() == min_value);
+      }
+    }
+
+    if (observed)
+    {
+      ++observed_regions;
+      EXPECT_EQ(chunk->dirty_stamp, map.stamp());
+      EXPECT_EQ(chunk->touched_stamps[occupancy_layer], map.stamp());
+    }
+  }
+  occupancy.reset();
+  EXPECT_EQ(observed_regions, modified_regions);
+
+  // Invalid layers are rejected.
+  EXPECT_EQ(ohm::parallelVoxelTransform<double>(map, occupancy_layer, [](double &, const ohm::Key &) { return true; }),
+            0u);
+  EXPECT_EQ(ohm::parallelVoxelTransform<float>(map, -1, [](float &, const ohm::Key &) { return true; }), 0u);
+}
+
+
+TEST(MapParallel, VoxelAccess)
+{
+  // Write to the map using Voxel objects from parallel region tasks.
+  ohm::OccupancyMap map(0.1, glm::u8vec3(16));
+  populateMap(map);
+  const int occupancy_layer = map.layout().occupancyLayer();
+  const float max_value = map.maxVoxelValue();
+
+  ohm::forEachRegion(map, [&map, occupancy_layer, max_value](ohm::MapChunk &chunk) {
+    ohm::Voxel<float> occupancy(&map, occupancy_layer, chunk.region.coord);
+    const glm::ivec3 dim(map.regionVoxelDimensions());
+    for (int i = 0; i < dim.x * dim.y * dim.z; ++i)
+    {
+      occupancy.setKey(chunk.keyForIndex(i, dim));
+      if (ohm::isOccupied(occupancy))
+      {
+        occupancy.write(max_value);
+      }
+    }
+  });
+
+  const size_t max_count = ohm::reduceRegions(
+    map, size_t(0),
+    [&map, occupancy_layer, max_value](size_t count, const ohm::MapChunk &chunk) {
+      ohm::Voxel<const float> occupancy(&map, occupancy_layer, chunk.region.coord);
+      const glm::ivec3 dim(map.regionVoxelDimensions());
+      for (int i = 0; i < dim.x * dim.y * dim.z; ++i)
+      {
+        occupancy.setKey(chunk.keyForIndex(i, dim));
+        count += (occupancy.data() == max_value) ? 1u : 0u;
+      }
+      return count;
+    },
+    [](size_t a, size_t b) { return a + b; });
+
+  size_t occupied_count = 0;
+  for (auto iter = map.begin(ohm::kIfOccupied); iter != map.end(); ++iter)
+  {
+    ++occupied_count;
+  }
+  EXPECT_GT(occupied_count, 0u);
+  EXPECT_EQ(max_count, occupied_count);
+}
+}  // namespace mapparallel
@@ -6,11 +6,20 @@
 #include "OhmTestConfig.h"
 
 #include <ohm/Aabb.h>
+#include <ohm/DefaultLayer.h>
 #include <ohm/Key.h>
+#include <ohm/KeyHash.h>
 #include <ohm/LineQuery.h>
+#include <ohm/MapChunk.h>
 #include <ohm/OccupancyMap.h>
+#include <ohm/OccupancyMask.h>
 #include <ohm/RayMapperOccupancy.h>
+#include <ohm/VoxelMean.h>
 #include <ohm/VoxelData.h>
+#include <ohm/VoxelOccupancy.h>
+
+#include <ohm/private/ChunkIndex.h>
+#include <ohm/private/OccupancyMapDetail.h>
 
 #include <ohmtools/OhmCloud.h>
 #include <ohmtools/OhmGen.h>
@@ -18,10 +27,15 @@
 #include <ohmutil/OhmUtil.h>
 #include <ohmutil/Profile.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <random>
+#include <thread>
+#include <unordered_set>
 
 #include <gtest/gtest.h>
 #include "ohmtestcommon/OhmTestUtil.h"
@@ -193,4 +207,841 @@ TEST(Map, ClipBox)
 
   EXPECT_TRUE(touched);
 }
+
+
+TEST(Map, ThreadedIntegration)
+{
+  // Validate threaded ray integration generates identical results to the single threaded integration.
+  const double resolution = 0.1;
+  const glm::u8vec3 region_size(16);
+  const unsigned batch_count = 4;
+  const unsigned batch_ray_count = 2000;
+  const double range = 8.0;
+
+  OccupancyMap map(resolution, region_size, ohm::MapFlag::kVoxelMean | ohm::MapFlag::kTraversal);
+  ohm::addTouchTime(map.layout());
+  ohm::addIncidentNormal(map.layout());
+  const std::unique_ptr<OccupancyMap> threaded_map(map.clone());
+
+  RayMapperOccupancy mapper(&map);
+  RayMapperOccupancy threaded_mapper(threaded_map.get());
+  ASSERT_TRUE(mapper.valid());
+  ASSERT_TRUE(threaded_mapper.valid());
+  threaded_mapper.setThreaded(true);
+
+  std::mt19937 rand_engine(1000);
+  std::uniform_real_distribution<double> rand(-range, range);
+  std::vector<glm::dvec3> rays;
+  std::vector<double> timestamps;
+  double timestamp = 0;
+  for (unsigned b = 0; b < batch_count; ++b)
+  {
+    rays.clear();
+    timestamps.clear();
+    const glm::dvec3 origin(rand(rand_engine) * 0.1, rand(rand_engine) * 0.1, rand(rand_engine) * 0.1);
+    // The last call is large enough to be processed in several windows of ray batches.
+    const unsigned ray_count = (b + 1 < batch_count) ? batch_ray_count : 20 * batch_ray_count;
+    for (unsigned i = 0; i < ray_count; ++i)
+    {
+      rays.emplace_back(origin);
+      rays.emplace_back(rand(rand_engine), rand(rand_engine), rand(rand_engine));
+      timestamps.emplace_back(timestamp);
+      timestamp += 1e-3;
+    }
+
+    mapper.integrateRays(rays.data(), rays.size(), nullptr, timestamps.data(), kRfDefault);
+    threaded_mapper.integrateRays(rays.data(), rays.size(), nullptr, timestamps.data(), kRfDefault);
+  }
+
+  ohmtestutil::compareMaps(*threaded_map, map, ohmtestutil::kCfCompareFineDetail);
+
+  // Validate the secondary layers.
+  Voxel<const VoxelMean> mean(&map, map.layout().meanLayer());
+  Voxel<const float> traversal(&map, map.layout().traversalLayer());
+  Voxel<const uint32_t> touch_time(&map, map.layout().layerIndex(default_layer::touchTimeLayerName()));
+  Voxel<const uint32_t> incident(&map, map.layout().layerIndex(default_layer::incidentNormalLayerName()));
+  Voxel<const VoxelMean> threaded_mean(threaded_map.get(), map.layout().meanLayer());
+  Voxel<const float> threaded_traversal(threaded_map.get(), map.layout().traversalLayer());
+  Voxel<const uint32_t> threaded_touch_time(threaded_map.get(),
+                                            map.layout().layerIndex(default_layer::touchTimeLayerName()));
+  Voxel<const uint32_t> threaded_incident(threaded_map.get(),
+                                          map.layout().layerIndex(default_layer::incidentNormalLayerName()));
+  ASSERT_TRUE(mean.isLayerValid() && traversal.isLayerValid());
+  ASSERT_TRUE(touch_time.isLayerValid() && incident.isLayerValid());
+
+  for (auto iter = map.begin(); iter != map.end(); ++iter)
+  {
+    setVoxelKey(*iter, mean, traversal, touch_time, incident);
+    setVoxelKey(*iter, threaded_mean, threaded_traversal, threaded_touch_time, threaded_incident);
+    ASSERT_TRUE(threaded_mean.isValid());
+    EXPECT_EQ(mean.data().coord, threaded_mean.data().coord);
+    EXPECT_EQ(mean.data().count, threaded_mean.data().count);
+    EXPECT_EQ(traversal.data(), threaded_traversal.data());
+    EXPECT_EQ(touch_time.data(), threaded_touch_time.data());
+    EXPECT_EQ(incident.data(), threaded_incident.data());
+  }
+}
+
+
+TEST(Map, AccumulatedIntegration)
+{
+  // Validate batch accumulated ray integration against the sequential integration. Accumulation preserves the ray order
+  // of the hits and misses for each voxel so all but the traversal must match exactly.
+  const double resolution = 0.1;
+  const glm::u8vec3 region_size(16);
+  const unsigned batch_count = 4;
+  const unsigned batch_ray_count = 2000;
+  const double range = 8.0;
+
+  // Exercise the value clamping and saturation limits with hits and misses interleaved near the sensor.
+  const unsigned near_sample_interval = 4;
+  const std::vector<std::pair<unsigned, bool>> configurations = {
+    { unsigned(kRfDefault), false },
+    { unsigned(kRfEndPointAsFree), false },
+    { unsigned(kRfExcludeFree), false },
+    { unsigned(kRfDefault), true },
+  };
+  for (const auto &configuration : configurations)
+  {
+    const unsigned ray_flags = configuration.first;
+    OccupancyMap map(resolution, region_size, ohm::MapFlag::kVoxelMean | ohm::MapFlag::kTraversal);
+    ohm::addTouchTime(map.layout());
+    ohm::addIncidentNormal(map.layout());
+    map.setMinVoxelValue(-2.0f);
+    map.setMaxVoxelValue(2.0f);
+    map.setSaturateAtMinValue(configuration.second);
+    map.setSaturateAtMaxValue(configuration.second);
+    const std::unique_ptr<OccupancyMap> accumulated_map(map.clone());
+
+    RayMapperOccupancy mapper(&map);
+    RayMapperOccupancy accumulated_mapper(accumulated_map.get());
+    ASSERT_TRUE(mapper.valid());
+    ASSERT_TRUE(accumulated_mapper.valid());
+    accumulated_mapper.setBatchAccumulation(true);
+    ASSERT_TRUE(accumulated_mapper.batchAccumulation());
+
+    std::mt19937 rand_engine(1000);
+    std::uniform_real_distribution<double> rand(-range, range);
+    std::vector<glm::dvec3> rays;
+    std::vector<double> timestamps;
+    double timestamp = 0;
+    for (unsigned b = 0; b < batch_count; ++b)
+    {
+      rays.clear();
+      timestamps.clear();
+      const glm::dvec3 origin(rand(rand_engine) * 0.1, rand(rand_engine) * 0.1, rand(rand_engine) * 0.1);
+      for (unsigned i = 0; i < batch_ray_count; ++i)
+      {
+        // End some rays near the sensor so the sample voxels are also traversed by other rays.
+        const double scale = (i % near_sample_interval == 0) ? 0.1 : 1.0;
+        rays.emplace_back(origin);
+        rays.emplace_back(glm::dvec3(rand(rand_engine), rand(rand_engine), rand(rand_engine)) * scale);
+        timestamps.emplace_back(timestamp);
+        timestamp += 1e-3;
+      }
+
+      mapper.integrateRays(rays.data(), rays.size(), nullptr, timestamps.data(), ray_flags);
+      accumulated_mapper.integrateRays(rays.data(), rays.size(), nullptr, timestamps.data(), ray_flags);
+    }
+
+    EXPECT_EQ(accumulated_map->regionCount(), map.regionCount());
+
+    Voxel<const float> occupancy(&map, map.layout().occupancyLayer());
+    Voxel<const VoxelMean> mean(&map, map.layout().meanLayer());
+    Voxel<const float> traversal(&map, map.layout().traversalLayer());
+    Voxel<const uint32_t> touch_time(&map, map.layout().layerIndex(default_layer::touchTimeLayerName()));
+    Voxel<const uint32_t> incident(&map, map.layout().layerIndex(default_layer::incidentNormalLayerName()));
+    Voxel<const float> accumulated_occupancy(accumulated_map.get(), map.layout().occupancyLayer());
+    Voxel<const VoxelMean> accumulated_mean(accumulated_map.get(), map.layout().meanLayer());
+    Voxel<const float> accumulated_traversal(accumulated_map.get(), map.layout().traversalLayer());
+    Voxel<const uint32_t> accumulated_touch_time(accumulated_map.get(),
+                                                 map.layout().layerIndex(default_layer::touchTimeLayerName()));
+    Voxel<const uint32_t> accumulated_incident(accumulated_map.get(),
+                                               map.layout().layerIndex(default_layer::incidentNormalLayerName()));
+    ASSERT_TRUE(occupancy.isLayerValid() && mean.isLayerValid() && traversal.isLayerValid());
+    ASSERT_TRUE(touch_time.isLayerValid() && incident.isLayerValid());
+
+    for (auto iter = map.begin(); iter != map.end(); ++iter)
+    {
+      setVoxelKey(*iter, occupancy, mean, traversal, touch_time, incident);
+      setVoxelKey(*iter, accumulated_occupancy, accumulated_mean, accumulated_traversal, accumulated_touch_time,
+                  accumulated_incident);
+      ASSERT_TRUE(accumulated_occupancy.isValid());
+      EXPECT_EQ(occupancy.data(), accumulated_occupancy.data());
+      EXPECT_EQ(mean.data().coord, accumulated_mean.data().coord);
+      EXPECT_EQ(mean.data().count, accumulated_mean.data().count);
+      EXPECT_EQ(touch_time.data(), accumulated_touch_time.data());
+      EXPECT_EQ(incident.data(), accumulated_incident.data());
+      // Traversal is summed in a different order.
+      EXPECT_NEAR(traversal.data(), accumulated_traversal.data(), 1e-3f * std::max(1.0f, traversal.data()));
+    }
+  }
+}
+
+
+TEST(Map, SaturatedFreeSkip)
+{
+  // Validate skipping regions where all voxels are saturated free. The results are compared against a map with a
+  // traversal layer, which disables skipping.
+  const double resolution = 0.1;
+  const glm::u8vec3 region_size(8);
+  const unsigned batch_count = 20;
+  const unsigned batch_ray_count = 5000;
+  const double range = 5.0;
+
+  OccupancyMap map(resolution, region_size);
+  OccupancyMap reference_map(resolution, region_size, ohm::MapFlag::kTraversal);
+  map.setSaturateAtMinValue(true);
+  reference_map.setSaturateAtMinValue(true);
+
+  RayMapperOccupancy mapper(&map);
+  RayMapperOccupancy reference_mapper(&reference_map);
+  ASSERT_TRUE(mapper.valid());
+  ASSERT_TRUE(reference_mapper.valid());
+
+  std::mt19937 rand_engine(1000);
+  std::uniform_real_distribution<double> rand(-1.0, 1.0);
+  std::vector<glm::dvec3> rays;
+  std::chrono::high_resolution_clock::duration skip_time{};
+  std::chrono::high_resolution_clock::duration reference_time{};
+  for (unsigned b = 0; b < batch_count; ++b)
+  {
+    rays.clear();
+    for (unsigned i = 0; i < batch_ray_count; ++i)
+    {
+      glm::dvec3 dir(rand(rand_engine), rand(rand_engine), rand(rand_engine));
+      dir = (glm::length(dir) > 1e-3) ? glm::normalize(dir) : glm::dvec3(1, 0, 0);
+      rays.emplace_back(glm::dvec3(0.0));
+      rays.emplace_back(dir * range);
+    }
+
+    auto timer = std::chrono::high_resolution_clock::now();
+    mapper.integrateRays(rays.data(), rays.size(), nullptr, nullptr, kRfEndPointAsFree);
+    skip_time += std::chrono::high_resolution_clock::now() - timer;
+    timer = std::chrono::high_resolution_clock::now();
+    reference_mapper.integrateRays(rays.data(), rays.size(), nullptr, nullptr, kRfEndPointAsFree);
+    reference_time += std::chrono::high_resolution_clock::now() - timer;
+  }
+
+  std::cout << "Saturated skip: " << std::chrono::duration_cast<std::chrono::milliseconds>(skip_time).count()
+            << "ms reference: " << std::chrono::duration_cast<std::chrono::milliseconds>(reference_time).count()
+            << "ms" << std::endl;
+
+  // Validate the saturation counts and that some regions are fully saturated.
+  std::vector<const MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  const unsigned region_volume = unsigned(region_size.x) * unsigned(region_size.y) * unsigned(region_size.z);
+  unsigned saturated_regions = 0;
+  Voxel<const float> occupancy(&map, map.layout().occupancyLayer());
+  ASSERT_TRUE(occupancy.isLayerValid());
+  for (const MapChunk *chunk : chunks)
+  {
+    ASSERT_EQ(chunk->saturated_free_stamp, chunk->touched_stamps[map.layout().occupancyLayer()].load());
+    unsigned saturated_count = 0;
+    for (unsigned i = 0; i < region_volume; ++i)
+    {
+      occupancy.setKey(chunk->keyForIndex(i, map.regionVoxelDimensions()));
+      saturated_count += (occupancy.data() <= map.minVoxelValue()) ? 1u : 0u;
+    }
+    EXPECT_EQ(chunk->saturated_free_count, saturated_count);
+    saturated_regions += (saturated_count == region_volume) ? 1u : 0u;
+  }
+  EXPECT_GT(saturated_regions, 0u);
+
+  // Skipping must not change the occupancy results.
+  Voxel<const float> reference_occupancy(&reference_map, reference_map.layout().occupancyLayer());
+  ASSERT_TRUE(reference_occupancy.isLayerValid());
+  unsigned mismatch_count = 0;
+  unsigned voxel_count = 0;
+  for (auto iter = reference_map.begin(); iter != reference_map.end(); ++iter)
+  {
+    setVoxelKey(*iter, occupancy, reference_occupancy);
+    mismatch_count += (occupancy.data() != reference_occupancy.data()) ? 1u : 0u;
+    ++voxel_count;
+  }
+  EXPECT_EQ(mismatch_count, 0u) << "of " << voxel_count;
+}
+
+
+TEST(Map, ThreadedSaturatedFreeSkip)
+{
+  // Validate threaded integration matches the single threaded integration when skipping saturated regions. Region
+  // skipping must be resolved in ray order, with rays saturating regions and samples landing in saturated regions which
+  // later rays in the same call cross.
+  const double resolution = 0.1;
+  const glm::u8vec3 region_size(8);
+  const unsigned batch_ray_count = 5000;
+  const double range = 2.0;
+
+  OccupancyMap map(resolution, region_size);
+  map.setSaturateAtMinValue(true);
+  const std::unique_ptr<OccupancyMap> threaded_map(map.clone());
+
+  RayMapperOccupancy mapper(&map);
+  RayMapperOccupancy threaded_mapper(threaded_map.get());
+  ASSERT_TRUE(mapper.valid());
+  ASSERT_TRUE(threaded_mapper.valid());
+  threaded_mapper.setThreaded(true);
+
+  std::mt19937 rand_engine(1015);
+  std::uniform_real_distribution<double> rand(-1.0, 1.0);
+  std::uniform_real_distribution<double> rand_range(0.5 * range, range);
+  std::vector<glm::dvec3> rays;
+  const auto integrate = [&](unsigned ray_flags) {
+    rays.clear();
+    for (unsigned i = 0; i < batch_ray_count; ++i)
+    {
+      glm::dvec3 dir(rand(rand_engine), rand(rand_engine), rand(rand_engine));
+      dir = (glm::length(dir) > 1e-3) ? glm::normalize(dir) : glm::dvec3(1, 0, 0);
+      rays.emplace_back(glm::dvec3(0.0));
+      rays.emplace_back(dir * ((ray_flags & kRfEndPointAsFree) ? range : rand_range(rand_engine)));
+    }
+    mapper.integrateRays(rays.data(), rays.size(), nullptr, nullptr, ray_flags);
+    threaded_mapper.integrateRays(rays.data(), rays.size(), nullptr, nullptr, ray_flags);
+  };
+
+  // Saturate the regions around the origin.
+  for (unsigned b = 0; b < 20; ++b)
+  {
+    integrate(kRfEndPointAsFree);
+  }
+
+  std::vector<const MapChunk *> chunks;
+  threaded_map->enumerateRegions(chunks);
+  const unsigned region_volume = unsigned(region_size.x) * unsigned(region_size.y) * unsigned(region_size.z);
+  unsigned saturated_regions = 0;
+  for (const MapChunk *chunk : chunks)
+  {
+    saturated_regions += (chunk->saturated_free_count == region_volume) ? 1u : 0u;
+  }
+  ASSERT_GT(saturated_regions, 0u);
+
+  // Add samples within the saturated regions, which later rays in each call traverse.
+  for (unsigned b = 0; b < 4; ++b)
+  {
+    integrate(kRfDefault);
+  }
+
+  ohmtestutil::compareMaps(*threaded_map, map, ohmtestutil::kCfCompareFineDetail);
+}
+
+
+TEST(Map, ThreadedSaturatedFreeSkipCorners)
+{
+  // Validate threaded integration matches the single threaded integration for rays which cross saturated regions
+  // through their corners and edges. The walk must visit the same voxels either side of a skipped region as a walk
+  // which does not skip.
+  const double resolution = 0.1;
+  const glm::u8vec3 region_size(8);
+
+  OccupancyMap map(resolution, region_size);
+  map.setSaturateAtMinValue(true);
+  const std::unique_ptr<OccupancyMap> threaded_map(map.clone());
+
+  RayMapperOccupancy mapper(&map);
+  RayMapperOccupancy threaded_mapper(threaded_map.get());
+  ASSERT_TRUE(mapper.valid());
+  ASSERT_TRUE(threaded_mapper.valid());
+  threaded_mapper.setThreaded(true);
+
+  std::vector<glm::dvec3> rays;
+  const auto integrate = [&](unsigned ray_flags) {
+    mapper.integrateRays(rays.data(), rays.size(), nullptr, nullptr, ray_flags);
+    threaded_mapper.integrateRays(rays.data(), rays.size(), nullptr, nullptr, ray_flags);
+  };
+
+  // Saturate a block of regions, leaving the surrounding regions unsaturated. Each ray covers a single voxel.
+  const glm::i16vec3 saturated_min(-1);
+  const glm::i16vec3 saturated_max(1);
+  glm::dvec3 saturated_min_ext;
+  glm::dvec3 saturated_max_ext;
+  glm::dvec3 region_min;
+  glm::dvec3 region_max;
+  map.region(saturated_min, true)->extents(saturated_min_ext, region_max);
+  map.region(saturated_max, true)->extents(region_min, saturated_max_ext);
+  rays.clear();
+  const glm::dvec3 voxel_offset(0.25 * resolution);
+  for (double z = saturated_min_ext.z + 0.5 * resolution; z < saturated_max_ext.z; z += resolution)
+  {
+    for (double y = saturated_min_ext.y + 0.5 * resolution; y < saturated_max_ext.y; y += resolution)
+    {
+      for (double x = saturated_min_ext.x + 0.5 * resolution; x < saturated_max_ext.x; x += resolution)
+      {
+        rays.emplace_back(glm::dvec3(x, y, z) - voxel_offset);
+        rays.emplace_back(glm::dvec3(x, y, z) + voxel_offset);
+      }
+    }
+  }
+  for (int i = 0; i < 20; ++i)
+  {
+    integrate(kRfEndPointAsFree);
+  }
+
+  const unsigned region_volume = unsigned(region_size.x) * unsigned(region_size.y) * unsigned(region_size.z);
+  glm::i16vec3 region_key;
+  for (region_key.z = saturated_min.z; region_key.z <= saturated_max.z; ++region_key.z)
+  {
+    for (region_key.y = saturated_min.y; region_key.y <= saturated_max.y; ++region_key.y)
+    {
+      for (region_key.x = saturated_min.x; region_key.x <= saturated_max.x; ++region_key.x)
+      {
+        ASSERT_EQ(map.region(region_key)->saturated_free_count, region_volume);
+        ASSERT_EQ(threaded_map->region(region_key)->saturated_free_count, region_volume);
+      }
+    }
+  }
+
+  // Cast rays through the corners and edge midpoints of the regions in the saturated block. These rays exit the
+  // skipped regions through corners and edges into unsaturated regions.
+  std::mt19937 rand_engine(1115);
+  std::uniform_real_distribution<double> rand(-1.0, 1.0);
+  const int block_regions = saturated_max.x - saturated_min.x + 1;
+  std::uniform_int_distribution<int> rand_boundary(0, block_regions);
+  const glm::dvec3 region_extents = map.regionSpatialResolution();
+  rays.clear();
+  for (int i = 0; i < 4000; ++i)
+  {
+    // Select a region corner, moving odd rays to an edge midpoint along one axis.
+    const int edge_axis = (i % 2) ? (i / 2) % 3 : -1;
+    glm::dvec3 point = saturated_min_ext;
+    for (int a = 0; a < 3; ++a)
+    {
+      const int boundary = rand_boundary(rand_engine);
+      point[a] += region_extents[a] *
+                  ((a == edge_axis) ? double(std::min(boundary, block_regions - 1)) + 0.5 : double(boundary));
+    }
+    glm::dvec3 dir(rand(rand_engine), rand(rand_engine), rand(rand_engine));
+    dir = (glm::length(dir) > 1e-3) ? glm::normalize(dir) : glm::dvec3(1, 0, 0);
+    rays.emplace_back(point - dir * 2.0);
+    rays.emplace_back(point + dir * 2.0);
+  }
+  integrate(kRfDefault);
+
+  ohmtestutil::compareMaps(*threaded_map, map, ohmtestutil::kCfCompareFineDetail);
+}
+
+
+TEST(Map, ConcurrentRegionAccess)
+{
+  // Validate concurrent region lookup and creation. Each thread creates and looks up an overlapping set of regions.
+  // All threads must resolve the same chunk for each region.
+  OccupancyMap map(0.25, glm::u8vec3(8));
+  const int region_extents = 12;
+  const unsigned thread_count = 4;
+
+  std::vector<std::vector<const MapChunk *>> thread_chunks(thread_count);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < thread_count; ++t)
+  {
+    threads.emplace_back([&map, &thread_chunks, t]() {
+      std::vector<const MapChunk *> &chunks = thread_chunks[t];
+      for (int z = -region_extents; z < region_extents; ++z)
+      {
+        for (int y = -region_extents; y < region_extents; ++y)
+        {
+          for (int x = -region_extents; x < region_extents; ++x)
+          {
+            // Alternate the traversal direction between threads to maximise contention on creation.
+            const glm::i16vec3 region_key = (t % 2) ? glm::i16vec3(x, y, z) : glm::i16vec3(-x - 1, -y - 1, -z - 1);
+            MapChunk *chunk = map.region(region_key, true);
+            chunks.emplace_back((chunk && map.region(region_key) == chunk) ? chunk : nullptr);
+          }
+        }
+      }
+    });
+  }
+
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  const size_t expected_count = size_t(2 * region_extents) * size_t(2 * region_extents) * size_t(2 * region_extents);
+  EXPECT_EQ(map.regionCount(), expected_count);
+
+  // Compare against the map directly.
+  for (unsigned t = 0; t < thread_count; ++t)
+  {
+    ASSERT_EQ(thread_chunks[t].size(), expected_count);
+    for (const MapChunk *chunk : thread_chunks[t])
+    {
+      ASSERT_NE(chunk, nullptr);
+      EXPECT_EQ(map.region(chunk->region.coord), chunk);
+    }
+  }
+
+  // Cull all but one region and validate lookup.
+  const glm::i16vec3 retain_key(1, 0, 0);
+  const glm::dvec3 retain_centre = map.regionCentreGlobal(retain_key);
+  const glm::dvec3 retain_extents = 0.25 * map.regionSpatialResolution();
+  map.cullRegionsOutside(retain_centre - retain_extents, retain_centre + retain_extents);
+  EXPECT_EQ(map.regionCount(), 1u);
+  EXPECT_EQ(map.region(glm::i16vec3(-1, 0, 0)), nullptr);
+  EXPECT_NE(map.region(retain_key), nullptr);
+}
+
+
+TEST(Map, ChunkIndexChurn)
+{
+  // Slide a window of regions along X, creating regions ahead and culling those behind. This continually tombstones
+  // chunk index entries, forcing repeated index rebuilds. Superseded index tables must be released rather than
+  // accumulating for the life of the map, including while lock free readers are active.
+  OccupancyMap map(0.25, glm::u8vec3(8));
+  const ChunkIndex &chunk_index = map.detail()->chunk_index;
+  const int window_length = 4;
+  const int window_width = 4;
+  const int step_count = 200;
+
+  const auto step_window = [&map](int step) {
+    for (int z = 0; z < window_width; ++z)
+    {
+      for (int y = 0; y < window_width; ++y)
+      {
+        map.region(glm::i16vec3(step + window_length - 1, y, z), true);
+      }
+    }
+    const glm::dvec3 half_region = 0.25 * map.regionSpatialResolution();
+    const glm::dvec3 min_ext = map.regionCentreGlobal(glm::i16vec3(step, 0, 0)) - half_region;
+    const glm::dvec3 max_ext =
+      map.regionCentreGlobal(glm::i16vec3(step + window_length - 1, window_width - 1, window_width - 1)) + half_region;
+    map.cullRegionsOutside(min_ext, max_ext);
+  };
+
+  // Without concurrent readers, superseded tables are released as soon as they are retired.
+  size_t max_memory = 0;
+  for (int step = 0; step < step_count; ++step)
+  {
+    step_window(step);
+    ASSERT_EQ(chunk_index.retiredTableCount(), 0u);
+    max_memory = std::max(max_memory, chunk_index.memoryUsage());
+  }
+  EXPECT_EQ(map.regionCount(), size_t(window_length * window_width * window_width));
+
+  // Repeat with a concurrent lock free reader.
+  std::atomic_bool quit(false);
+  std::thread reader([&map, &quit]() {
+    const OccupancyMap &const_map = map;
+    while (!quit)
+    {
+      for (int x = 0; x < 2 * step_count; ++x)
+      {
+        const_map.region(glm::i16vec3(x, 0, 0));
+      }
+    }
+  });
+
+  for (int step = step_count; step < 2 * step_count; ++step)
+  {
+    step_window(step);
+  }
+
+  quit = true;
+  reader.join();
+
+  // The next modification without readers releases anything retired while the reader was active.
+  step_window(2 * step_count);
+  EXPECT_EQ(chunk_index.retiredTableCount(), 0u);
+  EXPECT_LE(chunk_index.memoryUsage(), max_memory);
+  EXPECT_EQ(map.regionCount(), size_t(window_length * window_width * window_width));
+}
+
+
+TEST(Map, DirtyRegions)
+{
+  // Validate the dirty region queries against a brute force evaluation of the MapChunk::dirty_stamp values.
+  OccupancyMap map(0.25, glm::u8vec3(8));
+  RayMapperOccupancy mapper(&map);
+  std::vector<glm::dvec3> rays;
+
+  // Add rays in batches, recording the stamp after each batch.
+  std::vector<uint64_t> batch_stamps;
+  for (int i = 0; i < 4; ++i)
+  {
+    rays.clear();
+    rays.emplace_back(glm::dvec3(0.0));
+    rays.emplace_back(glm::dvec3(2.0 * (i + 1), 0.5 * i, -1.0 * i));
+    batch_stamps.emplace_back(map.stamp());
+    mapper.integrateRays(rays.data(), rays.size());
+  }
+
+  std::vector<const MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+
+  for (const uint64_t from_stamp : batch_stamps)
+  {
+    std::vector<std::pair<uint64_t, glm::i16vec3>> dirty_regions;
+    const unsigned dirty_count = map.collectDirtyRegions(from_stamp, dirty_regions);
+    EXPECT_EQ(dirty_count, dirty_regions.size());
+
+    glm::i16vec3 expected_min(std::numeric_limits<int16_t>::max());
+    glm::i16vec3 expected_max(std::numeric_limits<int16_t>::min());
+    unsigned expected_count = 0;
+    for (const MapChunk *chunk : chunks)
+    {
+      if (chunk->dirty_stamp > from_stamp)
+      {
+        ++expected_count;
+        expected_min = glm::min(expected_min, chunk->region.coord);
+        expected_max = glm::max(expected_max, chunk->region.coord);
+        const auto search = std::find(dirty_regions.begin(), dirty_regions.end(),
+                                      std::make_pair(chunk->dirty_stamp.load(), chunk->region.coord));
+        EXPECT_NE(search, dirty_regions.end());
+      }
+    }
+
+    EXPECT_EQ(dirty_count, expected_count);
+    EXPECT_GT(dirty_count, 0u);
+    for (size_t i = 1; i < dirty_regions.size(); ++i)
+    {
+      EXPECT_LE(dirty_regions[i - 1].first, dirty_regions[i].first);
+    }
+
+    glm::i16vec3 min_ext;
+    glm::i16vec3 max_ext;
+    map.calculateDirtyExtents(from_stamp, &min_ext, &max_ext);
+    EXPECT_EQ(min_ext, expected_min);
+    EXPECT_EQ(max_ext, expected_max);
+  }
+
+  // Nothing is dirty after the current stamp.
+  std::vector<std::pair<uint64_t, glm::i16vec3>> dirty_regions;
+  EXPECT_EQ(map.collectDirtyRegions(map.stamp(), dirty_regions), 0u);
+
+  // Culled regions must be removed from the index.
+  map.cullRegionsOutside(glm::dvec3(-0.5), glm::dvec3(0.5));
+  EXPECT_EQ(map.collectDirtyRegions(0, dirty_regions), map.regionCount());
+}
+
+
+TEST(Map, FilteredIteration)
+{
+  // Validate the filtered iterators against a brute force search of all voxels. Run with and without the occupancy
+  // mask layer to cover both scanning paths.
+  for (bool with_mask : { false, true })
+  {
+    OccupancyMap map(0.1, glm::u8vec3(16));
+    if (with_mask)
+    {
+      ASSERT_NE(addOccupancyMask(map.layout()), nullptr);
+    }
+    RayMapperOccupancy mapper(&map);
+    ASSERT_TRUE(mapper.valid());
+
+    std::mt19937 rand_engine(with_mask ? 42 : 7);
+    std::uniform_real_distribution<double> rand(-4.0, 4.0);
+    const auto integrate_batch = [&](const glm::dvec3 &origin) {
+      std::vector<glm::dvec3> rays;
+      for (unsigned i = 0; i < 500; ++i)
+      {
+        rays.emplace_back(origin);
+        rays.emplace_back(origin + glm::dvec3(rand(rand_engine), rand(rand_engine), 0.25 * rand(rand_engine)));
+      }
+      mapper.integrateRays(rays.data(), rays.size());
+    };
+
+    integrate_batch(glm::dvec3(0.0));
+    const uint64_t since_stamp = map.stamp();
+    // Touch only some of the regions with the second batch.
+    integrate_batch(glm::dvec3(6.0, 0, 0));
+
+    const int occupancy_layer = map.layout().occupancyLayer();
+    std::vector<const MapChunk *> chunks;
+    map.enumerateRegions(chunks);
+
+    const auto validate = [&](unsigned filter) {
+      // Brute force the expected set.
+      std::unordered_set<Key, KeyHash> expected;
+      Voxel<const float> occupancy(&map, occupancy_layer);
+      for (const MapChunk *chunk : chunks)
+      {
+        if ((filter & kIfTouchedSince) && chunk->dirty_stamp <= since_stamp)
+        {
+          continue;
+        }
+
+        for (int z = 0; z < map.regionVoxelDimensions().z; ++z)
+        {
+          for (int y = 0; y < map.regionVoxelDimensions().y; ++y)
+          {
+            for (int x = 0; x < map.regionVoxelDimensions().x; ++x)
+            {
+              const Key key(chunk->region.coord, uint8_t(x), uint8_t(y), uint8_t(z));
+              occupancy.setKey(key);
+              if ((filter & kIfObserved) && isUnobserved(occupancy) || (filter & kIfOccupied) && !isOccupied(occupancy))
+              {
+                continue;
+              }
+              expected.insert(key);
+            }
+          }
+        }
+      }
+      occupancy.reset();
+
+      // Filtered iteration must visit each expected voxel exactly once.
+      size_t visited_count = 0;
+      std::unordered_set<Key, KeyHash> visited;
+      const OccupancyMap &const_map = map;
+      for (auto iter = const_map.begin(filter, since_stamp); iter != const_map.end(); ++iter)
+      {
+        EXPECT_TRUE(expected.find(*iter) != expected.end());
+        visited.insert(*iter);
+        ++visited_count;
+      }
+      EXPECT_EQ(visited_count, visited.size());
+      EXPECT_EQ(visited.size(), expected.size());
+      return visited.size();
+    };
+
+    const size_t observed_count = validate(kIfObserved);
+    const size_t occupied_count = validate(kIfOccupied);
+    const size_t touched_count = validate(kIfTouchedSince);
+    const size_t touched_occupied_count = validate(kIfTouchedSince | kIfOccupied);
+    EXPECT_GT(occupied_count, 0u);
+    EXPECT_GT(observed_count, occupied_count);
+    EXPECT_GT(touched_count, 0u);
+    EXPECT_GT(touched_occupied_count, 0u);
+    EXPECT_LT(touched_occupied_count, occupied_count);
+
+    // Nothing has been touched since the current stamp.
+    EXPECT_TRUE(map.begin(kIfTouchedSince, map.stamp()) == map.end());
+  }
+}
+
+TEST(Map, RollingWindow)
+{
+  const glm::ivec3 window(6, 6, 2);
+  const glm::u8vec3 region_size(16);
+  const double resolution = 0.1;
+  OccupancyMap map(resolution, region_size);
+  ASSERT_TRUE(map.setRollingWindow(window));
+  EXPECT_EQ(map.rollingWindow(), window);
+
+  RayMapperOccupancy mapper(&map);
+  ASSERT_TRUE(mapper.valid());
+
+  // Sweep the sensor along the X axis, well beyond the window extents. The sensor range fits within the window.
+  const double sensor_range = 2.0;
+  std::mt19937 rand_engine(20);
+  std::uniform_real_distribution<double> rand(-sensor_range, sensor_range);
+  std::unordered_set<const MapChunk *> chunk_memory;
+  std::vector<glm::dvec3> rays;
+  const size_t window_volume = size_t(window.x) * size_t(window.y) * size_t(window.z);
+  for (int step = 0; step < 40; ++step)
+  {
+    const glm::dvec3 sensor(0.5 * step, 0, 0);
+    rays.clear();
+    for (unsigned i = 0; i < 500; ++i)
+    {
+      rays.emplace_back(sensor);
+      rays.emplace_back(sensor + glm::dvec3(rand(rand_engine), rand(rand_engine), 0.1 * rand(rand_engine)));
+    }
+    mapper.integrateRays(rays.data(), rays.size());
+
+    // Region memory is recycled: the number of distinct chunks never exceeds the window.
+    std::vector<const MapChunk *> chunks;
+    map.enumerateRegions(chunks);
+    ASSERT_LE(chunks.size(), window_volume);
+    for (const MapChunk *chunk : chunks)
+    {
+      chunk_memory.insert(chunk);
+      ASSERT_EQ(map.region(chunk->region.coord), chunk);
+    }
+    ASSERT_LE(chunk_memory.size(), window_volume);
+
+    // The regions around the sensor are resident and hold the latest samples. Sample voxels may have been cleared by
+    // later rays, but are all observed.
+    Voxel<const float> occupancy(&map, map.layout().occupancyLayer());
+    for (size_t i = 1; i < rays.size(); i += 2)
+    {
+      occupancy.setKey(map.voxelKey(rays[i]));
+      ASSERT_TRUE(occupancy.isValid());
+      ASSERT_FALSE(isUnobserved(occupancy));
+    }
+  }
+
+  // The starting regions have been evicted.
+  EXPECT_EQ(map.region(map.regionKey(glm::dvec3(0.0))), nullptr);
+
+  // Creating a region in an occupied slot recycles the resident region, clearing its content.
+  std::vector<const MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  const MapChunk *resident = nullptr;
+  for (const MapChunk *chunk : chunks)
+  {
+    if (chunk->hasValidNodes())
+    {
+      resident = chunk;
+      break;
+    }
+  }
+  ASSERT_NE(resident, nullptr);
+  const glm::i16vec3 resident_key = resident->region.coord;
+  const glm::i16vec3 new_key = resident_key + glm::i16vec3(window.x, 0, 0);
+  const size_t region_count = map.regionCount();
+  MapChunk *recycled = map.region(new_key, true);
+  EXPECT_EQ(recycled, resident);
+  EXPECT_EQ(recycled->region.coord, new_key);
+  EXPECT_EQ(map.region(resident_key), nullptr);
+  EXPECT_EQ(map.region(new_key), recycled);
+  EXPECT_EQ(map.regionCount(), region_count);
+  EXPECT_FALSE(recycled->hasValidNodes());
+  EXPECT_EQ(recycled->dirty_stamp, 0u);
+  Voxel<const float> occupancy(&map, map.layout().occupancyLayer(), new_key);
+  for (int i = 0; i < int(region_size.x) * int(region_size.y) * int(region_size.z); ++i)
+  {
+    occupancy.setKey(recycled->keyForIndex(i, glm::ivec3(region_size)));
+    ASSERT_TRUE(isUnobserved(occupancy));
+  }
+  occupancy.reset();
+
+  // The mode cannot change while the map has regions.
+  EXPECT_FALSE(map.setRollingWindow(glm::ivec3(0)));
+  map.clear();
+  EXPECT_EQ(map.region(new_key), nullptr);
+  EXPECT_TRUE(map.setRollingWindow(glm::ivec3(0)));
+  EXPECT_EQ(map.rollingWindow(), glm::ivec3(0));
+}
+
+TEST(Map, ThreadedRollingWindow)
+{
+  // Validate threaded integration in rolling window mode where each call spans more regions than the window. Regions
+  // sharing a ring slot evict each other within a call and must be updated in ray order as per the single threaded
+  // integration.
+  const glm::ivec3 window(3, 3, 2);
+  const glm::u8vec3 region_size(16);
+  const double resolution = 0.1;
+  const double range = 4.0;
+  OccupancyMap map(resolution, region_size);
+  ASSERT_TRUE(map.setRollingWindow(window));
+  const std::unique_ptr<OccupancyMap> threaded_map(map.clone());
+  ASSERT_EQ(threaded_map->rollingWindow(), window);
+
+  RayMapperOccupancy mapper(&map);
+  RayMapperOccupancy threaded_mapper(threaded_map.get());
+  ASSERT_TRUE(mapper.valid());
+  ASSERT_TRUE(threaded_mapper.valid());
+  threaded_mapper.setThreaded(true);
+
+  std::mt19937 rand_engine(1020);
+  std::uniform_real_distribution<double> rand(-range, range);
+  std::vector<glm::dvec3> rays;
+  const size_t window_volume = size_t(window.x) * size_t(window.y) * size_t(window.z);
+  for (int step = 0; step < 10; ++step)
+  {
+    const glm::dvec3 sensor(0.5 * step, 0, 0);
+    rays.clear();
+    for (unsigned i = 0; i < 2000; ++i)
+    {
+      rays.emplace_back(sensor);
+      rays.emplace_back(sensor + glm::dvec3(rand(rand_engine), rand(rand_engine), 0.25 * rand(rand_engine)));
+    }
+    mapper.integrateRays(rays.data(), rays.size());
+    threaded_mapper.integrateRays(rays.data(), rays.size());
+
+    ASSERT_LE(threaded_map->regionCount(), window_volume);
+    ASSERT_EQ(threaded_map->regionCount(), map.regionCount());
+    ohmtestutil::compareMaps(*threaded_map, map, ohmtestutil::kCfCompareFineDetail);
+  }
+}
 }  // namespace maptests
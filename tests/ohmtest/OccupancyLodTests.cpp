@@ -0,0 +1,224 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OhmTestConfig.h"
+
+#include <gtest/gtest.h>
+
+#include <ohm/DefaultLayer.h>
+#include <ohm/Key.h>
+#include <ohm/MapChunk.h>
+#include <ohm/OccupancyLod.h>
+#include <ohm/OccupancyLodProcess.h>
+#include <ohm/OccupancyMap.h>
+#include <ohm/RayMapperOccupancy.h>
+#include <ohm/RaysQuery.h>
+#include <ohm/VoxelBuffer.h>
+#include <ohm/VoxelOccupancy.h>
+
+#include <ohmutil/OhmUtil.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace occupancylod
+{
+using Clock = std::chrono::high_resolution_clock;
+
+/// Generate @p count rays from around the origin out to @p range .
+std::vector<glm::dvec3> generateRays(unsigned count, double range, unsigned seed)
+{
+  std::default_random_engine rng(seed);
+  std::uniform_real_distribution<double> origin_rand(-0.5, 0.5);
+  std::uniform_real_distribution<double> end_rand(-range, range);
+  std::vector<glm::dvec3> rays;
+  rays.reserve(2 * count);
+  for (unsigned i = 0; i < count; ++i)
+  {
+    rays.emplace_back(glm::dvec3(origin_rand(rng), origin_rand(rng), origin_rand(rng)));
+    rays.emplace_back(glm::dvec3(end_rand(rng), end_rand(rng), 0.25 * end_rand(rng)));
+  }
+  return rays;
+}
+
+
+/// Generate @p count rays from the origin to the walls of a box with the given @p half_extents .
+std::vector<glm::dvec3> generateRoomRays(unsigned count, const glm::dvec3 &half_extents, unsigned seed)
+{
+  std::default_random_engine rng(seed);
+  std::uniform_real_distribution<double> rand(-1.0, 1.0);
+  std::vector<glm::dvec3> rays;
+  rays.reserve(2 * count);
+  for (unsigned i = 0; i < count; ++i)
+  {
+    const glm::dvec3 dir(rand(rng), rand(rng), rand(rng));
+    // Scale the direction to touch the closest wall.
+    const glm::dvec3 wall_scale = half_extents / glm::abs(dir);
+    rays.emplace_back(glm::dvec3(0.0));
+    rays.emplace_back(dir * std::min(wall_scale.x, std::min(wall_scale.y, wall_scale.z)));
+  }
+  return rays;
+}
+
+
+/// Validate the LOD layers of @p map against the occupancy layer.
+void validateLod(const ohm::OccupancyMap &map, unsigned levels)
+{
+  const glm::ivec3 region_dim = map.regionVoxelDimensions();
+  const int occupancy_layer = map.layout().occupancyLayer();
+  std::vector<const ohm::MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  ASSERT_FALSE(chunks.empty());
+
+  for (unsigned level = 1; level <= levels; ++level)
+  {
+    const int lod_layer = ohm::occupancyLodLayer(map, level);
+    ASSERT_GE(lod_layer, 0);
+    const int cell_size = 1 << level;
+    const glm::ivec3 cell_dim = region_dim / cell_size;
+
+    for (const ohm::MapChunk *chunk : chunks)
+    {
+      ASSERT_TRUE(ohm::occupancyLodUpToDate(*chunk, occupancy_layer, lod_layer));
+      ohm::VoxelBuffer<const ohm::VoxelBlock> occupancy_buffer(chunk->voxel_blocks[occupancy_layer]);
+      ohm::VoxelBuffer<const ohm::VoxelBlock> lod_buffer(chunk->voxel_blocks[lod_layer]);
+
+      // Brute force reduction.
+      std::vector<ohm::OccupancyLodVoxel> expected(size_t(cell_dim.x) * cell_dim.y * cell_dim.z,
+                                                   ohm::OccupancyLodVoxel{ ohm::unobservedOccupancyValue(), 0 });
+      for (int z = 0; z < region_dim.z; ++z)
+      {
+        for (int y = 0; y < region_dim.y; ++y)
+        {
+          for (int x = 0; x < region_dim.x; ++x)
+          {
+            float occupancy;
+            occupancy_buffer.readVoxel(ohm::voxelIndex(x, y, z, region_dim.x, region_dim.y, region_dim.z), &occupancy);
+            ohm::OccupancyLodVoxel &cell = expected[ohm::voxelIndex(x / cell_size, y / cell_size, z / cell_size,
+                                                                    cell_dim.x, cell_dim.y, cell_dim.z)];
+            if (occupancy == ohm::unobservedOccupancyValue())
+            {
+              ++cell.unobserved_count;
+            }
+            else if (cell.occupancy == ohm::unobservedOccupancyValue() || occupancy > cell.occupancy)
+            {
+              cell.occupancy = occupancy;
+            }
+          }
+        }
+      }
+
+      for (unsigned i = 0; i < unsigned(expected.size()); ++i)
+      {
+        ohm::OccupancyLodVoxel lod_voxel{};
+        lod_buffer.readVoxel(i, &lod_voxel);
+        ASSERT_EQ(lod_voxel.occupancy, expected[i].occupancy) << "level " << level << " cell " << i;
+        ASSERT_EQ(lod_voxel.unobserved_count, expected[i].unobserved_count) << "level " << level << " cell " << i;
+      }
+    }
+  }
+}
+
+
+/// Execute @p rays against @p map with and without the LOD layers and compare the results.
+void compareRaysQuery(ohm::OccupancyMap &map, const std::vector<glm::dvec3> &rays)
+{
+  ohm::RaysQuery fine_query;
+  fine_query.setMap(&map);
+  fine_query.setQueryFlags(fine_query.queryFlags() | ohm::RaysQuery::kQfIgnoreOccupancyLod);
+  fine_query.setRays(rays);
+
+  ohm::RaysQuery lod_query;
+  lod_query.setMap(&map);
+  lod_query.setRays(rays);
+
+  auto start = Clock::now();
+  fine_query.execute();
+  auto end = Clock::now();
+  std::cout << "Map resolution query: " << (end - start) << std::endl;
+  start = Clock::now();
+  lod_query.execute();
+  end = Clock::now();
+  std::cout << "LOD query: " << (end - start) << std::endl;
+
+  ASSERT_EQ(fine_query.numberOfResults(), rays.size() / 2);
+  ASSERT_EQ(lod_query.numberOfResults(), fine_query.numberOfResults());
+  for (size_t i = 0; i < fine_query.numberOfResults(); ++i)
+  {
+    EXPECT_NEAR(lod_query.ranges()[i], fine_query.ranges()[i], 1e-5) << i;
+    EXPECT_NEAR(lod_query.unobservedVolumes()[i], fine_query.unobservedVolumes()[i],
+                1e-6 * std::max(1.0, fine_query.unobservedVolumes()[i]))
+      << i;
+    EXPECT_EQ(lod_query.terminalOccupancyTypes()[i], fine_query.terminalOccupancyTypes()[i]) << i;
+    EXPECT_EQ(lod_query.intersectedVoxels()[i], fine_query.intersectedVoxels()[i]) << i;
+  }
+}
+
+
+TEST(OccupancyLod, Process)
+{
+  ohm::OccupancyMap map(0.1);
+  ohm::RayMapperOccupancy mapper(&map);
+  const std::vector<glm::dvec3> rays = generateRays(2000, 8.0, 1153297050u);
+  mapper.integrateRays(rays.data(), rays.size());
+
+  ohm::OccupancyLodProcess lod_process;
+  const auto start = Clock::now();
+  EXPECT_EQ(lod_process.update(map, 0), ohm::kMprProgressing);
+  const auto end = Clock::now();
+  std::cout << "LOD update: " << (end - start) << std::endl;
+  EXPECT_EQ(lod_process.update(map, 0), ohm::kMprUpToDate);
+  validateLod(map, lod_process.levels());
+
+  // Integrating more rays only dirties the touched regions.
+  const std::vector<glm::dvec3> more_rays = generateRays(10, 1.0, 7u);
+  mapper.integrateRays(more_rays.data(), more_rays.size());
+  EXPECT_EQ(lod_process.update(map, 0), ohm::kMprProgressing);
+  EXPECT_EQ(lod_process.update(map, 0), ohm::kMprUpToDate);
+  validateLod(map, lod_process.levels());
+
+  // Check the cell lookup and classification.
+  ohm::OccupancyLodVoxel lod_voxel{};
+  const ohm::Key key = map.voxelKey(rays[1]);
+  ASSERT_TRUE(ohm::occupancyLodVoxel(map, key, 1, &lod_voxel));
+  EXPECT_EQ(ohm::occupancyLodType(lod_voxel, map.occupancyThresholdValue()), ohm::kOccupied);
+  ASSERT_TRUE(ohm::occupancyLodVoxel(map, map.voxelKey(glm::dvec3(0)), 1, &lod_voxel));
+  EXPECT_EQ(ohm::occupancyLodType(lod_voxel, map.occupancyThresholdValue()), ohm::kFree);
+  EXPECT_FALSE(ohm::occupancyLodVoxel(map, map.voxelKey(glm::dvec3(1000.0)), 1, &lod_voxel));
+}
+
+
+TEST(OccupancyLod, RaysQuery)
+{
+  ohm::OccupancyMap map(0.1);
+  ohm::RayMapperOccupancy mapper(&map);
+  const std::vector<glm::dvec3> rays = generateRoomRays(200000, glm::dvec3(6.0, 6.0, 1.8), 1153297050u);
+  mapper.integrateRays(rays.data(), rays.size());
+
+  ohm::OccupancyLodProcess lod_process;
+  lod_process.calculateAll(map);
+
+  // Query rays from inside the room, terminating on the walls.
+  const std::vector<glm::dvec3> room_rays = generateRays(20000, 12.0, 42u);
+  compareRaysQuery(map, room_rays);
+
+  // Query long rays which cross the unmapped space around the room and lie along voxel boundaries.
+  std::vector<glm::dvec3> long_rays;
+  for (int i = 0; i < 20000; ++i)
+  {
+    const double y = -20.0 + i * 0.002;  // NOLINT(readability-magic-numbers)
+    long_rays.emplace_back(glm::dvec3(-30.0, y, 0.1));
+    long_rays.emplace_back(glm::dvec3(30.0, y, 0.1));
+  }
+  compareRaysQuery(map, long_rays);
+
+  // Dirty some regions without updating the LOD layers. The query must fall back to the map resolution there.
+  const std::vector<glm::dvec3> more_rays = generateRays(200, 4.0, 7u);
+  mapper.integrateRays(more_rays.data(), more_rays.size());
+  compareRaysQuery(map, room_rays);
+  compareRaysQuery(map, long_rays);
+}
+}  // namespace occupancylod
@@ -0,0 +1,167 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OhmTestConfig.h"
+
+#include <gtest/gtest.h>
+
+#include <ohm/DefaultLayer.h>
+#include <ohm/Key.h>
+#include <ohm/MapChunk.h>
+#include <ohm/NearestNeighbours.h>
+#include <ohm/OccupancyMap.h>
+#include <ohm/OccupancyMask.h>
+#include <ohm/QueryFlag.h>
+#include <ohm/RayMapperOccupancy.h>
+#include <ohm/VoxelBuffer.h>
+#include <ohm/VoxelOccupancy.h>
+
+#include <chrono>
+#include <random>
+
+namespace occupancymask
+{
+using Clock = std::chrono::high_resolution_clock;
+
+/// Generate @p count rays from around the origin out to @p range .
+std::vector<glm::dvec3> generateRays(unsigned count, double range, unsigned seed)
+{
+  std::default_random_engine rng(seed);
+  std::uniform_real_distribution<double> origin_rand(-0.5, 0.5);
+  std::uniform_real_distribution<double> end_rand(-range, range);
+  std::vector<glm::dvec3> rays;
+  rays.reserve(2 * count);
+  for (unsigned i = 0; i < count; ++i)
+  {
+    rays.emplace_back(glm::dvec3(origin_rand(rng), origin_rand(rng), origin_rand(rng)));
+    rays.emplace_back(glm::dvec3(end_rand(rng), end_rand(rng), 0.25 * end_rand(rng)));
+  }
+  return rays;
+}
+
+
+/// Validate the occupancy mask of @p map against the occupancy layer.
+void validateMask(const ohm::OccupancyMap &map)
+{
+  const int occupancy_layer = map.layout().occupancyLayer();
+  const int mask_layer = ohm::occupancyMaskLayer(map);
+  ASSERT_GE(mask_layer, 0);
+  std::vector<const ohm::MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  ASSERT_FALSE(chunks.empty());
+
+  for (const ohm::MapChunk *chunk : chunks)
+  {
+    ASSERT_TRUE(ohm::occupancyMaskUpToDate(*chunk, occupancy_layer, mask_layer));
+    ohm::VoxelBuffer<const ohm::VoxelBlock> occupancy_buffer(chunk->voxel_blocks[occupancy_layer]);
+    ohm::VoxelBuffer<const ohm::VoxelBlock> mask_buffer(chunk->voxel_blocks[mask_layer]);
+    const unsigned voxel_count = unsigned(occupancy_buffer.voxelMemorySize() / sizeof(float));
+    ASSERT_EQ(mask_buffer.voxelMemorySize() / sizeof(ohm::OccupancyMaskVoxel) * ohm::kOccupancyMaskVoxelBits,
+              voxel_count);
+
+    unsigned occupied_count = 0;
+    unsigned observed_count = 0;
+    for (unsigned i = 0; i < voxel_count; ++i)
+    {
+      float occupancy;
+      ohm::OccupancyMaskVoxel mask;
+      occupancy_buffer.readVoxel(i, &occupancy);
+      mask_buffer.readVoxel(i / ohm::kOccupancyMaskVoxelBits, &mask);
+      const bool observed = !ohm::isUnobserved(occupancy);
+      const bool occupied = observed && occupancy >= map.occupancyThresholdValue();
+      EXPECT_EQ(observed, ((mask.observed >> (i % ohm::kOccupancyMaskVoxelBits)) & 1u) != 0);
+      EXPECT_EQ(occupied, ((mask.occupied >> (i % ohm::kOccupancyMaskVoxelBits)) & 1u) != 0);
+      occupied_count += unsigned(occupied);
+      observed_count += unsigned(observed);
+    }
+    EXPECT_EQ(chunk->occupied_voxel_count, occupied_count);
+    EXPECT_EQ(chunk->observed_voxel_count, observed_count);
+  }
+}
+
+
+TEST(OccupancyMask, Maintenance)
+{
+  // Validate the occupancy mask is maintained incrementally by the RayMapperOccupancy and may be brought up to date
+  // after other modifications.
+  ohm::OccupancyMap map(0.1, glm::u8vec3(32));
+  ASSERT_NE(ohm::addOccupancyMask(map.layout()), nullptr);
+  ASSERT_GE(ohm::occupancyMaskLayer(map), 0);
+
+  ohm::RayMapperOccupancy mapper(&map);
+  ASSERT_TRUE(mapper.valid());
+  for (unsigned i = 0; i < 4; ++i)
+  {
+    const std::vector<glm::dvec3> rays = generateRays(5000, 6.0, 100 + i);
+    mapper.integrateRays(rays.data(), rays.size());
+  }
+  validateMask(map);
+
+  // Modify the map outside of the ray mapper. The affected region mask becomes stale.
+  const ohm::Key key = map.voxelKey(glm::dvec3(0.05));
+  ohm::integrateHit(map, key);
+  ohm::MapChunk *chunk = map.region(key.regionKey());
+  ASSERT_NE(chunk, nullptr);
+  const int mask_layer = ohm::occupancyMaskLayer(map);
+  EXPECT_FALSE(ohm::occupancyMaskUpToDate(*chunk, map.layout().occupancyLayer(), mask_layer));
+  EXPECT_TRUE(ohm::updateOccupancyMask(map, *chunk));
+  EXPECT_FALSE(ohm::updateOccupancyMask(map, *chunk));
+  validateMask(map);
+
+  // Continue integrating rays, which also brings any stale mask up to date.
+  ohm::integrateMiss(map, key);
+  const std::vector<glm::dvec3> rays = generateRays(5000, 6.0, 200);
+  mapper.integrateRays(rays.data(), rays.size());
+  validateMask(map);
+}
+
+
+TEST(OccupancyMask, NearestNeighbours)
+{
+  // Validate nearest neighbour queries using the occupancy mask match those using the occupancy layer.
+  ohm::OccupancyMap map(0.1, glm::u8vec3(32));
+  ohm::OccupancyMap mask_map(0.1, glm::u8vec3(32));
+  ohm::addOccupancyMask(mask_map.layout());
+  ASSERT_GE(ohm::occupancyMaskLayer(mask_map), 0);
+
+  ohm::RayMapperOccupancy mapper(&map);
+  ohm::RayMapperOccupancy mask_mapper(&mask_map);
+  const std::vector<glm::dvec3> rays = generateRays(20000, 8.0, 1000);
+  mapper.integrateRays(rays.data(), rays.size());
+  mask_mapper.integrateRays(rays.data(), rays.size());
+
+  std::default_random_engine rng(1000);
+  std::uniform_real_distribution<double> rand(-6.0, 6.0);
+  Clock::duration query_time{};
+  Clock::duration mask_query_time{};
+  for (unsigned flags : { 0u, unsigned(ohm::kQfUnknownAsOccupied) })
+  {
+    for (unsigned i = 0; i < 20; ++i)
+    {
+      const glm::dvec3 near_point(rand(rng), rand(rng), 0.25 * rand(rng));
+      ohm::NearestNeighbours query(map, near_point, 2.0f, flags);
+      ohm::NearestNeighbours mask_query(mask_map, near_point, 2.0f, flags);
+
+      auto start_time = Clock::now();
+      query.execute();
+      query_time += Clock::now() - start_time;
+      start_time = Clock::now();
+      mask_query.execute();
+      mask_query_time += Clock::now() - start_time;
+
+      ASSERT_EQ(query.numberOfResults(), mask_query.numberOfResults());
+      for (size_t r = 0; r < query.numberOfResults(); ++r)
+      {
+        EXPECT_EQ(query.intersectedVoxels()[r], mask_query.intersectedVoxels()[r]);
+        EXPECT_EQ(query.ranges()[r], mask_query.ranges()[r]);
+      }
+    }
+  }
+
+  std::cout << "Occupancy layer: " << std::chrono::duration_cast<std::chrono::microseconds>(query_time).count()
+            << "us mask: " << std::chrono::duration_cast<std::chrono::microseconds>(mask_query_time).count() << "us"
+            << std::endl;
+}
+}  // namespace occupancymask
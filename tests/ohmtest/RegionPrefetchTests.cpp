@@ -0,0 +1,247 @@
+// Copyright (c) 2021
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Kazys Stepanas
+#include "OhmTestConfig.h"
+
+#include <gtest/gtest.h>
+
+#include <ohm/Aabb.h>
+#include <ohm/MapChunk.h>
+#include <ohm/OccupancyMap.h>
+#include <ohm/RayMapperOccupancy.h>
+#include <ohm/RegionPrefetch.h>
+#include <ohm/VoxelBlock.h>
+#include <ohm/VoxelBlockCompressionQueue.h>
+
+#include <chrono>
+#include <random>
+#include <thread>
+
+namespace regionprefetch
+{
+using Clock = std::chrono::high_resolution_clock;
+
+/// Check if all the non uniform voxel blocks in @p chunk are uncompressed, or compressed if @p uncompressed is false.
+bool blocksUncompressed(const ohm::MapChunk &chunk, bool uncompressed)
+{
+  for (const auto &block : chunk.voxel_blocks)
+  {
+    if (block && !(block->flags() & ohm::VoxelBlock::kFUniform) &&
+        bool(block->flags() & ohm::VoxelBlock::kFUncompressed) != uncompressed)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/// Wait until the non uniform blocks of all @p chunks are compressed.
+bool waitForCompression(const std::vector<const ohm::MapChunk *> &chunks)
+{
+  const auto start = Clock::now();
+  while (Clock::now() - start < std::chrono::seconds(10))
+  {
+    bool compressed = true;
+    for (const ohm::MapChunk *chunk : chunks)
+    {
+      compressed = compressed && blocksUncompressed(*chunk, false);
+    }
+    if (compressed)
+    {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return false;
+}
+
+
+TEST(RegionPrefetch, PinRegions)
+{
+  ohm::OccupancyMap map(0.1, glm::u8vec3(16));
+  ohm::RayMapperOccupancy mapper(&map);
+  std::mt19937 rand_engine(19);
+  std::uniform_real_distribution<double> rand(-3.0, 3.0);
+  std::vector<glm::dvec3> rays;
+  for (unsigned i = 0; i < 1000; ++i)
+  {
+    rays.emplace_back(glm::dvec3(0.0));
+    rays.emplace_back(glm::dvec3(rand(rand_engine), rand(rand_engine), 0.25 * rand(rand_engine)));
+  }
+  mapper.integrateRays(rays.data(), rays.size());
+
+  std::vector<const ohm::MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  ASSERT_GT(chunks.size(), 2u);
+
+  // Force everything to compress.
+  ohm::VoxelBlockCompressionQueue &compressor = ohm::VoxelBlockCompressionQueue::instance();
+  const uint64_t high_tide = compressor.highTide();
+  const uint64_t low_tide = compressor.lowTide();
+  compressor.setLowTide(0);
+  compressor.setHighTide(0);
+  ASSERT_TRUE(waitForCompression(chunks));
+
+  {
+    ohm::RegionPrefetch prefetch(map, 2);
+    EXPECT_EQ(&prefetch.map(), &map);
+
+    // Prefetch the first half of the regions.
+    std::vector<glm::i16vec3> region_keys;
+    for (size_t i = 0; i < chunks.size() / 2; ++i)
+    {
+      region_keys.emplace_back(chunks[i]->region.coord);
+    }
+    EXPECT_EQ(prefetch.request(region_keys), region_keys.size());
+    // Repeat requests are ignored.
+    EXPECT_EQ(prefetch.request(region_keys), 0u);
+    prefetch.wait();
+    EXPECT_EQ(prefetch.pendingCount(), 0u);
+    EXPECT_EQ(prefetch.pinnedCount(), region_keys.size());
+
+    // Regions not in the map are dropped.
+    const glm::i16vec3 missing_key(1000, 1000, 1000);
+    ASSERT_EQ(map.region(missing_key), nullptr);
+    EXPECT_EQ(prefetch.request(&missing_key, 1), 1u);
+    prefetch.wait();
+    EXPECT_FALSE(prefetch.isPinned(missing_key));
+    EXPECT_EQ(prefetch.pinnedCount(), region_keys.size());
+
+    // Pinned regions stay uncompressed while the compression queue runs.
+    compressor.setHighTide(0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+      const bool pinned = i < region_keys.size();
+      EXPECT_EQ(prefetch.isPinned(chunks[i]->region.coord), pinned);
+      if (pinned)
+      {
+        EXPECT_TRUE(blocksUncompressed(*chunks[i], true));
+      }
+    }
+
+    // Released regions are compressed again.
+    EXPECT_EQ(prefetch.release(region_keys.data(), 1), 1u);
+    EXPECT_FALSE(prefetch.isPinned(region_keys[0]));
+    EXPECT_EQ(prefetch.pinnedCount(), region_keys.size() - 1);
+    EXPECT_TRUE(waitForCompression({ chunks[0] }));
+
+    // Prefetch by bounds.
+    prefetch.releaseAll();
+    EXPECT_EQ(prefetch.pinnedCount(), 0u);
+    const ohm::Aabb box(chunks.back()->region.centre, chunks.back()->region.centre);
+    EXPECT_EQ(prefetch.request(box), 1u);
+    prefetch.wait();
+    EXPECT_TRUE(prefetch.isPinned(chunks.back()->region.coord));
+    EXPECT_TRUE(blocksUncompressed(*chunks.back(), true));
+    EXPECT_EQ(prefetch.release(box), 1u);
+    EXPECT_EQ(prefetch.pinnedCount(), 0u);
+
+    // Leave some regions pinned for the destructor to release.
+    prefetch.request(region_keys);
+    prefetch.wait();
+  }
+
+  ASSERT_TRUE(waitForCompression(chunks));
+  compressor.setHighTide(high_tide);
+  compressor.setLowTide(low_tide);
+}
+
+
+/// Check if any of the voxel blocks in @p chunk are locked by a retain.
+bool blocksLocked(const ohm::MapChunk &chunk)
+{
+  for (const auto &block : chunk.voxel_blocks)
+  {
+    if (block && (block->flags() & ohm::VoxelBlock::kFLocked))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+TEST(RegionPrefetch, RollingWindow)
+{
+  // A pinned region may be evicted by the rolling window recycling its slot. Releasing the evicted region key must
+  // still release the recycled blocks.
+  const glm::ivec3 window(2);
+  ohm::OccupancyMap map(0.1, glm::u8vec3(16));
+  ASSERT_TRUE(map.setRollingWindow(window));
+  ohm::RayMapperOccupancy mapper(&map);
+  std::mt19937 rand_engine(1019);
+  std::uniform_real_distribution<double> rand(-1.5, 1.5);
+  std::vector<glm::dvec3> rays;
+  for (unsigned i = 0; i < 1000; ++i)
+  {
+    rays.emplace_back(glm::dvec3(0.0));
+    rays.emplace_back(glm::dvec3(rand(rand_engine), rand(rand_engine), rand(rand_engine)));
+  }
+  mapper.integrateRays(rays.data(), rays.size());
+
+  std::vector<const ohm::MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  ASSERT_FALSE(chunks.empty());
+
+  ohm::VoxelBlockCompressionQueue &compressor = ohm::VoxelBlockCompressionQueue::instance();
+  const uint64_t high_tide = compressor.highTide();
+  const uint64_t low_tide = compressor.lowTide();
+  compressor.setLowTide(0);
+  compressor.setHighTide(0);
+  ASSERT_TRUE(waitForCompression(chunks));
+
+  {
+    ohm::RegionPrefetch prefetch(map);
+    std::vector<glm::i16vec3> region_keys;
+    for (const ohm::MapChunk *chunk : chunks)
+    {
+      region_keys.emplace_back(chunk->region.coord);
+    }
+    EXPECT_EQ(prefetch.request(region_keys), region_keys.size());
+    prefetch.wait();
+    EXPECT_EQ(prefetch.pinnedCount(), region_keys.size());
+
+    // Find a pinned region with retained blocks and evict it by creating a region in the same slot.
+    const ohm::MapChunk *pinned = nullptr;
+    for (const ohm::MapChunk *chunk : chunks)
+    {
+      if (blocksLocked(*chunk))
+      {
+        pinned = chunk;
+        break;
+      }
+    }
+    ASSERT_NE(pinned, nullptr);
+    const glm::i16vec3 evicted_key = pinned->region.coord;
+    const glm::i16vec3 new_key = evicted_key + glm::i16vec3(window.x, 0, 0);
+    ASSERT_EQ(map.region(new_key, true), pinned);
+    EXPECT_EQ(map.region(evicted_key), nullptr);
+    EXPECT_TRUE(blocksLocked(*pinned));
+
+    // Releasing the evicted region releases the recycled blocks, making them eligible for compression.
+    EXPECT_EQ(prefetch.release(&evicted_key, 1), 1u);
+    EXPECT_FALSE(blocksLocked(*pinned));
+
+    // Evicting and releasing the remaining pinned regions leaves no locked blocks.
+    for (const ohm::MapChunk *chunk : chunks)
+    {
+      if (chunk != pinned)
+      {
+        map.region(chunk->region.coord + glm::i16vec3(window.x, 0, 0), true);
+      }
+    }
+    prefetch.releaseAll();
+    for (const ohm::MapChunk *chunk : chunks)
+    {
+      EXPECT_FALSE(blocksLocked(*chunk));
+    }
+  }
+
+  compressor.setHighTide(high_tide);
+  compressor.setLowTide(low_tide);
+}
+}  // namespace regionprefetch
@@ -7,12 +7,19 @@
 
 #include "ohmtestcommon/OhmTestUtil.h"
 
+#include <ohm/Aabb.h>
+#include <ohm/DefaultLayer.h>
 #include <ohm/Key.h>
 #include <ohm/KeyList.h>
 #include <ohm/LineQuery.h>
+#include <ohm/MapChunk.h>
+#include <ohm/MapFlag.h>
 #include <ohm/MapSerialise.h>
 #include <ohm/OccupancyMap.h>
 #include <ohm/OccupancyUtil.h>
+#include <ohm/Voxel.h>
+#include <ohm/VoxelBlock.h>
+#include <ohm/VoxelBuffer.h>
 #include <ohm/VoxelOccupancy.h>
 
 #include <ohmtools/OhmCloud.h>
@@ -22,8 +29,12 @@
 #include <ohmutil/Profile.h>
 
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <random>
 
@@ -102,6 +113,432 @@ TEST(Serialisation, Basic)
 }
 
 
+TEST(Serialisation, LoadRegions)
+{
+  const char *map_name = "test-map-regions.ohm";
+  int error_code = 0;
+  const double boundary_distance = 2.5;
+  OccupancyMap save_map(0.25, glm::u8vec3(8));
+
+  ohmgen::boxRoom(save_map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+
+  error_code = save(map_name, save_map);
+  ASSERT_EQ(error_code, 0);
+
+  // Load a sub box. Only the overlapping regions should be loaded.
+  const glm::dvec3 min_ext(0.5, -boundary_distance, -1.0);
+  const glm::dvec3 max_ext(boundary_distance, boundary_distance, 1.0);
+  OccupancyMap load_map(1);
+  MapVersion version;
+  error_code = loadRegions(map_name, load_map, Aabb(min_ext, max_ext), nullptr, &version);
+  ASSERT_EQ(error_code, 0);
+  EXPECT_EQ(version, kCurrentVersion);
+
+  std::vector<const MapChunk *> regions;
+  save_map.enumerateRegions(regions);
+  std::vector<glm::i16vec3> expected_regions;
+  for (const MapChunk *region : regions)
+  {
+    if (region->overlapsExtents(min_ext, max_ext))
+    {
+      expected_regions.emplace_back(region->region.coord);
+    }
+  }
+
+  ASSERT_GT(expected_regions.size(), 0u);
+  ASSERT_LT(expected_regions.size(), save_map.regionCount());
+  EXPECT_EQ(load_map.regionCount(), expected_regions.size());
+  ohmtestutil::compareMaps(load_map, save_map, min_ext, max_ext, ohmtestutil::kCfCompareExtended);
+
+  // Load by region list. Include a region which is not present.
+  std::vector<glm::i16vec3> region_list = { expected_regions.front(), glm::i16vec3(1000) };
+  OccupancyMap list_map(1);
+  error_code = loadRegions(map_name, list_map, region_list);
+  ASSERT_EQ(error_code, 0);
+  EXPECT_EQ(list_map.regionCount(), 1u);
+  EXPECT_NE(list_map.region(expected_regions.front()), nullptr);
+}
+
+
+TEST(Serialisation, Batched)
+{
+  // Save and load a map with more regions than are processed in a single batch.
+  const char *map_name = "test-map-batched.ohm";
+  int error_code = 0;
+  const double boundary_distance = 5.0;
+  OccupancyMap save_map(0.25, glm::u8vec3(4));
+  OccupancyMap load_map(1);
+
+  ohmgen::boxRoom(save_map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+  ASSERT_GT(save_map.regionCount(), 2 * 256u);
+
+  ProgressDisplay progress;
+  error_code = save(map_name, save_map, &progress);
+  std::cout << std::endl;
+  ASSERT_EQ(error_code, 0);
+  EXPECT_EQ(progress.progress(), save_map.regionCount());
+
+  progress.reset();
+  error_code = load(map_name, load_map, &progress);
+  std::cout << std::endl;
+  ASSERT_EQ(error_code, 0);
+  EXPECT_EQ(progress.progress(), save_map.regionCount());
+
+  ohmtestutil::compareMaps(load_map, save_map, ohmtestutil::kCfCompareExtended);
+}
+
+
+/// Query the size of @p filename in bytes.
+size_t fileSize(const char *filename)
+{
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  return size_t(file.tellg());
+}
+
+
+TEST(Serialisation, Incremental)
+{
+  const char *map_name = "test-map-incremental.ohm";
+  const char *reference_name = "test-map-incremental-ref.ohm";
+  const double boundary_distance = 2.5;
+  // The test map regions compress to sizes comparable to the region index. Avoid compaction until tested.
+  const double no_compaction = 1000.0;
+  OccupancyMap map(0.25, glm::u8vec3(8));
+  ohmgen::boxRoom(map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+  ASSERT_GT(map.regionCount(), 4u);
+
+  // The first incremental save writes the full map.
+  std::remove(map_name);
+  ProgressDisplay progress;
+  ASSERT_EQ(saveIncremental(map_name, map, &progress), 0);
+  EXPECT_EQ(progress.progress(), map.regionCount());
+  const size_t full_size = fileSize(map_name);
+
+  const auto validate = [map_name](const OccupancyMap &reference) {
+    OccupancyMap load_map(1);
+    ASSERT_EQ(load(map_name, load_map), 0);
+    EXPECT_EQ(load_map.regionCount(), reference.regionCount());
+    ohmtestutil::compareMaps(load_map, reference, ohmtestutil::kCfCompareExtended);
+  };
+
+  // Modify a single region. Only that region is appended.
+  const Key key(0, 0, 0, 1, 1, 1);
+  ohm::integrateHit(map, key);
+  progress.reset();
+  ASSERT_EQ(saveIncremental(map_name, map, &progress, no_compaction), 0);
+  EXPECT_EQ(progress.progress(), 1u);
+  const size_t incremental_size = fileSize(map_name);
+  EXPECT_GT(incremental_size, full_size);
+  EXPECT_LT(incremental_size - full_size, full_size / 2);
+  validate(map);
+
+  // Nothing changed: the file content is unchanged.
+  progress.reset();
+  ASSERT_EQ(saveIncremental(map_name, map, &progress, no_compaction), 0);
+  EXPECT_EQ(progress.progress(), 0u);
+  EXPECT_EQ(fileSize(map_name), incremental_size);
+  validate(map);
+
+  // Removed regions are dropped. A region removed and recreated without modification holds none of its previous
+  // content and must not reuse its existing block.
+  const Aabb bounds(glm::dvec3(-boundary_distance, -boundary_distance, 0.0), glm::dvec3(boundary_distance));
+  const glm::i16vec3 recreated_key = map.regionKey(glm::dvec3(-boundary_distance));
+  ASSERT_NE(map.region(recreated_key), nullptr);
+  ASSERT_TRUE(map.region(recreated_key)->hasValidNodes());
+  const size_t region_count = map.regionCount();
+  map.cullRegionsOutside(bounds.minExtents(), bounds.maxExtents());
+  ASSERT_LT(map.regionCount(), region_count);
+  ASSERT_EQ(map.region(recreated_key), nullptr);
+  ASSERT_NE(map.region(recreated_key, true), nullptr);
+  ASSERT_EQ(saveIncremental(map_name, map, nullptr, no_compaction), 0);
+  validate(map);
+
+  // Continue the journal from a loaded map.
+  OccupancyMap loaded_map(1);
+  ASSERT_EQ(load(map_name, loaded_map), 0);
+  ohm::integrateMiss(loaded_map, key);
+  progress.reset();
+  ASSERT_EQ(saveIncremental(map_name, loaded_map, &progress, no_compaction), 0);
+  EXPECT_EQ(progress.progress(), 1u);
+  validate(loaded_map);
+
+  // A different map never appends to the journal, even with matching content and stamps. A clone has its own identity.
+  std::unique_ptr<OccupancyMap> other_map(loaded_map.clone());
+  ohm::integrateHit(*other_map, key);
+  progress.reset();
+  ASSERT_EQ(saveIncremental(map_name, *other_map, &progress, no_compaction), 0);
+  EXPECT_EQ(progress.progress(), other_map->regionCount());
+  validate(*other_map);
+
+  // Modifying every region leaves no reusable blocks, compacting the file to the same size as a full save.
+  ohmgen::boxRoom(loaded_map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+  ASSERT_EQ(saveIncremental(map_name, loaded_map), 0);
+  validate(loaded_map);
+  ASSERT_EQ(save(reference_name, loaded_map), 0);
+  EXPECT_EQ(fileSize(map_name), fileSize(reference_name));
+}
+
+
+TEST(Serialisation, Memory)
+{
+  const char *map_name = "test-map-memory.ohm";
+  const double boundary_distance = 2.5;
+  OccupancyMap map(0.25, glm::u8vec3(8));
+  ohmgen::boxRoom(map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+  ASSERT_GT(map.regionCount(), 4u);
+
+  // Saving to a buffer yields the same bytes as saving to file.
+  std::vector<uint8_t> buffer;
+  ProgressDisplay progress;
+  ASSERT_EQ(save(buffer, map, &progress), 0);
+  EXPECT_EQ(progress.progress(), map.regionCount());
+  ASSERT_EQ(save(map_name, map), 0);
+  std::ifstream file(map_name, std::ios::binary);
+  const std::vector<uint8_t> file_bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  EXPECT_EQ(buffer, file_bytes);
+
+  OccupancyMap load_map(1);
+  ASSERT_EQ(load(buffer.data(), buffer.size(), load_map), 0);
+  ohmtestutil::compareMaps(load_map, map, ohmtestutil::kCfCompareExtended);
+
+  // A truncated buffer fails to load.
+  EXPECT_NE(load(buffer.data(), buffer.size() / 2, load_map), 0);
+
+  // Stream the map region at a time into a map initialised from the header.
+  OccupancyMap stream_map(1);
+  size_t region_count = 0;
+  ASSERT_EQ(loadHeader(buffer.data(), buffer.size(), stream_map, nullptr, &region_count), 0);
+  EXPECT_EQ(region_count, map.regionCount());
+  EXPECT_EQ(stream_map.regionCount(), 0u);
+  EXPECT_EQ(stream_map.resolution(), map.resolution());
+
+  const auto load_region = [&stream_map](const glm::i16vec3 & /*region_coord*/, const uint8_t *block,
+                                         size_t block_size) {
+    return loadRegionBlock(stream_map, block, block_size) == 0;
+  };
+  ASSERT_EQ(saveRegionBlocks(map, load_region), 0);
+  EXPECT_EQ(stream_map.regionCount(), map.regionCount());
+  ohmtestutil::compareMaps(stream_map, map, ohmtestutil::kCfCompareExtended);
+
+  // Stream an update for a single region, replacing the existing region.
+  const Key key(0, 0, 0, 1, 1, 1);
+  ohm::integrateHit(map, key);
+  size_t streamed = 0;
+  const auto count_region = [&](const glm::i16vec3 &region_coord, const uint8_t *block, size_t block_size) {
+    EXPECT_EQ(region_coord, key.regionKey());
+    ++streamed;
+    return load_region(region_coord, block, block_size);
+  };
+  ASSERT_EQ(saveRegionBlocks(map, { key.regionKey(), glm::i16vec3(1000) }, count_region), 0);
+  EXPECT_EQ(streamed, 1u);
+  EXPECT_EQ(stream_map.regionCount(), map.regionCount());
+  ohmtestutil::compareMaps(stream_map, map, ohmtestutil::kCfCompareExtended);
+
+  // Aborting from the callback fails the save.
+  EXPECT_EQ(saveRegionBlocks(map, [](const glm::i16vec3 &, const uint8_t *, size_t) { return false; }),
+            kSeFileWriteFailure);
+}
+
+
+/// Validate that each region resident in the rolling window @p map is reachable and matches @p reference .
+void validateRollingWindow(const OccupancyMap &map, const OccupancyMap &reference)
+{
+  const glm::ivec3 window = map.rollingWindow();
+  const size_t window_volume = size_t(window.x) * size_t(window.y) * size_t(window.z);
+  std::vector<const MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  ASSERT_FALSE(chunks.empty());
+  ASSERT_LE(chunks.size(), window_volume);
+  EXPECT_EQ(map.regionCount(), chunks.size());
+
+  const glm::ivec3 region_dim = map.regionVoxelDimensions();
+  Voxel<const float> occupancy(&map, map.layout().occupancyLayer());
+  Voxel<const float> ref_occupancy(&reference, reference.layout().occupancyLayer());
+  for (const MapChunk *chunk : chunks)
+  {
+    ASSERT_EQ(map.region(chunk->region.coord), chunk);
+    for (int i = 0; i < region_dim.x * region_dim.y * region_dim.z; ++i)
+    {
+      const Key key = chunk->keyForIndex(i, region_dim);
+      occupancy.setKey(key);
+      ref_occupancy.setKey(key);
+      ASSERT_TRUE(ref_occupancy.isValid());
+      ASSERT_EQ(occupancy.data(), ref_occupancy.data());
+    }
+  }
+}
+
+
+TEST(Serialisation, RollingWindow)
+{
+  // Load a map spanning more regions than the rolling window. Regions sharing a ring slot evict each other, leaving
+  // one resident region per slot.
+  const char *map_name = "test-map-rolling.ohm";
+  const double boundary_distance = 2.5;
+  const glm::ivec3 window(2);
+  OccupancyMap map(0.25, glm::u8vec3(8));
+  ohmgen::boxRoom(map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+  ASSERT_GT(map.regionCount(), size_t(window.x * window.y * window.z));
+  ASSERT_EQ(save(map_name, map), 0);
+
+  OccupancyMap load_map(1);
+  ASSERT_TRUE(load_map.setRollingWindow(window));
+  ASSERT_EQ(load(map_name, load_map), 0);
+  EXPECT_EQ(load_map.rollingWindow(), window);
+  validateRollingWindow(load_map, map);
+
+  // Creating a region in an occupied slot recycles the resident region.
+  std::vector<const MapChunk *> chunks;
+  load_map.enumerateRegions(chunks);
+  ASSERT_FALSE(chunks.empty());
+  const MapChunk *resident = chunks.front();
+  const glm::i16vec3 resident_key = resident->region.coord;
+  const glm::i16vec3 new_key = resident_key + glm::i16vec3(window.x, 0, 0);
+  const size_t region_count = load_map.regionCount();
+  EXPECT_EQ(load_map.region(new_key, true), resident);
+  EXPECT_EQ(load_map.region(resident_key), nullptr);
+  EXPECT_EQ(load_map.region(new_key), resident);
+  EXPECT_EQ(load_map.regionCount(), region_count);
+
+  // Reloading and streaming region blocks into the map keeps the map and window in sync.
+  ASSERT_EQ(load(map_name, load_map), 0);
+  validateRollingWindow(load_map, map);
+
+  OccupancyMap stream_map(1);
+  ASSERT_TRUE(stream_map.setRollingWindow(window));
+  std::vector<uint8_t> buffer;
+  ASSERT_EQ(save(buffer, map), 0);
+  ASSERT_EQ(loadHeader(buffer.data(), buffer.size(), stream_map), 0);
+  const auto load_region = [&stream_map](const glm::i16vec3 & /*region_coord*/, const uint8_t *block,
+                                         size_t block_size) {
+    return loadRegionBlock(stream_map, block, block_size) == 0;
+  };
+  ASSERT_EQ(saveRegionBlocks(map, load_region), 0);
+  validateRollingWindow(stream_map, map);
+}
+
+
+/// Count the non uniform voxel blocks in @p map and how many of those are uncompressed.
+void countBlocks(const OccupancyMap &map, size_t &non_uniform, size_t &uncompressed)
+{
+  non_uniform = uncompressed = 0;
+  std::vector<const MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  for (const MapChunk *chunk : chunks)
+  {
+    for (const auto &block : chunk->voxel_blocks)
+    {
+      if (!(block->flags() & VoxelBlock::kFUniform))
+      {
+        ++non_uniform;
+        uncompressed += (block->flags() & VoxelBlock::kFUncompressed) ? 1 : 0;
+      }
+    }
+  }
+}
+
+
+TEST(Serialisation, CompressedBlocks)
+{
+  const double boundary_distance = 2.5;
+  OccupancyMap map(0.25, glm::u8vec3(8));
+  ohmgen::boxRoom(map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+
+  // Compress every block.
+  std::vector<const MapChunk *> chunks;
+  map.enumerateRegions(chunks);
+  for (const MapChunk *chunk : chunks)
+  {
+    for (const auto &block : chunk->voxel_blocks)
+    {
+      block->compress();
+    }
+  }
+  size_t non_uniform = 0;
+  size_t uncompressed = 0;
+  countBlocks(map, non_uniform, uncompressed);
+  ASSERT_GT(non_uniform, 0u);
+  ASSERT_EQ(uncompressed, 0u);
+
+  // Saving copies the compressed bytes without inflating the blocks.
+  std::vector<uint8_t> buffer;
+  ASSERT_EQ(save(buffer, map), 0);
+  countBlocks(map, non_uniform, uncompressed);
+  EXPECT_EQ(uncompressed, 0u);
+
+  // Loading adopts the compressed bytes.
+  OccupancyMap load_map(1);
+  ASSERT_EQ(load(buffer.data(), buffer.size(), load_map), 0);
+  size_t loaded_non_uniform = 0;
+  countBlocks(load_map, loaded_non_uniform, uncompressed);
+  EXPECT_EQ(loaded_non_uniform, non_uniform);
+  EXPECT_EQ(uncompressed, 0u);
+
+  // The first valid index is restored without decompressing.
+  for (const MapChunk *chunk : chunks)
+  {
+    const MapChunk *loaded_chunk = load_map.region(chunk->region.coord);
+    ASSERT_NE(loaded_chunk, nullptr);
+    EXPECT_EQ(loaded_chunk->first_valid_index, chunk->first_valid_index);
+  }
+
+  ohmtestutil::compareMaps(load_map, map, ohmtestutil::kCfCompareExtended);
+
+  // A map saved while uncompressed loads the same.
+  OccupancyMap uncompressed_map(0.25, glm::u8vec3(8), MapFlag::kNone);
+  ohmgen::boxRoom(uncompressed_map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+  ASSERT_EQ(save(buffer, uncompressed_map), 0);
+  ASSERT_EQ(load(buffer.data(), buffer.size(), load_map), 0);
+  ohmtestutil::compareMaps(load_map, uncompressed_map, ohmtestutil::kCfCompareExtended);
+}
+
+
+TEST(Serialisation, LoadLayers)
+{
+  const char *map_name = "test-map-layers.ohm";
+  const double boundary_distance = 2.5;
+  OccupancyMap save_map(0.25, glm::u8vec3(8), MapFlag::kVoxelMean);
+  save_map.addTraversalLayer();
+  ohmgen::boxRoom(save_map, glm::dvec3(-boundary_distance), glm::dvec3(boundary_distance));
+  ASSERT_EQ(save(map_name, save_map), 0);
+
+  // Load only the occupancy layer.
+  OccupancyMap load_map(1);
+  ASSERT_EQ(loadLayers(map_name, load_map, { default_layer::occupancyLayerName() }), 0);
+  EXPECT_EQ(load_map.layout().layerCount(), 1u);
+  EXPECT_GE(load_map.layout().occupancyLayer(), 0);
+  EXPECT_LT(load_map.layout().meanLayer(), 0);
+  EXPECT_LT(load_map.layout().traversalLayer(), 0);
+  EXPECT_FALSE(load_map.voxelMeanEnabled());
+  EXPECT_EQ((load_map.flags() & MapFlag::kVoxelMean), MapFlag::kNone);
+  ohmtestutil::compareMaps(load_map, save_map);
+
+  // Unknown layers are ignored and layer order follows the file.
+  std::vector<uint8_t> buffer;
+  ASSERT_EQ(save(buffer, save_map), 0);
+  ASSERT_EQ(loadLayers(buffer.data(), buffer.size(), load_map,
+                       { default_layer::traversalLayerName(), "no-such-layer", default_layer::occupancyLayerName() }),
+            0);
+  EXPECT_EQ(load_map.layout().layerCount(), 2u);
+  EXPECT_EQ(load_map.layout().occupancyLayer(), 0);
+  EXPECT_EQ(load_map.layout().traversalLayer(), 1);
+  ohmtestutil::compareMaps(load_map, save_map);
+
+  // Traversal values survive.
+  std::vector<const MapChunk *> chunks;
+  save_map.enumerateRegions(chunks);
+  for (const MapChunk *chunk : chunks)
+  {
+    const MapChunk *loaded_chunk = load_map.region(chunk->region.coord);
+    ASSERT_NE(loaded_chunk, nullptr);
+    VoxelBuffer<const VoxelBlock> expected(chunk->voxel_blocks[save_map.layout().traversalLayer()]);
+    VoxelBuffer<const VoxelBlock> actual(loaded_chunk->voxel_blocks[load_map.layout().traversalLayer()]);
+    ASSERT_EQ(actual.voxelMemorySize(), expected.voxelMemorySize());
+    EXPECT_EQ(memcmp(actual.voxelMemory(), expected.voxelMemory(), expected.voxelMemorySize()), 0);
+  }
+}
+
+
 // Legacy code used to generate the test map for Serialisation.Upgrade tests.
 void cubicRoomLegacy(OccupancyMap &map, float boundary_range, int voxel_step)
 {
@@ -505,7 +505,7 @@ TEST(Ranges, OuterCorners)
 }
 
 
-void scalingTest(bool gpu, bool voxel_mean = false, unsigned region_dim = 8)
+void scalingTest(bool gpu, bool voxel_mean = false, unsigned region_dim = 8, bool rolling_window = false)
 {
   const double resolution = 0.25;
   const glm::u8vec3 region_size(region_dim);
@@ -517,6 +517,11 @@ void scalingTest(bool gpu, bool voxel_mean = false, unsigned region_dim = 8)
   // Offset the map origin so that 0, 0, 0 is the centre of a voxel.
   map.setOrigin(glm::dvec3(-0.5 * resolution));
 
+  if (rolling_window)
+  {
+    map.setRollingWindow(glm::ivec3(4));
+  }
+
   // Populate a map with points the following coordinates:
   // 1. (0.5, 0, 0)
   // 2. (0, 0.75, 0)
@@ -573,6 +578,13 @@ TEST(Ranges, Scaling)
 }
 
 
+TEST(Ranges, ScalingRollingWindow)
+{
+  // Rolling window maps resolve regions through the ring rather than the chunk index.
+  scalingTest(false, false, 8, true);
+}
+
+
 TEST(Ranges, ScalingGpu)
 {
   scalingTest(true);
@@ -41,7 +41,9 @@
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <string>
 #include <unordered_set>
+#include <vector>
 
 namespace
 {
@@ -438,12 +440,36 @@ int parseOptions(Options *opt, int argc, char *argv[])  // NOLINT(modernize-avoi
 }
 
 
+/// Select the map layers required to export a point cloud in the given @p mode . Empty to load all layers.
+std::vector<std::string> exportLayers(ExportMode mode)
+{
+  switch (mode)
+  {
+  case kExportOccupancy:
+  case kExportOccupancyCentre:
+  case kExportObserved:
+    return { ohm::default_layer::occupancyLayerName(), ohm::default_layer::meanLayerName() };
+  case kExportClearance:
+    return { ohm::default_layer::occupancyLayerName(), ohm::default_layer::clearanceLayerName() };
+  case kExportDensity:
+    return { ohm::default_layer::occupancyLayerName(), ohm::default_layer::meanLayerName(),
+             ohm::default_layer::traversalLayerName() };
+  default:
+    break;
+  }
+  return {};
+}
+
+
 int exportPointCloud(const Options &opt, ProgressMonitor &prog, LoadMapProgress &load_progress)
 {
   ohm::OccupancyMap map(1.0f);
 
+  // Skip loading layers which are not exported.
+  const std::vector<std::string> layers = exportLayers(opt.mode);
   prog.startThread();
-  int res = ohm::load(opt.map_file.c_str(), map, &load_progress);
+  int res = (!layers.empty()) ? ohm::loadLayers(opt.map_file, map, layers, &load_progress) :
+                                ohm::load(opt.map_file.c_str(), map, &load_progress);
   prog.endProgress();
 
   std::cout << std::endl;
@@ -675,8 +701,11 @@ int exportCovariance(const Options &opt, ProgressMonitor &prog, LoadMapProgress
   ohm::OccupancyMap map(1.0f);
   ohm::PlyMesh ply;
 
+  const std::vector<std::string> layers = { ohm::default_layer::occupancyLayerName(),
+                                            ohm::default_layer::meanLayerName(),
+                                            ohm::default_layer::covarianceLayerName() };
   prog.startThread();
-  int res = ohm::load(opt.map_file.c_str(), map, &load_progress);
+  int res = ohm::loadLayers(opt.map_file, map, layers, &load_progress);
   prog.endProgress();
 
   std::cout << std::endl;
@@ -758,7 +787,8 @@ int exportCovariance(const Options &opt, ProgressMonitor &prog, LoadMapProgress
 
   prog.beginProgress(ProgressMonitor::Info(region_count));
 
-  for (auto iter = map.begin(); iter != map.end() && !g_quit; ++iter)
+  // Only occupied voxels are exported, so iterate only those.
+  for (auto iter = map.begin(ohm::kIfOccupied); iter != map.end() && !g_quit; ++iter)
   {
     ohm::setVoxelKey(*iter, occupancy, mean, covariance);
     if (last_region != iter->regionKey())
@@ -767,11 +797,6 @@ int exportCovariance(const Options &opt, ProgressMonitor &prog, LoadMapProgress
       last_region = iter.key().regionKey();
     }
 
-    if (!ohm::isOccupied(occupancy))
-    {
-      continue;
-    }
-
     const glm::dvec3 pos = ohm::positionSafe(mean);
     ohm::CovarianceVoxel cov;
     covariance.read(&cov);
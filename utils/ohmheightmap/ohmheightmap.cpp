@@ -2,6 +2,7 @@
 // author Kazys Stepanas
 //
 // Utility for generating an ohm heightmap from an ohm occupancy map.
+#include <ohm/DefaultLayer.h>
 #include <ohm/MapSerialise.h>
 #include <ohm/OccupancyMap.h>
 #include <ohm/Trace.h>
@@ -28,7 +29,9 @@
 #include <iostream>
 #include <locale>
 #include <sstream>
+#include <string>
 #include <unordered_set>
+#include <vector>
 
 #include <3esservermacros.h>
 
@@ -304,8 +307,12 @@ int main(int argc, char *argv[])
     std::cout << str.str() << std::flush;
   });
 
+  // Only the layers used to generate the heightmap are loaded.
+  const std::vector<std::string> layers = { ohm::default_layer::occupancyLayerName(),
+                                            ohm::default_layer::meanLayerName(),
+                                            ohm::default_layer::covarianceLayerName() };
   prog.startThread();
-  res = ohm::load(opt.map_file.c_str(), map, &load_progress, &version);
+  res = ohm::loadLayers(opt.map_file, map, layers, &load_progress, &version);
   prog.endProgress();
 
   std::cout << std::endl;
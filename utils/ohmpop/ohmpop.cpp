@@ -88,6 +88,7 @@ struct Options
   {
     ohm::util::Bytes high_tide;
     ohm::util::Bytes low_tide;
+    std::string spill_file;
   };
 
 #ifdef OHMPOP_GPU
@@ -240,6 +241,10 @@ void Options::print(std::ostream **out, const ohm::OccupancyMap &map) const
     {
       **out << "  High tide:" << compression.high_tide << '\n';
       **out << "  Low tide:" << compression.low_tide << '\n';
+      if (!compression.spill_file.empty())
+      {
+        **out << "  Spill file:" << compression.spill_file << '\n';
+      }
     }
     glm::i16vec3 region_dim = region_voxel_dim;
     region_dim.x = (region_dim.x) ? region_dim.x : OHM_DEFAULT_CHUNK_DIM_X;
@@ -468,6 +473,12 @@ int populateMap(const Options &opt)
   // Set compression marks.
   ohm::VoxelBlockCompressionQueue::instance().setHighTide(opt.compression.high_tide.byteSize());
   ohm::VoxelBlockCompressionQueue::instance().setLowTide(opt.compression.low_tide.byteSize());
+  if (!opt.compression.spill_file.empty() &&
+      !ohm::VoxelBlockCompressionQueue::instance().enableSpill(opt.compression.spill_file))
+  {
+    fprintf(stderr, "Error opening spill file %s\n", opt.compression.spill_file.c_str());
+    return -2;
+  }
 
   std::cout << "Loading points from " << opt.cloud_file << " with trajectory " << opt.trajectory_file << std::endl;
 
@@ -998,6 +1009,7 @@ int parseOptions(Options *opt, int argc, char *argv[])  // NOLINT(modernize-avoi
     opt_parse.add_options("Compression")
       ("high-tide", "Set the high memory tide which the background compression thread will try keep below.", optVal(opt->compression.high_tide))
       ("low-tide", "Set the low memory tide to which the background compression thread will try reduce to once high-tide is exceeded.", optVal(opt->compression.low_tide))
+      ("spill-file", "Page compressed voxel blocks out to this file when compression alone cannot reduce memory to low-tide. The file is removed on exit.", optVal(opt->compression.spill_file))
       ;
 
     // clang-format on